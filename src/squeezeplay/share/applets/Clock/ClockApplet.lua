@@ -402,32 +402,23 @@ end
 
 function Analog:_reDraw(screen)
 
-	local x, y
-
 	-- Setup Time Objects
 	local time = os.date("*t")
 	local m = time.min
 	local h = time.hour % 12
 
-	-- Hour Pointer
+	local x = math.floor(self.screen_width/2)
+	local y = math.floor(self.screen_height/2)
+
+	-- Hour Pointer, the rotated hands are cached
 	local angle = (360 / 12) * (h + (m/60))
 
-	local tmp = self.pointer_hour:rotozoom(-angle, 1, 5)
-	local facew, faceh = tmp:getSize()
-	x = math.floor((self.screen_width/2) - (facew/2))
-	y = math.floor((self.screen_height/2) - (faceh/2))
-	tmp:blit(screen, x, y)
-	tmp:release()
+	self.pointer_hour:blitRotated(screen, x, y, -angle)
 
 	-- Minute Pointer
 	local angle = (360 / 60) * m 
 
-	local tmp = self.pointer_minute:rotozoom(-angle, 1, 5)
-	local facew, faceh = tmp:getSize()
-	x = math.floor((self.screen_width/2) - (facew/2))
-	y = math.floor((self.screen_height/2) - (faceh/2))
-	tmp:blit(screen, x, y)
-	tmp:release()
+	self.pointer_minute:blitRotated(screen, x, y, -angle)
 
 	if self.alarmSet then
 		local tmp = self.alarmIcon
@@ -783,32 +774,23 @@ end
 function Radial:_reDraw(screen)
 
 	-- Draw Background
-	local x, y, facew, faceh
+	local x = math.floor(self.screen_width/2)
+	local y = math.floor(self.screen_height/2)
 	
 	-- Setup Time Objects
 	local m = os.date("%M")
 	local h = os.date("%I")
 
-	-- Hour Pointer
+	-- Hour Pointer, the rotated ticks are cached
 	for i = 0, tonumber(h) do
 		local angle = (360 / 12) * i
-		local tmp = self.hourTick:rotozoom(-angle, 1, 5)
-		facew, faceh = tmp:getSize()
-		x = math.floor((self.screen_width/2) - (facew/2))
-		y = math.floor((self.screen_height/2) - (faceh/2))
-		tmp:blit(screen, x, y)
-		tmp:release()
+		self.hourTick:blitRotated(screen, x, y, -angle, 12)
 	end
 
 	-- Minute Pointer
 	for i = 0, tonumber(m) do
 		local angle = (360 / 60) * i
-		local tmp = self.minuteTick:rotozoom(-angle, 1, 5)
-		facew, faceh = tmp:getSize()
-		x = math.floor((self.screen_width/2) - (facew/2))
-		y = math.floor((self.screen_height/2) - (faceh/2))
-		tmp:blit(screen, x, y)
-		tmp:release()
+		self.minuteTick:blitRotated(screen, x, y, -angle, 60)
 	end
 
 end
@@ -30,7 +30,7 @@ local RadioButton	= require("jive.ui.RadioButton")
 local RadioGroup	= require("jive.ui.RadioGroup")
 local Textinput     = require("jive.ui.Textinput")
 local Window        = require("jive.ui.Window")
-local SocketHttp	= require("jive.net.SocketHttp")
+local HttpPool	= require("jive.net.HttpPool")
 local RequestHttp	= require("jive.net.RequestHttp")
 local URL       	= require("socket.url")
 local Surface		= require("jive.ui.Surface")
@@ -87,7 +87,6 @@ function readImageList(self)
 
 	local host, port, path = self:_flickrApi(method, args)
 	if host then
-		local socket = SocketHttp(jnt, host, port, "flickr")
 		local req = RequestHttp(
 			function(chunk, err)
 				if chunk then
@@ -103,7 +102,7 @@ function readImageList(self)
 			end,
 			'GET',
 			path)
-		socket:fetch(req)
+		HttpPool:forHost(jnt, host, port):queue(req)
 
 		return true
 	else
@@ -151,8 +150,7 @@ function requestImage(self)
 	log:info("photo URL: ", self.url)
 
 	-- request photo
-	-- create a HTTP socket (see L<jive.net.SocketHttp>)
-	local http = SocketHttp(jnt, host, port, "ImageSourceHttp")
+	-- use the shared connections to the host (see L<jive.net.HttpPool>)
 	local req = RequestHttp(function(chunk, err)
 			if chunk then
 				local image = Surface:loadImageData(chunk, #chunk)
@@ -164,7 +162,7 @@ function requestImage(self)
 			self.imgReady = true
 		end,
 		'GET', path)
-	http:fetch(req)
+	HttpPool:forHost(jnt, host, port):queue(req)
 end
 
 function getText(self)
@@ -431,7 +429,6 @@ function resolveFlickrIdByEmail(self, searchText)
 	local host, port, path = self:_findFlickrIdByEmail(searchText)
 	log:info("find by email: ", host, ":", port, path)
 
-	local http = SocketHttp(jnt, host, port, "flickr3")
 	local req = RequestHttp(function(chunk, err)
 			if chunk then
 				local obj = json.decode(chunk)
@@ -446,7 +443,7 @@ function resolveFlickrIdByEmail(self, searchText)
 		end,
 		'GET',
 		path)
-	http:fetch(req)
+	HttpPool:forHost(jnt, host, port):queue(req)
 
 	return true
 end
@@ -455,7 +452,6 @@ function resolveFlickrIdByUsername(self, searchText)
 	-- check whether searchText is a username
 	local host, port, path = self:_findFlickrIdByUserID(searchText)
 	log:info("find by userid: ", host, ":", port, path)
-	local http = SocketHttp(jnt, host, port, "flickr4")
 	local req = RequestHttp(function(chunk, err)
 			if chunk then
 				local obj = json.decode(chunk)
@@ -470,7 +466,7 @@ function resolveFlickrIdByUsername(self, searchText)
 		end,
 		'GET',
 		path)
-	http:fetch(req)
+	HttpPool:forHost(jnt, host, port):queue(req)
 
 	return true
 end
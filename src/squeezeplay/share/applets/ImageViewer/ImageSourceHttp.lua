@@ -23,7 +23,7 @@ local Group			= require("jive.ui.Group")
 local Keyboard		= require("jive.ui.Keyboard")
 local Textinput     = require("jive.ui.Textinput")
 local Window        = require("jive.ui.Window")
-local SocketHttp	= require("jive.net.SocketHttp")
+local HttpPool	= require("jive.net.HttpPool")
 local RequestHttp	= require("jive.net.RequestHttp")
 local URL       	= require("socket.url")
 local Surface		= require("jive.ui.Surface")
@@ -61,8 +61,7 @@ function readImageList(self)
 	}
 	local parsed = URL.parse(urlString, defaults)
 
-	-- create a HTTP socket (see L<jive.net.SocketHttp>)
-	local http = SocketHttp(jnt, parsed.host, parsed.port, "ImageSourceHttp")
+	-- use the shared connections to the host (see L<jive.net.HttpPool>)
 	local req = RequestHttp(
 		function(chunk, err)
 			if err then
@@ -82,7 +81,7 @@ function readImageList(self)
 		end, 'GET', urlString)
 
 	 -- go get it!
-	 http:fetch(req)
+	 HttpPool:forHost(jnt, parsed.host, parsed.port):queue(req)
 end
 
 function nextImage(self, ordering)
@@ -120,8 +119,7 @@ function requestImage(self)
 
 	log:debug("url: " .. urlString)
 
-	-- create a HTTP socket (see L<jive.net.SocketHttp>)
-	local http = SocketHttp(jnt, parsed.host, parsed.port, "ImageSourceHttp")
+	-- use the shared connections to the host (see L<jive.net.HttpPool>)
 	local req = RequestHttp(function(chunk, err)
 			if chunk then
 				local image = Surface:loadImageData(chunk, #chunk)
@@ -134,7 +132,7 @@ function requestImage(self)
 			self.imgReady = true
 		end,
 		'GET', urlString)
-	http:fetch(req)
+	HttpPool:forHost(jnt, parsed.host, parsed.port):queue(req)
 end
 
 
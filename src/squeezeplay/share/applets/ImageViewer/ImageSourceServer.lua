@@ -25,7 +25,7 @@ local string		= require("jive.utils.string")
 local json          = require("json")
 local math			= require("math")
 local debug         = require("jive.utils.debug")
-local SocketHttp	= require("jive.net.SocketHttp")
+local HttpPool	= require("jive.net.HttpPool")
 local SlimServer    = require("jive.slim.SlimServer")
 local RequestHttp	= require("jive.net.RequestHttp")
 local URL       	= require("socket.url")
@@ -249,8 +249,7 @@ function requestImage(self, imageData)
 
 	log:debug("url: " .. urlString)
 
-	-- create a HTTP socket (see L<jive.net.SocketHttp>)
-	local http = SocketHttp(jnt, parsed.host, parsed.port, "ImageSourceServer")
+	-- use the shared connections to the host (see L<jive.net.HttpPool>)
 	local req = RequestHttp(function(chunk, err)
 			if chunk then
 				local image = Surface:loadImageData(chunk, #chunk)
@@ -266,7 +265,7 @@ function requestImage(self, imageData)
 			self.imgReady = true
 		end,
 		'GET', urlString)
-	http:fetch(req)
+	HttpPool:forHost(jnt, parsed.host, parsed.port):queue(req)
 end
 
 function getText(self)
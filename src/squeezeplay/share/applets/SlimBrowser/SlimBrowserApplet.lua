@@ -117,6 +117,9 @@ local _playerKeyHandler = false
 local _lastInput = ""
 local _inputParams = {}
 
+-- Number of menu rows rendered ahead of scrolling
+local PRERENDER_ROWS = 2
+
 -- legacy map of menuStyles to windowStyles
 -- this allows SlimBrowser to make an educated guess at window style when one is not sent but a menu style is
 local menu2window = {
@@ -2405,6 +2408,12 @@ local function _browseMenuRenderer(menu, step, widgets, toRenderIndexes, toRende
 			if item and (item['checkbox'] or item['radio'] or item['selectedIndex']) then
 				style = 'item_choice'
 			end
+
+			-- prefer a spare widget already skinned with this style
+			if item and (not widget or widget:getStyle() ~= style) then
+				widget = menu:getRecycledWidget(style) or widget
+			end
+
 			widgets[widgetIndex] = _decoratedLabel(widget, style, item, step, menuAccel)
 		end
 	end
@@ -2723,6 +2732,7 @@ _newDestination = function(origin, item, windowSpec, sink, data, containerContex
 	
 		-- a menu. We manage closing ourselves to guide our path
 		menu = Menu(db:menuStyle(), _browseMenuRenderer, _browseMenuListener, _browseMenuAvailable)
+		menu:setRecycleWidgets(PRERENDER_ROWS)
 		
 		-- alltogether now
 		window:addWidget(menu)
@@ -419,7 +419,7 @@ function JiveMain:__init()
 	heapTimer:start()
 
 	-- run event loop
-	Framework:eventLoop(jnt:task())
+	Framework:eventLoop(jnt:task(), jnt)
 
 	Framework:quit()
 
@@ -555,6 +555,8 @@ local function _loadSkin(self, appletName, reload, useDefaultSize)
 		return false
 	end
 
+	local t0 = Framework:getTicks()
+
 	local name, method = unpack(self.skins[appletName])
 	local obj = appletManager:loadApplet(appletName)
 	assert(obj, "Cannot load skin " .. appletName)
@@ -567,6 +569,11 @@ local function _loadSkin(self, appletName, reload, useDefaultSize)
 
 	Framework:styleChanged()
 
+	-- decode the skin images before they are needed
+	local queued = Framework:preloadImages()
+
+	log:info("skin ", appletName, " loaded in ", Framework:getTicks() - t0, "ms, preloading ", queued, " images")
+
 	return true
 end
 
@@ -13,6 +13,7 @@ local hasSprivate, spprivate = pcall(require, "spprivate")
 local Stream                 = require("squeezeplay.stream")
 local socket                 = require("socket") -- for proxy streams
 local SlimProto              = require("jive.net.SlimProto")
+local DNS                    = require("jive.net.DNS")
 local Player                 = require("jive.slim.Player")
 
 local Task                   = require("jive.ui.Task")
@@ -51,6 +52,7 @@ local STREAM_WRITE_TIMEOUT = 5
 local PROXY_WRITE_TIMEOUT = 0 -- because the stream may be paused
 local PROXY_CONNECT_TIMEOUT = STREAM_WRITE_TIMEOUT + 1
 local PROXY_LISTEN_PORT = 9001
+local PROXY_MIN_FREE = 4096 -- streambuf space needed to read the stream
 
 local LOCAL_PAUSE_STOP_TIMEOUT = 400
 
@@ -299,6 +301,22 @@ function _timerCallback(self)
 		self:_proxyAndStream(true)
 	end
 
+	-- decode-ahead: once the stream has fully arrived let the server
+	-- send the next track. its stream is queued behind this track in
+	-- the streambuf and decoded as soon as this track has been decoded.
+	if not self.sentDecoderUnderrunEvent and self.streamComplete and
+		not self.stream and not self.proxy and
+		status.decodeState & DECODE_RUNNING ~= 0 and
+		status.decodeState & DECODE_ERROR == 0 then
+
+		log:debug("status DECODE AHEAD")
+		self:sendStatus(status, "STMd")
+
+		self.sentDecoderUnderrunEvent = true
+		self.sentDecoderFullEvent = false
+		self.decodeAhead = true
+	end
+
 	if status.decodeState & DECODE_UNDERRUN ~= 0 or
 		status.decodeState & DECODE_ERROR ~= 0 then
 
@@ -328,8 +346,24 @@ function _timerCallback(self)
 			self.ignoreStream = false
 
 			decode:songEnded()
+
+		elseif self.decodeAhead and not self.stream then
+			-- STMd was sent early, this track has now been decoded
+			log:debug("status DECODE UNDERRUN (decode-ahead)")
+
+			self.decodeAhead = false
+			self.ignoreStream = false
+
+			decode:songEnded()
+
+			if self.deferredStrm then
+				local data = self.deferredStrm
+				self.deferredStrm = nil
+
+				self:_strm(data)
+			end
 		end
-	else
+	elseif not self.decodeAhead then
 		self.sentDecoderUnderrunEvent = false
 	end
 
@@ -482,7 +516,12 @@ function _streamConnect(self, serverIp, serverPort, reader, writer, slaves)
 
 	_setSource(self, "stream")
 
-	self.stream = Stream:connect(serverIp, serverPort)
+	-- direct http streams follow redirects and are resumed after the
+	-- connection drops, see _streamResume
+	local http = not reader and self.flags & 0x20 == 0 and self.mode ~= 'n'
+		and serverIp ~= self.slimproto:getServerIp()
+
+	self.stream = Stream:connect(serverIp, serverPort, http)
 
 	-- The following manipluates the metatable for the stream object to allow Http and other streaming
 	-- to use different read and write methods while using a common constructor which reuses the same
@@ -525,18 +564,18 @@ function _streamConnect(self, serverIp, serverPort, reader, writer, slaves)
 	self.slimproto:sendStatus('STMc')
 end
 
-function _proxyQueueSegment(self, chunk)
-	if self.proxy then
-		table.insert(self.proxy.q, chunk)
-	end
-end
-
 function _proxyConnClose(self, conn, err, leaveConnectionTable)
 	log:info("Proxy connection closed: from ", conn.ip, ':', conn.port, '; ', err or '')
 	self.jnt:t_removeWrite(conn.stream)
 	self.jnt:t_removeRead(conn.stream)
+	for i, stats in ipairs(Stream:proxyStats()) do
+		if stats.fd == conn.fd then
+			log:info("Proxy sent ", stats.sent, " bytes, max lag ", stats.maxLag, ", stalls ", stats.stalls)
+		end
+	end
+	Stream:proxyRemove(conn.fd)
 	conn.stream:close()
-	conn.chunk = nil
+	conn.writing = false
 	if self.proxy and not leaveConnectionTable then
 		for i, c in ipairs(self.proxy.connections) do
 			if c == conn then
@@ -554,25 +593,24 @@ function _proxyWrite(self, conn, networkErr)
 	end
 	
 	while true do
-		local n, err
-		if conn.chunk then
-			n, err = Stream:proxyWrite(conn.stream, conn.chunk, conn.chunkOffset)
-			if n then -- stuff left
-				conn.chunkOffset = n
-			else
-				conn.chunk = nil
-				self.jnt:t_removeWrite(conn.stream)
-				-- Let reading be restarted by the status timer
-				-- once the decoder is running.
-				-- This prevents the streambuf starving the cpu
-				self:_proxyAndStream(not self.sentResumeDecoder)
-			end
-		end
-		
+		local pending, err = Stream:proxySend(conn.fd)
+
 		if err then
 			self:_proxyConnClose(conn, err)
 			break
 		end
+
+		if pending == 0 then
+			conn.writing = false
+			self.jnt:t_removeWrite(conn.stream)
+		end
+
+		if pending == 0 or self.proxy.blocked then
+			-- Let reading be restarted by the status timer
+			-- once the decoder is running.
+			-- This prevents the streambuf starving the cpu
+			self:_proxyAndStream(not self.sentResumeDecoder)
+		end
 		
 		_, networkErr = Task:yield(false)
 	end
@@ -614,7 +652,15 @@ function _proxyAccept(self, networkErr)
 			conn.ip, conn.port = stream:getpeername()
 			log:info("Proxy connection accepted: from ", conn.ip, ':', conn.port)
 			conn.stream = stream
+			conn.fd = stream:getfd()
+			conn.writing = false
 			stream:settimeout(0)
+			local ok, err = Stream:proxyAdd(conn.fd)
+			if not ok then
+				log:warn("Proxy connection refused: ", err)
+				stream:close()
+				break
+			end
 			conn.wtask = Task("proxyW", self, 
 					function (self, networkErr) self:_proxyWrite(conn, networkErr) end,
 					nil, Task.PRIORITY_AUDIO)
@@ -680,7 +726,7 @@ function _proxyInit(self, expected, stream)
 		local proxy = {}
 		proxy.expected = expected
 		proxy.stream = stream
-		proxy.q = {}
+		proxy.blocked = false
 		proxy.connections = {}
 		
 		if not self.proxyListener then
@@ -704,21 +750,24 @@ function _proxyAndStream(self, canRead)
 		if self.proxy.listenTask then
 			return
 		end
-		
+
+		-- each slave is sent the stream from its own position
+		local draining = false
 		for i, c in ipairs(self.proxy.connections) do
-			if c.chunk then return end
-		end
-						
-		if #self.proxy.q > 0 then
-			local chunk = table.remove(self.proxy.q, 1)
-			for i, c in ipairs(self.proxy.connections) do
-				c.chunk, c.chunkOffset = chunk, 0
+			if not c.writing and Stream:proxyPending(c.fd) > 0 then
+				c.writing = true
 				self.jnt:t_addWrite(c.stream, c.wtask, PROXY_WRITE_TIMEOUT)
 			end
+			draining = draining or c.writing
+		end
+
+		-- only the slowest slave stops the stream being read
+		self.proxy.blocked = Stream:proxyFree() < PROXY_MIN_FREE
+		if self.proxy.blocked then
 			return
 		end
-		
-		if self.proxy.close then
+
+		if self.proxy.close and not draining then
 			for i, c in ipairs(self.proxy.connections) do
 				self:_proxyConnClose(c, nil, true)
 			end
@@ -739,6 +788,12 @@ end
 				
 
 function _streamDisconnect(self, reason, flush)
+	if flush then
+		self.streamComplete = false
+		self.decodeAhead = false
+		self.deferredStrm = nil
+	end
+
 	if not self.stream then
 		if flush then
 			log:debug("flush streambuf")
@@ -800,28 +855,100 @@ end
 
 
 function _streamRead(self, networkErr)
-	if networkErr then
-		log:warn("read error: ", networkErr)
-		self:_streamDisconnect(TCP_CLOSE_LOCAL_RST)
-		return
-	end
+	local stream = self.stream
+	local n, err
 
-	local n = self.stream:read(self)
-	while n do
-		-- stop reading if the decoder is running. the socket will
-		-- be added again by the status timer. this prevents the 
-		-- streambuf starving the cpu
-		self:_proxyAndStream(not self.sentResumeDecoder)
+	while true do
+		if networkErr then
+			log:warn("read error: ", networkErr)
+			self:_streamDisconnect(TCP_CLOSE_LOCAL_RST)
+			return
+		end
+
+		n, err = self.stream:read(self)
+		while n do
+			-- stop reading if the decoder is running. the socket will
+			-- be added again by the status timer. this prevents the 
+			-- streambuf starving the cpu
+			self:_proxyAndStream(not self.sentResumeDecoder)
 
+			_, networkErr = Task:yield(false)
+
+			n, err = self.stream:read(self)
+		end
+
+		if not self:_streamResume(err) then
+			break
+		end
+
+		-- wait for the response
 		_, networkErr = Task:yield(false)
+	end
 
-		n = self.stream:read(self)
+	-- stopped while resuming
+	if self.stream ~= stream then
+		return
 	end
 
+	self.streamComplete = (n == false)
 	self:_streamDisconnect((n == false) and TCP_CLOSE_FIN or TCP_CLOSE_REMOTE_RST)
 end
 
 
+-- Follow a redirect or resume a dropped stream, the stream works out
+-- where to reconnect and the request to send. Returns true if the stream
+-- was reconnected.
+function _streamResume(self, err)
+	local stream = self.stream
+
+	local host, port, header, delay = stream:httpResume()
+	if not host then
+		return false
+	end
+
+	log:info("resume stream ", host, ":", port, " (", err or "closed", ")")
+
+	self.jnt:t_removeRead(stream)
+
+	-- give the network time to recover
+	if delay > 0 then
+		local task = Task:running()
+		Timer(delay, function() task:addTask() end, true):start()
+		Task:yield(false)
+	end
+
+	local ip = host
+	if not DNS:isip(host) then
+		ip, err = DNS:toip(host)
+	end
+
+	if self.stream ~= stream then
+		return false
+	end
+
+	if not ip then
+		log:warn("can't resolve ", host, ": ", err)
+		return false
+	end
+
+	local ok
+	ok, err = stream:reconnect(ip, port)
+	if not ok then
+		log:warn("reconnect failed: ", err)
+		return false
+	end
+
+	self.header = header
+
+	local wtask = Task("streambufW", self, _streamWrite, nil, Task.PRIORITY_AUDIO)
+	self.jnt:t_addWrite(stream, wtask, STREAM_WRITE_TIMEOUT)
+
+	self:_proxyAndStream(true)
+
+	return true
+end
+
+
 function _streamHttpHeaders(self, headers)
 	-- send stream http headers to SqueezeCenter
 	self.slimproto:send({
@@ -857,6 +984,14 @@ function _strm(self, data)
 
 	if data.command == 's' then
 		-- start
+
+		if self.decodeAhead and (data.flags & 0x10 ~= 0 or data.mode == 'n') then
+			-- this can't be queued behind the current track, start
+			-- it once the current track has been decoded
+			log:debug("defer strm-s until decode underrun")
+			self.deferredStrm = data
+			return true
+		end
 		
 		local serverIp = data.serverIp == 0 and self.slimproto:getServerIp() or data.serverIp
 		self.flags = data.flags
@@ -888,9 +1023,19 @@ function _strm(self, data)
 			end
 		end
 		
-		-- if we aborted the stream early, or there's any junk left 
-		-- over, flush out whatever's left.
-		self:_streamDisconnect(nil, true)
+		-- with decode-ahead the current track is still being decoded
+		-- from the streambuf, the next track is queued behind it.
+		local decodeAhead = self.decodeAhead
+
+		if decodeAhead then
+			log:debug("decode-ahead")
+			self.decodeAhead = false
+			self.slimproto:sendStatus('STMf')
+		else
+			-- if we aborted the stream early, or there's any junk left 
+			-- over, flush out whatever's left.
+			self:_streamDisconnect(nil, true)
+		end
 
 		-- reset stream state
 		self.sentResume = false
@@ -945,7 +1090,16 @@ function _strm(self, data)
 			self:_streamConnect(serverIp, data.serverPort)
 		else
 			-- standard stream - start the decoder and connect
-			decode:start(string.byte(data.mode),
+			local start = decode.start
+
+			if decodeAhead then
+				-- the decoder is already running
+				Stream:markNext()
+				start = decode.startNext
+				self.sentResumeDecoder = true
+			end
+
+			start(decode, string.byte(data.mode),
 			     string.byte(data.transitionType),
 			     data.transitionPeriod,
 			     data.replayGain,
@@ -120,25 +120,35 @@ function _layout(self)
 	barHeight[1] = h - t - b - self.capHeight[1] - self.capSpace[1]
 	barHeight[2] = h - t - b - self.capHeight[2] - self.capSpace[2]
 
-	-- max bin value from C code is 31
-	self.barHeightMulti = {}
-	self.barHeightMulti[1] = barHeight[1] / 31
-	self.barHeightMulti[2] = barHeight[2] / 31
-
 	self.x1 = x + l + self.channelWidth[1] - numBars[1] * barSize[1]
 	self.x2 = x + l + self.channelWidth[2] + self.binSpace[2]
 
 	self.y = y + h - b
 
-	self.cap = { {}, {} }
-	for i = 1, numBars[1] do
-		self.cap[1][i] = 0
-	end
-
-	for i = 1, numBars[2] do
-		self.cap[2][i] = 0
-	end
-
+	-- bars and caps are drawn by the C code
+	decode:spectrum_layout(
+		self.x1,
+		self.x2,
+		self.y,
+		self.barColor,
+		self.capColor,
+
+		self.barsInBin[1],
+		self.barWidth[1],
+		self.barSpace[1],
+		self.binSpace[1],
+		barHeight[1],
+		self.capHeight[1],
+		self.capSpace[1],
+
+		self.barsInBin[2],
+		self.barWidth[2],
+		self.barSpace[2],
+		self.binSpace[2],
+		barHeight[2],
+		self.capHeight[2],
+		self.capSpace[2]
+	)
 end
 
 
@@ -153,68 +163,7 @@ function draw(self, surface)
 		self.backgroundDrawn = true
 	end
 
-	local bins = { {}, {} }
-
-	bins[1], bins[2] = decode:spectrum()
-
-	_drawBins(
-		self, surface, bins, 1, self.x1, self.y, self.barsInBin[1],
-		self.barWidth[1], self.barSpace[1], self.binSpace[1],
-		self.barHeightMulti[1], self.capHeight[1], self.capSpace[1]
-	)
-	_drawBins(
-		self, surface, bins, 2, self.x2, self.y, self.barsInBin[2],
-		self.barWidth[2], self.barSpace[2], self.binSpace[2],
-		self.barHeightMulti[2], self.capHeight[2], self.capSpace[2]
-	)
-end
-
-
-function _drawBins(self, surface, bins, ch, x, y, barsInBin, barWidth, barSpace, binSpace, barHeightMulti, capHeight, capSpace)
-	local bch = bins[ch]
-	local cch = self.cap[ch]
-	local barSize = barWidth + barSpace
-
-	for i = 1, #bch do
-		bch[i] = bch[i] * barHeightMulti
-
-		-- bar
-		if bch[i] > 0 then
-			for k = 0, barsInBin - 1 do
-				surface:filledRectangle(
-					x + (k * barSize),
-					y,
-					x + (barWidth - 1) + (k * barSize),
-					y - bch[i] + 1,
-					self.barColor
-				)
-			end
-		end
-		
-		if bch[i] >= cch[i] then
-			cch[i] = bch[i]
-		elseif cch[i] > 0 then
-			cch[i] = cch[i] - barHeightMulti
-			if cch[i] < 0 then
-				cch[i] = 0
-			end
-		end
-
-		-- cap
-		if capHeight > 0 then
-			for k = 0, barsInBin - 1 do
-				surface:filledRectangle(
-					x + (k * barSize),
-					y - cch[i] - capSpace,
-					x + (barWidth - 1) + (k * barSize),
-					y - cch[i] - capHeight - capSpace,
-					self.capColor
-				)
-			end
-		end
-
-		x = x + barWidth * barsInBin + barSpace * (barsInBin - 1) + binSpace
-	end
+	decode:spectrum_draw(surface)
 end
 
 
@@ -24,8 +24,6 @@ function __init(self, style)
 
 	obj.style = style
 
-	obj.cap = { 0, 0 }
-
 	obj:addAnimation(function() obj:reDraw() end, FRAME_RATE)
 
 	return obj
@@ -79,69 +77,16 @@ end
 
 
 function draw(self, surface)
+	-- meter values and caps are computed and drawn by the C code
 	if self.style == "vumeter" then
 		self.bgImg:blit(surface, self:getBounds())
-	end
-
-	local sampleAcc = decode:vumeter()
-
-	_drawMeter(self, surface, sampleAcc, 1, self.x1, self.y, self.w, self.h)
-	_drawMeter(self, surface, sampleAcc, 2, self.x2, self.y, self.w, self.h)
-end
-
-
--- FIXME dynamic based on number of bars
-local RMS_MAP = {
-	0, 2, 5, 7, 10, 21, 33, 45, 57, 82, 108, 133, 159, 200, 
-	242, 284, 326, 387, 448, 509, 570, 652, 735, 817, 900, 
-	1005, 1111, 1217, 1323, 1454, 1585, 1716, 1847, 2005, 
-	2163, 2321, 2480, 2666, 2853, 3040, 3227, 
-}
-
-
-function _drawMeter(self, surface, sampleAcc, ch, x, y, w, h)
-	local val = 1
-	for i = #RMS_MAP, 1, -1 do
-		if sampleAcc[ch] > RMS_MAP[i] then
-			val = i
-			break
-		end
-	end
-
-	-- FIXME when rms map scaled
-	val = math.floor(val / 2)
-
-	if val >= self.cap[ch] then
-		self.cap[ch] = val
-	elseif self.cap[ch] > 0 then
-		self.cap[ch] = self.cap[ch] - 1
-	end
-
-	if self.style == "vumeter" then
 
 		local tw,th = self.tickOn:getMinSize()
 
-		for i = 1, self.bars do
-			if i == self.cap[ch] then
-				self.tickCap:blit(surface, x, y, tw, th)
-			elseif i < val then
-				self.tickOn:blit(surface, x, y, tw, th)
-			else
-				self.tickOff:blit(surface, x, y, tw, th)
-			end
-
-			y = y - th
-		end
+		decode:vumeter_draw(surface, self.x1, self.x2, self.y, tw, th, self.bars, self.tickCap, self.tickOn, self.tickOff)
 
 	elseif self.style == "vumeter_analog" then
-
---		local x,y,w,h = self:getBounds()
-
-		if ch == 1 then
-			self.bgImg:blitClip(self.cap[ch] * w, y, w, h, surface, x, y)
-		else
-			self.bgImg:blitClip(self.cap[ch] * w, y, w, h, surface, x, y)
-		end
+		decode:vumeter_draw(surface, self.x1, self.x2, self.y, self.w, self.h, 0, self.bgImg)
 	end
 end
 
@@ -47,6 +47,12 @@ This class implements a HTTP socket running in a L<jive.net.NetworkThread>.
   comet:request(...)
   comet:endBatch()
 
+ -- calls made while handling one event or response are also sent together
+ -- in one request, startBatch and endBatch are only needed to batch more
+
+ -- routing statistics
+ local stats = comet:getStats()
+
 =head1 FUNCTIONS
 
 =cut
@@ -61,11 +67,13 @@ local assert, ipairs, table, pairs, string, tonumber, tostring = assert, ipairs,
 
 local oo            = require("loop.simple")
 local math          = require("math")
+local os            = require("os")
 
 local System        = require("jive.System")
 local CometRequest  = require("jive.net.CometRequest")
 local HttpPool      = require("jive.net.HttpPool")
 local SocketHttp    = require("jive.net.SocketHttp")
+local Framework     = require("jive.ui.Framework")
 local Timer         = require("jive.ui.Timer")
 local Task          = require("jive.ui.Task")
 local DNS           = require("jive.net.DNS")
@@ -86,6 +94,8 @@ module(..., oo.class)
 -- forward declarations
 local _addPendingRequests
 local _sendPendingRequests
+local _queuePendingRequests
+local _route
 local _state
 local _handshake
 local _getHandshakeSink
@@ -148,12 +158,32 @@ function __init(self, jnt, name)
 	obj.subs           = {}       -- all subscriptions
 	obj.pending_unsubs = {}       -- pending unsubscribe requests
 	obj.pending_reqs   = {}       -- pending requests to send with connect
-	obj.sent_reqs      = {}       -- sent requests, awaiting a response
-	obj.notify         = {}       -- callbacks to notify
+	obj.sent_reqs      = {}       -- sent requests awaiting a response, by id
+	obj.notify         = {}       -- callbacks to notify, by subscription
+	obj.notify_reqs    = {}       -- request callbacks, by id
+	obj.routes         = {}       -- channel to subscription cache
+
+	-- routing statistics
+	obj.stats          = {}
+	obj:getStats(true)
 
 	-- Reconnection timer
 	obj.reconnect_timer = Timer(0, function() _handleTimer(obj) end, true)
 
+	-- Requests made while handling one event or response are sent together
+	-- by this task, it runs once the current task or event dispatch is done
+	obj.send_task = Task("cometSend", obj,
+			     function(self)
+				     while true do
+					     local ok, err = Task:pcall(_sendPendingRequests, self)
+					     if not ok then
+						     log:error(self, ": send failed: ", err)
+					     end
+					     Task:yield(false)
+				     end
+			     end,
+			     nil, Task.PRIORITY_HIGH)
+
 	-- Subscribe to networkConnected events, which happen if we change wireless networks
 	jnt:subscribe(obj)
 	
@@ -267,7 +297,7 @@ _addPendingRequests = function(self, data)
 		}
 
 		table.insert( data, unsub )
-		table.insert( self.sent_reqs, unsub )
+		self.sent_reqs[v.reqid] = unsub
 	end
 
 	-- Clear out pending requests
@@ -276,23 +306,28 @@ _addPendingRequests = function(self, data)
 	-- Add any pending subscription requests
 	for i, v in ipairs( self.subs ) do
 		if v.pending then
-			local cmd = {
-				v.playerid or '',
-				v.request
-			}
-			
+			-- The subscribe message is kept for resubscribing, only
+			-- the clientId changes
+			local sub = v.message
+			if not sub then
+				local cmd = {
+					v.playerid or '',
+					v.request
+				}
+
+				sub = {
+					channel = '/slim/subscribe',
+					id      = v.reqid,
+					data    = {
+						request  = cmd,
+						priority = v.priority,
+					},
+				}
+				v.message = sub
+			end
+
 			-- Prepend clientId to subscription name
-			local subscription = '/' .. self.clientId .. v.subscription
-
-			local sub = {
-				channel = '/slim/subscribe',
-				id      = v.reqid,
-				data    = {
-					request  = cmd,
-					response = subscription,
-					priority = v.priority,
-				},
-			}
+			sub.data.response = '/' .. self.clientId .. v.subscription
 
 			-- Add callback
 			if not self.notify[v.subscription] then
@@ -304,7 +339,7 @@ _addPendingRequests = function(self, data)
 			v.pending = nil
 	
 			table.insert( data, sub )
-			table.insert( self.sent_reqs, sub )
+			self.sent_reqs[v.reqid] = sub
 		end
 	end
 
@@ -329,13 +364,9 @@ _addPendingRequests = function(self, data)
 			req.id = v.reqid
 				
 			-- Store this request's callback
-			local subscription = '/slim/request|' .. v.reqid
-			if not self.notify[subscription] then
-				self.notify[subscription] = {}
-			end
-			self.notify[subscription][v.func] = v.func
+			self.notify_reqs[v.reqid] = v.func
 
-			table.insert( self.sent_reqs, req )
+			self.sent_reqs[v.reqid] = req
 		end
 
 		table.insert( data, req )
@@ -349,14 +380,23 @@ end
 -- Send any pending subscriptions and requests
 _sendPendingRequests = function(self, data)
 
-	-- add all pending unsub requests, and any others we need to send
 	if not data then
+		-- queued requests wait for the connection or the end of the batch
+		if self.state ~= CONNECTED or self.batch ~= 0 then
+			return
+		end
+
 		data = {}
 	end
+
+	-- add all pending unsub requests, and any others we need to send
 	_addPendingRequests(self, data)
 	
 	-- Only continue if we have some data to send
 	if data[1] then
+		self.stats.posts = self.stats.posts + 1
+		self.stats.sent = self.stats.sent + #data
+
 		if log:isDebug() then
 			log:debug("Sending pending request(s):")
 			debug.dump(data, 5)
@@ -377,6 +417,13 @@ _sendPendingRequests = function(self, data)
 end
 
 
+-- Send the pending requests once the current task or event dispatch is
+-- done, so the requests made meanwhile go in one request
+_queuePendingRequests = function(self)
+	self.send_task:addTask()
+end
+
+
 function subscribe(self, subscription, func, playerid, request, priority)
 	local id = self.reqid
 
@@ -399,13 +446,13 @@ function subscribe(self, subscription, func, playerid, request, priority)
 	-- Bump reqid for the next request
 	self.reqid = id + 1
 
-	-- Send immediately unless we're batching queries
+	-- Send with the other requests made meanwhile, unless we're batching queries
 	if self.state ~= CONNECTED or self.batch ~= 0 then
 		return
 	end
 
 	-- Send all pending requests and subscriptions
-	_sendPendingRequests(self)
+	_queuePendingRequests(self)
 end
 
 
@@ -447,13 +494,13 @@ function unsubscribe(self, subscription, func)
 	-- Bump reqid for the next request
 	self.reqid = id + 1
 
-	-- Send immediately unless we're batching queries
+	-- Send with the other requests made meanwhile, unless we're batching queries
 	if self.state ~= CONNECTED or self.batch ~= 0 then
 		return
 	end
 
 	-- Send all pending requests
-	_sendPendingRequests(self)
+	_queuePendingRequests(self)
 end
 
 
@@ -488,7 +535,7 @@ function request(self, func, playerid, request, priority)
 		_reconnect(self)
 	end
 
-	-- Send immediately unless we're batching queries
+	-- Send with the other requests made meanwhile, unless we're batching queries
 	if self.state ~= CONNECTED or self.batch ~= 0 then
 		if self.state ~= CONNECTED then
 			self.jnt:notify('cometDisconnected', self, self.idleTimeoutTriggered)
@@ -499,7 +546,7 @@ function request(self, func, playerid, request, priority)
 	end
 
 	-- Send all pending requests
-	_sendPendingRequests(self)
+	_queuePendingRequests(self)
 
 	return id
 end
@@ -599,15 +646,12 @@ _handshake = function(self)
 		
 		-- Also remove them from the set of requests waiting to be sent
 		-- They will get readded later and we do not want duplicates
-		for j, request in ipairs(self.sent_reqs) do
-			if sub.reqid == request.id then
-				table.remove( self.sent_reqs, j )
-			end
-		end
+		self.sent_reqs[sub.reqid] = nil
 	end
 
 	-- Reset clientId
 	self.clientId  = nil
+	self.routes    = {}
 
 	local data = { {
 		channel                  = '/meta/handshake',
@@ -670,7 +714,7 @@ _getHandshakeSink = function(self)
 			log:debug(self, ": _handshake OK, clientId: ", self.clientId)
 
 			-- Rewrite clientId in requests to be resent
-			for i, req in ipairs(self.sent_reqs) do
+			for id, req in pairs(self.sent_reqs) do
 				if req.data.response then
 					req.data.response = string.gsub(req.data.response, "/([%xX]+)/", "/" .. self.clientId .. "/")
 				end
@@ -760,10 +804,12 @@ end
 _connected = function(self)
 	local data = { }
 
-	-- Add any un-acknowledged requests to the outgoing data
-	for i, v in ipairs(self.sent_reqs) do
+	-- Add any un-acknowledged requests to the outgoing data, in the
+	-- order they were made
+	for id, v in pairs(self.sent_reqs) do
 		table.insert(data, v)
 	end
+	table.sort(data, function(a, b) return a.id < b.id end)
 
 	_sendPendingRequests(self, data)
 	_state(self, CONNECTED)
@@ -844,11 +890,9 @@ function removeRequest(self, requestId)
 	end
 
 	--try both sent and pending, since request may have been sent prior to knowing server was down
-	for i, request in ipairs( self.sent_reqs ) do
-		if request.id == requestId then
-			table.remove( self.sent_reqs, i )
-			return true
-		end
+	if self.sent_reqs[requestId] then
+		self.sent_reqs[requestId] = nil
+		return true
 	end
 
 	for i, request in ipairs( self.pending_reqs ) do
@@ -862,6 +906,27 @@ function removeRequest(self, requestId)
 end
 
 
+-- Returns the subscription for a channel, or false for the responses to
+-- requests. The subscription for each channel is cached in self.routes.
+_route = function(self, channel)
+	local route = self.routes[channel]
+
+	if route == nil then
+		-- strip clientId from channel
+		route = string.gsub(channel, "^/[0-9A-Za-z]+", "")
+
+		if string.find(route, '/slim/request') then
+			-- an async notification from a normal request
+			route = false
+		end
+
+		self.routes[channel] = route
+	end
+
+	return route
+end
+
+
 -- handle responses for both request and chunked connections
 _response = function(self, chunk)
 	-- If we have data
@@ -869,8 +934,11 @@ _response = function(self, chunk)
 		return
 	end
 
+	local stats = self.stats
+
 	-- Process each response event
 	for i, event in ipairs(chunk) do
+		stats.messages = stats.messages + 1
 
 		-- Update advice if any
 		if event.advice then
@@ -889,11 +957,8 @@ _response = function(self, chunk)
 		end
 
 		-- Remove request from sent queue
-		for i, v in ipairs( self.sent_reqs ) do
-			if v.id == tonumber(event.id) then
-				table.remove( self.sent_reqs, i )
-				break
-			end
+		if event.id then
+			self.sent_reqs[tonumber(event.id)] = nil
 		end
 
 		-- Handle response
@@ -931,38 +996,38 @@ _response = function(self, chunk)
 		elseif event.channel == '/slim/request' and event.successful then
 			-- no action
 		elseif event.channel then
-			local subscription    = event.channel
-			local onetime_request = false
-					
-			-- strip clientId from channel
-			subscription = string.gsub(subscription, "^/[0-9A-Za-z]+", "")
-				
-			if string.find(subscription, '/slim/request') then
-				-- an async notification from a normal request
-				if not event.id then
-					log:error("No id. event:")
-					return
-				end
-				subscription = subscription .. '|' .. event.id
-				onetime_request = true
+			local subscription = _route(self, event.channel)
+			local callbacks, func
+			if subscription then
+				callbacks = self.notify[subscription]
+			elseif event.id then
+				func = self.notify_reqs[tonumber(event.id)]
 			end
 
-			if self.notify[subscription] then
+			if callbacks then
 				log:debug(self, ": _response, notifiying callbacks for ", subscription)
-				
-				for _, func in pairs( self.notify[subscription] ) do
+				stats.routed = stats.routed + 1
+
+				for _, func in pairs( callbacks ) do
 					log:debug("  callback to: ", func)
 					func(event)
 				end
-						
-				if onetime_request then
-					-- this was a one-time request, so remove the callback
-					self.notify[subscription] = nil
-				end
+			elseif func then
+				log:debug(self, ": _response, notifiying callback for request ", event.id)
+				stats.routed = stats.routed + 1
+
+				func(event)
+
+				-- this was a one-time request, so remove the callback
+				self.notify_reqs[tonumber(event.id)] = nil
+			elseif subscription == false and not event.id then
+				log:error("No id. event:")
+				return
 			else
 				-- this is normal, since unsub's are delayed by a few seconds, we may receive events
 				-- after we unsubscribed but before the server is notified about it
-				log:debug(self, ": _response, got data for an event we aren't subscribed to, ignoring -> ", subscription)
+				log:debug(self, ": _response, got data for an event we aren't subscribed to, ignoring -> ", event.channel)
+				stats.unrouted = stats.unrouted + 1
 			end
 		else
 			log:warn(self, ": _response, unknown error: ", event.error)
@@ -977,6 +1042,40 @@ _response = function(self, chunk)
 end
 
 
+--[[
+
+=head2 jive.net.Comet:getStats(reset)
+
+Returns the message statistics since the last reset: the I<messages> received and their rate in I<messagesPerSecond>, the messages I<routed> to callbacks and I<unrouted> messages with no callback, and the I<posts> made with the I<sent> messages. If I<reset> is true the counts are cleared.
+
+=cut
+--]]
+function getStats(self, reset)
+	local stats = self.stats
+	local now = Framework:getTicks()
+
+	local result = {}
+	for k, v in pairs(stats) do
+		result[k] = v
+	end
+	result.since = nil
+
+	local elapsed = now - (stats.since or now)
+	result.messagesPerSecond = elapsed > 0 and (stats.messages * 1000 / elapsed) or 0
+
+	if reset then
+		stats.messages  = 0
+		stats.routed    = 0
+		stats.unrouted  = 0
+		stats.posts     = 0
+		stats.sent      = 0
+		stats.since     = now
+	end
+
+	return result
+end
+
+
 _disconnect = function(self)
 	assert(self.state == CONNECTED)
 
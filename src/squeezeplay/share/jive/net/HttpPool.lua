@@ -20,6 +20,10 @@ have been serviced.
  -- queue a request
  pool:queue(aRequest)
 
+ -- queue a request to another host, using the shared pool of
+ -- keep-alive connections to that host
+ HttpPool:forHost(jnt, "www.example.com", 80):queue(aRequest)
+
 
 =head1 FUNCTIONS
 
@@ -31,7 +35,7 @@ have been serviced.
 
 
 -- stuff we use
-local _assert, ipairs, tostring, type = _assert, ipairs, tostring, type
+local _assert, ipairs, pairs, tostring, type = _assert, ipairs, pairs, tostring, type
 
 local table           = require("table")
 local math            = require("math")
@@ -39,12 +43,19 @@ local math            = require("math")
 local oo              = require("loop.base")
 
 local SocketHttpQueue = require("jive.net.SocketHttpQueue")
+local Framework       = require("jive.ui.Framework")
 local Timer           = require("jive.ui.Timer")
 
 local log             = require("jive.utils.log").logger("net.http")
 
 local KEEPALIVE_TIMEOUT = 60000 -- timeout idle connections after 60 seconds
 
+-- shared pools for forHost, by host:port
+local hostPools = {}
+
+local HOST_CONNECTIONS = 2         -- connections per host
+local HOST_KEEPALIVE_TIMEOUT = 4000 -- close before the server does, often after 5 seconds
+
 -- jive.net.HttpPool is a base class
 module(..., oo.class)
 
@@ -84,6 +95,8 @@ function __init(self, jnt, name, ip, port, quantity, threshold, priority)
 		reqQueue      = {},
 		reqQueueCount = 0,
 		timeout_timer = nil,
+		keepalive     = KEEPALIVE_TIMEOUT,
+		pipeline      = true,    -- send requests before the last response
 	})
 	
 	
@@ -98,6 +111,52 @@ function __init(self, jnt, name, ip, port, quantity, threshold, priority)
 end
 
 
+--[[
+
+=head2 jive.net.HttpPool:forHost(jnt, host, port)
+
+Class method returning the pool shared by all requests to I<host>:I<port>.
+The pool opens up to 2 keep-alive connections to the host, each used for
+one request at a time. Connections are closed after 4 seconds idle, before
+most servers close them, and the pool is freed once all are closed. Use
+this instead of creating a L<jive.net.SocketHttp> for each request to a
+remote server.
+
+=cut
+--]]
+function forHost(class, jnt, host, port)
+	local key = host .. ":" .. (port or 80)
+
+	local pool = hostPools[key]
+	if not pool then
+		pool = class(jnt, key, host, port or 80, HOST_CONNECTIONS, 1)
+		pool.keepalive = HOST_KEEPALIVE_TIMEOUT
+		pool.pipeline = false
+		pool.hostKey = key
+
+		hostPools[key] = pool
+	end
+
+	return pool
+end
+
+
+--[[
+
+=head2 jive.net.HttpPool:setPipeline(pipeline)
+
+If I<pipeline> is true, the default, a connection sends the next queued
+request without waiting for the response to the last one (HTTP/1.1
+pipelining). Otherwise a connection takes the next request when it is
+idle, and the other connections in the pool are used in parallel.
+
+=cut
+--]]
+function setPipeline(self, pipeline)
+	self.pipeline = pipeline
+end
+
+
 --[[
 
 =head2 jive.net.HttpPool:free()
@@ -164,11 +223,22 @@ function queue(self, request)
 end
 
 
+-- true if the socket is waiting for a response
+local function _socketBusy(socket)
+	return socket.t_httpSendRequest or socket.t_httpRecvRequest or #socket.t_httpRecvRequests > 0
+end
+
+
 -- t_dequeue
 -- returns a request if there is any
 -- called by SocketHttpQueue
 function t_dequeue(self, socket)
 --	log:debug(self, ":t_dequeue()")
+
+	-- without pipelining the socket asks again when the response is done
+	if not self.pipeline and _socketBusy(socket) then
+		return nil, false
+	end
 		
 	local request = table.remove(self.reqQueue, 1)
 	if request then
@@ -179,36 +249,102 @@ function t_dequeue(self, socket)
 		self.reqQueueCount = self.reqQueueCount - 1
 --		log:warn(self, " dequeues ", request)
 			
-		if self.timeout_timer then
-			self.timeout_timer:stop()
-			self.timeout_timer = nil
-		end
-			
 		return request, false
 	end
 	
 	self.reqQueueCount = 0
 	
-	-- close the first connection after a timeout expires
+	-- the connection is idle from its last use, the timer closes it
+	-- once the keep-alive timeout expires
+	socket.t_idleSince = Framework:getTicks()
+
 	if not self.timeout_timer then
 		self.timeout_timer = Timer(
-			KEEPALIVE_TIMEOUT,
+			self.keepalive,
 			function()
-				log:debug(self, ": closing idle connection")
-				for i = 1, self.pool.active do
-					self.pool.jshq[1]:close('keep-alive timeout')
-				end
+				self:_closeIdle()
 			end,
 			true -- run once
 		)
-		self.timeout_timer:start()
-	end			
+	end
+	if not self.timeout_timer:isRunning() then
+		self.timeout_timer:restart(self.keepalive)
+	end
 
-	-- close all but the first one (active = 1)
 	return nil, false
 end
 
 
+-- t_retry
+-- queues request again before the others, the server closed the
+-- connection it was sent on
+-- called by SocketHttpQueue
+function t_retry(self, request)
+	table.insert(self.reqQueue, 1, request)
+	self.reqQueueCount = self.reqQueueCount + 1
+end
+
+
+-- _closeIdle
+-- closes the connections idle for the keep-alive timeout, and frees a
+-- shared pool once they are all closed
+function _closeIdle(self)
+	log:debug(self, ": closing idle connections")
+
+	local now = Framework:getTicks()
+	local wait = false
+
+	for i = 1, self.pool.active do
+		local socket = self.pool.jshq[i]
+
+		if _socketBusy(socket) then
+			-- try again when the responses are done
+			wait = wait or self.keepalive
+		elseif socket:connected() then
+			local idle = now - (socket.t_idleSince or 0)
+
+			if idle >= self.keepalive then
+				socket:close('keep-alive timeout')
+			else
+				wait = math.min(wait or self.keepalive, self.keepalive - idle)
+			end
+		end
+	end
+
+	if wait then
+		self.timeout_timer:restart(wait)
+		return
+	end
+
+	-- shared pools are freed once idle
+	if self.hostKey then
+		hostPools[self.hostKey] = nil
+		self:free()
+	end
+end
+
+
+--[[
+
+=head2 jive.net.HttpPool:getHostPools()
+
+Class method returning the number of shared host pools, and the number
+of requests queued in them.
+
+=cut
+--]]
+function getHostPools(class)
+	local pools, queued = 0, 0
+
+	for key, pool in pairs(hostPools) do
+		pools = pools + 1
+		queued = queued + pool.reqQueueCount
+	end
+
+	return pools, queued
+end
+
+
 --[[
 
 =head2 tostring(aPool)
@@ -70,6 +70,16 @@ local SOCKET_BODY_TIMEOUT = 70 -- response in 70 seconds
 -- http authentication credentials
 local credentials = {}
 
+-- connection statistics, times are in ms
+local stats = {
+	requests    = 0,
+	connections = 0,    -- requests that opened a connection
+	reused      = 0,    -- requests sent on an open connection
+	retried     = 0,    -- requests sent again after an open connection closed
+	dnsTime     = 0,
+	connectTime = 0,
+}
+
 
 -- Class method to set HTTP authentication headers
 function setCredentials(class, cred)
@@ -84,6 +94,46 @@ function setCredentials(class, cred)
 end
 
 
+--[[
+
+=head2 jive.net.SocketHttp:getStats(reset)
+
+Class method returning the connection statistics for all HTTP sockets:
+the I<requests> sent, the I<connections> opened and the requests sent
+on a connection that was already open (I<reused>, and I<reuseRate> in
+percent), the requests sent again because the server closed a reused
+connection before responding (I<retried>), and the time spent resolving
+host names (I<dnsTime>) and connecting (I<connectTime>), in total and per
+request, in ms. If I<reset> is true the counts are cleared.
+
+=cut
+--]]
+function getStats(class, reset)
+	local result = {}
+	for k, v in pairs(stats) do
+		result[k] = v
+	end
+
+	if stats.requests > 0 then
+		result.reuseRate = stats.reused * 100 / stats.requests
+		result.dnsTimePerRequest = stats.dnsTime / stats.requests
+		result.connectTimePerRequest = stats.connectTime / stats.requests
+	else
+		result.reuseRate = 0
+		result.dnsTimePerRequest = 0
+		result.connectTimePerRequest = 0
+	end
+
+	if reset then
+		for k, v in pairs(stats) do
+			stats[k] = 0
+		end
+	end
+
+	return result
+end
+
+
 --[[
 
 =head2 jive.net.SocketHttp(jnt, host, port, name)
@@ -172,6 +222,14 @@ function _dequeueRequest(self)
 end
 
 
+-- _retryRequest
+-- sends request again before any queued request, can be overridden by
+-- sub-classes
+function _retryRequest(self, request)
+	table.insert(self.t_httpSendRequests, 1, request)
+end
+
+
 -- t_sendDequeue
 -- removes a request from the queue
 function t_sendDequeue(self)
@@ -181,9 +239,17 @@ function t_sendDequeue(self)
 
 	if self.t_httpSendRequest then
 		log:debug(self, " send processing ", self.t_httpSendRequest)
+
+		stats.requests = stats.requests + 1
+
 		if self:connected() then
+			stats.reused = stats.reused + 1
+			self.t_httpReused = true
 			self:t_nextSendState(true, 't_sendRequest')
 		else
+			stats.connections = stats.connections + 1
+			self.t_httpReused = false
+			self.t_resolveStart = socket.gettime()
 			self:t_nextSendState(true, 't_sendResolve')
 		end
 		return
@@ -252,6 +318,13 @@ end
 function t_sendConnect(self)
 	log:debug(self, ":t_sendConnect()")
 
+	local now = socket.gettime()
+	if self.t_resolveStart then
+		stats.dnsTime = stats.dnsTime + (now - self.t_resolveStart) * 1000
+		self.t_resolveStart = nil
+	end
+	self.t_connectStart = now
+
 	local err = socket.skip(1, self:t_connect())
 	
 	if err then
@@ -370,6 +443,12 @@ function t_sendRequest(self)
 	
 	local pump = function (NetworkThreadErr)
 		log:debug(self, ":t_sendRequest.pump()")
+
+		-- the socket is writable once connected
+		if self.t_connectStart then
+			stats.connectTime = stats.connectTime + (socket.gettime() - self.t_connectStart) * 1000
+			self.t_connectStart = nil
+		end
 		
 		if NetworkThreadErr then
 			log:error(self, ":t_sendRequest.pump: ", NetworkThreadErr)
@@ -867,6 +946,15 @@ function free(self)
 end
 
 
+-- true if request may be sent again after its connection closed: a GET
+-- with no response yet, that was not sent again already
+local function _canRetry(request)
+	return not request.t_httpRetried
+		and not request:t_hasBody()
+		and not request:t_getResponseStatus()
+end
+
+
 -- close
 -- close our socket
 function close(self, err)
@@ -886,6 +974,33 @@ function close(self, err)
 	self.t_httpRecvRequest = false
 	self.t_httpRecvRequests = {}
 
+	-- the server may close a kept alive connection just as a request is
+	-- sent on it, these requests are sent again once on a new connection
+	local retryRequests = {}
+	if err and self.t_httpReused then
+		for i = #errorRecvRequests, 1, -1 do
+			if _canRetry(errorRecvRequests[i]) then
+				table.insert(retryRequests, 1, table.remove(errorRecvRequests, i))
+			end
+		end
+
+		if errorSendRequest and _canRetry(errorSendRequest) then
+			retryRequests[#retryRequests + 1] = errorSendRequest
+			errorSendRequest = false
+		end
+	end
+	self.t_httpReused = false
+
+	-- requeue in reverse, so they are sent in the original order
+	for i = #retryRequests, 1, -1 do
+		local request = retryRequests[i]
+		log:info(self, " retrying ", request, " after ", err)
+
+		request.t_httpRetried = true
+		stats.retried = stats.retried + 1
+		self:_retryRequest(request)
+	end
+
 	-- start again
 	self:t_nextSendState(true, 't_sendDequeue')
 	self:t_nextRecvState(true, 't_recvDequeue')
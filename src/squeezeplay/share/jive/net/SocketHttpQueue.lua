@@ -44,7 +44,8 @@ oo.class(_M, SocketHttp)
 Same as L<jive.net.SocketHttp>, save for the I<queueObj> parameter
 which must refer to an object implementing a B<t_dequeue> function
 that returns a request from its queue and a boolean indicating if
-the connection must close.
+the connection must close, and a B<t_retry> function that queues a
+request again before the others.
 
 =cut
 --]]
@@ -81,6 +82,23 @@ function _dequeueRequest(self)
 end
 
 
+-- _retryRequest
+-- requests are sent again from the head of the external queue
+function _retryRequest(self, request)
+	self.httpqueue:t_retry(request)
+end
+
+
+-- t_recvComplete
+-- ask the queue for the next request, if it was held back waiting for
+-- this response
+function t_recvComplete(self)
+	SocketHttp.t_recvComplete(self)
+
+	self:t_sendDequeueIfIdle()
+end
+
+
 --[[
 
 =head2 tostring(aSocket)
@@ -965,13 +965,10 @@ function processArtworkQueue(self)
 			self.artworkFetchCount = self.artworkFetchCount + 1
 
 			if string.find(entry.url, "^http") then
-				-- image from remote server
-
-				-- XXXX manage pool of connections to remote server
+				-- image from remote server, using the shared
+				-- keep-alive connections to that host
 				local uri  = req:getURI()
-				local http = SocketHttp(self.jnt, uri.host, uri.port, uri.host)
- 
-				http:fetch(req)
+				HttpPool:forHost(self.jnt, uri.host, uri.port):queue(req)
 			elseif self.artworkPool then
 				-- slimserver icon id
 				self.artworkPool:queue(req)
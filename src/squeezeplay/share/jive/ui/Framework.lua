@@ -47,6 +47,16 @@ local jnt           = jnt
 
 local LONG_HOLD_TIME  = 3500
 
+-- when nothing has been drawn for IDLE_TIMEOUT ms the ui events are only
+-- processed every IDLE_INTERVAL ms, or when the next timer is due. input
+-- ends the idle interval
+local IDLE_TIMEOUT    = 2000
+local IDLE_INTERVAL   = 100
+
+-- input is polled every INPUT_INTERVAL ms between frames, unless idle. when
+-- idle the input devices wake the event loop
+local INPUT_INTERVAL  = 10
+
 -- our class
 module(..., oo.class)
 
@@ -90,8 +100,6 @@ jive.frameworkOpen()
 -- initial global state
 windowStack = {}
 widgets = {} -- global widgets
-globalListeners = {} -- global listeners
-unusedListeners = {} -- unused listeners
 animations = {} -- active widget animations
 sound = {} -- sounds
 soundEnabled = {} -- sound enabled state
@@ -157,6 +165,46 @@ Sets the background image I<image>.
 
 Indicates the style parameters have changed, this clears any caching of the style values used.
 
+=head2 jive.ui.Framework:getFrameInterval()
+
+Returns the number of milliseconds until the next frame should be drawn, this is faster during window transitions and scrolling. Returns 0 when there is nothing to layout, animate or draw.
+
+=head2 jive.ui.Framework:getFrameHistogram(reset)
+
+Returns a histogram of the time spent in each phase of a frame (layout, animate, background, draw, flip and the whole screen update). Each phase is an array of counts, the first entry is frames under 1ms, entry n is frames of 2^(n-2) to 2^(n-1)-1 ms and the last entry longer frames. Also returns the number of I<frames> drawn and the number of I<idle> frames skipped. The histogram is only collected while the perfwarn I<screen> threshold is set. If I<reset> is true the counts are cleared.
+
+=head2 jive.ui.Framework:getLayoutStats(reset)
+
+Returns the number of widgets I<visited>, I<skinned> and laid out (I<layout>) by the layout pass, for the I<last> frame, the frame that laid out the most widgets (I<max>) and the I<total> over the number of I<frames> that needed a layout. If I<reset> is true the max and total counts are cleared.
+
+=head2 jive.ui.Framework:gcStep(budget)
+
+Runs incremental garbage collection steps for the memory allocated by Lua since the last call, for up to I<budget> milliseconds. Debt that does not fit the budget is carried to the next call, unless the heap has grown past twice its size after the last collection cycle. The event loop stops the collector and calls this once per frame.
+
+=head2 jive.ui.Framework:getGCStats(reset)
+
+Returns garbage collector pacing statistics: the number of I<frames> paced, collector I<steps> and completed I<cycles>, the number of frames I<forced> over budget to bound the heap, the gc I<time> of the last frame, the worst frame (I<timeMax>) and I<timeTotal> in ms, the bytes allocated in the last frame (I<alloc>) and the worst frame (I<allocMax>), and the Lua I<heap> size, its high-water mark since the last reset (I<heapPeak>) and since startup (I<heapMax>). If I<reset> is true the counts are cleared.
+
+=head2 jive.ui.Framework:pollInput()
+
+Reads the pending keyboard, mouse and platform input. Returns true if there are input events to process. The event loop uses this to dispatch input between frames.
+
+=head2 jive.ui.Framework:getInputFds()
+
+Returns a list of the file descriptors of the platform input devices. The event loop waits for these to be readable when the ui is idle, instead of polling the input.
+
+=head2 jive.ui.Framework:getInputStats(reset)
+
+Returns input queue statistics: the number of events I<queued>, mouse motion events merged into a queued event (I<coalesced>), events queued behind a full input ring (I<overflow>) and events I<dispatched> from the queue. The latency from queueing input to the flip of the next frame drawn is measured for a number of I<frames>, and returned as the 50th, 90th and 99th percentile (I<latency50>, I<latency90>, I<latency99>) and the worst latency (I<latencyMax>) in ms. If I<reset> is true the counts are cleared.
+
+=head2 jive.ui.Framework:getActionStats(reset)
+
+Returns global listener statistics: the number of I<listeners> registered, the I<events> dispatched to them, the listeners I<called> and the most listeners called for one event (I<calledMax>), the input events converted to an action (I<mapped>) or with no action (I<unmapped>), and the number of entries in the input to action map (I<inputMap>). If I<reset> is true the counts are cleared.
+
+=head2 jive.ui.Framework:preloadImages()
+
+Decodes the images used by the skin in background threads, so they are ready before a window is first drawn. Only as many images as fit in the image cache are preloaded. Returns the number of images queued.
+
 =cut
 --]]
 
@@ -275,13 +323,14 @@ end
 
 --[[
 
-=head2 jive.ui.Framework:eventLoop(netTask)
+=head2 jive.ui.Framework:eventLoop(netTask, jnt)
 
-Main event loop.
+Main event loop. The platform input devices are added to I<jnt>, the
+network thread run by I<netTask>, so input wakes the loop when it is idle.
 
 =cut
 --]]
-function eventLoop(self, netTask)
+function eventLoop(self, netTask, jnt)
 
 	local eventTask =
 		Task("ui",
@@ -307,6 +356,30 @@ function eventLoop(self, netTask)
 	local now = self:getTicks()
 	local framedue = now + framerate
 
+	-- when did the screen become idle?
+	local idleSince = nil
+
+	-- poll for input between frames?
+	local inputPoll = true
+
+	-- input read by the input task, when the input devices woke the
+	-- network task
+	local inputPending = false
+
+	if jnt then
+		local inputTask = Task("input", self,
+				       function(self)
+					       while true do
+						       inputPending = self:pollInput() or inputPending
+						       Task:yield(false)
+					       end
+				       end)
+
+		for i, fd in ipairs(self:getInputFds()) do
+			jnt:t_addRead({ getfd = function() return fd end }, inputTask, 0)
+		end
+	end
+
 	local running = true
 	while running do
 		-- process tasks: 
@@ -327,8 +400,10 @@ function eventLoop(self, netTask)
 		-- call the network task, if no tasks are runnable this blocks
 		-- until a file descriptor is ready for io or it will timeout
 		-- before the next frame should be drawn
-		if tasks then
+		if tasks or inputPending then
 			netTask:setArgs(0)
+		elseif inputPoll and framedue - now > INPUT_INTERVAL then
+			netTask:setArgs(INPUT_INTERVAL)
 		else
 			netTask:setArgs(framedue - now)
 		end
@@ -342,21 +417,55 @@ function eventLoop(self, netTask)
 			-- draw screen
 			self:updateScreen()
 
-			-- keep on top of the garbage
-			collectgarbage("step")
-
 			-- process ui event once per frame
 			Timer:_runTimer(now)
 			running = eventTask:resume()
 
-			-- when is the next frame due?
-			framedue = framedue + framerate
+			-- when is the next frame due? nothing is drawn when idle,
+			-- but the ui events are still polled
+			local interval = self:getFrameInterval()
+			inputPoll = true
+			if interval > 0 then
+				idleSince = nil
+			else
+				idleSince = idleSince or now
+				interval = framerate
+
+				if now - idleSince > IDLE_TIMEOUT then
+					interval = IDLE_INTERVAL
+					inputPoll = false
+
+					local expires = Timer:_nextExpires()
+					if expires and expires - framedue < interval then
+						interval = math.max(expires - framedue, framerate)
+					end
+				end
+			end
+
+			framedue = framedue + interval
+
+			-- keep on top of the garbage, in the idle time before
+			-- the next frame
+			now = self:getTicks()
+			self:gcStep(framedue - framerefresh - now)
 
 			now = self:getTicks()
 			if now > framedue - framerefresh then
 				logTask:debug("Dropped frame. delay=", now-framedue, "ms")
 				framedue = now + framerefresh
 			end
+
+		elseif inputPending or (inputPoll and self:pollInput()) then
+			-- dispatch the input now, so it is in the next frame
+			inputPending = false
+			running = eventTask:resume()
+
+			-- when idle the next frame may be IDLE_INTERVAL away, draw
+			-- the result of the input straight away
+			if idleSince then
+				idleSince = nil
+				framedue = math.min(framedue, self:getTicks())
+			end
 		end
 	end
 
@@ -500,7 +609,7 @@ end
 --[[
 =head2 jive.ui.Framework:loadSound(file, name, channel)
 
-Load the wav file I<file> to play on the mixer channel I<channel>. Currently two channels are supported.
+Load the wav file I<file> to play on the mixer channel I<channel>. One sound plays on each channel at a time, and up to eight channels are mixed together.
 
 =cut
 --]]
@@ -600,9 +709,11 @@ end
 
 Add a global event listener I<listener>. The listener is called for events that match the event mask I<mask>. By default the listener is called before any widget event listeners, and can stop event processing by returned EVENT_CONSUME. If priority is negative then it is called before any other listeners, otherwise if it is posible then the listener is only called after the widget listeners have processed the event. Returns a I<handle> to use in removeEventListener().
 
+The listeners are kept in C, indexed by event type, in priority order with the most recently added listener first.
+
 =cut
 --]]
-function addListener(self, mask, listener, priority)
+function addListener(self, mask, listener, priority, _actionIndex)
 	_assert(type(mask) == "number")
 	_assert(type(listener) == "function")
 
@@ -617,22 +728,7 @@ function addListener(self, mask, listener, priority)
 
 	local handle = { mask, listener, math.abs(priority), self:getTicks() }
 
-	local listeners
-	if priority < 0 then
-		listeners = self.globalListeners
-	else
-		listeners = self.unusedListeners
-	end
-
-	table.insert(listeners, handle)
-	table.sort(listeners,
-		function(a, b)
-			-- stable sort, most recent first
-			if a[3] == b[3] then
-				return a[4] > b[4]
-			end
-			return a[3] < b[3]
-		end)
+	self:_addListener(handle, priority < 0, _actionIndex)
 
 	return handle
 end
@@ -649,8 +745,7 @@ Removes the listener I<handle> from the widget.
 function removeListener(self, handle)
 	_assert(type(handle) == "table")
 
-	table.delete(self.globalListeners, handle)
-	table.delete(self.unusedListeners, handle)
+	self:_removeListener(handle)
 end
 
 function dumpActions(self)
@@ -737,6 +832,10 @@ function registerAction(self, actionName)
 	
 	--Bump as default (in case no one is handling this action)
 	self:addActionListener(actionName, self, bump, 9999)
+
+	if self.inputToActionMap then
+		self:_updateInputMap()
+	end
 end
 
 
@@ -773,37 +872,93 @@ end
 
 
 function registerActions(self, map)
-	self.inputToActionMap = map
+	-- the input map is built once all the actions are registered
+	self.inputToActionMap = nil
 
-	for key, action in pairs(self.inputToActionMap.keyActionMappings.press) do
+	for key, action in pairs(map.keyActionMappings.press) do
 		self:registerAction(action)
 	end
-	for key, action in pairs(self.inputToActionMap.keyActionMappings.hold) do
+	for key, action in pairs(map.keyActionMappings.hold) do
 		self:registerAction(action)
 	end
-	for key, action in pairs(self.inputToActionMap.charActionMappings.press) do
+	for key, action in pairs(map.charActionMappings.press) do
 		self:registerAction(action)
 	end
-	for key, action in pairs(self.inputToActionMap.irActionMappings.press) do
+	for key, action in pairs(map.irActionMappings.press) do
 		self:registerAction(action)
 	end
-	for key, action in pairs(self.inputToActionMap.irActionMappings.hold) do
+	for key, action in pairs(map.irActionMappings.hold) do
 		self:registerAction(action)
 	end
-	for i, action in ipairs(self.inputToActionMap.unassignedActionMappings) do
+	for i, action in ipairs(map.unassignedActionMappings) do
 		self:registerAction(action)
 	end
-	for key, action in pairs(self.inputToActionMap.actionActionMappings) do
+	for key, action in pairs(map.actionActionMappings) do
 		self:registerAction(action)
 	end
-	for key, action in pairs(self.inputToActionMap.gestureActionMappings) do
+	for key, action in pairs(map.gestureActionMappings) do
 		self:registerAction(action)
 	end
+
+	self.inputToActionMap = map
+	self:_updateInputMap()
 end
 
 
 function applyInputToActionOverrides(self, overrideMap)
 	self:applyInputToActionOverridesToDestination(overrideMap, self.inputToActionMap)
+	self:_updateInputMap()
+end
+
+
+-- rebuild the hashed input to action map used by convertInputToAction,
+-- with the action to action translations applied
+function _updateInputMap(self)
+	local map = self.inputToActionMap
+	if not map then
+		return
+	end
+
+	self:_clearInputMap()
+
+	local function mapInput(eventType, code, action)
+		-- not all ir buttons have a press and hold action
+		if not code or not action then
+			return
+		end
+
+		action = map.actionActionMappings[action] or action
+
+		local actionIndex = self:_getActionEventIndexByName(action)
+		if not actionIndex then
+			log:error("action name not registered: (" , action, ")")
+			return
+		end
+
+		self:_mapInput(eventType, code, actionIndex)
+	end
+
+	for key, action in pairs(map.keyActionMappings.press) do
+		mapInput(jive.ui.EVENT_KEY_PRESS, key, action)
+	end
+	for key, action in pairs(map.keyActionMappings.hold) do
+		mapInput(jive.ui.EVENT_KEY_HOLD, key, action)
+	end
+	for char, action in pairs(map.charActionMappings.press) do
+		if #char == 1 then
+			mapInput(jive.ui.EVENT_CHAR_PRESS, string.byte(char), action)
+		end
+	end
+	for gesture, action in pairs(map.gestureActionMappings) do
+		mapInput(jive.ui.EVENT_GESTURE, gesture, action)
+	end
+
+	for mapName, irMap in pairs(self.irMaps or {}) do
+		for irCode, buttonName in pairs(irMap.byCode) do
+			mapInput(jive.ui.EVENT_IR_PRESS, irCode, map.irActionMappings.press[buttonName])
+			mapInput(jive.ui.EVENT_IR_HOLD, irCode, map.irActionMappings.hold[buttonName])
+		end
+	end
 end
 
 
@@ -894,20 +1049,18 @@ function convertInputToAction(self, inputEvent)
 
 	end
 
-	local action = self:getAction(inputEvent)
-	if not action then
+	local actionIndex = self:_inputToAction(inputEvent)
+	if not actionIndex then
 		return EVENT_UNUSED
 	end
 
-	local actionEvent = self:newActionEvent(action)
-	if not actionEvent then
-		log:error("Odd, newActionEvent returned nil, but should always return a result when match was found for action: ", action)
-		return EVENT_UNUSED
-	end
+	local actionEvent = Event:new(ACTION, actionIndex)
 
 	--getmetatable(actionEvent).sourceEvent = inputEvent
 
-	log:debug("Pushing action event (", action, "), triggered from source event:", inputEvent:tostring())
+	if log:isDebug() then
+		log:debug("Pushing action event (", self:getActionEventNameByIndex(actionIndex), "), triggered from source event:", inputEvent:tostring())
+	end
 	self:pushEvent(actionEvent)
 
 	return EVENT_CONSUME
@@ -940,12 +1093,9 @@ function addActionListener(self, action, obj, listener, priority)
 
 	log:debug("Creating action listener for action: (" , action, ") from source: ", callerInfo)
 	
+	-- the listener is only called for events with this action
 	return self:addListener(ACTION,
 		function(event)
-			local eventAction = event:getAction()
-			if eventAction != action then
-				return EVENT_UNUSED
-			end
 			log:debug("Calling action listener for action: (" , action, ") from source: ", callerInfo)
 		
 			local listenerResult = listener(obj, event)
@@ -956,7 +1106,8 @@ function addActionListener(self, action, obj, listener, priority)
 			end
 			return eventResult
 		end,
-		priority
+		priority,
+		self:_getActionEventIndexByName(action)
 	)
 end
 
@@ -1020,6 +1171,7 @@ function initIRCodeMappings(self)
 	        self.irMaps[mapWrapper.name].byName[buttonName] = irCode
         end
         
+	self:_updateInputMap()
         
 	
 end
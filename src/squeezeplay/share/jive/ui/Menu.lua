@@ -31,7 +31,7 @@ B<itemHeight> : the height of each menu item.
 
 
 -- stuff we use
-local _assert, ipairs, pairs, string, tostring, type, getmetatable = _assert, ipairs, pairs, string, tostring, type, getmetatable
+local _assert, ipairs, pairs, string, tostring, type, getmetatable, setmetatable = _assert, ipairs, pairs, string, tostring, type, getmetatable, setmetatable
 
 local oo                   = require("loop.simple")
 local debug                = require("jive.utils.debug")
@@ -1011,6 +1011,11 @@ function __init(self, style, itemRenderer, itemListener, itemAvailable, contextM
 
 	obj.widgets = {}        -- array of widgets
 	obj.lastWidgets = {}    -- hash of widgets
+	obj.recycleWidgets = false -- true if widgets are kept on their items
+	obj.prerenderRows = 0   -- number of rows rendered ahead of scrolling
+	obj.prerendered = {}    -- hash of list index to pre-rendered widget
+	obj.widgetPool = {}     -- hash of style to array of spare widgets
+	obj.renderedIndex = setmetatable({}, { __mode = "k" }) -- hash of widget to list index
 	obj.numWidgets = 0      -- number of visible widges
 	obj.topItem = 1         -- index of top widget
 	obj.selected = nil      -- index of selected widget
@@ -1161,6 +1166,43 @@ function setCloseable(self, isCloseable)
 end
 
 
+--[[
+
+=head2 jive.ui.Menu:setRecycleWidgets(prerenderRows)
+
+Keeps the item widgets on the items they last rendered and recycles the widgets that leave the menu, so scrolling only renders the rows entering the view. Up to I<prerenderRows> rows ahead of the scrolling direction are rendered and laid out before they scroll into view. Only use this with item renderers that don't share widgets between rows. Set I<prerenderRows> to nil to disable recycling.
+
+=cut
+--]]
+function setRecycleWidgets(self, prerenderRows)
+	_assert(prerenderRows == nil or type(prerenderRows) == "number")
+
+	self.recycleWidgets = prerenderRows ~= nil
+	self.prerenderRows = prerenderRows or 0
+	self.prerendered = {}
+	self.widgetPool = {}
+
+	self:reLayout()
+end
+
+
+--[[
+
+=head2 jive.ui.Menu:getRecycledWidget(style)
+
+Returns a widget with I<style> that has left the menu, or nil. Item renderers can use this to avoid reskinning a widget when the item style changes.
+
+=cut
+--]]
+function getRecycledWidget(self, style)
+	local pool = self.widgetPool[style]
+
+	if pool then
+		return table.remove(pool)
+	end
+end
+
+
 --[[
 
 =head2 jive.ui.Menu:getVisibleIndices()
@@ -1558,6 +1600,145 @@ function _scrollList(self)
 end
 
 
+-- keep spare widgets for reuse, keyed by style
+local function _recycleWidget(self, widget)
+	self.renderedIndex[widget] = nil
+
+	local style = widget:getStyle()
+	local pool = self.widgetPool[style]
+	if not pool then
+		pool = {}
+		self.widgetPool[style] = pool
+	end
+
+	if #pool <= self.numWidgets then
+		pool[#pool + 1] = widget
+	end
+end
+
+
+-- move the widgets to the items they last rendered, using pre-rendered
+-- widgets for the rows entering the view
+local function _bindWidgets(self, indexList, indexSize)
+	local renderedIndex = self.renderedIndex
+	local prerendered = self.prerendered
+
+	local bound = {}
+	local spare = {}
+	for i, widget in pairs(self.widgets) do
+		local index = renderedIndex[widget]
+		if index and not bound[index] then
+			bound[index] = widget
+		else
+			spare[#spare + 1] = widget
+		end
+	end
+
+	local widgets = {}
+	for i = 1, indexSize do
+		local index = indexList[i]
+
+		widgets[i] = bound[index] or prerendered[index]
+		bound[index] = nil
+		prerendered[index] = nil
+	end
+
+	for index, widget in pairs(bound) do
+		spare[#spare + 1] = widget
+	end
+
+	-- keep the selected widget in the selected position, this avoids
+	-- having to change the widgets skin modifier.
+	local lastSelected = self._lastSelected
+	local selectedOffset = self.selected and self.selected - self.topItem + 1 or self.topItem
+
+	if lastSelected and selectedOffset >= 1 and selectedOffset <= indexSize
+		and widgets[selectedOffset] ~= lastSelected then
+
+		local found = false
+		for i = 1, indexSize do
+			if widgets[i] == lastSelected then
+				widgets[i], widgets[selectedOffset] = widgets[selectedOffset], widgets[i]
+				found = true
+				break
+			end
+		end
+
+		if not found and table.delete(spare, lastSelected) then
+			spare[#spare + 1] = widgets[selectedOffset]
+			widgets[selectedOffset] = lastSelected
+		end
+	end
+
+	-- the remaining rows reuse the spare widgets
+	for i = 1, indexSize do
+		if not widgets[i] then
+			widgets[i] = table.remove(spare)
+		end
+	end
+
+	self.widgets = widgets
+end
+
+
+-- render and layout the rows about to scroll into view
+local function _prerenderWidgets(self, min, max)
+	local dir = self.topItem - (self._prerenderTop or self.topItem)
+	self._prerenderTop = self.topItem
+
+	if dir ~= 0 then
+		self._prerenderDir = dir > 0 and 1 or -1
+	end
+
+	local prerendered = self.prerendered
+	local indexList = {}
+	local widgetList = {}
+
+	if self._prerenderDir and not self.accel then
+		local from = (self._prerenderDir > 0) and max + 1 or min - self.prerenderRows
+
+		for index = from, from + self.prerenderRows - 1 do
+			if index >= 1 and index <= self.listSize then
+				local n = #indexList + 1
+				indexList[n] = index
+				widgetList[n] = prerendered[index]
+				prerendered[index] = nil
+			end
+		end
+	end
+
+	-- rows no longer ahead of the view
+	for index, widget in pairs(prerendered) do
+		_recycleWidget(self, widget)
+	end
+
+	prerendered = {}
+	self.prerendered = prerendered
+
+	if #indexList == 0 then
+		return
+	end
+
+	self.itemRenderer(self, self.list, widgetList, indexList, #indexList)
+
+	for i, index in ipairs(indexList) do
+		local widget = widgetList[i]
+
+		if widget then
+			prerendered[index] = widget
+			self.renderedIndex[widget] = index
+
+			-- the style path includes the menu and window, the parent
+			-- is only set while skinning so the row is still shown
+			-- when _updateWidgets attaches it
+			widget.parent = self
+			widget:checkLayout()
+			widget.parent = nil
+		end
+	end
+end
+
+
 function _updateWidgets(self)
 
 	local jumpScrollBottom = self.topItem + self.numWidgets
@@ -1602,7 +1783,10 @@ function _updateWidgets(self)
 	-- reorder widgets to maintain the position of the selected widgets
 	-- this avoids having to change the widgets skin modifier, and
 	-- therefore avoids having to reskin the widgets during scrolling.
-	if self._lastSelectedOffset then
+	if self.recycleWidgets then
+		_bindWidgets(self, indexList, indexSize)
+
+	elseif self._lastSelectedOffset then
 		local lastSelectedOffset = self._lastSelectedOffset
 		local selectedOffset = self.selected and self.selected - self.topItem + 1 or self.topItem
 
@@ -1616,6 +1800,14 @@ function _updateWidgets(self)
 	-- render menu widgets
 	self.itemRenderer(self, self.list, self.widgets, indexList, indexSize)
 
+	if self.recycleWidgets then
+		for i = 1, indexSize do
+			if self.widgets[i] then
+				self.renderedIndex[self.widgets[i]] = indexList[i]
+			end
+		end
+	end
+
 	-- show or hide widgets
 	local nextWidgets = {}
 	local lastWidgets = self.lastWidgets
@@ -1644,6 +1836,10 @@ function _updateWidgets(self)
 		if TOUCH then
 			widget:setSmoothScrollingMenu(nil)
 		end
+
+		if self.recycleWidgets then
+			_recycleWidget(self, widget)
+		end
 	end
 
 	self.lastWidgets = nextWidgets
@@ -1653,6 +1849,10 @@ function _updateWidgets(self)
 		self.widgets[i] = nil
 	end
 
+	if self.recycleWidgets and self.prerenderRows > 0 then
+		_prerenderWidgets(self, min, max)
+	end
+
 
 	local nextSelected = _selectedItem(self)
 
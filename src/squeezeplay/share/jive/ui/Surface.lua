@@ -65,10 +65,34 @@ Blits a subset this surface I<sx, sy, sw, sh> to the I<dst> surface at I<dx, dy>
 
 Blits this surface to the I<dst> surface at I<dx, dy> using a per surface alpha value. Only works with RGB surfaces.
 
+=head2 blitRotated(dst, cx, cy, angle, steps)
+
+Blits this surface rotated by I<angle> degrees counter clockwise to the I<dst> surface, centred at I<cx, cy>. The angle is rounded to 360/I<steps> degrees, by default 1 degree. The rotated images are cached, so unlike rotozoom this is cheap when the same angles are drawn again. The surface must not be changed after it has been drawn rotated.
+
 =head2 getSize()
 
 Returns I<w, h>, the surface size.
 
+=head2 drawList(list)
+
+Draws a list of primitives on this surface with one call. I<list> is a flat array of operations, each followed by its arguments:
+
+ Surface.DRAW_BLIT, src, x, y
+ Surface.DRAW_BLIT_CLIP, src, sx, sy, sw, sh, x, y
+ Surface.DRAW_BLIT_ALPHA, src, x, y, alpha
+ Surface.DRAW_TILE, tile, x, y, w, h
+ Surface.DRAW_PIXEL, x, y, color
+ Surface.DRAW_HLINE, x1, x2, y, color
+ Surface.DRAW_VLINE, x, y1, y2, color
+ Surface.DRAW_RECTANGLE, x1, y1, x2, y2, color
+ Surface.DRAW_FILLED_RECTANGLE, x1, y1, x2, y2, color
+ Surface.DRAW_LINE, x1, y1, x2, y2, color
+ Surface.DRAW_AALINE, x1, y1, x2, y2, color
+
+=head2 Surface:benchmark(n)
+
+Times I<n> calls of blit and filledRectangle through the tolua++ bindings and the fast bindings, and the same rectangles drawn with drawList. Returns a table of calls per second.
+
 =head2 release()
 
 Free the wrapped surface object. This can be useful if temporary surfaces are created frequently (such as when using rotozoom), Lua has
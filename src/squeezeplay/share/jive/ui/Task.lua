@@ -21,13 +21,9 @@ PRIORITY_HIGH = 2
 PRIORITY_LOW = 3
 
 
--- the task list is modified while iterating over the entries,
--- we use a linked list to make the iteration easier
--- three queues: streaming, high and low
-local taskHead = { nil, nil, nil }
-
--- the task that is active, or nil for the main thread
-local taskRunning = nil
+-- the run queues are kept in C, see jive_task.c. Task:addTask(),
+-- removeTask(), setArgs(), resume(), iterator(), running() and dump()
+-- are native methods registered when the framework is opened.
 
 
 function __init(self, name, obj, f, errf, priority)
@@ -48,115 +44,6 @@ function __init(self, name, obj, f, errf, priority)
 end
 
 
--- returns true if the task is suspened or false if it is completed
-function resume(self)
-	log:debug("task: ", self.name)
-
-	taskRunning = self
-
-	local nerr, val = coroutine.resume(self.thread, self.obj, unpack(self.args))
-
-	taskRunning = nil
-	if nerr then
-		if val == nil then
-			val = (coroutine.status(self.thread) ~= "dead")
-		end
-
-		if val then
-			-- continue to run task
-			return true
-		else
-			-- suspend task
-			self:removeTask()
-			return false
-		end
-	else
-		-- task has error
-		log:error("task error ", self.name, ": ", val)
-		self:removeTask()
-		self.state = "error"
-
-		if self.errf then
-			self.errf(self.obj)
-		end
-		return false
-	end
-end
-
-
--- set the arguments passed to the co-routine function or yield
-function setArgs(self, ...)
-	self.args = { ... }
-end
-
-
--- add task to the end of the task list
-function addTask(self, ...)
-	log:debug("addTask ", self.name)
-
-	if self.state == "error" then
-		log:warn("task ", self.name, " in error state")
-		return false
-	end
-
-	if self.state == "active" then
-		return true
-	end
-
-	self.args = { ... }
-	self.state = "active"
-	self.next = nil
-
-	if taskHead[self.priority] == nil then
-		taskHead[self.priority] = self
-	else
-		local entry = taskHead[self.priority]
-		while entry do
-			if not entry.next then
-				entry.next = self
-				break
-			end
-
-			entry = entry.next
-		end
-	end
-
-	return true
-end
-
-
--- remove task from task list
-function removeTask(self)
-	log:debug("removeTask ", self.name)
-
-	self.state = "suspended"
-
-	-- unlink from linked list
-	if not taskHead then
-		return
-	end
-
-	if taskHead[self.priority] == self then
-		if taskHead[self.priority].next then
-			taskHead[self.priority] = self.next
-		else
-			taskHead[self.priority] = nil
-		end
-		return
-	end
-
-	local entry = taskHead[self.priority]
-	while entry do
-		if entry.next == self then
-			entry.next = self.next
-			return
-		end
-
-		entry = entry.next
-	end
-end
-
-
 function yield(class, ...)
 	return coroutine.yield(...)
 end
@@ -172,53 +59,6 @@ function xpcall(class, ...)
 end
 
 
-function running(class)
-	return taskRunning
-end
-
-
-function dump(class)
-	local header = false
-
-	for i,v in pairs(taskHead) do
-		local entry = taskHead[i]
-
-		if entry and not header then
-			log:info("Task queue:")
-			header = true
-		end
-
-		while entry do
-			log:info(i, ": ", entry.name, " (", entry, ")")
-			entry = entry.next
-		end
-	end
-end
-
-
--- iterate over the task list. it is safe to add or remove tasks while
--- iterating.
-function iterator(class)
-	local entry = true
-	local priority = 1
-
-	return function()
-		       if entry == true then
-			       entry = taskHead[priority]
-		       else
-			       entry = entry.next
-		       end
-
-		       while entry == nil and priority < PRIORITY_LOW do
-			       priority = priority + 1
- 			       entry = taskHead[priority]
-		       end
-
-		       return entry
-	       end
-end
-
-
 function __tostring(self)
 	return "Task(" .. self.name .. ")"
 end
@@ -167,6 +167,12 @@ function _insertTimer(self, expires)
 end
 
 
+-- returns when the next timer expires, or nil if no timers are running
+function _nextExpires(self)
+	return timers[1] and timers[1].expires
+end
+
+
 -- process timer queue
 function _runTimer(self, now)
 	if timers[1] and not timers[1].expires then
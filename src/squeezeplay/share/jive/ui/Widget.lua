@@ -347,6 +347,9 @@ widget is packed and any layout updated before it is redrawn.
 Called when the widget has change position or size. This will make sure the widget
 is layout is updated before it is redrawn.
 
+The parent widgets are laid out again up to the first layout root, this is a
+widget with I<layoutRoot> set or a widget whose style sets both its w and h.
+
 =cut
 --]]
 -- C function
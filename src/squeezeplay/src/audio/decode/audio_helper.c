@@ -71,6 +71,153 @@ bool_t decode_check_start_point(void) {
 }
 
 
+/*
+ * Publish frames handed to the audio device to the visualizer tap. buf may
+ * be NULL for silence. Called from the audio output thread only.
+ */
+void decode_vis_tap_write(sample_t *buf, size_t frames, u32_t sample_rate) {
+	struct decode_vis_tap *tap = &decode_audio->vis_tap;
+	u32_t wpos, decimate;
+	s16_t *ptr;
+
+	decimate = 1;
+	while (sample_rate / decimate > VIS_TAP_MAX_RATE) {
+		decimate <<= 1;
+	}
+	if (decimate != tap->decimate) {
+		tap->decimate = decimate;
+		tap->phase = 0;
+	}
+
+	wpos = tap->wpos;
+
+	while (frames--) {
+		if (++tap->phase >= decimate) {
+			tap->phase = 0;
+
+			ptr = tap->buf + ((wpos & (VIS_TAP_FRAMES - 1)) * 2);
+			if (buf) {
+				ptr[0] = buf[0] >> 16;
+				ptr[1] = buf[1] >> 16;
+			}
+			else {
+				ptr[0] = 0;
+				ptr[1] = 0;
+			}
+			wpos++;
+		}
+
+		if (buf) {
+			buf += 2;
+		}
+	}
+
+	/* samples must be visible before the new write position */
+	decode_vis_tap_barrier();
+	tap->wpos = wpos;
+}
+
+
+/*
+ * Record that the frame written delay frames ago is at the DAC now.
+ */
+void decode_vis_tap_mark(u32_t delay, u32_t sample_rate) {
+	struct decode_vis_tap *tap = &decode_audio->vis_tap;
+	u32_t decimate = tap->decimate ? tap->decimate : 1;
+
+	tap->mark_seq++;
+	decode_vis_tap_barrier();
+
+	tap->mark_pos = tap->wpos - (delay / decimate);
+	tap->mark_jiffies = jive_jiffies();
+	tap->mark_rate = sample_rate / decimate;
+
+	decode_vis_tap_barrier();
+	tap->mark_seq++;
+}
+
+
+/*
+ * Publish the playback state to the status page. This must be called
+ * with the fifo locked, which keeps the writers serialized.
+ */
+void decode_status_page_update(void) {
+	struct decode_status_page *page = &decode_audio->status_page;
+
+	ASSERT_AUDIO_LOCKED();
+
+	/* seq is odd while writing, it is still odd if the last writer
+	 * died during an update */
+	page->seq |= 1;
+	decode_vis_tap_barrier();
+
+	page->state = decode_audio->state;
+	page->output_full = fifo_bytes_used(&decode_audio->fifo);
+	page->output_size = decode_audio->fifo.size;
+	page->track_sample_rate = decode_audio->track_sample_rate;
+	page->elapsed_samples = decode_audio->elapsed_samples;
+	page->sync_elapsed_samples = decode_audio->sync_elapsed_samples;
+	page->sync_elapsed_timestamp = decode_audio->sync_elapsed_timestamp;
+	page->num_tracks_started = decode_audio->num_tracks_started;
+	page->clock_drift = decode_audio->clock_drift;
+	page->clock_correction = decode_audio->clock_correction;
+
+	page->updates++;
+	page->update_jiffies = jive_jiffies();
+
+	decode_vis_tap_barrier();
+	page->seq++;
+
+	page->version = DECODE_STATUS_PAGE_VERSION;
+}
+
+
+/*
+ * Copy a consistent snapshot of the status page without locking. Returns
+ * false if the page has not been written by this version of the code, or
+ * if no consistent copy was made within DECODE_STATUS_PAGE_RETRIES, the
+ * caller then refreshes the page with the fifo locked.
+ */
+bool_t decode_status_page_read(struct decode_status_page *snap) {
+	struct decode_status_page *page = &decode_audio->status_page;
+	u32_t seq;
+	int i;
+
+	if (page->version != DECODE_STATUS_PAGE_VERSION) {
+		return false;
+	}
+
+	for (i = 0; i < DECODE_STATUS_PAGE_RETRIES; i++) {
+		seq = page->seq;
+		decode_vis_tap_barrier();
+
+		memcpy(snap, (void *)page, sizeof(struct decode_status_page));
+
+		decode_vis_tap_barrier();
+		if (!(seq & 1) && seq == page->seq) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * Wake the decode thread once the output has drained the fifo to the low
+ * watermark. Called by the output with the fifo locked.
+ */
+void decode_check_low_watermark(void) {
+	ASSERT_AUDIO_LOCKED();
+
+	if (decode_audio->decode_waiting
+	    && fifo_bytes_used(&decode_audio->fifo) <= decode_audio->low_watermark) {
+		decode_audio->decode_waiting = FALSE;
+		fifo_signal(&decode_audio->fifo);
+	}
+}
+
+
 static inline s16_t s16_clip(s16_t a, s16_t b) {
 	s32_t s = a + b;
 
@@ -84,112 +231,58 @@ static inline s16_t s16_clip(s16_t a, s16_t b) {
 	}
 }
 
-#ifdef RESAMPLE_EFFECTS
-#   include "../speex/speex_resampler.h"
-#   define EFFECTS_SAMPLE_RATE 44100
-#   define EFFECTS_RESAMPLE_QUALITY 2
-	static SpeexResamplerState *resampler;
-#endif
-
-static int get_effects_samples(effect_t* output_samples_buf, size_t n_samples, unsigned int output_sample_rate) {
-		size_t samples_available, samples_until_wrap;
-
-        fifo_lock(&decode_audio->effect_fifo);
-
-        samples_available = fifo_bytes_used(&decode_audio->effect_fifo) / sizeof(effect_t);
-
-        /* shortcut the common case */
-        if (samples_available == 0
-#ifdef RESAMPLE_EFFECTS
-        		&& !(resampler && jive_resampler_has_samples(resampler, 0))
-#endif
-			)
-        {
-                fifo_unlock(&decode_audio->effect_fifo);
-                return 0;
-        }
-
-        samples_until_wrap = fifo_bytes_until_rptr_wrap(&decode_audio->effect_fifo) / sizeof(effect_t);
-        if (samples_until_wrap < samples_available) {
-        	samples_available = samples_until_wrap;
-        }
-
-
-#ifdef RESAMPLE_EFFECTS
-       if (output_sample_rate != EFFECTS_SAMPLE_RATE) {
-                spx_uint32_t in_samples;
-                spx_uint32_t out_samples;
-                int err;
-
-                if (!resampler) {
-                        resampler = jive_resampler_init(1, EFFECTS_SAMPLE_RATE, output_sample_rate, EFFECTS_RESAMPLE_QUALITY, &err);
-                } else {
-                        spx_uint32_t in_rate, out_rate;
-                        jive_resampler_get_rate(resampler, &in_rate, &out_rate);
-                        if (out_rate != output_sample_rate) {
-                                jive_resampler_reset_mem(resampler);
-                                jive_resampler_set_rate(resampler, EFFECTS_SAMPLE_RATE, output_sample_rate);
-                        }
-                }
-
-                in_samples = samples_available;
-                out_samples = n_samples;
-
-                jive_resampler_process_int(resampler, 0,
-                        (spx_int16_t *)(effect_t *)(void *)(effect_fifo_buf + decode_audio->effect_fifo.rptr),
-                        &in_samples,
-                        output_samples_buf, &out_samples);
-
-                fifo_rptr_incby(&decode_audio->effect_fifo, in_samples * sizeof(effect_t));
-
-                n_samples = out_samples;
-        }
-#else
-        if (0) {}
-#endif
-        else {          /* no resampling */
-                if (n_samples > samples_available) {
-                        n_samples = samples_available;
-                }
-                memcpy(output_samples_buf,
-                                effect_fifo_buf + decode_audio->effect_fifo.rptr,
-                                n_samples * sizeof(effect_t));
-                fifo_rptr_incby(&decode_audio->effect_fifo, n_samples * sizeof(effect_t));
-        }
-
-        fifo_unlock(&decode_audio->effect_fifo);
-
-        return n_samples;
-}
-
 /*
- * This function is called by to copy effects to the audio buffer.
+ * This function is called by to copy effects to the audio buffer. The
+ * effects are resampled to the output rate and mixed before they are
+ * queued, so this only has to add them to the output.
  */
 void decode_mix_effects(void *outputBuffer,
 			size_t framesPerBuffer,
 			int sample_width,
 			int output_sample_rate)
 {
-	effect_t effects_buffer[EFFECT_FIFO_SIZE]; /* pretty arbitrary size */
-	int effects_frames;
+	size_t effects_frames, wrap_frames;
+	effect_t *effect_ptr;
+	fft_fixed effect_gain;
+	size_t i;
+	s32_t s;
+
+	fifo_lock(&decode_audio->effect_fifo);
+
+	/* the queued effects are at the old rate, they are dropped and
+	 * the sample code stops any voices still playing at that rate */
+	if (decode_audio->effect_rate != (u32_t)output_sample_rate) {
+		decode_audio->effect_rate = output_sample_rate;
+		decode_audio->effect_fifo.rptr = decode_audio->effect_fifo.wptr;
+
+		fifo_unlock(&decode_audio->effect_fifo);
+		return;
+	}
 
-	for ( ;
-			framesPerBuffer > 0 &&
-				(effects_frames = get_effects_samples(effects_buffer, framesPerBuffer, output_sample_rate)) > 0;
-			framesPerBuffer -= effects_frames)
-	{
-		effect_t *effect_ptr;
-		int i;
-		s32_t s;
+	effect_gain = decode_audio->effect_gain;
 
-		effect_ptr = effects_buffer;
+	while (framesPerBuffer > 0) {
+		effects_frames = fifo_bytes_used(&decode_audio->effect_fifo) / sizeof(effect_t);
+		if (effects_frames == 0) {
+			break;
+		}
+
+		wrap_frames = fifo_bytes_until_rptr_wrap(&decode_audio->effect_fifo) / sizeof(effect_t);
+		if (effects_frames > wrap_frames) {
+			effects_frames = wrap_frames;
+		}
+		if (effects_frames > framesPerBuffer) {
+			effects_frames = framesPerBuffer;
+		}
+
+		effect_ptr = (effect_t *)(void *)(effect_fifo_buf + decode_audio->effect_fifo.rptr);
 
 		if (sample_width == 24) {
 			s32_t *output_ptr  = (sample_t *)outputBuffer;
 
 			for (i=0; i < effects_frames; i++) {
 				s = (*effect_ptr++) << 8;
-				s = fixed_mul(decode_audio->effect_gain, s);
+				s = fixed_mul(effect_gain, s);
 
 				*output_ptr = sample_clip(*output_ptr, s);
 				output_ptr++;
@@ -205,7 +298,7 @@ void decode_mix_effects(void *outputBuffer,
 
 			for (i=0; i < effects_frames; i++) {
 				s = (*effect_ptr++) << 8;
-				s = fixed_mul(decode_audio->effect_gain, s);
+				s = fixed_mul(effect_gain, s);
 
 				*output_ptr = s16_clip(*output_ptr, s >> 8);
 				output_ptr++;
@@ -216,6 +309,10 @@ void decode_mix_effects(void *outputBuffer,
 
 			outputBuffer = output_ptr;
 		}
+
+		fifo_rptr_incby(&decode_audio->effect_fifo, effects_frames * sizeof(effect_t));
+		framesPerBuffer -= effects_frames;
 	}
-}
 
+	fifo_unlock(&decode_audio->effect_fifo);
+}
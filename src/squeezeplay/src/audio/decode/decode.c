@@ -11,6 +11,9 @@
 #include "audio/streambuf.h"
 #include "audio/decode/decode.h"
 #include "audio/decode/decode_priv.h"
+#ifndef _WIN32
+#include "audio/mp4.h"
+#endif
 
 
 #ifdef WITH_SPPRIVATE
@@ -18,12 +21,17 @@ extern int luaopen_spprivate(lua_State *L);
 #endif
 
 #define DECODE_MAX_INTERVAL 500
-#define DECODE_WAIT_INTERVAL 100
+
+/* how often the decode thread wakeup rate is sampled */
+#define DECODE_WAKEUP_PERIOD 60000
 
 #define DECODE_MQUEUE_SIZE 512
 
 #define DECODE_METADATA_SIZE 128
 
+/* refresh the status page if the output has not published for this long */
+#define DECODE_STATUS_PAGE_STALE 100
+
 /* loggers */
 LOG_CATEGORY *log_audio_decode;
 LOG_CATEGORY *log_audio_codec;
@@ -41,6 +49,9 @@ int decode_watchdog = -1;
 
 /* state variables for the current track */
 bool_t decode_first_buffer = FALSE;
+u32_t decode_output_count = 0;
+u32_t decode_start_jiffies = 0;
+u32_t decode_start_latency = 0;
 
 
 /* decoder fifo used to store decoded samples */
@@ -61,6 +72,27 @@ static u8_t *wma_guid;
 
 static bool_t trigger_resume = FALSE;
 
+static u32_t status_page_refreshes = 0;
+
+
+/* decode thread wakeups, by cause */
+enum decode_wakeup {
+	DECODE_WAKEUP_REQUEST = 0,
+	DECODE_WAKEUP_OUTPUT,
+	DECODE_WAKEUP_STREAM,
+	DECODE_WAKEUP_TIMEOUT,
+	DECODE_WAKEUP_MAX
+};
+
+static u32_t decode_wakeups[DECODE_WAKEUP_MAX];
+static u32_t decode_wakeups_last_period = 0;
+static u32_t decode_wakeups_period_start = 0;
+static u32_t decode_wakeups_period_jiffies = 0;
+
+/* stream bytes the decode thread is waiting for, protected by the
+ * audio fifo lock */
+volatile size_t decode_wait_stream_bytes = 0;
+
 
 /* audio instance */
 struct decode_audio *decode_audio;
@@ -70,6 +102,24 @@ struct decode_audio *decode_audio;
 static struct decode_module *decoder;
 static void *decoder_data;
 
+/* decoder instance kept from the last track, for reuse */
+static struct decode_module *idle_decoder;
+static void *idle_decoder_data;
+
+static u32_t decoder_starts = 0;
+static u32_t decoder_reuses = 0;
+
+/* parameters of a strm-s */
+struct decode_start_params {
+	Uint32 decoder_id, transition_type, transition_period, replay_gain;
+	Uint32 output_threshold, polarity_inversion, output_channels;
+	Uint32 num_params;
+	Uint8 params[DECODER_MAX_PARAMS];
+};
+
+/* the next track, started when the current track has been decoded */
+static struct decode_start_params next_start;
+static bool_t next_start_pending = FALSE;
 
 
 /* installed decoders */
@@ -113,6 +163,32 @@ static inline void debug_fullness(void)
 }
 
 
+/*
+ * Finish with the current decoder. If the decoder can be reset it is kept
+ * for the next track, replacing any decoder that was kept before.
+ */
+static void decode_release_decoder(void) {
+	if (!decoder) {
+		return;
+	}
+
+	if (decoder->reset) {
+		if (idle_decoder) {
+			idle_decoder->stop(idle_decoder_data);
+		}
+
+		idle_decoder = decoder;
+		idle_decoder_data = decoder_data;
+	}
+	else {
+		decoder->stop(decoder_data);
+	}
+
+	decoder = NULL;
+	decoder_data = NULL;
+}
+
+
 static void decode_resume_decoder_handler(void) {
 	mqueue_read_complete(&decode_mqueue);
 
@@ -139,6 +215,8 @@ static void decode_resume_audio_handler(void) {
 		decode_audio->f->resume();
 	}
 
+	decode_status_page_update();
+
 	decode_audio_unlock();
 
 	LOG_DEBUG(log_audio_decode, "resume_audio decode state: %x audio state %x", current_decoder_state, decode_audio->state);
@@ -164,6 +242,8 @@ static void decode_pause_audio_handler(void) {
 		}
 	}
 
+	decode_status_page_update();
+
 	decode_audio_unlock();
 
 	LOG_DEBUG(log_audio_decode, "pause_audio decode state: %x audio state %x", current_decoder_state, decode_audio->state);
@@ -172,6 +252,7 @@ static void decode_pause_audio_handler(void) {
 
 static void decode_skip_ahead_handler(void) {
 	Uint32 interval;
+	u32_t frames, used, skipped;
 
 	interval = mqueue_read_u32(&decode_mqueue);
 	mqueue_read_complete(&decode_mqueue);
@@ -182,6 +263,34 @@ static void decode_skip_ahead_handler(void) {
 
 	decode_audio->skip_ahead_bytes = SAMPLES_TO_BYTES((u32_t)((interval * decode_audio->track_sample_rate) / 1000));
 
+	/* the output drops the decoded samples, if the skip goes past those
+	 * the decoder can seek over the rest of the stream */
+	frames = BYTES_TO_SAMPLES(decode_audio->skip_ahead_bytes);
+	used = BYTES_TO_SAMPLES(fifo_bytes_used(&decode_audio->fifo));
+
+	decode_audio_unlock();
+
+	if (!decoder || !decoder->skip || !decoder_data || frames <= used) {
+		return;
+	}
+
+	skipped = decoder->skip(decoder_data, frames - used);
+	if (!skipped) {
+		return;
+	}
+
+	LOG_DEBUG(log_audio_decode, "decoder skipped %u of %u frames", skipped, frames);
+
+	decode_audio_lock();
+
+	if (SAMPLES_TO_BYTES(skipped) < decode_audio->skip_ahead_bytes) {
+		decode_audio->skip_ahead_bytes -= SAMPLES_TO_BYTES(skipped);
+	}
+	else {
+		decode_audio->skip_ahead_bytes = 0;
+	}
+	decode_audio->elapsed_samples += skipped;
+
 	decode_audio_unlock();
 }
 
@@ -196,17 +305,15 @@ static void decode_stop_handler(void) {
 	current_decoder_state = 0;
 	decode_audio->state = 0;
 
-	if (decoder) {
-		decoder->stop(decoder_data);
-
-		decoder = NULL;
-		decoder_data = NULL;
-	}
+	decode_release_decoder();
+	next_start_pending = FALSE;
 
 	decode_audio->num_tracks_started = 0;
 	decode_first_buffer = FALSE;
 	decode_output_end();
 
+	decode_status_page_update();
+
 	decode_audio_unlock();
 }
 
@@ -220,79 +327,132 @@ static void decode_flush_handler(void) {
 
 	current_decoder_state = 0;
 
-	if (decoder) {
-		decoder->stop(decoder_data);
-
-		decoder = NULL;
-		decoder_data = NULL;
-	}
+	decode_release_decoder();
+	next_start_pending = FALSE;
 
 	decode_first_buffer = FALSE;
 	decode_output_flush();
 
+	decode_status_page_update();
+
 	decode_audio_unlock();
 }
 
 
-static void decode_start_handler(void) {
-	Uint32 decoder_id, transition_type, transition_period, replay_gain;
-	Uint32 output_threshold, polarity_inversion, output_channels;
-	Uint32 i, num_params;
-	Uint8 params[DECODER_MAX_PARAMS];
+static void decode_read_start_params(struct decode_start_params *p) {
+	Uint32 i;
 
-	decoder_id = mqueue_read_u32(&decode_mqueue);
-	transition_type = mqueue_read_u32(&decode_mqueue);
-	transition_period = mqueue_read_u32(&decode_mqueue);
-	replay_gain = mqueue_read_u32(&decode_mqueue);
-	output_threshold = mqueue_read_u32(&decode_mqueue);
-	polarity_inversion = mqueue_read_u32(&decode_mqueue);
-	output_channels = mqueue_read_u32(&decode_mqueue);
+	p->decoder_id = mqueue_read_u32(&decode_mqueue);
+	p->transition_type = mqueue_read_u32(&decode_mqueue);
+	p->transition_period = mqueue_read_u32(&decode_mqueue);
+	p->replay_gain = mqueue_read_u32(&decode_mqueue);
+	p->output_threshold = mqueue_read_u32(&decode_mqueue);
+	p->polarity_inversion = mqueue_read_u32(&decode_mqueue);
+	p->output_channels = mqueue_read_u32(&decode_mqueue);
 
-	num_params = mqueue_read_u32(&decode_mqueue);
-	if (num_params > DECODER_MAX_PARAMS) {
-		num_params = DECODER_MAX_PARAMS;
+	p->num_params = mqueue_read_u32(&decode_mqueue);
+	if (p->num_params > DECODER_MAX_PARAMS) {
+		p->num_params = DECODER_MAX_PARAMS;
 	}
-	for (i = 0; i < num_params; i++) {
-		params[i] = mqueue_read_u8(&decode_mqueue);
+	for (i = 0; i < p->num_params; i++) {
+		p->params[i] = mqueue_read_u8(&decode_mqueue);
 	}
 	mqueue_read_complete(&decode_mqueue);
+}
 
-	if (decoder) {
-		decoder->stop(decoder_data);
 
-		decoder = NULL;
-		decoder_data = NULL;
-	}
+static void decode_start_track(struct decode_start_params *p) {
+	Uint32 i;
+
+	decode_release_decoder();
 
 	for (i=0; i<(sizeof(all_decoders)/sizeof(struct decode_module *)); i++) {
-		if (all_decoders[i]->id == decoder_id) {
+		if (all_decoders[i]->id == p->decoder_id) {
 			decoder = all_decoders[i];
 			break;
 		}
 	}
 
 	if (!decoder) {
-		LOG_ERROR(log_audio_decode, "unknown decoder %x\n", decoder_id);
+		LOG_ERROR(log_audio_decode, "unknown decoder %x\n", p->decoder_id);
 		return;
 	}
 
-	LOG_INFO(log_audio_decode, "init decoder %s", decoder->name);
+	decode_start_jiffies = jive_jiffies();
+	decoder_starts++;
+
+	if (idle_decoder == decoder) {
+		if (decoder->reset(idle_decoder_data, p->params, p->num_params)) {
+			decoder_data = idle_decoder_data;
+			decoder_reuses++;
+		}
+		else {
+			decoder->stop(idle_decoder_data);
+		}
+
+		idle_decoder = NULL;
+		idle_decoder_data = NULL;
+	}
+
+	LOG_INFO(log_audio_decode, "init decoder %s%s", decoder->name, decoder_data ? " (reused)" : "");
 
 	decode_first_buffer = TRUE;
-	decode_output_set_transition(transition_type, transition_period);
-	decode_output_set_track_gain(replay_gain);
-	decode_set_track_polarity_inversion(polarity_inversion);
-	decode_set_output_channels(output_channels);
+	decode_output_set_transition(p->transition_type, p->transition_period);
+	decode_output_set_track_gain(p->replay_gain);
+	decode_set_track_polarity_inversion(p->polarity_inversion);
+	decode_set_output_channels(p->output_channels);
 
-	decoder_data = decoder->start(params, num_params);
+	if (!decoder_data) {
+		decoder_data = decoder->start(p->params, p->num_params);
+	}
 
 	decode_audio_lock();
-	decode_audio->output_threshold = output_threshold;
+	decode_audio->output_threshold = p->output_threshold;
 	decode_output_begin();
 	decode_audio_unlock();
 }
 
 
+/*
+ * Start the next track, its samples follow the current track's in the
+ * decode fifo. The decoder keeps running without waiting for the server.
+ */
+static void decode_start_next_track(void) {
+	LOG_DEBUG(log_audio_decode, "decode_start_next_track");
+
+	streambuf_next_track();
+
+	next_start_pending = FALSE;
+	decode_start_track(&next_start);
+
+	current_decoder_state = DECODE_STATE_RUNNING;
+}
+
+
+static void decode_start_handler(void) {
+	struct decode_start_params p;
+
+	decode_read_start_params(&p);
+
+	next_start_pending = FALSE;
+	decode_start_track(&p);
+}
+
+
+static void decode_start_next_handler(void) {
+	decode_read_start_params(&next_start);
+
+	LOG_DEBUG(log_audio_decode, "decode_start_next_handler");
+
+	next_start_pending = TRUE;
+
+	if (!decoder) {
+		/* the current track has already ended */
+		decode_start_next_track();
+	}
+}
+
+
 static void decode_capture_handler(void) {
 	Uint32 loopback;
 
@@ -324,59 +484,139 @@ static void decode_song_ended_handler(void) {
 
 	decode_output_song_ended();
 
-	if (decoder) {
-		decoder->stop(decoder_data);
+	decode_release_decoder();
+
+	decode_audio_unlock();
+
+	if (next_start_pending) {
+		decode_start_next_track();
+	}
+}
+
+
+/*
+ * Called by the stream with the audio fifo unlocked, after new data has
+ * arrived or the stream has ended.
+ */
+void decode_wake_stream(void) {
+	if (!decode_audio) {
+		return;
+	}
+
+	decode_audio_lock();
 
-		decoder = NULL;
-		decoder_data = NULL;
+	if (decode_wait_stream_bytes) {
+		decode_wait_stream_bytes = 0;
+		fifo_signal(&decode_audio->fifo);
 	}
 
 	decode_audio_unlock();
 }
 
 
-/* returns true if decode can run */
-static bool_t decode_timer_interval(u32_t *delay) {
-	size_t free_bytes, used_bytes, max_samples;
-	u32_t state, sample_rate;
+static void decode_count_wakeup(enum decode_wakeup cause) {
+	u32_t now, total;
+	int i;
 
-	if (!decoder || (current_decoder_state & (DECODE_STATE_RUNNING|DECODE_STATE_ERROR)) != DECODE_STATE_RUNNING) {
-		*delay = DECODE_MAX_INTERVAL;
+	decode_wakeups[cause]++;
 
-		return false;
+	now = jive_jiffies();
+	if (now - decode_wakeups_period_jiffies < DECODE_WAKEUP_PERIOD) {
+		return;
 	}
 
-	/* Small delay if the stream empty but still streaming? */
-	/* special case for flac as it has a minimum number of bytes before the decoder processes anything */
-	if (streambuf_would_wait_for(decoder == &decode_flac ? DECODE_MINIMUM_BYTES_FLAC : DECODE_MINIMUM_BYTES_OTHER)) {
-		*delay = DECODE_WAIT_INTERVAL;
-		
-		return false;
+	total = 0;
+	for (i=0; i<DECODE_WAKEUP_MAX; i++) {
+		total += decode_wakeups[i];
 	}
 
-	/* Variable delay based on output buffer fullness */
-	max_samples = decoder->samples(decoder_data);
+	decode_wakeups_last_period = total - decode_wakeups_period_start;
+	decode_wakeups_period_start = total;
+	decode_wakeups_period_jiffies = now;
+
+	LOG_DEBUG(log_audio_decode, "decode wakeups %u/min request:%u output:%u stream:%u timeout:%u",
+		  decode_wakeups_last_period,
+		  decode_wakeups[DECODE_WAKEUP_REQUEST],
+		  decode_wakeups[DECODE_WAKEUP_OUTPUT],
+		  decode_wakeups[DECODE_WAKEUP_STREAM],
+		  decode_wakeups[DECODE_WAKEUP_TIMEOUT]);
+}
+
+
+/*
+ * Returns true if decode can run, otherwise blocks on the audio fifo
+ * until there may be work to do. The decoder runs until the output fifo is
+ * above the high watermark (less than one decoder buffer free), it then
+ * sleeps until the output has drained to the low watermark, a request is
+ * queued, or the stream has the data the decoder is waiting for.
+ */
+static bool_t decode_wait_for_work(void) {
+	size_t free_bytes, min_bytes, max_samples = 0;
+	bool_t running, wait_output = FALSE, wait_stream = FALSE;
+	enum decode_wakeup cause = DECODE_WAKEUP_MAX;
+
+	running = decoder && (current_decoder_state & (DECODE_STATE_RUNNING|DECODE_STATE_ERROR)) == DECODE_STATE_RUNNING;
+	if (running) {
+		max_samples = decoder->samples(decoder_data);
+	}
+
+	/* special case for flac as it has a minimum number of bytes before the decoder processes anything */
+	min_bytes = (decoder == &decode_flac) ? DECODE_MINIMUM_BYTES_FLAC : DECODE_MINIMUM_BYTES_OTHER;
 
 	decode_audio_lock();
-	state = decode_audio->state;
-	sample_rate = decode_audio->track_sample_rate;
-	free_bytes = fifo_bytes_free(&decode_audio->fifo);
-	used_bytes = fifo_bytes_used(&decode_audio->fifo);
-	decode_audio_unlock();
 
-	if (SAMPLES_TO_BYTES(max_samples) < free_bytes) {
-		*delay = 0;
+	if (running) {
+		/* set before checking the stream, data arriving meanwhile
+		 * clears it and signals the fifo */
+		decode_wait_stream_bytes = min_bytes;
 
-		return true;
+		if (streambuf_would_wait_for(min_bytes)) {
+			wait_stream = TRUE;
+		}
+		else {
+			decode_wait_stream_bytes = 0;
+
+			free_bytes = fifo_bytes_free(&decode_audio->fifo);
+			if (SAMPLES_TO_BYTES(max_samples) < free_bytes) {
+				decode_audio_unlock();
+				return true;
+			}
+
+			decode_audio->low_watermark = DECODE_LOW_WATERMARK;
+			decode_audio->decode_waiting = TRUE;
+			wait_output = TRUE;
+		}
+	}
+
+	/* requests are signalled on the audio fifo too, but may have been
+	 * queued before we took the lock */
+	if (mqueue_is_empty(&decode_mqueue)) {
+		fifo_wait_timeout(&decode_audio->fifo, DECODE_MAX_INTERVAL);
+
+		if (!mqueue_is_empty(&decode_mqueue)) {
+			cause = DECODE_WAKEUP_REQUEST;
+		}
+		else if (wait_output && !decode_audio->decode_waiting) {
+			cause = DECODE_WAKEUP_OUTPUT;
+		}
+		else if (wait_stream && !decode_wait_stream_bytes) {
+			cause = DECODE_WAKEUP_STREAM;
+		}
+		else {
+			cause = DECODE_WAKEUP_TIMEOUT;
+		}
 	}
-	else {
-		*delay = ((max_samples * 1000) / sample_rate) + 1; /* ms */
 
-		/* don't decode for every buffer, do it every other one */
-		*delay *= 2;
+	decode_wait_stream_bytes = 0;
+	decode_audio->decode_waiting = FALSE;
 
-		return false;
+	decode_audio_unlock();
+
+	if (cause != DECODE_WAKEUP_MAX) {
+		decode_count_wakeup(cause);
 	}
+
+	return false;
 }
 
 
@@ -396,26 +636,42 @@ static int decode_thread_execute(void *unused) {
 
 	while (true) {
 		mqueue_func_t handler;
-		u32_t delay;
 		bool_t can_decode;
 
 		/* XXXX 30 seconds for testing */
 		watchdog_keepalive(decode_watchdog, 3);
 
-		can_decode = decode_timer_interval(&delay);
-		while ((handler = mqueue_read_request(&decode_mqueue, delay))) {
+		while ((handler = mqueue_read_request(&decode_mqueue, 0))) {
 			// for debugging race conditions
 			//sleep(2);
 
 			handler();
-
-			can_decode = decode_timer_interval(&delay);
 		}
 
+		can_decode = decode_wait_for_work();
+
 		if (can_decode && decoder
 		    && (current_decoder_state & DECODE_STATE_RUNNING)) {
+			u32_t output_count = decode_output_count;
+
 			decoder->callback(decoder_data);
 
+			/* Switch to the next track when the decoder has no
+			 * more output for the current track.
+			 */
+			if (next_start_pending
+			    && ((current_decoder_state & DECODE_STATE_ERROR)
+				|| ((current_decoder_state & DECODE_STATE_UNDERRUN)
+				    && output_count == decode_output_count
+				    && streambuf_at_next()))) {
+				decode_audio_lock();
+				decode_output_song_ended();
+				decode_release_decoder();
+				decode_audio_unlock();
+
+				decode_start_next_track();
+			}
+
 			/* Additional debugging enabled with an environment
 			 * variable, used to track decoder performance.
 			 */
@@ -664,14 +920,20 @@ static int decode_stop(lua_State *L) {
 
 	LOG_DEBUG(log_audio_decode, "decode_stop");
 
-	if (mqueue_write_request(&decode_mqueue, decode_stop_handler, 0)) {
-		decode_audio_lock();
-		decode_audio->state |= DECODE_STATE_STOPPING;
-		decode_audio_unlock();
+	/* set before queueing the request, the audio fifo must not be
+	 * locked while the queue is locked */
+	decode_audio_lock();
+	decode_audio->state |= DECODE_STATE_STOPPING;
+	decode_audio_unlock();
 
+	if (mqueue_write_request(&decode_mqueue, decode_stop_handler, 0)) {
 		mqueue_write_complete(&decode_mqueue);
 	}
 	else {
+		decode_audio_lock();
+		decode_audio->state &= ~DECODE_STATE_STOPPING;
+		decode_audio_unlock();
+
 		LOG_DEBUG(log_audio_decode, "Full message queue, dropped stop message");
 	}
 
@@ -697,11 +959,9 @@ static int decode_flush(lua_State *L) {
 }
 
 
-static int decode_start(lua_State *L) {
+static void decode_write_start(lua_State *L, mqueue_func_t handler) {
 	int num_params, i;
 
-	LOG_DEBUG(log_audio_decode, "decode_start");
-
 	/* stack is:
 	 * 1: self
 	 * 2: decoder
@@ -714,13 +974,7 @@ static int decode_start(lua_State *L) {
 	 * 9: params...
 	 */
 
-	/* Reset the decoder state in calling thread to avoid potential
-	 * race condition - we may incorrectly report a decoder underrun
-	 * if we wait till the decoder thread resets it.
-	 */
-	current_decoder_state = 0;
-
-	if (mqueue_write_request(&decode_mqueue, decode_start_handler, 0)) {
+	if (mqueue_write_request(&decode_mqueue, handler, 0)) {
 		mqueue_write_u32(&decode_mqueue, (Uint32) luaL_optinteger(L, 2, 0)); /* decoder */
 		mqueue_write_u32(&decode_mqueue, (Uint32) luaL_optinteger(L, 3, 0)); /* transition_type */
 		mqueue_write_u32(&decode_mqueue, (Uint32) luaL_optinteger(L, 4, 0)); /* transition_period */
@@ -739,6 +993,33 @@ static int decode_start(lua_State *L) {
 	else {
 		LOG_DEBUG(log_audio_decode, "Full message queue, dropped start message");
 	}
+}
+
+
+static int decode_start(lua_State *L) {
+	LOG_DEBUG(log_audio_decode, "decode_start");
+
+	/* Reset the decoder state in calling thread to avoid potential
+	 * race condition - we may incorrectly report a decoder underrun
+	 * if we wait till the decoder thread resets it.
+	 */
+	current_decoder_state = 0;
+
+	decode_write_start(L, decode_start_handler);
+
+	return 0;
+}
+
+
+/*
+ * Start the next track once the current track has been decoded, the
+ * arguments are the same as for start. The streambuf must be marked with
+ * Stream:markNext() before the next track's stream is connected.
+ */
+static int decode_start_next(lua_State *L) {
+	LOG_DEBUG(log_audio_decode, "decode_start_next");
+
+	decode_write_start(L, decode_start_next_handler);
 
 	return 0;
 }
@@ -786,6 +1067,7 @@ static int decode_song_ended(lua_State *L) {
 
 
 static int decode_status(lua_State *L) {
+	struct decode_status_page page;
 	size_t size, usedbytes;
 	u32_t bytesL, bytesH, elapsed_jiffies;
 	u64_t elapsed, output;
@@ -794,19 +1076,32 @@ static int decode_status(lua_State *L) {
 		return 0;
 	}
 
-	lua_newtable(L);
+	elapsed_jiffies = jive_jiffies();
 
-	decode_audio_lock();
+	/* the status page is published by the output each period, only
+	 * take the lock if the output is not running to refresh it.
+	 */
+	if (!decode_status_page_read(&page)
+		|| (s32_t)(elapsed_jiffies - page.update_jiffies) > DECODE_STATUS_PAGE_STALE) {
+		decode_audio_lock();
+		decode_status_page_update();
+		decode_status_page_read(&page);
+		decode_audio_unlock();
+
+		status_page_refreshes++;
+	}
 
-	lua_pushinteger(L, fifo_bytes_used(&decode_audio->fifo));
+	lua_newtable(L);
+
+	lua_pushinteger(L, page.output_full);
 	lua_setfield(L, -2, "outputFull");
 
-	lua_pushinteger(L, decode_audio->fifo.size);
+	lua_pushinteger(L, page.output_size);
 	lua_setfield(L, -2, "outputSize");
 
-	if (decode_audio->track_sample_rate) {
-		output = fifo_bytes_used(&decode_audio->fifo);
-		output = (BYTES_TO_SAMPLES(output) * 1000) / decode_audio->track_sample_rate;
+	if (page.track_sample_rate) {
+		output = page.output_full;
+		output = (BYTES_TO_SAMPLES(output) * 1000) / page.track_sample_rate;
 	}
 	else {
 		output = 0;
@@ -814,26 +1109,24 @@ static int decode_status(lua_State *L) {
 	lua_pushinteger(L, (u32_t)output);
 	lua_setfield(L, -2, "outputTime");
 
-	elapsed_jiffies = jive_jiffies();
-
-	if (decode_audio->track_sample_rate) {
-		if (decode_audio->sync_elapsed_timestamp) {
+	if (page.track_sample_rate) {
+		if (page.sync_elapsed_timestamp) {
 			/* elapsed is sync adjusted */
-			elapsed = decode_audio->sync_elapsed_samples;
+			elapsed = page.sync_elapsed_samples;
 
 		}
 		else {
 			/* no sync adjustment */
-			elapsed = decode_audio->elapsed_samples;
+			elapsed = page.elapsed_samples;
 		}
 
-		elapsed = (elapsed * 1000) / decode_audio->track_sample_rate;
+		elapsed = (elapsed * 1000) / page.track_sample_rate;
 
-		if ((decode_audio->state & DECODE_STATE_RUNNING) &&
-			decode_audio->sync_elapsed_timestamp &&
-			elapsed_jiffies > decode_audio->sync_elapsed_timestamp)
+		if ((page.state & DECODE_STATE_RUNNING) &&
+			page.sync_elapsed_timestamp &&
+			elapsed_jiffies > page.sync_elapsed_timestamp)
 		{
-			elapsed += (elapsed_jiffies - decode_audio->sync_elapsed_timestamp);
+			elapsed += (elapsed_jiffies - page.sync_elapsed_timestamp);
 		}
 	}
 	else {
@@ -845,7 +1138,7 @@ static int decode_status(lua_State *L) {
 	lua_pushinteger(L, elapsed_jiffies);
 	lua_setfield(L, -2, "elapsed_jiffies");
 	
-	lua_pushinteger(L, decode_audio->num_tracks_started);
+	lua_pushinteger(L, page.num_tracks_started);
 	lua_setfield(L, -2, "tracksStarted");
 
 	if (decoder) {
@@ -853,21 +1146,77 @@ static int decode_status(lua_State *L) {
 		lua_setfield(L, -2, "decoder");
 	}
 
-	lua_pushinteger(L, decode_audio->state);
+	lua_pushinteger(L, page.state);
 	lua_setfield(L, -2, "audioState");
 
+	lua_pushinteger(L, page.clock_drift);
+	lua_setfield(L, -2, "clockDrift");
+
+	lua_pushinteger(L, page.clock_correction);
+	lua_setfield(L, -2, "clockCorrection");
+
+	lua_pushinteger(L, page.updates);
+	lua_setfield(L, -2, "statusUpdates");
+
+	lua_pushinteger(L, status_page_refreshes);
+	lua_setfield(L, -2, "statusRefreshes");
+
+	lua_pushinteger(L, decode_wakeups_last_period);
+	lua_setfield(L, -2, "decodeWakeups");
+
+	lua_pushinteger(L, decode_wakeups[DECODE_WAKEUP_REQUEST]);
+	lua_setfield(L, -2, "decodeWakeupsRequest");
+
+	lua_pushinteger(L, decode_wakeups[DECODE_WAKEUP_OUTPUT]);
+	lua_setfield(L, -2, "decodeWakeupsOutput");
+
+	lua_pushinteger(L, decode_wakeups[DECODE_WAKEUP_STREAM]);
+	lua_setfield(L, -2, "decodeWakeupsStream");
+
+	lua_pushinteger(L, decode_wakeups[DECODE_WAKEUP_TIMEOUT]);
+	lua_setfield(L, -2, "decodeWakeupsTimeout");
+
+	lua_pushinteger(L, decode_start_latency);
+	lua_setfield(L, -2, "startLatency");
+
+	lua_pushinteger(L, decoder_starts);
+	lua_setfield(L, -2, "decoderStarts");
+
+	lua_pushinteger(L, decoder_reuses);
+	lua_setfield(L, -2, "decoderReuses");
+
+#ifndef _WIN32
+	/* mp4 sample tables and in-stream seeks */
+	lua_pushinteger(L, mp4_stats.table_bytes);
+	lua_setfield(L, -2, "mp4TableBytes");
+
+	lua_pushinteger(L, mp4_stats.flat_bytes);
+	lua_setfield(L, -2, "mp4FlatBytes");
+
+	lua_pushinteger(L, mp4_stats.seeks);
+	lua_setfield(L, -2, "mp4Seeks");
+
+	lua_pushinteger(L, mp4_stats.seek_failed);
+	lua_setfield(L, -2, "mp4SeekFailed");
+
+	lua_pushinteger(L, mp4_stats.seek_time);
+	lua_setfield(L, -2, "mp4SeekTime");
+
+	lua_pushinteger(L, mp4_stats.seek_time_max);
+	lua_setfield(L, -2, "mp4SeekTimeMax");
+#endif
+
 	// Allow a decoder to trigger audio to resume. This is
 	// needed to resume Spotify after rebuffering earlier than
 	// the server would normally resume
 	if (trigger_resume) {
+		decode_audio_lock();
 		lua_pushinteger(L, 1);
 		lua_setfield(L, -2, "triggerResume");
 		trigger_resume = FALSE;
+		decode_audio_unlock();
 	}
 
-	decode_audio_unlock();
-
-
 	streambuf_get_status(&size, &usedbytes, &bytesL, &bytesH);
 
 	lua_pushinteger(L, size);
@@ -1043,8 +1392,9 @@ static int decode_audio_open(lua_State *L) {
 
 	decode_audio->f = f;
 
-	/* start decoder thread */
+	/* start decoder thread, requests also wake it from the audio fifo */
 	mqueue_init(&decode_mqueue, decode_mqueue_buffer, sizeof(decode_mqueue_buffer));
+	decode_mqueue.wake = &decode_audio->fifo;
 	mqueue_init(&metadata_mqueue, metadata_mqueue_buffer, sizeof(metadata_mqueue_buffer));
 
 	decode_thread = SDL_CreateThread(decode_thread_execute, NULL);
@@ -1064,6 +1414,7 @@ static const struct luaL_Reg decode_f[] = {
 	{ "stop", decode_stop },
 	{ "flush", decode_flush },
 	{ "start", decode_start },
+	{ "startNext", decode_start_next },
 	{ "capture", decode_capture },
 	{ "songEnded", decode_song_ended },
 	{ "status", decode_status },
@@ -1073,8 +1424,11 @@ static const struct luaL_Reg decode_f[] = {
 	{ "audioGain", decode_audio_gain },
 	{ "captureGain", decode_capture_gain },
 	{ "vumeter", decode_vumeter },
+	{ "vumeter_draw", decode_vumeter_draw },
 	{ "spectrum_init", decode_spectrum_init },
+	{ "spectrum_layout", decode_spectrum_layout },
 	{ "spectrum", decode_spectrum },
+	{ "spectrum_draw", decode_spectrum_draw },
 	{ NULL, NULL }
 };
 
@@ -32,6 +32,7 @@ struct decode_alac {
 	/* stream info */
 	int sample_rate;
 	int num_channels;
+	u32_t frame_length;	/* frames per packet */
 
 	/* buffers */
 	sample_t *output_buffer;
@@ -85,6 +86,12 @@ static bool_t decode_alac_callback(void *data) {
 		self->sample_rate = self->alacdec.samplerate;
 		self->num_channels = self->alacdec.channels;
 
+		/* alac specific config: size, 'alac', version, frame length */
+		self->frame_length = ((u8_t *)self->alacdec.extradata)[12] << 24
+			| ((u8_t *)self->alacdec.extradata)[13] << 16
+			| ((u8_t *)self->alacdec.extradata)[14] << 8
+			| ((u8_t *)self->alacdec.extradata)[15];
+
 		LOG_INFO(log_audio_codec, "sample_rate=%d channels=%d", self->sample_rate, self->num_channels);
 		self->init = TRUE;
 	}
@@ -221,6 +228,30 @@ static size_t decode_alac_samples(void *data) {
 }
 
 
+/* seek over whole packets, the rest is skipped by the output */
+static u32_t decode_alac_skip(void *data, u32_t frames) {
+	struct decode_alac *self = (struct decode_alac *) data;
+	u32_t packets;
+
+	if (!self->init || !self->frame_length) {
+		return 0;
+	}
+
+	packets = frames / self->frame_length;
+	if (!packets) {
+		return 0;
+	}
+
+	if (!mp4_seek(&self->mp4, 0, mp4_sample(&self->mp4, 0) + packets)) {
+		return 0;
+	}
+
+	LOG_DEBUG(log_audio_codec, "skipped %u packets", packets);
+
+	return packets * self->frame_length;
+}
+
+
 // FIXME alac does not work fully yet, see Bug 12421
 struct decode_module decode_alac = {
 	'l',
@@ -229,4 +260,6 @@ struct decode_module decode_alac = {
 	decode_alac_stop,
 	decode_alac_samples,
 	decode_alac_callback,
+	NULL,
+	decode_alac_skip,
 };
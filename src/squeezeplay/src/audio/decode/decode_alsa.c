@@ -24,6 +24,7 @@
 #define ALSA_DEFAULT_DEVICE "default"
 #define ALSA_DEFAULT_BUFFER_TIME 30000
 #define ALSA_DEFAULT_PERIOD_COUNT 3
+#define ALSA_DEFAULT_RESAMPLE_QUALITY 4
 
 #define FLAG_STREAM_PLAYBACK 0x01
 #define FLAG_STREAM_EFFECTS  0x02
@@ -90,16 +91,16 @@ static void decode_alsa_stop(void) {
 }
 
 
-static pid_t decode_alsa_fork(const char *device, const char *capture, unsigned int buffer_time, unsigned int period_count, unsigned int sample_size, u32_t flags)
+static pid_t decode_alsa_fork(const char *device, const char *capture, unsigned int buffer_time, unsigned int period_count, unsigned int sample_size, u32_t flags, int resample_rate, int resample_quality)
 {
-	char *path, b[10], p[10], f[10], s[10];
-	char *cmd[20];
+	char *path, b[10], p[10], f[10], s[10], r[10], q[10];
+	char *cmd[24];
 	pid_t pid;
 	int i, idx = 0, ret;
 
 	path = alloca(PATH_MAX);
 
-	/* jive_alsa [-v] -d <device> -b <buffer_time> -p <period_count> -f <flags> */
+	/* jive_alsa [-v] -d <device> -b <buffer_time> -p <period_count> -f <flags> [-r <resample_rate> -q <quality>] */
 
 	cmd[idx++] = "jive_alsa";
 
@@ -132,6 +133,16 @@ static pid_t decode_alsa_fork(const char *device, const char *capture, unsigned
 	cmd[idx++] = "-f";
 	cmd[idx++] = f;
 
+	if (resample_rate) {
+		snprintf(r, sizeof(r), "%d", resample_rate);
+		cmd[idx++] = "-r";
+		cmd[idx++] = r;
+
+		snprintf(q, sizeof(q), "%d", resample_quality);
+		cmd[idx++] = "-q";
+		cmd[idx++] = q;
+	}
+
 	cmd[idx] = '\0';
 
 	if (IS_LOG_PRIORITY(log_audio_output, LOG_PRIORITY_DEBUG)) {
@@ -193,6 +204,7 @@ static int decode_alsa_init(lua_State *L) {
 	unsigned int buffer_time;
 	unsigned int period_count;
 	unsigned int sample_size;
+	int resample_rate, resample_quality;
 	int shmid;
 	void *buf;
 
@@ -234,6 +246,14 @@ static int decode_alsa_init(lua_State *L) {
 	lua_getfield(L, 2, "alsaSampleSize");
 	sample_size = luaL_optinteger(L, -1, 16);
 
+	/* resample to a fixed rate instead of reopening the device when
+	 * the track rate changes, -1 for the maximum device rate */
+	lua_getfield(L, 2, "alsaResampleRate");
+	resample_rate = luaL_optinteger(L, -1, 0);
+
+	lua_getfield(L, 2, "alsaResampleQuality");
+	resample_quality = luaL_optinteger(L, -1, ALSA_DEFAULT_RESAMPLE_QUALITY);
+
 
 #if 0
 	/* test if device is available */
@@ -258,7 +278,7 @@ static int decode_alsa_init(lua_State *L) {
 		period_count = luaL_optinteger(L, -1, ALSA_DEFAULT_PERIOD_COUNT);
 		lua_pop(L, 2);
 
-		effect_pid = decode_alsa_fork(effects_device, NULL, buffer_time, period_count, 16, FLAG_STREAM_EFFECTS);
+		effect_pid = decode_alsa_fork(effects_device, NULL, buffer_time, period_count, 16, FLAG_STREAM_EFFECTS, 0, 0);
 	}
 
 
@@ -272,9 +292,10 @@ static int decode_alsa_init(lua_State *L) {
 	lua_pop(L, 2);
 
 	playback_pid = decode_alsa_fork(playback_device, capture_device, buffer_time, period_count, sample_size,
-					(effects_device) ? FLAG_STREAM_PLAYBACK : FLAG_STREAM_PLAYBACK | FLAG_STREAM_EFFECTS /*| FLAG_STREAM_NOISE*/);
+					(effects_device) ? FLAG_STREAM_PLAYBACK : FLAG_STREAM_PLAYBACK | FLAG_STREAM_EFFECTS /*| FLAG_STREAM_NOISE*/,
+					resample_rate, resample_quality);
 
-	lua_pop(L, 2);
+	lua_pop(L, 4);
 
 	return 1;
 }
@@ -28,6 +28,14 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 
+/* floating point build of the speex resampler */
+#ifndef OUTSIDE_SPEEX
+#define OUTSIDE_SPEEX
+#endif
+#undef RANDOM_PREFIX
+#define RANDOM_PREFIX jive_float
+#include "audio/speex/speex_resampler.h"
+
 
 /* COMPAT */
 #undef LOG_DEBUG
@@ -129,6 +137,27 @@ struct decode_alsa {
 	/* playback state */
 	u32_t pcm_sample_rate;
 
+	/* resampling to a fixed device rate, when resample_rate is set */
+	u32_t resample_rate;
+	int resample_quality;
+	SpeexResamplerState *resampler;
+	u32_t resample_in_rate;
+	u32_t resample_out_rate;
+	s32_t resample_ppm;
+	bool_t resample_bypass;
+	bool_t resample_reset;
+
+	/* dac clock drift estimate */
+	u64_t drift_frames;
+	u64_t drift_anchor_frames;
+	u64_t drift_anchor_us;
+	u64_t drift_last_us;
+	double drift_ppm;
+
+	/* resampler cpu use at the current rate */
+	u32_t resample_us;
+	u32_t resample_frames;
+
 	/* capture buffer */
 	void *cbuf;
 	ssize_t cbuf_size;
@@ -151,6 +180,26 @@ static snd_output_t *output;
 /* player state */
 static struct decode_alsa state;
 
+/* resampler buffers, in frames */
+#define RESAMPLE_CHUNK 512
+
+/* the resampler ratio is adjusted in steps of 10 ppm */
+#define RESAMPLE_PPM_STEP 10
+#define RESAMPLE_PPM_MAX 500
+#define RESAMPLE_MAX_DEN 0x7ffffff
+
+/* drift is measured once a second, over at least 30 seconds and at most
+ * 10 minutes. Jumps of more than 50ms are xruns or suspends. */
+#define DRIFT_INTERVAL_US 1000000
+#define DRIFT_MIN_BASELINE_US 30000000
+#define DRIFT_MAX_BASELINE_US 600000000
+#define DRIFT_MAX_ERROR_US 50000
+#define DRIFT_SMOOTHING 8
+
+static float resample_in[RESAMPLE_CHUNK * 2];
+static float resample_out[RESAMPLE_CHUNK * 2];
+static sample_t resample_buf[RESAMPLE_CHUNK * 2];
+
 static int randomise_cpu = 0;
 
 #define	timerspecsub(a, b, result) \
@@ -266,6 +315,421 @@ static void decode_alsa_copyright(struct decode_alsa *state,
 }
 
 
+/*
+ * Apply the fade out to the gains, frames is the number of track frames
+ * being played.
+ */
+static void playback_fade(size_t frames, s32_t *lgain, s32_t *rgain) {
+	if (!decode_audio->samples_to_fade) {
+		return;
+	}
+
+	if (decode_audio->samples_until_fade > frames) {
+		decode_audio->samples_until_fade -= frames;
+		return;
+	}
+
+	decode_audio->samples_until_fade = 0;
+
+	/* initialize transition parameters */
+	if (!decode_audio->transition_gain_step) {
+		size_t nbytes;
+		fft_fixed interval;
+
+		interval = determine_transition_interval(decode_audio->transition_sample_rate, (u32_t)(decode_audio->samples_to_fade / decode_audio->transition_sample_rate), &nbytes);
+		if (!interval)
+			interval = 1;
+
+		decode_audio->transition_gain_step = fixed_div(FIXED_ONE, fixed_mul(interval, s32_to_fixed(TRANSITION_STEPS_PER_SECOND)));
+		decode_audio->transition_gain = FIXED_ONE;
+		decode_audio->transition_sample_step = decode_audio->transition_sample_rate / TRANSITION_STEPS_PER_SECOND;
+		decode_audio->transition_samples_in_step = 0;
+
+		LOG_DEBUG("Starting FADEOUT over %d seconds, transition_gain_step %d, transition_sample_step %d",
+			fixed_to_s32(interval), decode_audio->transition_gain_step, decode_audio->transition_sample_step);
+	}
+
+	/* Apply transition gain to left/right gain values */
+	*lgain = fixed_mul(*lgain, decode_audio->transition_gain);
+	*rgain = fixed_mul(*rgain, decode_audio->transition_gain);
+
+	/* Reduce transition gain when we've processed enough samples */
+	decode_audio->transition_samples_in_step += frames;
+	while (decode_audio->transition_gain && decode_audio->transition_samples_in_step >= decode_audio->transition_sample_step) {
+		decode_audio->transition_samples_in_step -= decode_audio->transition_sample_step;
+		decode_audio->transition_gain -= decode_audio->transition_gain_step;
+	}
+}
+
+
+/*
+ * Convert frames to the device format, applying the gain.
+ */
+static void playback_write(struct decode_alsa *state,
+			   u8_t *output_buffer,
+			   sample_t *decode_ptr,
+			   size_t frames_cnt,
+			   s32_t lgain,
+			   s32_t rgain) {
+	switch (state->format) {
+	case SND_PCM_FORMAT_S16_LE:
+		{
+			Sint16 *output_ptr;
+
+			output_ptr = (Sint16 *)(void *)output_buffer;
+
+			if (lgain == FIXED_ONE && rgain == FIXED_ONE) {
+				while (frames_cnt--) {
+					*(output_ptr++) = *(decode_ptr++) >> 16;
+					*(output_ptr++) = *(decode_ptr++) >> 16;
+				}
+			}
+			else {
+				while (frames_cnt--) {
+					*(output_ptr++) = fixed_mul(lgain, *(decode_ptr++)) >> 16;
+					*(output_ptr++) = fixed_mul(rgain, *(decode_ptr++)) >> 16;
+				}
+			}
+		}
+		break;
+	case SND_PCM_FORMAT_S24_LE: 
+		{
+			Sint32 *output_ptr;
+
+			output_ptr = (Sint32 *)(void *)output_buffer;
+
+			if (lgain == FIXED_ONE && rgain == FIXED_ONE) {
+				while (frames_cnt--) {
+					*(output_ptr++) = *(decode_ptr++) >> 8;
+					*(output_ptr++) = *(decode_ptr++) >> 8;
+				}
+			}
+			else {
+				while (frames_cnt--) {
+					*(output_ptr++) = fixed_mul(lgain, *(decode_ptr++)) >> 8;
+					*(output_ptr++) = fixed_mul(rgain, *(decode_ptr++)) >> 8;
+				}
+			}
+		}
+		break;
+	case SND_PCM_FORMAT_S24_3LE:
+		{
+			u8_t *output_ptr;
+
+			output_ptr = (u8_t *)(void *)output_buffer;
+
+			if (lgain == FIXED_ONE && rgain == FIXED_ONE) {
+				while (frames_cnt--) {
+					sample_t lsample = *(decode_ptr++);
+					sample_t rsample = *(decode_ptr++);
+					*(output_ptr++) = (lsample & 0x0000ff00) >>  8;
+					*(output_ptr++) = (lsample & 0x00ff0000) >> 16;
+					*(output_ptr++) = (lsample & 0xff000000) >> 24;
+					*(output_ptr++) = (rsample & 0x0000ff00) >>  8;
+					*(output_ptr++) = (rsample & 0x00ff0000) >> 16;
+					*(output_ptr++) = (rsample & 0xff000000) >> 24;
+				}
+			}
+			else {
+				while (frames_cnt--) {
+					sample_t lsample = fixed_mul(lgain, *(decode_ptr++));
+					sample_t rsample = fixed_mul(rgain, *(decode_ptr++));
+					*(output_ptr++) = (lsample & 0x0000ff00) >>  8;
+					*(output_ptr++) = (lsample & 0x00ff0000) >> 16;
+					*(output_ptr++) = (lsample & 0xff000000) >> 24;
+					*(output_ptr++) = (rsample & 0x0000ff00) >>  8;
+					*(output_ptr++) = (rsample & 0x00ff0000) >> 16;
+					*(output_ptr++) = (rsample & 0xff000000) >> 24;
+				}
+			}
+		}
+		break;
+	case SND_PCM_FORMAT_S32_LE:
+		{
+			Sint32 *output_ptr;
+
+			output_ptr = (Sint32 *)(void *)output_buffer;
+
+			if (lgain == FIXED_ONE && rgain == FIXED_ONE) {
+				memcpy(output_ptr, decode_ptr, frames_cnt * 8);
+			}
+			else {
+				while (frames_cnt--) {
+					*(output_ptr++) = fixed_mul(lgain, *(decode_ptr++));
+					*(output_ptr++) = fixed_mul(rgain, *(decode_ptr++));
+				}
+			}
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+
+static u32_t gcd(u32_t a, u32_t b) {
+	u32_t t;
+
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+
+/*
+ * Update the resampler ratio for the rates and the drift correction.
+ */
+static void resample_update(struct decode_alsa *state) {
+	u32_t g, in_rate, out_rate;
+	u64_t num, den;
+	bool_t bypass;
+
+	in_rate = state->resample_in_rate;
+	out_rate = state->resample_out_rate;
+
+	bypass = (in_rate == out_rate && state->resample_ppm == 0);
+
+	/* the filter history is stale after passing audio through */
+	if (state->resample_bypass && !bypass) {
+		state->resample_reset = TRUE;
+	}
+	state->resample_bypass = bypass;
+
+	if (bypass) {
+		return;
+	}
+
+	if (state->resample_ppm == 0) {
+		jive_float_resampler_set_rate(state->resampler, in_rate, out_rate);
+		return;
+	}
+
+	/* in/out * (1 + ppm / 1000000) */
+	g = gcd(in_rate, out_rate);
+	num = (u64_t)(in_rate / g) * (1000000 + state->resample_ppm) / RESAMPLE_PPM_STEP;
+	den = (u64_t)(out_rate / g) * 1000000 / RESAMPLE_PPM_STEP;
+
+	while (num > RESAMPLE_MAX_DEN || den > RESAMPLE_MAX_DEN) {
+		num >>= 1;
+		den >>= 1;
+	}
+
+	jive_float_resampler_set_rate_frac(state->resampler, num, den, in_rate, out_rate);
+}
+
+
+/*
+ * Set the rate of the track frames being resampled.
+ */
+static void resample_set_rate(struct decode_alsa *state, u32_t in_rate) {
+	u64_t us_per_sec;
+
+	if (in_rate == state->resample_in_rate
+	    && state->pcm_sample_rate == state->resample_out_rate) {
+		return;
+	}
+
+	/* cpu cost of the last rate, per channel */
+	if (state->resample_frames) {
+		us_per_sec = ((u64_t)state->resample_us * state->resample_out_rate) / state->resample_frames / 2;
+
+		LOG_INFO("resampled %u->%u quality %d: %u us per second per channel",
+			 state->resample_in_rate, state->resample_out_rate, state->resample_quality, (unsigned int)us_per_sec);
+	}
+	state->resample_us = 0;
+	state->resample_frames = 0;
+
+	state->resample_in_rate = in_rate;
+	state->resample_out_rate = state->pcm_sample_rate;
+
+	resample_update(state);
+}
+
+
+/*
+ * Estimate the dac clock drift against the monotonic clock from the
+ * frames played when the delay was measured, and steer the resampler to
+ * cancel it. Only the dac side is measured, so the skip and silence
+ * adjustments made for sync don't upset the estimate.
+ *
+ * Called with fifo-lock held.
+ */
+static void drift_update(struct decode_alsa *state, u32_t delay) {
+	struct timespec now;
+	u64_t us, elapsed_us;
+	double played_us, error_us, drift;
+	s32_t ppm;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	us = (u64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+	if (us - state->drift_last_us < DRIFT_INTERVAL_US) {
+		return;
+	}
+	state->drift_last_us = us;
+
+	elapsed_us = us - state->drift_anchor_us;
+	played_us = ((double)(s64_t)(state->drift_frames - delay - state->drift_anchor_frames) * 1000000) / state->pcm_sample_rate;
+	error_us = played_us - (double)elapsed_us;
+
+	/* start again after an xrun, or when the baseline is long enough
+	 * that a change in drift would be missed */
+	if (!state->drift_anchor_us
+	    || error_us > DRIFT_MAX_ERROR_US || error_us < -DRIFT_MAX_ERROR_US
+	    || elapsed_us > DRIFT_MAX_BASELINE_US) {
+		state->drift_anchor_us = us;
+		state->drift_anchor_frames = state->drift_frames - delay;
+		return;
+	}
+
+	if (elapsed_us < DRIFT_MIN_BASELINE_US) {
+		return;
+	}
+
+	/* positive when the dac is fast */
+	drift = (error_us * 1000000) / elapsed_us;
+	state->drift_ppm += (drift - state->drift_ppm) / DRIFT_SMOOTHING;
+
+	ppm = (s32_t)(-state->drift_ppm / RESAMPLE_PPM_STEP) * RESAMPLE_PPM_STEP;
+	if (ppm > RESAMPLE_PPM_MAX) {
+		ppm = RESAMPLE_PPM_MAX;
+	}
+	else if (ppm < -RESAMPLE_PPM_MAX) {
+		ppm = -RESAMPLE_PPM_MAX;
+	}
+
+	if (ppm != state->resample_ppm) {
+		LOG_DEBUG("drift %d ppm, correction %d ppm", (int)state->drift_ppm, ppm);
+
+		state->resample_ppm = ppm;
+		resample_update(state);
+	}
+
+	decode_audio->clock_drift = (s32_t)state->drift_ppm;
+	decode_audio->clock_correction = state->resample_ppm;
+}
+
+
+/*
+ * Resample the track frames in the fifo to the device rate, switching
+ * rate at the track start point so rate changes are gapless. Returns the
+ * number of output frames that could not be filled.
+ *
+ * Called with fifo-lock held.
+ */
+static size_t playback_resample(struct decode_alsa *state,
+				u8_t *output_buffer,
+				size_t output_frames) {
+	size_t decode_frames, wrap_frames, start_frames, i;
+	spx_uint32_t in_frames, out_frames;
+	struct timespec t1, t2;
+	sample_t *decode_ptr, *src;
+	s32_t lgain, rgain;
+	float s;
+
+	decode_frames = BYTES_TO_SAMPLES(fifo_bytes_used(&decode_audio->fifo));
+
+	while (output_frames && decode_frames) {
+		in_frames = decode_frames;
+
+		/* the new track is at the read pointer, change rate now */
+		if (decode_audio->check_start_point) {
+			start_frames = BYTES_TO_SAMPLES((decode_audio->track_start_point + DECODE_FIFO_SIZE - decode_audio->fifo.rptr) % DECODE_FIFO_SIZE);
+
+			if (start_frames == 0) {
+				resample_set_rate(state, decode_audio->track_sample_rate);
+			}
+			else if (in_frames > start_frames) {
+				in_frames = start_frames;
+			}
+		}
+
+		wrap_frames = BYTES_TO_SAMPLES(fifo_bytes_until_rptr_wrap(&decode_audio->fifo));
+		if (in_frames > wrap_frames) {
+			in_frames = wrap_frames;
+		}
+		if (in_frames > RESAMPLE_CHUNK) {
+			in_frames = RESAMPLE_CHUNK;
+		}
+
+		out_frames = output_frames;
+		if (out_frames > RESAMPLE_CHUNK) {
+			out_frames = RESAMPLE_CHUNK;
+		}
+
+		decode_ptr = (sample_t *)(void *)(decode_fifo_buf + decode_audio->fifo.rptr);
+
+		if (state->resample_bypass) {
+			/* same rate, pass through */
+			if (in_frames > out_frames) {
+				in_frames = out_frames;
+			}
+			out_frames = in_frames;
+			src = decode_ptr;
+		}
+		else {
+			if (state->resample_reset) {
+				jive_float_resampler_reset_mem(state->resampler);
+				state->resample_reset = FALSE;
+			}
+
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+
+			for (i = 0; i < in_frames * 2; i++) {
+				resample_in[i] = (float)decode_ptr[i];
+			}
+
+			jive_float_resampler_process_interleaved_float(state->resampler,
+								       resample_in, &in_frames,
+								       resample_out, &out_frames);
+
+			for (i = 0; i < out_frames * 2; i++) {
+				s = resample_out[i];
+				if (s >= 2147483648.0f) {
+					resample_buf[i] = 0x7fffffff;
+				}
+				else if (s <= -2147483648.0f) {
+					resample_buf[i] = -0x7fffffff - 1;
+				}
+				else {
+					resample_buf[i] = (sample_t)s;
+				}
+			}
+
+			clock_gettime(CLOCK_MONOTONIC, &t2);
+			state->resample_us += (t2.tv_sec - t1.tv_sec) * 1000000 + (t2.tv_nsec - t1.tv_nsec) / 1000;
+			state->resample_frames += out_frames;
+
+			src = resample_buf;
+		}
+
+		if (!in_frames && !out_frames) {
+			break;
+		}
+
+		lgain = decode_audio->lgain;
+		rgain = decode_audio->rgain;
+		playback_fade(in_frames, &lgain, &rgain);
+
+		playback_write(state, output_buffer, src, out_frames, lgain, rgain);
+
+		decode_vis_tap_write(src, out_frames, state->pcm_sample_rate);
+
+		fifo_rptr_incby(&decode_audio->fifo, SAMPLES_TO_BYTES(in_frames));
+		decode_audio->elapsed_samples += in_frames;
+		decode_frames -= in_frames;
+
+		output_buffer += PCM_FRAMES_TO_BYTES(out_frames);
+		output_frames -= out_frames;
+	}
+
+	return output_frames;
+}
+
+
 /*
  * This function is called by to copy samples from the output buffer to
  * the alsa buffer.
@@ -275,7 +739,8 @@ static void decode_alsa_copyright(struct decode_alsa *state,
 static void playback_callback(struct decode_alsa *state,
 			      void *output_buf,
 			      size_t output_frames) {
-	size_t decode_frames, skip_frames = 0;
+	size_t decode_frames, want_frames, skip_frames = 0, silence_frames = 0;
+	u32_t in_rate;
 	int add_silence_ms;
 	bool_t reached_start_point;
 	u8_t *output_buffer = (u8_t *)output_buf;
@@ -284,12 +749,20 @@ static void playback_callback(struct decode_alsa *state,
 
 	decode_frames = BYTES_TO_SAMPLES(fifo_bytes_used(&decode_audio->fifo));
 
+	/* track frames needed to fill the output */
+	in_rate = state->pcm_sample_rate;
+	want_frames = output_frames;
+	if (state->resampler) {
+		in_rate = state->resample_in_rate;
+		want_frames = ((u64_t)output_frames * in_rate) / state->pcm_sample_rate + 1;
+	}
+
 	/* Should we start the audio now based on having enough decoded data?
 	   - override output_thresh for 176/192k and wait for 1 sec of data before starting */
 	if (decode_audio->state & DECODE_STATE_AUTOSTART
-			&& decode_frames > (output_frames * (3 + state->period_count))
-			&& decode_frames > (state->pcm_sample_rate <= 96000 ? (decode_audio->output_threshold * state->pcm_sample_rate / 10) :
-								state->pcm_sample_rate)
+			&& decode_frames > (want_frames * (3 + state->period_count))
+			&& decode_frames > (in_rate <= 96000 ? (decode_audio->output_threshold * in_rate / 10) :
+								in_rate)
 		)
 	{
 		u32_t now = jive_jiffies();
@@ -305,6 +778,10 @@ static void playback_callback(struct decode_alsa *state,
 	/* audio running? */
 	if (!(decode_audio->state & DECODE_STATE_RUNNING)) {
 		memset(output_buffer, 0, PCM_FRAMES_TO_BYTES(output_frames));
+		decode_vis_tap_write(NULL, output_frames, state->pcm_sample_rate);
+
+		/* don't resample the end of the last stream into the next */
+		state->resample_reset = TRUE;
 
 		return;
 	}
@@ -318,6 +795,7 @@ static void playback_callback(struct decode_alsa *state,
 			add_frames = output_frames;
 		}
 		memset(output_buffer, 0, PCM_FRAMES_TO_BYTES(add_frames));
+		decode_vis_tap_write(NULL, add_frames, state->pcm_sample_rate);
 		output_buffer += PCM_FRAMES_TO_BYTES(add_frames);
 		output_frames -= add_frames;
 		add_silence_ms -= (add_frames * 1000) / state->pcm_sample_rate;
@@ -333,23 +811,26 @@ static void playback_callback(struct decode_alsa *state,
 	}
 
 	/* only skip if it will not cause an underrun */
-	if (decode_frames >= output_frames && decode_audio->skip_ahead_bytes > 0) {
-		skip_frames = decode_frames - output_frames;
+	if (decode_frames >= want_frames && decode_audio->skip_ahead_bytes > 0) {
+		skip_frames = decode_frames - want_frames;
 		if (skip_frames > BYTES_TO_SAMPLES(decode_audio->skip_ahead_bytes)) {
 			skip_frames = BYTES_TO_SAMPLES(decode_audio->skip_ahead_bytes);
 		}
 	}
 
-	if (decode_frames > output_frames) {
-		decode_frames = output_frames;
+	if (decode_frames > want_frames) {
+		decode_frames = want_frames;
 	}
 
 	/* audio underrun? */
-	if (decode_frames < output_frames) {
-		memset(output_buffer + PCM_FRAMES_TO_BYTES(decode_frames), 0, PCM_FRAMES_TO_BYTES(output_frames) - PCM_FRAMES_TO_BYTES(decode_frames));
+	if (decode_frames < want_frames) {
+		if (!state->resampler) {
+			memset(output_buffer + PCM_FRAMES_TO_BYTES(decode_frames), 0, PCM_FRAMES_TO_BYTES(output_frames) - PCM_FRAMES_TO_BYTES(decode_frames));
+			silence_frames = output_frames - decode_frames;
+		}
 
 		if ((decode_audio->state & DECODE_STATE_UNDERRUN) == 0) {
-			LOG_ERROR("Audio underrun: used %ld frames, requested %ld frames. elapsed samples %ld", decode_frames, output_frames, decode_audio->elapsed_samples);
+			LOG_ERROR("Audio underrun: used %ld frames, requested %ld frames. elapsed samples %ld", decode_frames, want_frames, decode_audio->elapsed_samples);
 		}
 
 		decode_audio->state |= DECODE_STATE_UNDERRUN;
@@ -377,168 +858,48 @@ static void playback_callback(struct decode_alsa *state,
 		decode_audio->elapsed_samples += skip_frames;
 	}
 
-	while (decode_frames) {
-		size_t wrap_frames, frames_write, frames_cnt;
-		s32_t lgain, rgain;
-		
-		lgain = decode_audio->lgain;
-		rgain = decode_audio->rgain;
+	if (state->resampler) {
+		silence_frames = playback_resample(state, output_buffer, output_frames);
 
-		wrap_frames = BYTES_TO_SAMPLES(fifo_bytes_until_rptr_wrap(&decode_audio->fifo));
-
-		frames_write = decode_frames;
-		if (wrap_frames < frames_write) {
-			frames_write = wrap_frames;
+		if (silence_frames) {
+			memset(output_buffer + PCM_FRAMES_TO_BYTES(output_frames - silence_frames), 0, PCM_FRAMES_TO_BYTES(silence_frames));
 		}
+	}
+	else {
+		while (decode_frames) {
+			size_t wrap_frames, frames_write;
+			sample_t *decode_ptr;
+			s32_t lgain, rgain;
 
-		frames_cnt = frames_write;
-		
-		/* Handle fading and delayed fading */
-		if (decode_audio->samples_to_fade) {
-			if (decode_audio->samples_until_fade > frames_write) {
-				decode_audio->samples_until_fade -= frames_write;
-			}
-			else {
-				decode_audio->samples_until_fade = 0;
-			
-				/* initialize transition parameters */
-				if (!decode_audio->transition_gain_step) {
-					size_t nbytes;
-					fft_fixed interval;
-				
-					interval = determine_transition_interval(decode_audio->transition_sample_rate, (u32_t)(decode_audio->samples_to_fade / decode_audio->transition_sample_rate), &nbytes);
-					if (!interval)
-						interval = 1;
-					
-					decode_audio->transition_gain_step = fixed_div(FIXED_ONE, fixed_mul(interval, s32_to_fixed(TRANSITION_STEPS_PER_SECOND)));
-					decode_audio->transition_gain = FIXED_ONE;
-					decode_audio->transition_sample_step = decode_audio->transition_sample_rate / TRANSITION_STEPS_PER_SECOND;
-					decode_audio->transition_samples_in_step = 0;
-				
-					LOG_DEBUG("Starting FADEOUT over %d seconds, transition_gain_step %d, transition_sample_step %d",
-						fixed_to_s32(interval), decode_audio->transition_gain_step, decode_audio->transition_sample_step);	
-				}
-				
-				/* Apply transition gain to left/right gain values */
-				lgain = fixed_mul(lgain, decode_audio->transition_gain);
-				rgain = fixed_mul(rgain, decode_audio->transition_gain);
-				
-				/* Reduce transition gain when we've processed enough samples */
-				decode_audio->transition_samples_in_step += frames_write;
-				while (decode_audio->transition_gain && decode_audio->transition_samples_in_step >= decode_audio->transition_sample_step) {
-					decode_audio->transition_samples_in_step -= decode_audio->transition_sample_step;
-					decode_audio->transition_gain -= decode_audio->transition_gain_step;
-				}
+			lgain = decode_audio->lgain;
+			rgain = decode_audio->rgain;
+
+			wrap_frames = BYTES_TO_SAMPLES(fifo_bytes_until_rptr_wrap(&decode_audio->fifo));
+
+			frames_write = decode_frames;
+			if (wrap_frames < frames_write) {
+				frames_write = wrap_frames;
 			}
-		}
 
-		switch (state->format) {
-		case SND_PCM_FORMAT_S16_LE:
-			{
-				sample_t *decode_ptr;
-				Sint16 *output_ptr;
+			/* Handle fading and delayed fading */
+			playback_fade(frames_write, &lgain, &rgain);
 
-				output_ptr = (Sint16 *)(void *)output_buffer;
-				decode_ptr = (sample_t *)(void *)(decode_fifo_buf + decode_audio->fifo.rptr);
+			decode_ptr = (sample_t *)(void *)(decode_fifo_buf + decode_audio->fifo.rptr);
 
-				if (lgain == FIXED_ONE && rgain == FIXED_ONE) {
-					while (frames_cnt--) {
-						*(output_ptr++) = *(decode_ptr++) >> 16;
-						*(output_ptr++) = *(decode_ptr++) >> 16;
-					}
-				}
-				else {
-					while (frames_cnt--) {
-						*(output_ptr++) = fixed_mul(lgain, *(decode_ptr++)) >> 16;
-						*(output_ptr++) = fixed_mul(rgain, *(decode_ptr++)) >> 16;
-					}
-				}
-			}
-			break;
-		case SND_PCM_FORMAT_S24_LE: 
-			{
-				sample_t *decode_ptr;
-				Sint32 *output_ptr;
-				
-				output_ptr = (Sint32 *)(void *)output_buffer;
-				decode_ptr = (sample_t *)(void *)(decode_fifo_buf + decode_audio->fifo.rptr);
-
-				if (lgain == FIXED_ONE && rgain == FIXED_ONE) {
-					while (frames_cnt--) {
-						*(output_ptr++) = *(decode_ptr++) >> 8;
-						*(output_ptr++) = *(decode_ptr++) >> 8;
-					}
-				}
-				else {
-					while (frames_cnt--) {
-						*(output_ptr++) = fixed_mul(lgain, *(decode_ptr++)) >> 8;
-						*(output_ptr++) = fixed_mul(rgain, *(decode_ptr++)) >> 8;
-					}
-				}
-			}
-			break;
-		case SND_PCM_FORMAT_S24_3LE:
-			{
-				sample_t *decode_ptr;
-				u8_t *output_ptr;
-				
-				output_ptr = (u8_t *)(void *)output_buffer;
-				decode_ptr = (sample_t *)(void *)(decode_fifo_buf + decode_audio->fifo.rptr);
-
-				if (lgain == FIXED_ONE && rgain == FIXED_ONE) {
-					while (frames_cnt--) {
-						sample_t lsample = *(decode_ptr++);
-						sample_t rsample = *(decode_ptr++);
-						*(output_ptr++) = (lsample & 0x0000ff00) >>  8;
-						*(output_ptr++) = (lsample & 0x00ff0000) >> 16;
-						*(output_ptr++) = (lsample & 0xff000000) >> 24;
-						*(output_ptr++) = (rsample & 0x0000ff00) >>  8;
-						*(output_ptr++) = (rsample & 0x00ff0000) >> 16;
-						*(output_ptr++) = (rsample & 0xff000000) >> 24;
-					}
-				}
-				else {
-					while (frames_cnt--) {
-						sample_t lsample = fixed_mul(lgain, *(decode_ptr++));
-						sample_t rsample = fixed_mul(rgain, *(decode_ptr++));
-						*(output_ptr++) = (lsample & 0x0000ff00) >>  8;
-						*(output_ptr++) = (lsample & 0x00ff0000) >> 16;
-						*(output_ptr++) = (lsample & 0xff000000) >> 24;
-						*(output_ptr++) = (rsample & 0x0000ff00) >>  8;
-						*(output_ptr++) = (rsample & 0x00ff0000) >> 16;
-						*(output_ptr++) = (rsample & 0xff000000) >> 24;
-					}
-				}
-			}
-			break;
-		case SND_PCM_FORMAT_S32_LE:
-			{
-				sample_t *decode_ptr;
-				Sint32 *output_ptr;
-				
-				output_ptr = (Sint32 *)(void *)output_buffer;
-				decode_ptr = (sample_t *)(void *)(decode_fifo_buf + decode_audio->fifo.rptr);
-
-				if (lgain == FIXED_ONE && rgain == FIXED_ONE) {
-					memcpy(output_ptr, decode_ptr, frames_cnt * 8);
-				}
-				else {
-					while (frames_cnt--) {
-						*(output_ptr++) = fixed_mul(lgain, *(decode_ptr++));
-						*(output_ptr++) = fixed_mul(rgain, *(decode_ptr++));
-					}
-				}
-			}
-			break;
-		default:
-			break;
-		}
+			playback_write(state, output_buffer, decode_ptr, frames_write, lgain, rgain);
+
+			decode_vis_tap_write(decode_ptr, frames_write, state->pcm_sample_rate);
 
-		fifo_rptr_incby(&decode_audio->fifo, SAMPLES_TO_BYTES(frames_write));
-		decode_audio->elapsed_samples += frames_write;
+			fifo_rptr_incby(&decode_audio->fifo, SAMPLES_TO_BYTES(frames_write));
+			decode_audio->elapsed_samples += frames_write;
+
+			output_buffer += PCM_FRAMES_TO_BYTES(frames_write);
+			decode_frames -= frames_write;
+		}
+	}
 
-		output_buffer += PCM_FRAMES_TO_BYTES(frames_write);
-		decode_frames -= frames_write;
+	if (silence_frames) {
+		decode_vis_tap_write(NULL, silence_frames, state->pcm_sample_rate);
 	}
 
 	reached_start_point = decode_check_start_point();
@@ -814,6 +1175,11 @@ static int pcm_open(struct decode_alsa *state, bool_t loopback, int mode)
 			sample_rate = 44100;
 		}
 
+		/* the device rate is fixed when resampling */
+		if (state->resample_rate && !loopback) {
+			sample_rate = state->resample_rate;
+		}
+
 		err = _pcm_open(state,
 				&state->pcm,
 				mode,
@@ -925,7 +1291,7 @@ static void *audio_thread_execute(void *data) {
 	snd_pcm_sframes_t avail;
 	snd_pcm_status_t *status;
 	int err, count = 0, count_max = 441, first = 1;
-	u32_t delay, do_open = 1;
+	u32_t delay, vis_delay, do_open = 1;
 	void *buf = NULL;
 
 	LOG_DEBUG("audio_thread_execute");
@@ -972,6 +1338,11 @@ static void *audio_thread_execute(void *data) {
 				pcm_close(state, &state->capture_pcm, SND_PCM_STREAM_CAPTURE);
 			}
 
+			if (state->resampler) {
+				resample_set_rate(state, state->resample_in_rate);
+				state->drift_anchor_us = 0;
+			}
+
 			first = 1;
 			count_max = state->pcm_sample_rate / 1000;
 		}
@@ -1120,6 +1491,17 @@ static void *audio_thread_execute(void *data) {
 
 						decode_audio->sync_elapsed_samples = decode_audio->elapsed_samples;
 						delay = snd_pcm_status_get_delay(status);
+						vis_delay = delay;
+
+						if (state->resampler) {
+							drift_update(state, delay);
+						}
+
+						/* elapsed samples are in track frames */
+						if (state->resampler && !state->resample_bypass) {
+							delay = ((u64_t)delay * state->resample_in_rate) / state->pcm_sample_rate
+								+ jive_float_resampler_get_input_latency(state->resampler);
+						}
 
 						if (decode_audio->sync_elapsed_samples > delay) {
 							decode_audio->sync_elapsed_samples -= delay;
@@ -1136,6 +1518,8 @@ static void *audio_thread_execute(void *data) {
 						}
 					
 						decode_audio->sync_elapsed_timestamp = jive_jiffies();
+
+						decode_vis_tap_mark(vis_delay, state->pcm_sample_rate);
 					}
 
 					playback_callback(state, buf, frames);
@@ -1145,7 +1529,7 @@ static void *audio_thread_execute(void *data) {
 				 * fifo is locked, so we don't need to lock it twice
 				 * per loop.
 				 */
-				do_open = (decode_audio->set_sample_rate && (decode_audio->set_sample_rate != state->pcm_sample_rate)) ? 1 : 0;
+				do_open = (!state->resample_rate && decode_audio->set_sample_rate && (decode_audio->set_sample_rate != state->pcm_sample_rate)) ? 1 : 0;
 
 				/* start or stop loopback? */
 				if (state->capture_device && decode_audio->state & DECODE_STATE_LOOPBACK) {
@@ -1155,6 +1539,10 @@ static void *audio_thread_execute(void *data) {
 					do_open |= (state->capture_pcm) ? 1 : 0;
 				}
 
+				/* publish for the status readers */
+				decode_status_page_update();
+				decode_check_low_watermark();
+
 				decode_audio_unlock();
 			}
 			else {
@@ -1195,6 +1583,7 @@ static void *audio_thread_execute(void *data) {
 
 
 			size -= frames;
+			state->drift_frames += frames;
 
 			TIMER_CHECK("COMMIT");
 		}
@@ -1289,7 +1678,9 @@ static int decode_alsa_shared_mem_attach(void)
 int main(int argv, char **argc)
 {
 	struct utsname utsname;
-	int err, i;
+	int err, i, resample_rate = 0;
+
+	state.resample_quality = SPEEX_RESAMPLER_QUALITY_DEFAULT;
 
 	/* parse args */
 	for (i=1; i<argv; i++) {
@@ -1316,10 +1707,17 @@ int main(int argv, char **argc)
 		else if (strcmp(argc[i], "-f") == 0) {
 			state.flags = strtoul(argc[++i], NULL, 0);
 		}
+		else if (strcmp(argc[i], "-r") == 0) {
+			/* -1 for the maximum device rate */
+			resample_rate = strtol(argc[++i], NULL, 0);
+		}
+		else if (strcmp(argc[i], "-q") == 0) {
+			state.resample_quality = strtoul(argc[++i], NULL, 0);
+		}
 	}
 
 	if (!state.playback_device || !state.buffer_time || !state.period_count || !state.flags) {
-		printf("Usage: %s [-v] -d <playback_device> [-c <capture_device>] -b <buffer_time> -p <period_count> -f <flags>\n", argc[0]);
+		printf("Usage: %s [-v] -d <playback_device> [-c <capture_device>] -b <buffer_time> -p <period_count> -f <flags> [-r <resample_rate> [-q <quality>]]\n", argc[0]);
 		exit(-1);
 	}
 
@@ -1360,6 +1758,29 @@ int main(int argv, char **argc)
 		exit(0);
 	}
 
+	/* resample to a fixed rate? */
+	if (resample_rate && (state.flags & FLAG_STREAM_PLAYBACK)) {
+		if (resample_rate < 0 || (u32_t)resample_rate > decode_audio->max_rate) {
+			resample_rate = decode_audio->max_rate;
+		}
+		if (resample_rate > 192000) {
+			resample_rate = 192000;
+		}
+
+		state.resampler = jive_float_resampler_init(2, 44100, resample_rate, state.resample_quality, &err);
+		if (state.resampler) {
+			state.resample_rate = resample_rate;
+			state.resample_in_rate = 44100;
+			state.resample_out_rate = resample_rate;
+			resample_update(&state);
+
+			LOG_INFO("resampling to %d quality %d", resample_rate, state.resample_quality);
+		}
+		else {
+			LOG_ERROR("resampler init failed: %s", jive_float_resampler_strerror(err));
+		}
+	}
+
 	/* set real-time properties */
 	decode_realtime_process(&state);
 
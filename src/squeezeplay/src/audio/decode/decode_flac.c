@@ -181,20 +181,12 @@ static size_t decode_flac_samples(void *data) {
 }
 
 
-static void *decode_flac_start(u8_t *params, u32_t num_params) {
-	struct decode_flac *self;
-
-	LOG_DEBUG(log_audio_codec, "decode_flac_start()");
-
-	self = malloc(sizeof(struct decode_flac));
-	memset(self, 0, sizeof(struct decode_flac));
-
-	self->decoder = FLAC__stream_decoder_new();
-	// XXXX error handling
+static FLAC__StreamDecoderInitStatus decode_flac_init(struct decode_flac *self, u8_t *params) {
+	FLAC__StreamDecoderInitStatus status;
 
 	if (params[0] != 'o') {
 
-		FLAC__stream_decoder_init_stream(
+		status = FLAC__stream_decoder_init_stream(
 			self->decoder,
 			decode_flac_read_callback,
 			NULL, /* seek_callback */
@@ -211,7 +203,7 @@ static void *decode_flac_start(u8_t *params, u32_t num_params) {
 
 		LOG_DEBUG(log_audio_codec, "oggflac stream - using init_ogg_stream()");
 
-		FLAC__stream_decoder_init_ogg_stream(
+		status = FLAC__stream_decoder_init_ogg_stream(
 			self->decoder,
 			decode_flac_read_callback,
 			NULL, /* seek_callback */
@@ -225,11 +217,28 @@ static void *decode_flac_start(u8_t *params, u32_t num_params) {
 		);
 	}
 
-	// XXXX error handling
-
 	/* Assume we aren't changing sample rates until proven wrong */
 	self->sample_rate = decode_output_samplerate();
 	self->error_occurred = FALSE;
+
+	return status;
+}
+
+
+static void *decode_flac_start(u8_t *params, u32_t num_params) {
+	struct decode_flac *self;
+
+	LOG_DEBUG(log_audio_codec, "decode_flac_start()");
+
+	self = malloc(sizeof(struct decode_flac));
+	memset(self, 0, sizeof(struct decode_flac));
+
+	self->decoder = FLAC__stream_decoder_new();
+	// XXXX error handling
+
+	decode_flac_init(self, params);
+
+	// XXXX error handling
 	
 	// XXXX this was needed for SB, why?
 	//FLAC__stream_decoder_process_until_end_of_metadata(self->decoder);
@@ -238,6 +247,18 @@ static void *decode_flac_start(u8_t *params, u32_t num_params) {
 }
 
 
+static bool_t decode_flac_reset(void *data, u8_t *params, u32_t num_params) {
+	struct decode_flac *self = (struct decode_flac *) data;
+
+	LOG_DEBUG(log_audio_codec, "decode_flac_reset()");
+
+	/* the decoder can be initialized again once finished */
+	FLAC__stream_decoder_finish(self->decoder);
+
+	return decode_flac_init(self, params) == FLAC__STREAM_DECODER_INIT_STATUS_OK;
+}
+
+
 static void decode_flac_stop(void *data) {
 	struct decode_flac *self = (struct decode_flac *) data;
 
@@ -259,4 +280,6 @@ struct decode_module decode_flac = {
 	decode_flac_stop,
 	decode_flac_samples,
 	decode_flac_callback,
+	decode_flac_reset,
+	NULL,
 };
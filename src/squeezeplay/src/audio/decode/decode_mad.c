@@ -542,6 +542,33 @@ static void *decode_mad_start(u8_t *params, u32_t num_params) {
 }
 
 
+static bool_t decode_mad_reset(void *data, u8_t *params, u32_t num_params) {
+	struct decode_mad *self = (struct decode_mad *) data;
+
+	LOG_DEBUG(log_audio_codec, "decode_mad_reset()");
+
+	/* keep the buffers, drop any bit reservoir from the last track */
+	mad_stream_finish(&self->stream);
+	mad_stream_init(&self->stream);
+	mad_frame_mute(&self->frame);
+	mad_synth_mute(&self->synth);
+
+	self->guard_pointer = NULL;
+	self->packets = 0;
+	self->encoder_delay = MAD_DECODER_DELAY;
+	self->encoder_padding = 0;
+	self->lame_samples = 0;
+	self->lame_samples_remain = 0;
+	self->decoded_samples = 0;
+	self->state = MAD_STATE_OK;
+
+	/* Assume we aren't changing sample rates until proven wrong */
+	self->sample_rate = decode_output_samplerate();
+
+	return TRUE;
+}
+
+
 static void decode_mad_stop(void *data) {
 	struct decode_mad *self = (struct decode_mad *) data;
 
@@ -564,4 +591,6 @@ struct decode_module decode_mad = {
 	decode_mad_stop,
 	decode_mad_samples,
 	decode_mad_callback,
+	decode_mad_reset,
+	NULL,
 };
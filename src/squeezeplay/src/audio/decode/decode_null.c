@@ -157,6 +157,9 @@ static Uint32 callback(Uint32 interval) {
 	}
 
  mixin_effects:
+	decode_status_page_update();
+	decode_check_low_watermark();
+
 	/* mix in sound effects */
 	/* don't */
 
@@ -271,12 +271,17 @@ void decode_output_samples(sample_t *buffer, u32_t nsamples, int sample_rate) {
 		return;
 	}
 
+	decode_output_count++;
+
 	// XXXX full port from ip3k
 
 	decode_audio_lock();
 
 	if (decode_first_buffer) {
-		LOG_DEBUG(log_audio_decode, "first buffer sample_rate=%d", sample_rate);
+		/* time from strm-s to the first decoded samples */
+		decode_start_latency = jive_jiffies() - decode_start_jiffies;
+
+		LOG_DEBUG(log_audio_decode, "first buffer sample_rate=%d latency=%ums", sample_rate, decode_start_latency);
 
 		upload_open();
 
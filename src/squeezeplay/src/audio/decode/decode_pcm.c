@@ -193,4 +193,6 @@ struct decode_module decode_pcm = {
 	decode_pcm_stop,
 	decode_pcm_samples,
 	decode_pcm_callback,
+	NULL,
+	NULL,
 };
@@ -37,7 +37,7 @@ static int callback(const void *inputBuffer,
 		    const PaStreamCallbackTimeInfo *timeInfo,
 		    PaStreamCallbackFlags statusFlags,
 		    void *userData) {
-	size_t bytes_used, len, skip_bytes = 0, add_bytes = 0;
+	size_t bytes_used, len, skip_bytes = 0, add_bytes = 0, silence_bytes = 0;
 	int add_silence_ms;
 	bool_t reached_start_point;
 	Uint8 *outputArray = (u8_t *)outputBuffer;
@@ -75,6 +75,7 @@ static int callback(const void *inputBuffer,
 	/* audio running? */
 	if (!(decode_audio->state & DECODE_STATE_RUNNING)) {
 		memset(outputArray, 0, len);
+		decode_vis_tap_write(NULL, framesPerBuffer, stream_sample_rate);
 
 		/* mix in sound effects */
 		goto mixin_effects;
@@ -89,11 +90,14 @@ static int callback(const void *inputBuffer,
 	}
 	decode_audio->sync_elapsed_timestamp = jive_jiffies();
 
+	decode_vis_tap_mark(delay, stream_sample_rate);
+
 	add_silence_ms = decode_audio->add_silence_ms;
 	if (add_silence_ms) {
 		add_bytes = SAMPLES_TO_BYTES((u32_t)((add_silence_ms * stream_sample_rate) / 1000));
 		if (add_bytes > len) add_bytes = len;
 		memset(outputArray, 0, add_bytes);
+		decode_vis_tap_write(NULL, BYTES_TO_SAMPLES(add_bytes), stream_sample_rate);
 		outputArray += add_bytes;
 		len -= add_bytes;
 		add_silence_ms -= (BYTES_TO_SAMPLES(add_bytes) * 1000) / stream_sample_rate;
@@ -123,6 +127,7 @@ static int callback(const void *inputBuffer,
 	if (bytes_used == 0) {
 		decode_audio->state |= DECODE_STATE_UNDERRUN;
 		memset(outputArray, 0, len);
+		decode_vis_tap_write(NULL, BYTES_TO_SAMPLES(len), stream_sample_rate);
 
 		goto mixin_effects;
 	}
@@ -130,6 +135,7 @@ static int callback(const void *inputBuffer,
 	if (bytes_used < len) {
 		decode_audio->state |= DECODE_STATE_UNDERRUN;
 		memset(outputArray + bytes_used, 0, len - bytes_used);
+		silence_bytes = len - bytes_used;
 	}
 	else {
 		decode_audio->state &= ~DECODE_STATE_UNDERRUN;
@@ -217,6 +223,8 @@ static int callback(const void *inputBuffer,
 			*(output_ptr++) = fixed_mul(rgain, *(decode_ptr++));
 		}
 
+		decode_vis_tap_write((sample_t *)(decode_fifo_buf + decode_audio->fifo.rptr), BYTES_TO_SAMPLES(bytes_write), stream_sample_rate);
+
 		fifo_rptr_incby(&decode_audio->fifo, bytes_write);
 		decode_audio->elapsed_samples += BYTES_TO_SAMPLES(bytes_write);
 
@@ -224,6 +232,10 @@ static int callback(const void *inputBuffer,
 		bytes_used -= bytes_write;
 	}
 
+	if (silence_bytes) {
+		decode_vis_tap_write(NULL, BYTES_TO_SAMPLES(silence_bytes), stream_sample_rate);
+	}
+
 	reached_start_point = decode_check_start_point();
 	if (reached_start_point) {
 		decode_audio->samples_to_fade = 0;
@@ -237,6 +249,9 @@ static int callback(const void *inputBuffer,
 	}
 
  mixin_effects:
+	decode_status_page_update();
+	decode_check_low_watermark();
+
 	/* mix in sound effects */
 	decode_mix_effects(outputBuffer, framesPerBuffer, 24, stream_sample_rate);
 
@@ -68,6 +68,12 @@ struct decode_module {
 	size_t (*samples)(void *data);
 	/* callback to decode samples to output buffer */
 	bool_t (*callback)(void *data);
+	/* reuse the decode from the previous track for a new track, this
+	 * may be NULL. returns FALSE if the decode can't be reused */
+	bool_t (*reset)(void *data, u8_t *params, u32_t num_params);
+	/* skip ahead in the stream without decoding, this may be NULL.
+	 * returns the number of frames skipped, at most frames */
+	u32_t (*skip)(void *data, u32_t frames);
 };
 
 
@@ -124,9 +130,75 @@ struct decode_audio_func {
 	void (*stop)(void);
 };
 
+/* Visualizer tap, a history of the frames handed to the audio device.
+ * The output thread is the only writer and never waits for readers:
+ * samples are stored before wpos is advanced, and readers check wpos
+ * again after copying to detect frames that were overwritten. The mark
+ * records which tap frame was at the DAC at mark_jiffies, it is guarded
+ * by mark_seq which is odd while an update is in progress.
+ */
+#define VIS_TAP_FRAMES 16384 /* must be a power of 2 */
+#define VIS_TAP_MAX_RATE 48000
+
+struct decode_vis_tap {
+	volatile u32_t wpos;
+	volatile u32_t mark_seq;
+	volatile u32_t mark_pos;
+	volatile u32_t mark_jiffies;
+	volatile u32_t mark_rate;
+
+	/* writer state */
+	u32_t decimate;
+	u32_t phase;
+
+	s16_t buf[VIS_TAP_FRAMES * 2];
+};
+
+#if defined(__GNUC__)
+#define decode_vis_tap_barrier() __sync_synchronize()
+#elif defined(_WIN32)
+#define decode_vis_tap_barrier() MemoryBarrier()
+#else
+#define decode_vis_tap_barrier()
+#endif
+
+/* Status page, a snapshot of the playback state for status polling.
+ * It is only written with the fifo locked, normally by the output once
+ * per period, so there is one writer at a time. Readers don't take the
+ * lock: they retry while seq is odd or changed during the copy, and fall
+ * back to refreshing the page with the lock held. version
+ * is zero until the first update and is bumped when the layout changes.
+ */
+#define DECODE_STATUS_PAGE_VERSION 1
+
+/* lock free reads give up after this many torn copies */
+#define DECODE_STATUS_PAGE_RETRIES 100
+
+struct decode_status_page {
+	volatile u32_t version;
+	volatile u32_t seq;
+
+	u32_t state;
+	u32_t output_full;
+	u32_t output_size;
+	u32_t track_sample_rate;
+	u32_t elapsed_samples;
+	u32_t sync_elapsed_samples;
+	u32_t sync_elapsed_timestamp;
+	u32_t num_tracks_started;
+	s32_t clock_drift;
+	s32_t clock_correction;
+
+	u32_t updates;
+	u32_t update_jiffies;
+};
+
 struct decode_audio {
 	struct decode_audio_func *f;
 
+	/* status_page is lock free for readers */
+	struct decode_status_page status_page;
+
 	/* fifo locks: playback state, track state, sync state */
 	struct fifo fifo;
 
@@ -139,6 +211,11 @@ struct decode_audio {
 
 	u32_t output_threshold; /* tenths of a second */
 
+	/* decoder scheduling, the output signals the fifo when it drains
+	 * to low_watermark used bytes while decode_waiting is set */
+	bool_t decode_waiting;
+	size_t low_watermark;
+
 	u32_t sync_elapsed_samples;
 	u32_t sync_elapsed_timestamp;
 
@@ -155,12 +232,17 @@ struct decode_audio {
 	int add_silence_ms;
 	u32_t start_at_jiffies;
 
-	/* effect_fifo locks: effect_gain */
+	/* effect_fifo locks: effect_gain, effect_rate */
 	struct fifo effect_fifo;
 	fft_fixed effect_gain;
+	u32_t effect_rate; /* rate of the queued effects, set by the output */
 
 	/* device info */
 	u32_t max_rate;
+
+	/* dac clock drift and resampler correction, in ppm */
+	s32_t clock_drift;
+	s32_t clock_correction;
 	
 	/* fading state */
 	u32_t samples_until_fade;
@@ -170,6 +252,9 @@ struct decode_audio {
 	fft_fixed transition_gain_step;
 	u32_t transition_sample_step;
 	u32_t transition_samples_in_step;
+
+	/* vis_tap is lock free */
+	struct decode_vis_tap vis_tap;
 };
 
 extern struct decode_audio *decode_audio;
@@ -191,6 +276,16 @@ extern void decode_output_end(void);
 extern void decode_output_flush(void);
 extern bool_t decode_check_start_point(void);
 extern void decode_mix_effects(void *outputBuffer, size_t framesPerBuffer, int sample_width, int output_sample_rate);
+extern void decode_vis_tap_write(sample_t *buf, size_t frames, u32_t sample_rate);
+extern void decode_vis_tap_mark(u32_t delay, u32_t sample_rate);
+extern void decode_status_page_update(void);
+extern bool_t decode_status_page_read(struct decode_status_page *snap);
+extern void decode_check_low_watermark(void);
+
+/* Decode thread scheduling, the stream wakes the decoder when it has
+ * decode_wait_stream_bytes buffered or the stream ends */
+extern volatile size_t decode_wait_stream_bytes;
+extern void decode_wake_stream(void);
 
 
 /* Sample playback api (sound effects) */
@@ -199,9 +294,22 @@ extern void decode_sample_fill_buffer(void);
 
 
 /* visualizers */
+#define VISUALIZER_VUMETER  0
+#define VISUALIZER_SPECTRUM 1
+
+extern size_t visualizer_read(s16_t *buf, size_t frames, u32_t lead_ms);
+extern void visualizer_request(int which);
+extern void visualizer_lock(void);
+extern void visualizer_unlock(void);
+extern void visualizer_vumeter_compute(void);
+extern void visualizer_spectrum_compute(void);
+
 extern int decode_vumeter(lua_State *L);
+extern int decode_vumeter_draw(lua_State *L);
 extern int decode_spectrum(lua_State *L);
 extern int decode_spectrum_init(lua_State *L);
+extern int decode_spectrum_layout(lua_State *L);
+extern int decode_spectrum_draw(lua_State *L);
 
 /* Internal state */
 
@@ -210,10 +318,14 @@ extern int decode_spectrum_init(lua_State *L);
 
 /* State variables for the current track */
 extern bool_t decode_first_buffer;
+extern u32_t decode_output_count;
+extern u32_t decode_start_jiffies;
+extern u32_t decode_start_latency;
 
 
 /* The fifo used to store decoded samples */
 #define DECODE_FIFO_SIZE (10 * 2 * 44100 * sizeof(sample_t)) 
+#define DECODE_LOW_WATERMARK (DECODE_FIFO_SIZE * 3 / 4)
 extern u8_t *decode_fifo_buf;
 
 #define EFFECT_FIFO_SIZE (1 * 1 * 44100 * sizeof(effect_t))
@@ -11,21 +11,43 @@
 #include "audio/decode/decode.h"
 #include "audio/decode/decode_priv.h"
 
+/* floating point build of the speex resampler */
+#ifndef OUTSIDE_SPEEX
+#define OUTSIDE_SPEEX
+#endif
+#undef RANDOM_PREFIX
+#define RANDOM_PREFIX jive_float
+#include "audio/speex/speex_resampler.h"
+
+
+/* sounds are loaded at this rate, and resampled once for the output */
+#define EFFECTS_SAMPLE_RATE 44100
+#define EFFECTS_RESAMPLE_QUALITY 2
 
 struct jive_sample {
 	unsigned int refcount;
 	Uint8 *data;
 	size_t frames;
 	int channels;
-	size_t pos;
 	int mixer;
 	bool enabled;
+
+	/* data at the effects output rate */
+	effect_t *cache;
+	size_t cache_frames;
+	u32_t cache_rate;
 };
 
+struct effect_voice {
+	struct jive_sample *snd;
+	size_t pos;
+};
 
-/* mixer channels */
-#define MAX_EFFECT_SAMPLES 2
-static struct jive_sample *sample[MAX_EFFECT_SAMPLES];
+
+/* mixer voices, only one voice plays on each mixer channel */
+#define MAX_EFFECT_VOICES 8
+#define EFFECT_MIX_FRAMES 256
+static struct effect_voice voice[MAX_EFFECT_VOICES];
 static bool_t is_playing = false;
 u8_t *effect_fifo_buf;
 
@@ -41,6 +63,9 @@ static void sample_free(struct jive_sample *sample) {
 		return;
 	}
 
+	if (sample->cache && sample->cache != (effect_t *)(void *)sample->data) {
+		free(sample->cache);
+	}
 	if (sample->data) {
 		free(sample->data);
 	}
@@ -48,55 +73,145 @@ static void sample_free(struct jive_sample *sample) {
 }
 
 
-static void decode_sample_mix(int i, Uint8 *buffer, size_t buflen) {
+/*
+ * Resample a sound to the effects output rate. This is done once per
+ * rate, outside the effects lock, so the audio output only has to add
+ * the queued effects.
+ */
+static effect_t *sample_resample(struct jive_sample *snd, u32_t rate, size_t *frames) {
+	SpeexResamplerState *st;
+	spx_uint32_t in_len, out_len, latency;
+	effect_t zeros[64], *buf;
+	size_t len, size;
+	int err;
+
+	size = ((u64_t)snd->frames * rate) / EFFECTS_SAMPLE_RATE + 1;
+	buf = malloc(size * sizeof(effect_t));
+	if (!buf) {
+		return NULL;
+	}
+
+	st = jive_float_resampler_init(1, EFFECTS_SAMPLE_RATE, rate, EFFECTS_RESAMPLE_QUALITY, &err);
+	if (!st) {
+		LOG_WARN(log_audio_decode, "Couldn't resample sound: %s", jive_float_resampler_strerror(err));
+		free(buf);
+		return NULL;
+	}
+	jive_float_resampler_skip_zeros(st);
+
+	in_len = snd->frames;
+	out_len = size;
+	jive_float_resampler_process_int(st, 0, (spx_int16_t *)(void *)snd->data, &in_len, buf, &out_len);
+	len = out_len;
+
+	/* flush the filter */
+	memset(zeros, 0, sizeof(zeros));
+	latency = jive_float_resampler_get_input_latency(st);
+	while (latency && len < size) {
+		in_len = (latency < 64) ? latency : 64;
+		out_len = size - len;
+		jive_float_resampler_process_int(st, 0, zeros, &in_len, buf + len, &out_len);
+		if (!in_len && !out_len) {
+			break;
+		}
+		latency -= in_len;
+		len += out_len;
+	}
+
+	jive_float_resampler_destroy(st);
+
+	*frames = len;
+	return buf;
+}
+
+
+static void voice_stop(int v) {
+	sample_free(voice[v].snd);
+	voice[v].snd = NULL;
+	voice[v].pos = 0;
+}
+
+
+/*
+ * Mix the voices onto the buffer, v is the voice to mix or -1 for all
+ * voices. The voices are summed before clipping so the loops are simple
+ * enough for the compiler to vectorize.
+ */
+static void decode_sample_mix(int v, Uint8 *buffer, size_t buflen) {
 	const s32_t max_sample = 0x7fff;
 	const s32_t min_sample = -0x8000;
+	s32_t mix[EFFECT_MIX_FRAMES];
 	effect_t *s, *d;
-	size_t buf_frames, frames, j;
+	size_t buf_frames, chunk, frames, j;
+	int i, first, last;
 
-	/* fixme: this crudely mixes the samples onto the buffer */
+	first = (v < 0) ? 0 : v;
+	last = (v < 0) ? MAX_EFFECT_VOICES - 1 : v;
 
-	buf_frames = buflen / sizeof(effect_t);	
+	buf_frames = buflen / sizeof(effect_t);
+	d = (effect_t *)(void *)buffer;
 
-	frames = sample[i]->frames - sample[i]->pos;
-	if (frames > buf_frames) {
-		frames = buf_frames;
-	}
+	while (buf_frames) {
+		chunk = buf_frames;
+		if (chunk > EFFECT_MIX_FRAMES) {
+			chunk = EFFECT_MIX_FRAMES;
+		}
 
-	d = (effect_t *)(void *)buffer;
-	s = ((effect_t *)(void *)sample[i]->data) + sample[i]->pos;
-	
-	for (j=0; j<frames; j++) {
-		s32_t tmp = *s++;
-	
-		tmp += *d;
-	
-		if (tmp >= max_sample) {
-			tmp = max_sample;
+		for (j=0; j<chunk; j++) {
+			mix[j] = d[j];
 		}
-		else if (tmp <= min_sample) {
-			tmp = min_sample;
+
+		for (i=first; i<=last; i++) {
+			if (!voice[i].snd) {
+				continue;
+			}
+
+			frames = voice[i].snd->cache_frames - voice[i].pos;
+			if (frames > chunk) {
+				frames = chunk;
+			}
+
+			s = voice[i].snd->cache + voice[i].pos;
+			for (j=0; j<frames; j++) {
+				mix[j] += s[j];
+			}
+
+			voice[i].pos += frames;
+			if (voice[i].pos == voice[i].snd->cache_frames) {
+				voice_stop(i);
+			}
 		}
-		*d++ = tmp;
-	}
 
-	sample[i]->pos += frames;
+		for (j=0; j<chunk; j++) {
+			s32_t tmp = mix[j];
+
+			tmp = (tmp > max_sample) ? max_sample : tmp;
+			tmp = (tmp < min_sample) ? min_sample : tmp;
+			d[j] = tmp;
+		}
 
-	if (sample[i]->pos == sample[i]->frames) {
-		sample[i]->pos = 0;
-			
-		sample_free(sample[i]);
-		sample[i] = NULL;
+		d += chunk;
+		buf_frames -= chunk;
 	}
 }
 
 
 static void decode_sample_fill_buffer_locked(void)
 {
-	size_t i, n, size;
+	size_t n, size;
+	u32_t rate;
+	int i;
 
 	decode_audio->effect_gain = effect_gain;
 
+	/* the output rate changed, the queued effects were dropped */
+	rate = decode_audio->effect_rate ? decode_audio->effect_rate : EFFECTS_SAMPLE_RATE;
+	for (i=0; i<MAX_EFFECT_VOICES; i++) {
+		if (voice[i].snd && voice[i].snd->cache_rate != rate) {
+			voice_stop(i);
+		}
+	}
+
 	size = fifo_bytes_free(&decode_audio->effect_fifo);
 	size = (size / sizeof(effect_t)) * sizeof(effect_t);
 
@@ -108,11 +223,7 @@ static void decode_sample_fill_buffer_locked(void)
 
 		memset(effect_fifo_buf + decode_audio->effect_fifo.wptr, 0, n);
 
-		for (i=0; i<MAX_EFFECT_SAMPLES; i++) {
-			if (sample[i]) {
-				decode_sample_mix(i, effect_fifo_buf + decode_audio->effect_fifo.wptr, n);
-			}
-		}
+		decode_sample_mix(-1, effect_fifo_buf + decode_audio->effect_fifo.wptr, n);
 
 		fifo_wptr_incby(&decode_audio->effect_fifo, n);
 
@@ -121,8 +232,8 @@ static void decode_sample_fill_buffer_locked(void)
 
 	/* sound effects still playing? */
 	is_playing = false;
-	for (i=0; i<MAX_EFFECT_SAMPLES; i++) {
-		if (sample[i]) {
+	for (i=0; i<MAX_EFFECT_VOICES; i++) {
+		if (voice[i].snd) {
 			is_playing = true;
 			break;
 		}
@@ -149,8 +260,10 @@ void decode_sample_fill_buffer()
 
 static int decode_sample_obj_play(lua_State *L) {
 	struct jive_sample *snd;
-	size_t n, size;
-	int ch;
+	effect_t *cache, *old_cache = NULL;
+	size_t n, size, cache_frames;
+	u32_t rate;
+	int i, v;
 
 	/* stack is:
 	 * 1: sound
@@ -161,18 +274,64 @@ static int decode_sample_obj_play(lua_State *L) {
 		return 0;
 	}
 
+	/* resample for the output rate, if it has changed */
+	rate = decode_audio->effect_rate ? decode_audio->effect_rate : EFFECTS_SAMPLE_RATE;
+	if (snd->cache_rate != rate) {
+		if (rate == EFFECTS_SAMPLE_RATE) {
+			cache = (effect_t *)(void *)snd->data;
+			cache_frames = snd->frames;
+		}
+		else {
+			cache = sample_resample(snd, rate, &cache_frames);
+			if (!cache) {
+				return 0;
+			}
+		}
+	}
+	else {
+		cache = NULL;
+	}
+
 	fifo_lock(&decode_audio->effect_fifo);
 
-	ch = snd->mixer;	
-	if (sample[ch] != NULL) {
-		/* slot is not free */
+	if (cache) {
+		/* stop voices playing the old data */
+		for (i=0; i<MAX_EFFECT_VOICES; i++) {
+			if (voice[i].snd == snd) {
+				voice_stop(i);
+			}
+		}
+
+		if (snd->cache != (effect_t *)(void *)snd->data) {
+			old_cache = snd->cache;
+		}
+		snd->cache = cache;
+		snd->cache_frames = cache_frames;
+		snd->cache_rate = rate;
+	}
+
+	v = -1;
+	for (i=0; i<MAX_EFFECT_VOICES; i++) {
+		if (voice[i].snd && voice[i].snd->mixer == snd->mixer) {
+			/* mixer channel is not free */
+			v = -1;
+			break;
+		}
+		if (!voice[i].snd && v < 0) {
+			v = i;
+		}
+	}
+
+	if (v < 0 || snd->cache_rate != rate) {
 		fifo_unlock(&decode_audio->effect_fifo);
+		free(old_cache);
 		return 0;
 	}
 
 	/* queue sound effect */
-	sample[ch] = snd;
-	sample[ch]->refcount++;
+	voice[v].snd = snd;
+	voice[v].pos = 0;
+	snd->refcount++;
 
 	size = fifo_bytes_used(&decode_audio->effect_fifo);
 	if (size > 0) {
@@ -183,17 +342,15 @@ static int decode_sample_obj_play(lua_State *L) {
 			n = size;
 		}
 		
-		if (sample[ch]) {
-			decode_sample_mix(ch, effect_fifo_buf + decode_audio->effect_fifo.rptr, n);
-		}
+		decode_sample_mix(v, effect_fifo_buf + decode_audio->effect_fifo.rptr, n);
 		size -= n;
 
-		if (size && sample[ch]) {
-			decode_sample_mix(ch, effect_fifo_buf, size);
+		if (size && voice[v].snd) {
+			decode_sample_mix(v, effect_fifo_buf, size);
 		}
 	}
 
-	if (sample[ch]) {
+	if (voice[v].snd) {
 		/* fill remained of the effects fifo */
 		is_playing = true;
 		decode_sample_fill_buffer_locked();
@@ -201,6 +358,8 @@ static int decode_sample_obj_play(lua_State *L) {
 
 	fifo_unlock(&decode_audio->effect_fifo);
 
+	free(old_cache);
+
 	return 0;
 }
 
@@ -260,7 +419,7 @@ static struct jive_sample *load_sound(char *filename, int mixer) {
 
 	/* Convert to signed 16 bit mono */
 	if (SDL_BuildAudioCVT(&cvt, wave.format, wave.channels, wave.freq,
-			      AUDIO_S16SYS, 1, 44100) < 0) {
+			      AUDIO_S16SYS, 1, EFFECTS_SAMPLE_RATE) < 0) {
 		LOG_WARN(log_audio_decode, "Couldn't build audio converter: %s\n", SDL_GetError());
 		SDL_FreeWAV(data);
 		return NULL;
@@ -282,10 +441,13 @@ static struct jive_sample *load_sound(char *filename, int mixer) {
 	snd->data = cvt.buf;
 	snd->frames = cvt.len_cvt / sizeof(effect_t);
 	snd->channels = 1;
-	snd->pos = 0;
 	snd->mixer = mixer;
 	snd->enabled = true;
 
+	snd->cache = (effect_t *)(void *)snd->data;
+	snd->cache_frames = snd->frames;
+	snd->cache_rate = EFFECTS_SAMPLE_RATE;
+
 	return snd;
 }
 
@@ -0,0 +1,107 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+/*
+ * jive_status dumps the decode status page from the audio shared memory.
+ * The page is read without taking the fifo lock, so this is safe to run
+ * against a playing jive_alsa.
+ *
+ * usage: jive_status [-w interval_ms]
+ */
+
+#include "common.h"
+
+#include "audio/fifo.h"
+#include "audio/fixed_math.h"
+#include "audio/mqueue.h"
+#include "audio/streambuf.h"
+#include "audio/decode/decode.h"
+#include "audio/decode/decode_priv.h"
+
+
+#ifdef HAVE_LIBASOUND
+
+u8_t *decode_fifo_buf;
+u8_t *effect_fifo_buf;
+struct decode_audio *decode_audio;
+
+
+static void status_dump(void) {
+	struct decode_status_page page;
+	u32_t now;
+
+	if (!decode_status_page_read(&page)) {
+		if (decode_audio->status_page.version != DECODE_STATUS_PAGE_VERSION) {
+			printf("status page version %u, expected %u\n",
+			       decode_audio->status_page.version, DECODE_STATUS_PAGE_VERSION);
+		}
+		else {
+			printf("status page is being updated, seq %u\n",
+			       decode_audio->status_page.seq);
+		}
+		return;
+	}
+
+	now = jive_jiffies();
+
+	printf("version:            %u\n", page.version);
+	printf("seq:                %u\n", page.seq);
+	printf("updates:            %u\n", page.updates);
+	printf("age:                %d ms\n", (s32_t)(now - page.update_jiffies));
+	printf("state:              0x%x\n", page.state);
+	printf("output:             %u/%u bytes\n", page.output_full, page.output_size);
+	printf("track sample rate:  %u\n", page.track_sample_rate);
+	printf("elapsed samples:    %u\n", page.elapsed_samples);
+	printf("sync elapsed:       %u at %u\n", page.sync_elapsed_samples, page.sync_elapsed_timestamp);
+	printf("tracks started:     %u\n", page.num_tracks_started);
+	printf("clock drift:        %d ppm\n", page.clock_drift);
+	printf("clock correction:   %d ppm\n", page.clock_correction);
+	printf("\n");
+}
+
+
+int main(int argc, char **argv)
+{
+	int shmid, i;
+	u32_t interval = 0;
+
+	for (i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+			interval = strtoul(argv[++i], NULL, 0);
+		}
+		else {
+			fprintf(stderr, "usage: %s [-w interval_ms]\n", argv[0]);
+			exit(1);
+		}
+	}
+
+	/* attach to shared memory, never create it */
+	shmid = shmget(56833, 0, 0);
+	if (shmid == -1) {
+		fprintf(stderr, "shmget error %s\n", strerror(errno));
+		exit(1);
+	}
+
+	decode_audio = shmat(shmid, 0, SHM_RDONLY);
+	if (decode_audio == (void *)-1) {
+		fprintf(stderr, "shmat error %s\n", strerror(errno));
+		exit(1);
+	}
+
+	do {
+		status_dump();
+
+		if (interval) {
+			usleep(interval * 1000);
+		}
+	} while (interval);
+
+	shmdt(decode_audio);
+
+	return 0;
+}
+
+#endif // HAVE_LIBASOUND
@@ -282,11 +282,34 @@ static void *decode_vorbis_start(u8_t *params, u32_t num_params) {
 }
 
 
+static bool_t decode_vorbis_reset(void *data, u8_t *params, u32_t num_params) {
+	struct decode_vorbis *self = (struct decode_vorbis *) data;
+
+	LOG_DEBUG(log_audio_codec, "decode_vorbis_reset()");
+
+	if (self->state != OGG_STATE_INIT) {
+		ov_clear(&self->vf);
+	}
+
+	memset(&self->vf, 0, sizeof(self->vf));
+	self->bitstream = 0;
+	self->channels = 0;
+	self->sample_rate = 0;
+	self->state = OGG_STATE_INIT;
+
+	return TRUE;
+}
+
+
 static void decode_vorbis_stop(void *data) {
 	struct decode_vorbis *self = (struct decode_vorbis *) data;
 
 	LOG_DEBUG(log_audio_codec, "decode_vorbis_stop()");
 
+	if (self->state != OGG_STATE_INIT) {
+		ov_clear(&self->vf);
+	}
+
 	free(self->output_buffer);
 	free(self);
 }
@@ -299,4 +322,6 @@ struct decode_module decode_vorbis = {
 	decode_vorbis_stop,
 	decode_vorbis_samples,
 	decode_vorbis_callback,
+	decode_vorbis_reset,
+	NULL,
 };
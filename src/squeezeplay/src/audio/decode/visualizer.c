@@ -0,0 +1,147 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+#include "common.h"
+
+#include "audio/mqueue.h"
+#include "audio/fifo.h"
+#include "audio/streambuf.h"
+#include "audio/decode/decode.h"
+#include "audio/decode/decode_priv.h"
+
+
+/* The visualizers compute their results in a worker thread, the draw
+ * functions use the last published result and request the next one.
+ * visualizer_mutex is held while computing and when the visualizer
+ * configuration is changed.
+ */
+static SDL_Thread *visualizer_thread = NULL;
+static SDL_mutex *visualizer_mutex = NULL;
+static SDL_sem *visualizer_sem = NULL;
+static volatile int visualizer_pending[2];
+
+/* Do not extrapolate the DAC position further than this from the mark */
+#define VISUALIZER_MAX_EXTRAPOLATE 1000
+
+
+/*
+ * Copy the frames at the DAC lead_ms from now from the visualizer tap. The
+ * window ends at the DAC position, returns the number of frames copied or
+ * 0 if the tap has no valid history.
+ */
+size_t visualizer_read(s16_t *buf, size_t frames, u32_t lead_ms) {
+	struct decode_vis_tap *tap = &decode_audio->vis_tap;
+	u32_t seq, wpos, pos, start, rate, elapsed;
+	size_t i;
+
+	if (frames > VIS_TAP_FRAMES / 2) {
+		frames = VIS_TAP_FRAMES / 2;
+	}
+
+	do {
+		seq = tap->mark_seq;
+		decode_vis_tap_barrier();
+
+		pos = tap->mark_pos;
+		elapsed = jive_jiffies() + lead_ms - tap->mark_jiffies;
+		rate = tap->mark_rate;
+
+		decode_vis_tap_barrier();
+	} while ((seq & 1) || seq != tap->mark_seq);
+
+	if (!rate) {
+		return 0;
+	}
+
+	if (elapsed > VISUALIZER_MAX_EXTRAPOLATE) {
+		elapsed = VISUALIZER_MAX_EXTRAPOLATE;
+	}
+	pos += (elapsed * rate) / 1000;
+
+	wpos = tap->wpos;
+	decode_vis_tap_barrier();
+
+	/* the DAC can't be ahead of the writer */
+	if ((s32_t)(pos - wpos) > 0) {
+		pos = wpos;
+	}
+
+	start = pos - frames;
+	if (wpos - start > VIS_TAP_FRAMES) {
+		return 0;
+	}
+
+	for (i = 0; i < frames; i++) {
+		s16_t *ptr = tap->buf + (((start + i) & (VIS_TAP_FRAMES - 1)) * 2);
+
+		*buf++ = ptr[0];
+		*buf++ = ptr[1];
+	}
+
+	/* overwritten while copying? */
+	decode_vis_tap_barrier();
+	if (tap->wpos - start > VIS_TAP_FRAMES) {
+		return 0;
+	}
+
+	return frames;
+}
+
+
+void visualizer_lock(void) {
+	if (visualizer_mutex) {
+		SDL_LockMutex(visualizer_mutex);
+	}
+}
+
+
+void visualizer_unlock(void) {
+	if (visualizer_mutex) {
+		SDL_UnlockMutex(visualizer_mutex);
+	}
+}
+
+
+static int visualizer_thread_execute(void *unused) {
+	while (1) {
+		SDL_SemWait(visualizer_sem);
+
+		SDL_LockMutex(visualizer_mutex);
+
+		if (visualizer_pending[VISUALIZER_VUMETER]) {
+			visualizer_pending[VISUALIZER_VUMETER] = 0;
+			visualizer_vumeter_compute();
+		}
+
+		if (visualizer_pending[VISUALIZER_SPECTRUM]) {
+			visualizer_pending[VISUALIZER_SPECTRUM] = 0;
+			visualizer_spectrum_compute();
+		}
+
+		SDL_UnlockMutex(visualizer_mutex);
+	}
+
+	return 0;
+}
+
+
+/*
+ * Ask the worker for a new result, this never blocks the caller.
+ */
+void visualizer_request(int which) {
+	if (!visualizer_thread) {
+		visualizer_mutex = SDL_CreateMutex();
+		visualizer_sem = SDL_CreateSemaphore(0);
+		visualizer_thread = SDL_CreateThread(visualizer_thread_execute, NULL);
+	}
+
+	if (visualizer_pending[which]) {
+		return;
+	}
+
+	visualizer_pending[which] = 1;
+	SDL_SemPost(visualizer_sem);
+}
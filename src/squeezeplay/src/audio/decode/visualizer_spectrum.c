@@ -12,6 +12,7 @@
 #include "audio/decode/decode.h"
 #include "audio/decode/decode_priv.h"
 #include "audio/kiss_fft.h"
+#include "ui/jive.h"
 
 #include <math.h>
 
@@ -122,6 +123,31 @@ float avg_power[2 * MAX_SUBBANDS];
 
 kiss_fft_cfg cfg = NULL;
 
+// Tap samples for all sample windows, protected by visualizer_lock.
+static s16_t spectrum_buf[2 * MAX_SAMPLE_WINDOW];
+
+// Results published by the worker thread, the front buffer is
+// the one to draw.
+static int spectrum_result[2][2][MAX_SUBBANDS];
+static volatile int spectrum_front = 0;
+
+// Rendering state, set by decode_spectrum_layout
+static int bar_x[2];
+static int bar_y;
+static Uint32 bar_color;
+static Uint32 cap_color;
+static int bars_in_bin[2];
+static int bar_width[2];
+static int bar_space[2];
+static int bin_space[2];
+static int bar_height[2];
+static int cap_height[2];
+static int cap_space[2];
+static int cap[2][MAX_SUBBANDS];	// 1/256 pixels
+
+// the caps fall by a fraction of a pixel per frame on short meters
+#define CAP_SHIFT 8
+
 // Parameters on the lua stack for the spectrum analyzer:
 //   2 - Channels: stereo == 0, mono == 1
 // Left channel parameters:
@@ -136,6 +162,9 @@ int decode_spectrum_init( lua_State *L) {
 	int l2int = 0;
 	int shiftsubbands;
 
+	// The worker may be using the current configuration
+	visualizer_lock();
+
 	is_mono = luaL_optinteger(L, 2, 0);
 
 //	printf( "* is_mono: %d\n", is_mono);
@@ -190,6 +219,11 @@ int decode_spectrum_init( lua_State *L) {
 		num_subbands <<= 1;
 	}
 
+	// Limited by the size of the FFT buffers
+	if( num_subbands > MAX_SUBBANDS) {
+		num_subbands = MAX_SUBBANDS;
+	}
+
 	// The number of histogram bars we'll display is nominally
 	// the number of subbands we'll compute.
 	num_bars[0] = num_subbands;
@@ -305,6 +339,8 @@ int decode_spectrum_init( lua_State *L) {
 		}
 	}
 
+	visualizer_unlock();
+
 	// Return calculated number of bars for each channel
 	lua_newtable( L);
 	lua_pushinteger( L, num_bars[0]);
@@ -316,29 +352,21 @@ int decode_spectrum_init( lua_State *L) {
 }
 
 
-int decode_spectrum( lua_State *L) {
-	int sample_bin_ch0[MAX_SUBBANDS];
-	int sample_bin_ch1[MAX_SUBBANDS];
+static void spectrum_bins( int sample_bin[2][MAX_SUBBANDS], u32_t lead_ms) {
+	size_t frames;
 
 	int i;
 	int w;
 	int ch;
 
-	// Shortcut if audio isn't running
-	if( !( decode_audio->state & DECODE_STATE_RUNNING)) {
+	// Shortcut if audio isn't running, or the tap has no history yet
+	frames = sample_window * num_windows;
 
-		lua_newtable( L);
-		for( i = 0; i < num_bars[0]; i++) {
-			lua_pushinteger( L, 0);
-			lua_rawseti( L, -2, i + 1);
-		}
+	if( !( decode_audio->state & DECODE_STATE_RUNNING) || !cfg ||
+		visualizer_read( spectrum_buf, frames, lead_ms) != frames) {
 
-		lua_newtable( L);
-		for( i = 0; i < num_bars[1]; i++) {
-			lua_pushinteger( L, 0);
-			lua_rawseti( L, -2, i + 1);
-		}
-		return 2;
+		memset( sample_bin, 0, 2 * MAX_SUBBANDS * sizeof( int));
+		return;
 	}
 
 	// Init avg_power
@@ -353,31 +381,15 @@ int decode_spectrum( lua_State *L) {
 		int avg_ptr;
 		int s;
 
-		sample_t *ptr;
-		size_t samples_until_wrap;
+		s16_t *ptr;
 
-		int sample;
-
-		decode_audio_lock();
-
-		ptr = (sample_t *) (void *) ( decode_fifo_buf + decode_audio->fifo.rptr);
-		samples_until_wrap = BYTES_TO_SAMPLES( fifo_bytes_until_rptr_wrap( &decode_audio->fifo));
+		ptr = spectrum_buf + ( w * sample_window * 2);
 
 		for( i = 0; i < sample_window; i++) {
-			sample = (*ptr++) >> 16;
-			fin_buf[i].r = (float) ( filter_window[i] * sample);
-
-			sample = (*ptr++) >> 16;
-			fin_buf[i].i = (float) ( filter_window[i] * sample);
-
-			samples_until_wrap -= 2;
-			if( samples_until_wrap <= 0) {
-				ptr = (sample_t *) (void *) decode_fifo_buf;
-			}
+			fin_buf[i].r = (float) ( filter_window[i] * (*ptr++));
+			fin_buf[i].i = (float) ( filter_window[i] * (*ptr++));
 		}
 
-		decode_audio_unlock();
-
 #if 0
 // Test case
 		{
@@ -473,10 +485,10 @@ int decode_spectrum( lua_State *L) {
 				}
 
 				if( ch == 0) {
-					sample_bin_ch0[curr_bar++] = val;
+					sample_bin[0][curr_bar++] = val;
 				}
 				if( ch == 1) {
-					sample_bin_ch1[curr_bar++] = val;
+					sample_bin[1][curr_bar++] = val;
 				}
 
 //				printf( "*** ch: %d, curr_bar: %d, val: %d\n", ch, curr_bar, val);
@@ -494,12 +506,35 @@ int decode_spectrum( lua_State *L) {
 	}
 
 
+}
+
+
+void visualizer_spectrum_compute( void) {
+	int back = !spectrum_front;
+
+	// Aim for the audio at the DAC when the next frame is drawn
+	spectrum_bins( spectrum_result[back], 1000 / JIVE_FRAME_RATE);
+
+	decode_vis_tap_barrier();
+	spectrum_front = back;
+}
+
+
+int decode_spectrum( lua_State *L) {
+	int sample_bin[2][MAX_SUBBANDS];
+
+	int i;
+
+	visualizer_lock();
+	spectrum_bins( sample_bin, 0);
+	visualizer_unlock();
+
 	lua_newtable( L);
 	for( i = 0; i < num_bars[0]; i++) {
 		if( channel_flipped[0] == 0) {
-			lua_pushinteger( L, sample_bin_ch0[i]);
+			lua_pushinteger( L, sample_bin[0][i]);
 		} else {
-			lua_pushinteger( L, sample_bin_ch0[num_bars[0] - 1 - i]);
+			lua_pushinteger( L, sample_bin[0][num_bars[0] - 1 - i]);
 		}
 		lua_rawseti( L, -2, i + 1);
 	}
@@ -507,9 +542,9 @@ int decode_spectrum( lua_State *L) {
 	lua_newtable( L);
 	for( i = 0; i < num_bars[1]; i++) {
 		if( channel_flipped[1] == 0) {
-			lua_pushinteger( L, sample_bin_ch1[i]);
+			lua_pushinteger( L, sample_bin[1][i]);
 		} else {
-			lua_pushinteger( L, sample_bin_ch1[num_bars[1] - 1 - i]);
+			lua_pushinteger( L, sample_bin[1][num_bars[1] - 1 - i]);
 		}
 		lua_rawseti( L, -2, i + 1);
 	}
@@ -518,3 +553,126 @@ int decode_spectrum( lua_State *L) {
 }
 
 
+// Parameters on the lua stack for the spectrum rendering:
+//   2 - Left channel x position
+//   3 - Right channel x position
+//   4 - Bar baseline y position
+//   5 - Bar color
+//   6 - Cap color
+// Left channel parameters:
+//   7 - Bars in bin
+//   8 - Bar width in pixels
+//   9 - Space between bars in pixels
+//  10 - Space between bins in pixels
+//  11 - Bar height in pixels
+//  12 - Cap height in pixels
+//  13 - Space between bar and cap in pixels
+// Right channel parameters:
+//  14-20 - same as left channel parameters
+
+int decode_spectrum_layout( lua_State *L) {
+	int ch;
+	int i;
+
+	bar_x[0] = luaL_checkinteger( L, 2);
+	bar_x[1] = luaL_checkinteger( L, 3);
+	bar_y = luaL_checkinteger( L, 4);
+	bar_color = (Uint32) luaL_checknumber( L, 5);
+	cap_color = (Uint32) luaL_checknumber( L, 6);
+
+	for( ch = 0; ch < 2; ch++) {
+		int p = 7 + ( ch * 7);
+
+		bars_in_bin[ch] = luaL_optinteger( L, p, 1);
+		bar_width[ch] = luaL_optinteger( L, p + 1, 1);
+		bar_space[ch] = luaL_optinteger( L, p + 2, 0);
+		bin_space[ch] = luaL_optinteger( L, p + 3, 0);
+		bar_height[ch] = luaL_optinteger( L, p + 4, 31);
+		cap_height[ch] = luaL_optinteger( L, p + 5, 0);
+		cap_space[ch] = luaL_optinteger( L, p + 6, 0);
+
+		for( i = 0; i < MAX_SUBBANDS; i++) {
+			cap[ch][i] = 0;
+		}
+	}
+
+	return 0;
+}
+
+
+int decode_spectrum_draw( lua_State *L) {
+	JiveSurface *srf;
+
+	int ch;
+
+	srf = tolua_tousertype( L, 2, 0);
+
+	for( ch = 0; ch < (( is_mono) ? 1 : 2); ch++) {
+		int *bins = spectrum_result[spectrum_front][ch];
+		int bar_size = bar_width[ch] + bar_space[ch];
+		int cap_step, cap_y;
+		Sint16 x = bar_x[ch];
+		Sint16 y = bar_y;
+
+		int i;
+		int k;
+
+		// max bin value is 31, the caps fall by one bin value a frame
+		cap_step = ( bar_height[ch] << CAP_SHIFT) / 31;
+		if( cap_step < 1) {
+			cap_step = 1;
+		}
+
+		for( i = 0; i < num_bars[ch]; i++) {
+			int val;
+			int h, h_fixed;
+
+			if( channel_flipped[ch] == 0) {
+				val = bins[i];
+			} else {
+				val = bins[num_bars[ch] - 1 - i];
+			}
+
+			h_fixed = ( ( val * bar_height[ch]) << CAP_SHIFT) / 31;
+			h = h_fixed >> CAP_SHIFT;
+
+			// bar
+			if( h > 0) {
+				for( k = 0; k < bars_in_bin[ch]; k++) {
+					jive_surface_boxColor( srf,
+						x + ( k * bar_size), y,
+						x + ( bar_width[ch] - 1) + ( k * bar_size), y - h + 1,
+						bar_color);
+				}
+			}
+
+			if( h_fixed >= cap[ch][i]) {
+				cap[ch][i] = h_fixed;
+			} else if( cap[ch][i] > 0) {
+				cap[ch][i] -= cap_step;
+				if( cap[ch][i] < 0) {
+					cap[ch][i] = 0;
+				}
+			}
+
+			// cap
+			if( cap_height[ch] > 0) {
+				// rounded up, as SpectrumMeter.lua truncated y - cap
+				cap_y = y - ( ( cap[ch][i] + ( 1 << CAP_SHIFT) - 1) >> CAP_SHIFT) - cap_space[ch];
+
+				for( k = 0; k < bars_in_bin[ch]; k++) {
+					jive_surface_boxColor( srf,
+						x + ( k * bar_size), cap_y,
+						x + ( bar_width[ch] - 1) + ( k * bar_size), cap_y - cap_height[ch],
+						cap_color);
+				}
+			}
+
+			x += bar_width[ch] * bars_in_bin[ch] + bar_space[ch] * ( bars_in_bin[ch] - 1) + bin_space[ch];
+		}
+	}
+
+	visualizer_request( VISUALIZER_SPECTRUM);
+
+	return 0;
+}
@@ -11,49 +11,83 @@
 #include "audio/streambuf.h"
 #include "audio/decode/decode.h"
 #include "audio/decode/decode_priv.h"
+#include "ui/jive.h"
 
 
 #define VUMETER_DEFAULT_SAMPLE_WINDOW 8 * 1024
 
-int decode_vumeter(lua_State *L) {
-	u32_t sample_accumulator[2];
-	sample_t *ptr;
-	size_t samples_until_wrap;
-	s16_t sample;
-	s32_t sample_sq;
-	size_t i, num_samples;
+/* FIXME dynamic based on number of bars */
+static u32_t rms_map[] = {
+	0, 2, 5, 7, 10, 21, 33, 45, 57, 82, 108, 133, 159, 200,
+	242, 284, 326, 387, 448, 509, 570, 652, 735, 817, 900,
+	1005, 1111, 1217, 1323, 1454, 1585, 1716, 1847, 2005,
+	2163, 2321, 2480, 2666, 2853, 3040, 3227,
+};
 
-	num_samples = luaL_optinteger(L, 2, VUMETER_DEFAULT_SAMPLE_WINDOW);
+#define RMS_MAP_SIZE (sizeof(rms_map) / sizeof(rms_map[0]))
 
-	sample_accumulator[0] = 0;
-	sample_accumulator[1] = 0;
+/* Tap samples, protected by visualizer_lock */
+static s16_t vumeter_buf[VIS_TAP_FRAMES];
 
-	decode_audio_lock();
+/* Results published by the worker */
+static u32_t vumeter_result[2][2];
+static volatile int vumeter_front = 0;
 
-	if (decode_audio->state & DECODE_STATE_RUNNING) {
-		ptr = (sample_t *)(void *)(decode_fifo_buf + decode_audio->fifo.rptr);
-		samples_until_wrap = BYTES_TO_SAMPLES(fifo_bytes_until_rptr_wrap(&decode_audio->fifo));
+/* Meter state, only used by the draw function */
+static int vumeter_cap[2];
 
-		for (i=0; i<num_samples; i++) {
-			sample = (*ptr++) >> 24;
-			sample_sq = sample * sample;
-			sample_accumulator[0] += sample_sq;
 
-			sample = (*ptr++) >> 24;
-			sample_sq = sample * sample;
-			sample_accumulator[1] += sample_sq;
+static void vumeter_rms(u32_t sample_accumulator[2], size_t num_samples, u32_t lead_ms) {
+	s16_t *ptr;
+	s32_t sample;
+	size_t i;
 
-			samples_until_wrap -= 2;
-			if (samples_until_wrap <= 0) {
-				ptr = (sample_t *)(void *)decode_fifo_buf;
-			}
-		}
+	sample_accumulator[0] = 0;
+	sample_accumulator[1] = 0;
+
+	if (!(decode_audio->state & DECODE_STATE_RUNNING)) {
+		return;
+	}
+
+	num_samples = visualizer_read(vumeter_buf, num_samples, lead_ms);
+	if (!num_samples) {
+		return;
 	}
 
-	decode_audio_unlock();
+	ptr = vumeter_buf;
+	for (i=0; i<num_samples; i++) {
+		sample = (*ptr++) >> 8;
+		sample_accumulator[0] += sample * sample;
+
+		sample = (*ptr++) >> 8;
+		sample_accumulator[1] += sample * sample;
+	}
 
 	sample_accumulator[0] /= num_samples;
 	sample_accumulator[1] /= num_samples;
+}
+
+
+void visualizer_vumeter_compute(void) {
+	int back = !vumeter_front;
+
+	/* aim for the audio at the DAC when the next frame is drawn */
+	vumeter_rms(vumeter_result[back], VUMETER_DEFAULT_SAMPLE_WINDOW, 1000 / JIVE_FRAME_RATE);
+
+	decode_vis_tap_barrier();
+	vumeter_front = back;
+}
+
+
+int decode_vumeter(lua_State *L) {
+	u32_t sample_accumulator[2];
+	size_t num_samples;
+
+	num_samples = luaL_optinteger(L, 2, VUMETER_DEFAULT_SAMPLE_WINDOW);
+
+	visualizer_lock();
+	vumeter_rms(sample_accumulator, num_samples, 0);
+	visualizer_unlock();
 
 	lua_newtable(L);
 	lua_pushinteger(L, sample_accumulator[0]);
@@ -64,3 +98,86 @@ int decode_vumeter(lua_State *L) {
 	return 1;
 }
 
+
+int decode_vumeter_draw(lua_State *L) {
+	JiveSurface *srf, *bg_img;
+	JiveTile *tick_cap, *tick_on, *tick_off;
+	u32_t *rms;
+	Sint16 x[2], y, w, h;
+	int ch, bars, val, i;
+
+	/* stack is:
+	 * 1: decode
+	 * 2: surface
+	 * 3: x1
+	 * 4: x2
+	 * 5: y
+	 * 6: w
+	 * 7: h
+	 * 8: bars, 0 for the analog meter
+	 * 9: bgImg (analog), or tickCap
+	 * 10: tickOn
+	 * 11: tickOff
+	 */
+
+	srf = tolua_tousertype(L, 2, 0);
+	x[0] = luaL_checkinteger(L, 3);
+	x[1] = luaL_checkinteger(L, 4);
+	y = luaL_checkinteger(L, 5);
+	w = luaL_checkinteger(L, 6);
+	h = luaL_checkinteger(L, 7);
+	bars = luaL_checkinteger(L, 8);
+
+	rms = vumeter_result[vumeter_front];
+
+	for (ch = 0; ch < 2; ch++) {
+		val = 1;
+		for (i = RMS_MAP_SIZE - 1; i >= 0; i--) {
+			if (rms[ch] > rms_map[i]) {
+				val = i + 1;
+				break;
+			}
+		}
+
+		/* FIXME when rms map scaled */
+		val = val / 2;
+
+		if (val >= vumeter_cap[ch]) {
+			vumeter_cap[ch] = val;
+		}
+		else if (vumeter_cap[ch] > 0) {
+			vumeter_cap[ch]--;
+		}
+
+		if (bars) {
+			Sint16 ty = y;
+
+			tick_cap = tolua_tousertype(L, 9, 0);
+			tick_on = tolua_tousertype(L, 10, 0);
+			tick_off = tolua_tousertype(L, 11, 0);
+
+			for (i = 1; i <= bars; i++) {
+				if (i == vumeter_cap[ch]) {
+					jive_tile_blit(tick_cap, srf, x[ch], ty, w, h);
+				}
+				else if (i < val) {
+					jive_tile_blit(tick_on, srf, x[ch], ty, w, h);
+				}
+				else {
+					jive_tile_blit(tick_off, srf, x[ch], ty, w, h);
+				}
+
+				ty -= h;
+			}
+		}
+		else {
+			bg_img = tolua_tousertype(L, 9, 0);
+
+			jive_surface_blit_clip(bg_img, vumeter_cap[ch] * w, y, w, h, srf, x[ch], y);
+		}
+	}
+
+	visualizer_request(VISUALIZER_VUMETER);
+
+	return 0;
+}
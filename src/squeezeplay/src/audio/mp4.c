@@ -9,6 +9,8 @@
 #include "audio/decode/decode_priv.h"
 #include "audio/mp4.h"
 
+#include <time.h>
+
 
 static int mp4_parse_container_box(struct decode_mp4 *mp4, size_t r);
 static int mp4_parse_track_box(struct decode_mp4 *mp4, size_t r);
@@ -30,6 +32,20 @@ struct mp4_sample_to_chunk {
 	u32_t first_chunk;
 	u32_t samples_per_chunk;
 	u32_t description_index;
+	u32_t first_sample;		/* first sample in first_chunk */
+};
+
+/* Variable sample sizes are stored in blocks of MP4_SIZE_BLOCK samples,
+ * each size is packed in bits relative to the smallest size in the block.
+ * ALAC packet sizes only vary by a few kB so this needs less than half
+ * the memory of the stsz box.
+ */
+#define MP4_SIZE_BLOCK 64
+
+struct mp4_size_block {
+	u32_t base;
+	u32_t bit_offset;
+	u8_t bits;
 };
 
 struct mp4_track {
@@ -41,11 +57,14 @@ struct mp4_track {
 
 	/* sample size (fixed or variable) */
 	u32_t fixed_sample_size;
-	u32_t *sample_size;
+	struct mp4_size_block *size_block;
+	u8_t *size_bits;
+	u32_t size_bits_len;		/* in bits */
+	u32_t *size_stage;		/* sizes of the block being parsed */
 
 	/* chunk offsets */
 	u32_t chunk_offset_count;
-	u64_t *chunk_offset;
+	u32_t *chunk_offset;
 
 	/* sample to chunk */
 	u32_t sample_to_chunk_count;
@@ -96,6 +115,9 @@ static struct mp4_parser mp4_parsers[] = {
 #define MP4_BUFFER_SIZE (8192 * 3)
 
 
+struct mp4_stats mp4_stats;
+
+
 static ssize_t mp4_fill_buffer(struct decode_mp4 *mp4, bool_t *streaming)
 {
 	size_t n, r = (mp4->end - mp4->ptr);
@@ -203,6 +225,50 @@ static inline int mp4_skip(struct decode_mp4 *mp4, size_t n)
 }
 
 
+static void mp4_put_bits(u8_t *p, u32_t off, int n, u32_t v)
+{
+	while (n > 0) {
+		int k = MIN(8 - (int)(off & 7), n);
+
+		p[off >> 3] |= (v & ((1 << k) - 1)) << (off & 7);
+		v >>= k;
+		off += k;
+		n -= k;
+	}
+}
+
+
+static u32_t mp4_get_bits(u8_t *p, u32_t off, int n)
+{
+	u32_t v = 0;
+	int shift = 0;
+
+	while (n > 0) {
+		int k = MIN(8 - (int)(off & 7), n);
+
+		v |= (u32_t)((p[off >> 3] >> (off & 7)) & ((1 << k) - 1)) << shift;
+		shift += k;
+		off += k;
+		n -= k;
+	}
+
+	return v;
+}
+
+
+static inline u32_t mp4_sample_size(struct mp4_track *track, u32_t n)
+{
+	struct mp4_size_block *block;
+
+	if (track->fixed_sample_size) {
+		return track->fixed_sample_size;
+	}
+
+	block = &track->size_block[n / MP4_SIZE_BLOCK];
+	return block->base + mp4_get_bits(track->size_bits, block->bit_offset + (n % MP4_SIZE_BLOCK) * block->bits, block->bits);
+}
+
+
 static int mp4_parse_container_box(struct decode_mp4 *mp4, size_t r)
 {
 	struct mp4_parser *parser;
@@ -300,6 +366,7 @@ static int mp4_parse_track_header_box(struct decode_mp4 *mp4, size_t r)
 static int mp4_parse_sample_to_chunk_box(struct decode_mp4 *mp4, size_t r)
 {
 	struct mp4_track *track = &mp4->track[mp4->track_idx];
+	u32_t i, first_sample;
 
 	if (!track->sample_to_chunk) {
 		if (r < 8) {
@@ -333,6 +400,17 @@ static int mp4_parse_sample_to_chunk_box(struct decode_mp4 *mp4, size_t r)
 
 	track->chunk_num = 0;
 
+	/* index the first sample of each run, for seeking */
+	first_sample = 0;
+	for (i = 0; i < track->sample_to_chunk_count; i++) {
+		struct mp4_sample_to_chunk *stc = &track->sample_to_chunk[i];
+
+		stc->first_sample = first_sample;
+		if (i + 1 < track->sample_to_chunk_count) {
+			first_sample += (stc[1].first_chunk - stc->first_chunk) * stc->samples_per_chunk;
+		}
+	}
+
 	/* skip rest of box */
 	mp4->f = mp4_skip_box;
 
@@ -359,6 +437,38 @@ static int mp4_parse_sample_table_box(struct decode_mp4 *mp4, size_t r)
 }
 
 
+static void mp4_pack_sample_sizes(struct mp4_track *track)
+{
+	struct mp4_size_block *block;
+	u32_t i, n, min, max;
+
+	n = ((track->sample_num - 1) % MP4_SIZE_BLOCK) + 1;
+	block = &track->size_block[(track->sample_num - 1) / MP4_SIZE_BLOCK];
+
+	min = max = track->size_stage[0];
+	for (i = 1; i < n; i++) {
+		if (track->size_stage[i] < min) {
+			min = track->size_stage[i];
+		}
+		if (track->size_stage[i] > max) {
+			max = track->size_stage[i];
+		}
+	}
+
+	block->base = min;
+	block->bit_offset = track->size_bits_len;
+	block->bits = 0;
+	while (block->bits < 32 && ((max - min) >> block->bits)) {
+		block->bits++;
+	}
+
+	for (i = 0; i < n; i++) {
+		mp4_put_bits(track->size_bits, track->size_bits_len, block->bits, track->size_stage[i] - min);
+		track->size_bits_len += block->bits;
+	}
+}
+
+
 static int mp4_parse_sample_size_box(struct decode_mp4 *mp4, size_t r)
 {
 	struct mp4_track *track = &mp4->track[mp4->track_idx];
@@ -380,7 +490,12 @@ static int mp4_parse_sample_size_box(struct decode_mp4 *mp4, size_t r)
 			mp4->f = mp4_skip_box;
 		}
 
-		track->sample_size = malloc(sizeof(u32_t) * track->sample_count);
+		else {
+			track->size_block = malloc(sizeof(struct mp4_size_block) * ((track->sample_count + MP4_SIZE_BLOCK - 1) / MP4_SIZE_BLOCK));
+			track->size_bits = calloc(track->sample_count + 1, sizeof(u32_t));
+			track->size_bits_len = 0;
+			track->size_stage = malloc(sizeof(u32_t) * MP4_SIZE_BLOCK);
+		}
 
 		mp4->box_size -= 12;
 	}
@@ -391,10 +506,20 @@ static int mp4_parse_sample_size_box(struct decode_mp4 *mp4, size_t r)
 				return 1;
 			}
 
-			track->sample_size[track->sample_num++] = mp4_get_u32(mp4);
+			track->size_stage[track->sample_num++ % MP4_SIZE_BLOCK] = mp4_get_u32(mp4);
 			mp4->box_size -= 4;
+
+			if (track->sample_num % MP4_SIZE_BLOCK == 0 || track->sample_num == track->sample_count) {
+				mp4_pack_sample_sizes(track);
+			}
 		}
 
+		/* trim packed sizes */
+		track->size_bits = realloc(track->size_bits, (track->size_bits_len + 7) / 8 + 1);
+
+		free(track->size_stage);
+		track->size_stage = NULL;
+
 		track->sample_num = 0;
 
 		/* skip rest of box */
@@ -427,7 +552,7 @@ static int mp4_parse_chunk_offset_box(struct decode_mp4 *mp4, size_t r)
 		track->chunk_offset_count = mp4_get_u32(mp4);		
 		track->sample_num = 0;
 
-		track->chunk_offset = malloc(sizeof(u64_t) * track->chunk_offset_count);
+		track->chunk_offset = malloc(sizeof(u32_t) * track->chunk_offset_count);
 
 		mp4->box_size -= 8;
 	}
@@ -612,8 +737,27 @@ static int mp4_parse_mdat_box(struct decode_mp4 *mp4, size_t r)
 	}
 
 	LOG_DEBUG(log_audio_codec, "tracks: %d", mp4->track_count);
+	mp4_stats.table_bytes = 0;
+	mp4_stats.flat_bytes = 0;
 	for (i=0; i<mp4->track_count; i++) {
-		LOG_DEBUG(log_audio_codec, "%d:\t%d, %.4s", i, mp4->track[i].track_id, mp4->track[i].data_format);
+		struct mp4_track *track = &mp4->track[i];
+		size_t table, flat;
+
+		/* memory used for the sample tables, compared with flat arrays */
+		table = track->chunk_offset_count * sizeof(u32_t)
+			+ track->sample_to_chunk_count * sizeof(struct mp4_sample_to_chunk);
+		flat = track->chunk_offset_count * sizeof(u64_t)
+			+ track->sample_to_chunk_count * sizeof(u32_t) * 3
+			+ track->sample_count * sizeof(u32_t);
+		if (track->size_block) {
+			table += ((track->sample_count + MP4_SIZE_BLOCK - 1) / MP4_SIZE_BLOCK) * sizeof(struct mp4_size_block)
+				+ (track->size_bits_len + 7) / 8;
+		}
+
+		mp4_stats.table_bytes += table;
+		mp4_stats.flat_bytes += flat;
+
+		LOG_DEBUG(log_audio_codec, "%d:\t%d, %.4s samples=%u chunks=%u tables=%u bytes (flat %u)", i, track->track_id, track->data_format, track->sample_count, track->chunk_offset_count, (unsigned int)table, (unsigned int)flat);
 	}
 
 	/* start streaming content */
@@ -719,12 +863,7 @@ static inline void packet_size(struct mp4_track *track, size_t *pos, size_t *len
 
 	*pos = track->chunk_offset[track->chunk_num] + track->chunk_sample_offset;
 
-	if (track->fixed_sample_size) {
-		*len = track->fixed_sample_size;
-	}
-	else {
-		*len = track->sample_size[track->sample_num];
-	}
+	*len = mp4_sample_size(track, track->sample_num);
 }
 
 
@@ -744,7 +883,7 @@ static inline void next_packet(struct mp4_track *track)
 		track->chunk_sample_num = 0;
 		track->chunk_sample_offset = 0;
 
-		if (track->chunk_idx < track->chunk_offset_count
+		if (track->chunk_idx + 1 < track->sample_to_chunk_count
 				&& track->sample_to_chunk[track->chunk_idx + 1].first_chunk == track->chunk_num + 1) // first_chunk starts at 1
 		{
 			track->chunk_idx++;
@@ -780,7 +919,10 @@ u8_t *mp4_read(struct decode_mp4 *mp4, int track_idx, size_t *rlen, bool_t *stre
 		}
 
 		if (pos && (mp4->off < pos)) {
-			mp4_skip(mp4, MIN((size_t)r, pos - mp4->off));
+			size_t n = MIN((size_t)r, pos - mp4->off);
+
+			mp4_skip(mp4, n);
+			r -= n;
 
 			if (mp4->off < pos) {
 				mp4->box_size = pos - mp4->off;
@@ -811,6 +953,104 @@ u8_t *mp4_read(struct decode_mp4 *mp4, int track_idx, size_t *rlen, bool_t *stre
 }
 
 
+/*
+ * Position the track at sample, the next mp4_read returns this sample.
+ * The stream can only be skipped forward, or back to data that is still
+ * in the parser buffer. Returns 0 if the sample can't be reached.
+ */
+int mp4_seek(struct decode_mp4 *mp4, int track_idx, u32_t sample)
+{
+	struct mp4_track *track = &mp4->track[track_idx];
+	struct mp4_sample_to_chunk *stc;
+	u32_t lo, hi, mid, chunk, chunk_sample, i, us;
+	size_t pos, offset;
+	clock_t c0;
+
+	c0 = clock();
+	mp4_stats.seeks++;
+
+	if (track_idx >= mp4->track_count
+			|| sample >= track->sample_count
+			|| track->sample_to_chunk_count == 0) {
+		mp4_stats.seek_failed++;
+		return 0;
+	}
+
+	/* find the sample to chunk run containing the sample */
+	lo = 0;
+	hi = track->sample_to_chunk_count - 1;
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (track->sample_to_chunk[mid].first_sample <= sample) {
+			lo = mid;
+		}
+		else {
+			hi = mid - 1;
+		}
+	}
+
+	stc = &track->sample_to_chunk[lo];
+	if (stc->samples_per_chunk == 0) {
+		mp4_stats.seek_failed++;
+		return 0;
+	}
+
+	chunk = stc->first_chunk - 1 + (sample - stc->first_sample) / stc->samples_per_chunk; // first_chunk starts at 1
+	chunk_sample = (sample - stc->first_sample) % stc->samples_per_chunk;
+
+	if (chunk >= track->chunk_offset_count) {
+		mp4_stats.seek_failed++;
+		return 0;
+	}
+
+	offset = 0;
+	for (i = sample - chunk_sample; i < sample; i++) {
+		offset += mp4_sample_size(track, i);
+	}
+
+	pos = track->chunk_offset[chunk] + offset;
+	if (pos < mp4->off) {
+		if (mp4->off - pos > (size_t)(mp4->ptr - mp4->buf)) {
+			LOG_WARN(log_audio_codec, "sample %u is behind the stream", sample);
+			mp4_stats.seek_failed++;
+			return 0;
+		}
+
+		mp4->ptr -= mp4->off - pos;
+		mp4->off = pos;
+	}
+
+	LOG_DEBUG(log_audio_codec, "seek to sample %u: chunk %u run %u offset %u", sample, chunk, lo, (unsigned int)offset);
+
+	track->sample_num = sample;
+	track->chunk_num = chunk;
+	track->chunk_idx = lo;
+	track->chunk_sample_num = chunk_sample;
+	track->chunk_sample_offset = offset;
+
+	mp4->box_size = mp4_sample_size(track, sample);
+
+	us = (u32_t)((clock() - c0) * 1000000 / CLOCKS_PER_SEC);
+	mp4_stats.seek_time += us;
+	if (us > mp4_stats.seek_time_max) {
+		mp4_stats.seek_time_max = us;
+	}
+
+	return 1;
+}
+
+
+/* The next sample mp4_read returns from the track. */
+u32_t mp4_sample(struct decode_mp4 *mp4, int track_idx)
+{
+	if (track_idx >= mp4->track_count) {
+		return 0;
+	}
+
+	return mp4->track[track_idx].sample_num;
+}
+
+
 void mp4_track_conf(struct decode_mp4 *mp4, int track, u8_t **conf, size_t *size)
 {
 	if (track >= mp4->track_count) {
@@ -844,9 +1084,17 @@ void mp4_free(struct decode_mp4 *mp4)
 			free(track->sample_to_chunk);
 			track->sample_to_chunk = NULL;
 		}
-		if (track->sample_size) {
-			free(track->sample_size);
-			track->sample_size = NULL;
+		if (track->size_block) {
+			free(track->size_block);
+			track->size_block = NULL;
+		}
+		if (track->size_bits) {
+			free(track->size_bits);
+			track->size_bits = NULL;
+		}
+		if (track->size_stage) {
+			free(track->size_stage);
+			track->size_stage = NULL;
 		}
 		if (track->chunk_offset) {
 			free(track->chunk_offset);
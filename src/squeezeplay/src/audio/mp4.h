@@ -28,10 +28,24 @@ struct decode_mp4 {
 
 };
 
+/* sample table memory of the last file opened, and the cost of seeks */
+struct mp4_stats {
+	u32_t table_bytes;
+	u32_t flat_bytes;		/* as flat arrays */
+	u32_t seeks;
+	u32_t seek_failed;
+	u32_t seek_time;		/* us, total */
+	u32_t seek_time_max;		/* us */
+};
+
+extern struct mp4_stats mp4_stats;
+
 
 void mp4_init(struct decode_mp4 *mp4);
 size_t mp4_open(struct decode_mp4 *mp4);
 u8_t *mp4_read(struct decode_mp4 *mp4, int track, size_t *len, bool_t *streaming);
+int mp4_seek(struct decode_mp4 *mp4, int track, u32_t sample);
+u32_t mp4_sample(struct decode_mp4 *mp4, int track);
 void mp4_track_conf(struct decode_mp4 *mp4, int track, u8_t **conf, size_t *size);
 void mp4_free(struct decode_mp4 *mp4);
 int mp4_track_is_type(struct decode_mp4 *mp4, int track, const char *type);
@@ -14,6 +14,7 @@
 void mqueue_init(struct mqueue *mqueue, void *buffer, size_t buffer_size) {
 	fifo_init(&mqueue->fifo, buffer_size, false);
 	mqueue->buffer = buffer;
+	mqueue->wake = NULL;
 }
 
 
@@ -35,6 +36,16 @@ static void mqueue_read_buf(struct mqueue *mqueue, Uint8 *b, size_t n) {
 }
 
 
+/*
+ * Check the queue without locking it, the reader may call this holding
+ * the wake fifo. A request it misses is signalled on the wake fifo, which
+ * writers lock only after unlocking the queue.
+ */
+bool_t mqueue_is_empty(struct mqueue *mqueue) {
+	return fifo_bytes_used(&mqueue->fifo) == 0;
+}
+
+
 mqueue_func_t mqueue_read_request(struct mqueue *mqueue, Uint32 timeout) {
 	int err;
 
@@ -154,6 +165,14 @@ void mqueue_write_complete(struct mqueue *mqueue) {
 	/* Signal reader and unlock mutex */
 	fifo_signal(&mqueue->fifo);
 	fifo_unlock(&mqueue->fifo);
+
+	/* The wake fifo is locked after the queue is unlocked, the reader
+	 * may hold the wake fifo while checking the queue */
+	if (mqueue->wake) {
+		fifo_lock(mqueue->wake);
+		fifo_signal(mqueue->wake);
+		fifo_unlock(mqueue->wake);
+	}
 }
 
 
@@ -10,6 +10,10 @@
 struct mqueue {
 	char *buffer;
 	struct fifo fifo;
+
+	/* optional fifo also signalled when a request is queued, this lets
+	 * the reader wait on another condition */
+	struct fifo *wake;
 };
 
 typedef void (*mqueue_func_t)(void);
@@ -18,6 +22,7 @@ typedef void (*mqueue_func_t)(void);
 extern void mqueue_init(struct mqueue *mqueue, void *buffer, size_t buffer_size);
 
 extern mqueue_func_t mqueue_read_request(struct mqueue *mqueue, Uint32 timeout);
+extern bool_t mqueue_is_empty(struct mqueue *mqueue);
 
 extern Uint8 mqueue_read_u8(struct mqueue *mqueue);
 extern Uint16 mqueue_read_u16(struct mqueue *mqueue);
@@ -1013,7 +1013,7 @@ EXPORT void speex_resampler_get_rate(SpeexResamplerState *st, spx_uint32_t *in_r
 
 EXPORT int speex_resampler_set_rate_frac(SpeexResamplerState *st, spx_uint32_t ratio_num, spx_uint32_t ratio_den, spx_uint32_t in_rate, spx_uint32_t out_rate)
 {
-   spx_uint32_t fact;
+   spx_uint32_t fact, t;
    spx_uint32_t old_den;
    spx_uint32_t i;
    if (st->in_rate == in_rate && st->out_rate == out_rate && st->num_rate == ratio_num && st->den_rate == ratio_den)
@@ -1024,21 +1024,28 @@ EXPORT int speex_resampler_set_rate_frac(SpeexResamplerState *st, spx_uint32_t r
    st->out_rate = out_rate;
    st->num_rate = ratio_num;
    st->den_rate = ratio_den;
-   /* FIXME: This is terribly inefficient, but who cares (at least for now)? */
-   for (fact=2;fact<=IMIN(st->num_rate, st->den_rate);fact++)
+   /* Reduce by the greatest common divisor, the ratio may be fine
+      grained when it is used to correct clock drift */
+   fact = st->num_rate;
+   t = st->den_rate;
+   while (t)
    {
-      while ((st->num_rate % fact == 0) && (st->den_rate % fact == 0))
-      {
-         st->num_rate /= fact;
-         st->den_rate /= fact;
-      }
+      spx_uint32_t r = fact % t;
+      fact = t;
+      t = r;
+   }
+   if (fact > 1)
+   {
+      st->num_rate /= fact;
+      st->den_rate /= fact;
    }
       
    if (old_den > 0)
    {
       for (i=0;i<st->nb_channels;i++)
       {
-         st->samp_frac_num[i]=st->samp_frac_num[i]*st->den_rate/old_den;
+         /* 64 bit to avoid overflow with large denominators */
+         st->samp_frac_num[i]=(spx_uint32_t)(((unsigned long long)st->samp_frac_num[i]*st->den_rate)/old_den);
          /* Safety net */
          if (st->samp_frac_num[i] >= st->den_rate)
             st->samp_frac_num[i] = st->den_rate-1;
@@ -0,0 +1,26 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+/* Floating point build of the speex resampler, with a different prefix
+ * to the fixed point build. It is used to resample the decoded audio
+ * without losing the 24 bit samples, and to resample the sound effects
+ * once for the output rate.
+ */
+
+#ifndef OUTSIDE_SPEEX
+#define OUTSIDE_SPEEX
+#endif
+#ifndef EXPORT
+#define EXPORT
+#endif
+
+#undef FIXED_POINT
+#define FLOATING_POINT
+
+#undef RANDOM_PREFIX
+#define RANDOM_PREFIX jive_float
+
+#include "resample.c"
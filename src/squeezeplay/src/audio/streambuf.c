@@ -6,6 +6,8 @@
 
 #include "common.h"
 
+#include <ctype.h>
+
 #include "audio/fifo.h"
 #include "audio/streambuf.h"
 #include "audio/decode/decode.h"
@@ -20,9 +22,19 @@ typedef SOCKET socket_t;
 #define CLOSESOCKET(s) closesocket(s)
 #define SHUT_WR SD_SEND
 #define SOCKETERROR WSAGetLastError()
+#define strncasecmp _strnicmp
+#define strtoull _strtoui64
+
+/* only the first part is sent at a time */
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
 
 #else
 
+#include <sys/uio.h>
+
 typedef int socket_t;
 #define CLOSESOCKET(s) close(s)
 #define INVALID_SOCKET (-1)
@@ -40,6 +52,12 @@ static bool_t streambuf_loop = FALSE;
 static bool_t streambuf_streaming = FALSE;
 static u64_t streambuf_bytes_received = 0;
 
+/* The next track's stream is fed behind the current track once that has
+ * fully arrived. Reads for the current track stop at streambuf_next_ptr.
+ */
+static bool_t streambuf_has_next = FALSE;
+static size_t streambuf_next_ptr = 0;
+
 /* streambuf filter, used to parse metadata */
 static streambuf_filter_t streambuf_filter;
 static streambuf_filter_t streambuf_next_filter;
@@ -50,38 +68,120 @@ static bool_t streambuf_copyright;
 static u32_t icy_meta_interval;
 static s32_t icy_meta_remaining;
 
-struct chunk {
-	u8_t *buf;
-	size_t len;
+/* filter and metadata interval of the next track, these are only used
+ * once the decoder crosses the mark, the current track's tail must still
+ * be read with its own filter.
+ */
+static streambuf_filter_t streambuf_mark_filter;
+static u32_t icy_mark_interval;
+
+/* Proxy clients, the synchronized slave players, are served directly
+ * from the streambuf. Each client has its own cursor, proxy_wpos counts
+ * all bytes written to the streambuf so a cursor stays valid across
+ * streams while a client drains. The origin stream is only blocked when
+ * it would overwrite data the slowest client has not sent yet.
+ */
+#define PROXY_MAX_CLIENTS 8
+
+struct proxy_client {
+	socket_t fd;
+	bool_t header_done;
+	size_t header_sent;
+	u64_t pos;		/* next byte to send, in proxy_wpos units */
+	u64_t bytes_sent;
+	u64_t max_lag;		/* high water mark of bytes behind the origin */
+	u32_t stalls;		/* sends that would block */
 };
 
-static void proxy_chunk (u8_t *buf, size_t size, lua_State *L)
-{
-	if (L && size) {
-		struct chunk *chunk;
-		/*
-		 * Send chunk to proxy clients
-		 *
-		 * Relies on this being sent before wrap-around occurs
-		 * which is ensured by Playback.lua not scheduling any more reads
-		 * on the stream until the queued chunk (or, initially, chunks)
-		 * has been written to all proxy clients.
-		 *
-		 * At the start of a stream, there may be up to 3 queued chunks:
-		 * 	1. the header
-		 * 	2. the remains of the initial read up until fifo wrap-around
-		 * 	3. the remains of the initial read after fifo wrap-around
-		 */
-		/*  */
-		lua_getfield(L, 2, "_proxyQueueSegment");
-		lua_pushvalue(L, 2);
-		chunk = lua_newuserdata(L, sizeof(*chunk));
-		chunk->buf = buf;
-		chunk->len = size;
-		lua_call(L, 2, 0);
+static struct proxy_client proxy_clients[PROXY_MAX_CLIENTS];
+static int proxy_num_clients = 0;
+static u64_t proxy_wpos = 0;
+static u64_t proxy_stream_start = 0;
+static u8_t *proxy_header = NULL;
+static size_t proxy_header_len = 0;
+static bool_t proxy_valid = TRUE;
+
+
+/* bytes the origin can write without overtaking a proxy client */
+static size_t proxy_bytes_free(void) {
+	u64_t lag, max_lag = 0;
+	int i;
+
+	ASSERT_FIFO_LOCKED(&streambuf_fifo);
+
+	if (!proxy_num_clients) {
+		return STREAMBUF_SIZE;
+	}
+
+	for (i = 0; i < proxy_num_clients; i++) {
+		lag = proxy_wpos - proxy_clients[i].pos;
+		if (lag > max_lag) {
+			max_lag = lag;
+		}
+	}
+
+	if (max_lag >= STREAMBUF_SIZE - 1) {
+		return 0;
+	}
+	return STREAMBUF_SIZE - 1 - max_lag;
+}
+
+
+/* free space for the origin stream */
+static size_t streambuf_feed_freebytes(void) {
+	size_t n, p;
+
+	ASSERT_FIFO_LOCKED(&streambuf_fifo);
+
+	n = fifo_bytes_free(&streambuf_fifo);
+	p = proxy_bytes_free();
+
+	return (p < n) ? p : n;
+}
+
+
+static struct proxy_client *proxy_find(socket_t fd) {
+	int i;
+
+	for (i = 0; i < proxy_num_clients; i++) {
+		if (proxy_clients[i].fd == fd) {
+			return &proxy_clients[i];
+		}
+	}
+	return NULL;
+}
+
+
+static void proxy_set_header(u8_t *buf, size_t len) {
+	ASSERT_FIFO_LOCKED(&streambuf_fifo);
+
+	if (proxy_header) {
+		free(proxy_header);
+	}
+
+	proxy_header = malloc(len);
+	memcpy(proxy_header, buf, len);
+	proxy_header_len = len;
+}
+
+/* bytes of the current track in the streambuf, call with the fifo locked */
+static size_t streambuf_track_bytes(void) {
+	size_t n;
+
+	n = fifo_bytes_used(&streambuf_fifo);
+
+	if (streambuf_has_next) {
+		size_t left = (streambuf_next_ptr + streambuf_fifo.size - streambuf_fifo.rptr) % streambuf_fifo.size;
+
+		if (n > left) {
+			n = left;
+		}
 	}
+
+	return n;
 }
 
+
 size_t streambuf_get_size(void) {
 	return STREAMBUF_SIZE;
 }
@@ -115,7 +215,7 @@ size_t streambuf_get_usedbytes(void) {
 size_t streambuf_fast_usedbytes(void) {
 	ASSERT_FIFO_LOCKED(&streambuf_fifo);
 
-	return fifo_bytes_used(&streambuf_fifo);
+	return streambuf_track_bytes();
 }
 
 /* returns true if the stream is still open but cannot yet supply the requested bytes */
@@ -153,12 +253,101 @@ void streambuf_flush(void) {
 
 	streambuf_fifo.rptr = 0;
 	streambuf_fifo.wptr = 0;
+	streambuf_has_next = FALSE;
+
+	/* the proxy cursors no longer match the streambuf */
+	if (proxy_num_clients) {
+		proxy_valid = FALSE;
+	}
+
+	fifo_unlock(&streambuf_fifo);
+}
+
+
+/*
+ * The current track has fully arrived, the data fed from now on belongs to
+ * the next track.
+ */
+void streambuf_mark_next(void) {
+	fifo_lock(&streambuf_fifo);
+
+	streambuf_has_next = TRUE;
+	streambuf_next_ptr = streambuf_fifo.wptr;
+	streambuf_mark_filter = NULL;
+	icy_mark_interval = 0;
+
+	fifo_unlock(&streambuf_fifo);
+}
+
+
+/* returns true if the current track has been read up to the next track */
+bool_t streambuf_at_next(void) {
+	bool_t at_next;
+
+	fifo_lock(&streambuf_fifo);
+
+	at_next = streambuf_has_next && streambuf_fifo.rptr == streambuf_next_ptr;
+
+	fifo_unlock(&streambuf_fifo);
+
+	return at_next;
+}
+
+
+/*
+ * Start reading the next track, anything left of the current track is
+ * discarded.
+ */
+void streambuf_next_track(void) {
+	fifo_lock(&streambuf_fifo);
+
+	if (streambuf_has_next) {
+		streambuf_fifo.rptr = streambuf_next_ptr;
+		streambuf_has_next = FALSE;
+
+		streambuf_filter = streambuf_mark_filter;
+		streambuf_mark_filter = NULL;
+
+		if (icy_mark_interval) {
+			icy_meta_interval = icy_mark_interval;
+			icy_meta_remaining = icy_meta_interval;
+			icy_mark_interval = 0;
+		}
+
+		fifo_signal(&streambuf_fifo);
+	}
 
 	fifo_unlock(&streambuf_fifo);
 }
 
 
-static void streambuf_feedL(u8_t *buf, size_t size, lua_State *L) {
+/*
+ * Wake the decode thread if it waits for stream data that has arrived, or
+ * for a stream that has ended. Called with the fifo unlocked.
+ */
+static void streambuf_wake_decoder(void) {
+	size_t wait_bytes, n;
+
+	wait_bytes = decode_wait_stream_bytes;
+	if (!wait_bytes) {
+		return;
+	}
+
+	if (streambuf_streaming) {
+		fifo_lock(&streambuf_fifo);
+		n = fifo_bytes_used(&streambuf_fifo);
+		fifo_unlock(&streambuf_fifo);
+
+		if (n < wait_bytes) {
+			return;
+		}
+	}
+
+	decode_wake_stream();
+}
+
+
+void streambuf_feed(u8_t *buf, size_t size) {
 	size_t n;
 
 	fifo_lock(&streambuf_fifo);
@@ -176,18 +365,15 @@ static void streambuf_feedL(u8_t *buf, size_t size, lua_State *L) {
 
 		memcpy(streambuf_buf + streambuf_fifo.wptr, buf, n);
 
-		proxy_chunk(streambuf_buf + streambuf_fifo.wptr, n, L);
-
 		fifo_wptr_incby(&streambuf_fifo, n);
+		proxy_wpos += n;
 		buf  += n;
 		size -= n;
 	}
 
 	fifo_unlock(&streambuf_fifo);
-}
 
-void streambuf_feed(u8_t *buf, size_t size) {
-	streambuf_feedL(buf, size, 0);
+	streambuf_wake_decoder();
 }
 
 ssize_t streambuf_feed_fd(int fd, lua_State *L) {
@@ -197,7 +383,7 @@ ssize_t streambuf_feed_fd(int fd, lua_State *L) {
 
 	streambuf_streaming = TRUE;
 
-	size = fifo_bytes_free(&streambuf_fifo);
+	size = streambuf_feed_freebytes();
 	if (size < 4096) {
 		fifo_unlock(&streambuf_fifo);
 		return -ENOSPC; /* no space */
@@ -213,20 +399,21 @@ ssize_t streambuf_feed_fd(int fd, lua_State *L) {
 		streambuf_streaming = FALSE;
 
 		fifo_unlock(&streambuf_fifo);
+		streambuf_wake_decoder();
 		return -SOCKETERROR;
 	}
 	else if (n == 0) {
 		streambuf_streaming = FALSE;
 	}
 	else {
-		proxy_chunk(streambuf_buf + streambuf_fifo.wptr, n, L);
-
 		fifo_wptr_incby(&streambuf_fifo, n);
+		proxy_wpos += n;
 
 		streambuf_bytes_received += n;
 	}
 
 	fifo_unlock(&streambuf_fifo);
+	streambuf_wake_decoder();
 	return n;
 }
 
@@ -237,10 +424,11 @@ size_t streambuf_fast_read(u8_t *buf, size_t min, size_t max, bool_t *streaming)
 	ASSERT_FIFO_LOCKED(&streambuf_fifo);
 
 	if (streaming) {
-		*streaming = streambuf_streaming;
+		/* the current track's stream is complete */
+		*streaming = streambuf_streaming && !streambuf_has_next;
 	}
 
-	sz = fifo_bytes_used(&streambuf_fifo);
+	sz = streambuf_track_bytes();
 	if (sz < min) {
 		return 0; /* underrun */
 	}
@@ -316,6 +504,8 @@ void streambuf_set_copyright() {
 
 void streambuf_set_streaming(bool_t is_streaming) {
 	streambuf_streaming = is_streaming;
+
+	streambuf_wake_decoder();
 }
 
 
@@ -338,7 +528,7 @@ ssize_t streambuf_icy_filter(u8_t *buf, size_t min, size_t max, bool_t *streamin
 	 */
 	assert(min == 0);
 
-	avail = fifo_bytes_used(&streambuf_fifo);
+	avail = streambuf_track_bytes();
 	while (avail && n < max) {
 		if (icy_meta_remaining > 0) {
 			/* we're waiting for the metadata */
@@ -387,7 +577,7 @@ ssize_t streambuf_icy_filter(u8_t *buf, size_t min, size_t max, bool_t *streamin
 			icy_meta_remaining = icy_meta_interval;
 		}
 
-		avail = fifo_bytes_used(&streambuf_fifo);
+		avail = streambuf_track_bytes();
 	}
 
 	return n;
@@ -400,415 +590,1498 @@ bool_t streambuf_is_icy()
 }
 
 
+/* The stream is fetched with a small http client. The response headers
+ * are parsed here, so the stream can follow redirects, remove chunked
+ * transfer encoding and reconnect after the connection was dropped. The
+ * reconnect is driven by Playback.lua, which resolves the host names.
+ */
+#define STREAM_HTTP_HEADER_MAX 8192
+#define STREAM_HTTP_MAX_REDIRECTS 5
+#define STREAM_HTTP_MAX_RESUMES 5
+#define STREAM_HTTP_RESUME_DELAY 500 /* ms, times the resume attempt */
+#define STREAM_HTTP_RESUME_RESET (64 * 1024) /* bytes before resuming is retried afresh */
+
+enum stream_chunk_state {
+	CHUNK_SIZE = 0,
+	CHUNK_EXT,
+	CHUNK_DATA,
+	CHUNK_DATA_END,
+	CHUNK_TRAILER,
+	CHUNK_DONE,
+};
+
 struct stream {
 	socket_t fd;
-	int num_crlf;
+	struct sockaddr_in addr;
+
+	/* request, kept to reconnect */
+	char *request;
+	bool_t http;
 
-	/* save http headers or body */
-	u8_t *body;
-	int body_len;
+	/* response headers */
+	char header[STREAM_HTTP_HEADER_MAX + 1];
+	size_t header_len;
+	bool_t header_done;
+
+	int status;
+	char *location;
+	bool_t icy;
+	bool_t accept_ranges;
+	u64_t content_length;	/* of the resource, 0 if unknown */
+	u64_t body_offset;	/* of the next body byte in the resource */
+	u64_t discard;		/* bytes to drop from a resumed response */
+
+	/* chunked transfer encoding */
+	bool_t chunked;
+	enum stream_chunk_state chunk_state;
+	u32_t chunk_remaining;
+	int trailer_len;
+
+	/* icy position in the stream, so the icy filter stays aligned when
+	 * a live stream is reconnected */
+	u32_t icy_metaint;
+	u32_t icy_audio_remaining;
+	u32_t icy_meta_remaining;
+	u32_t pad_remaining;
+
+	/* reconnect state */
+	bool_t resuming;
+	int redirects;
+	int resumes;
+	bool_t got_body;
+	u32_t body_bytes;	/* of this connection */
+	u32_t connect_jiffies;
+	u32_t drop_jiffies;
 };
 
+/* http statistics of the current stream */
+static struct {
+	int status;
+	u32_t ttfb;		/* ms from connect to the first body byte */
+	u32_t redirects;
+	u32_t rebuffers;	/* dropped connections that were resumed */
+	u32_t rebuffer_time;	/* ms from the last drop to the first byte again */
+	u32_t rebuffer_total;
+} stream_http_stats;
 
-static int stream_load_loopL(lua_State *L) {
-	int fd;
-	ssize_t n, len;
-	char *filename;
 
-	/*
-	 * 1: self
-	 * 2: file
-	 */
+/* returns the value if line is the header name, or NULL */
+static char *stream_http_header_value(char *line, const char *name) {
+	size_t len = strlen(name);
 
-	filename = alloca(PATH_MAX);
-	if (!squeezeplay_find_file(lua_tostring(L, 2), filename)) {
-		LOG_ERROR(log_audio_decode, "Can't find image %s\n", lua_tostring(L, 2));
-		return 0;
+	if (strncasecmp(line, name, len) != 0 || line[len] != ':') {
+		return NULL;
 	}
 
-
-	if ((fd = open(filename, O_RDONLY)) < 0) {
-		LOG_ERROR(log_audio_decode, "Can't open %s", lua_tostring(L, 2));
-		return 0;
+	line += len + 1;
+	while (*line == ' ' || *line == '\t') {
+		line++;
 	}
+	return line;
+}
 
-	fifo_lock(&streambuf_fifo);
-
-	streambuf_lptr = streambuf_fifo.wptr;
-	streambuf_loop = TRUE;
 
-	n = fifo_bytes_free(&streambuf_fifo);
-	if ((len = read(fd, streambuf_buf + streambuf_fifo.wptr, n)) < 0) {
-		goto read_err;
-	}
-	fifo_wptr_incby(&streambuf_fifo, len);
+/* find the end of the header block, returns its length or 0 */
+static size_t stream_http_header_end(const char *buf, size_t len) {
+	size_t i;
 
-	n = fifo_bytes_free(&streambuf_fifo);
-	if (n) {
-		if ((n = read(fd, streambuf_buf + streambuf_fifo.wptr, n)) < 0) {
-			goto read_err;
+	for (i = 0; i < len; i++) {
+		if (buf[i] != '\n') {
+			continue;
+		}
+		if (i + 1 < len && buf[i + 1] == '\n') {
+			return i + 2;
+		}
+		if (i + 2 < len && buf[i + 1] == '\r' && buf[i + 2] == '\n') {
+			return i + 3;
 		}
-		fifo_wptr_incby(&streambuf_fifo, n);
-		len += n;
 	}
-
-	streambuf_streaming = FALSE;
-	streambuf_bytes_received = len;
-	streambuf_filter = streambuf_next_filter;
-	streambuf_next_filter = NULL;
-
-	fifo_unlock(&streambuf_fifo);
-	close(fd);
-
-	return 0;
-
- read_err:
-	fifo_unlock(&streambuf_fifo);
-	close(fd);
-
 	return 0;
 }
 
 
-static int stream_connectL(lua_State *L) {
-
-	/*
-	 * 1: self
-	 * 2: server_ip
-	 * 3: server_port
-	 */
-
-	struct sockaddr_in serv_addr;
-	struct stream *stream;
-	int flags;
-	int err;
-	socket_t fd;
+/*
+ * Replace, add or with a NULL value remove a header in a request or
+ * response header block. Returns a new block, the old one is freed.
+ */
+static char *stream_http_set_header(char *block, const char *name, const char *value) {
+	char *line, *next, *end, *new_block;
+	size_t len, name_len = strlen(name);
+
+	/* remove the header, the first line is the request or status line */
+	line = strchr(block, '\n');
+	while (line && *(++line) && *line != '\r' && *line != '\n') {
+		next = strchr(line, '\n');
+		if (!next) {
+			break;
+		}
 
-	/* Server address and port */
-	memset(&serv_addr, 0, sizeof(serv_addr));
-	if (lua_type(L, 2) == LUA_TSTRING) {
-		serv_addr.sin_addr.s_addr = inet_addr(luaL_checkstring(L, 2));
-	}
-	else {
-		serv_addr.sin_addr.s_addr = htonl(luaL_checkinteger(L, 2));
+		if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+			memmove(line, next + 1, strlen(next + 1) + 1);
+			line--;
+		}
+		else {
+			line = next;
+		}
 	}
-	serv_addr.sin_port = htons(luaL_checkinteger(L, 3));
-	serv_addr.sin_family = AF_INET;
-
 
-	LOG_DEBUG(log_audio_decode, "streambuf connect %s:%d", inet_ntoa(serv_addr.sin_addr), ntohs(serv_addr.sin_port));
-
-	/* Create socket */
-	fd = socket(AF_INET, SOCK_STREAM, 0);
-	if (fd == INVALID_SOCKET) {
-		lua_pushnil(L);
-		lua_pushstring(L, strerror(SOCKETERROR));
-		return 2;
+	if (!value) {
+		return block;
 	}
 
-	/* Make socket non-blocking */
-#if defined(WIN32)
-	{
-		u_long iMode = 0;
-		flags = ioctlsocket(fd, FIONBIO, &iMode);
+	/* add it before the blank line */
+	end = strstr(block, "\r\n\r\n");
+	end = end ? end + 2 : strstr(block, "\n\n");
+	if (!end) {
+		return block;
 	}
-#else
-	flags = fcntl(fd, F_GETFL, 0);
-	flags |= O_NONBLOCK;
-	fcntl(fd, F_SETFL, flags);
-#endif
-
-	/* Connect socket */
-	err = connect(fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
-	if (err != 0
-#if !defined(WIN32)
-		&&  SOCKETERROR != EINPROGRESS
-#endif
-		) {
-		CLOSESOCKET(fd);
-
-		lua_pushnil(L);
-		lua_pushstring(L, strerror(SOCKETERROR));
-		return 2;
+	if (*end == '\n') {
+		end++;
 	}
 
-	/* Stream object */
-	stream = lua_newuserdata(L, sizeof(struct stream));
+	len = strlen(block) + name_len + strlen(value) + 5;
+	new_block = malloc(len);
 
-	memset(stream, 0, sizeof(*stream));
-	stream->fd = fd;
+	memcpy(new_block, block, end - block);
+	sprintf(new_block + (end - block), "%s: %s\r\n%s", name, value, end);
 
-	luaL_getmetatable(L, "squeezeplay.stream");
-	lua_setmetatable(L, -2);
+	free(block);
+	return new_block;
+}
 
-	fifo_lock(&streambuf_fifo);
 
-	streambuf_loop = FALSE;
-	streambuf_bytes_received = 0;
-	streambuf_copyright = FALSE;
-	streambuf_filter = streambuf_next_filter;
-	streambuf_next_filter = NULL;
+/* replace the request target, the path in the request line */
+static char *stream_http_set_target(char *request, const char *target) {
+	char *start, *end, *new_request;
 
-	fifo_unlock(&streambuf_fifo);
+	start = strchr(request, ' ');
+	end = start ? strchr(start + 1, ' ') : NULL;
+	if (!end) {
+		return request;
+	}
 
-	return 1;
-}
+	new_request = malloc(strlen(request) - (end - start - 1) + strlen(target) + 1);
+	memcpy(new_request, request, start + 1 - request);
+	sprintf(new_request + (start + 1 - request), "%s%s", target, end);
 
+	free(request);
+	return new_request;
+}
 
-static int stream_disconnectL(lua_State *L) {
-	struct stream *stream;
 
-	/*
-	 * 1: self
-	 */
+/*
+ * Split an absolute http or a relative location into host[:port] and the
+ * path, hostport is empty for a relative location. Returns false if the
+ * location can't be followed, https for example.
+ */
+static bool_t stream_http_parse_location(const char *location, char *hostport, size_t size, const char **path) {
+	const char *ptr;
+	size_t len;
 
-	stream = lua_touserdata(L, 1);
+	hostport[0] = '\0';
 
-	if (stream->body) {
-		free(stream->body);
-		stream->body = NULL;
-		stream->body_len = 0;
+	if (location[0] == '/') {
+		*path = location;
+		return true;
 	}
 
-	if (stream->fd) {
-		CLOSESOCKET(stream->fd);
-		stream->fd = 0;
+	if (strncasecmp(location, "http://", 7) != 0) {
+		return false;
 	}
 
-	return 0;
-}
+	location += 7;
+	ptr = strchr(location, '/');
+	*path = ptr ? ptr : "/";
 
+	len = ptr ? (size_t)(ptr - location) : strlen(location);
+	if (len == 0 || len >= size) {
+		return false;
+	}
 
-static int stream_flushL(lua_State *L) {
-	streambuf_flush();
-	return 0;
-}
+	memcpy(hostport, location, len);
+	hostport[len] = '\0';
 
+	return true;
+}
 
-static int stream_getfdL(lua_State *L) {
-	struct stream *stream;
 
-	/*
-	 * 1: self
-	 */
+/*
+ * Parse the response headers, headers is a copy that is modified. Returns
+ * false on a malformed status line or a resume that doesn't match.
+ */
+static bool_t stream_http_parse_headers(struct stream *stream, char *headers) {
+	char *line, *next, *value;
+	u64_t range_start = 0, range_total = 0;
+
+	if (!stream->resuming) {
+		stream->icy = FALSE;
+		stream->icy_metaint = 0;
+		stream->accept_ranges = FALSE;
+		stream->content_length = 0;
+		stream->body_offset = 0;
+	}
 
-	stream = lua_touserdata(L, 1);
+	stream->status = 0;
+	stream->chunked = FALSE;
+	stream->chunk_state = CHUNK_SIZE;
+	stream->chunk_remaining = 0;
+	if (stream->location) {
+		free(stream->location);
+		stream->location = NULL;
+	}
 
-	if (stream->fd > 0) {
-		lua_pushinteger(L, stream->fd);
+	/* HTTP/1.x nnn or ICY nnn */
+	line = headers;
+	value = strchr(line, ' ');
+	if (!value) {
+		return false;
 	}
-	else {
+	stream->status = strtoul(value + 1, NULL, 10);
+	if (strncmp(line, "ICY", 3) == 0) {
+		stream->icy = TRUE;
+	}
+
+	for (line = strchr(line, '\n'); line && *(++line); line = next) {
+		next = strchr(line, '\n');
+		if (next) {
+			*next = '\0';
+			if (next > line && *(next - 1) == '\r') {
+				*(next - 1) = '\0';
+			}
+		}
+
+		if ((value = stream_http_header_value(line, "Location"))) {
+			stream->location = strdup(value);
+		}
+		else if ((value = stream_http_header_value(line, "Transfer-Encoding"))) {
+			stream->chunked = (strncasecmp(value, "chunked", 7) == 0);
+		}
+		else if ((value = stream_http_header_value(line, "Content-Length"))) {
+			if (!stream->resuming && stream->status == 200) {
+				stream->content_length = strtoull(value, NULL, 10);
+			}
+		}
+		else if ((value = stream_http_header_value(line, "Content-Range"))) {
+			/* bytes start-end/total */
+			if (strncasecmp(value, "bytes ", 6) == 0) {
+				range_start = strtoull(value + 6, NULL, 10);
+				value = strchr(value, '/');
+				if (value && value[1] != '*') {
+					range_total = strtoull(value + 1, NULL, 10);
+				}
+			}
+		}
+		else if ((value = stream_http_header_value(line, "Accept-Ranges"))) {
+			stream->accept_ranges = (strncasecmp(value, "bytes", 5) == 0);
+		}
+		else if ((value = stream_http_header_value(line, "icy-metaint"))) {
+			stream->icy = TRUE;
+			stream->icy_metaint = strtoul(value, NULL, 10);
+		}
+		else if (strncasecmp(line, "icy-", 4) == 0) {
+			stream->icy = TRUE;
+		}
+
+		if (!next) {
+			break;
+		}
+	}
+
+	if (stream->status == 206) {
+		if (stream->resuming) {
+			/* the resumed range must continue the stream */
+			if (range_start != stream->body_offset) {
+				LOG_WARN(log_audio_decode, "resumed at %llu, expected %llu", (unsigned long long)range_start, (unsigned long long)stream->body_offset);
+				return false;
+			}
+		}
+		else {
+			stream->body_offset = range_start;
+			stream->content_length = range_total;
+		}
+		stream->accept_ranges = TRUE;
+	}
+	else if (stream->status == 200 && stream->resuming && !stream->icy) {
+		/* the range was ignored, skip what was already received */
+		stream->discard = stream->body_offset;
+		stream->body_offset = 0;
+	}
+
+	return true;
+}
+
+
+static bool_t stream_http_is_redirect(struct stream *stream) {
+	switch (stream->status) {
+	case 301:
+	case 302:
+	case 303:
+	case 307:
+	case 308:
+		return stream->location != NULL;
+	default:
+		return false;
+	}
+}
+
+
+/* has the whole response body been received? */
+static bool_t stream_http_complete(struct stream *stream) {
+	if (stream->chunked) {
+		return stream->chunk_state == CHUNK_DONE;
+	}
+	if (stream->content_length) {
+		return stream->body_offset >= stream->content_length;
+	}
+
+	/* no length, only a live stream is incomplete */
+	return !stream->icy;
+}
+
+
+/* track the icy metadata position in body data fed to the streambuf */
+static void stream_http_icy_track(struct stream *stream, u8_t *buf, size_t len) {
+	size_t n;
+
+	while (len) {
+		if (stream->icy_audio_remaining) {
+			n = stream->icy_audio_remaining;
+			if (n > len) {
+				n = len;
+			}
+			stream->icy_audio_remaining -= n;
+		}
+		else if (stream->icy_meta_remaining) {
+			n = stream->icy_meta_remaining;
+			if (n > len) {
+				n = len;
+			}
+			stream->icy_meta_remaining -= n;
+			if (!stream->icy_meta_remaining) {
+				stream->icy_audio_remaining = stream->icy_metaint;
+			}
+		}
+		else {
+			/* metadata length byte */
+			n = 1;
+			stream->icy_meta_remaining = *buf * 16;
+			if (!stream->icy_meta_remaining) {
+				stream->icy_audio_remaining = stream->icy_metaint;
+			}
+		}
+
+		buf += n;
+		len -= n;
+	}
+}
+
+
+/* account for body bytes that were fed to the streambuf */
+static void stream_http_body_fed(struct stream *stream, u8_t *buf, size_t len) {
+	if (!stream->got_body) {
+		u32_t now = jive_jiffies();
+
+		stream->got_body = TRUE;
+
+		if (stream->resuming) {
+			stream_http_stats.rebuffer_time = now - stream->drop_jiffies;
+			stream_http_stats.rebuffer_total += stream_http_stats.rebuffer_time;
+
+			LOG_INFO(log_audio_decode, "stream resumed at %llu after %ums", (unsigned long long)stream->body_offset, stream_http_stats.rebuffer_time);
+		}
+		else {
+			stream_http_stats.ttfb = now - stream->connect_jiffies;
+
+			LOG_DEBUG(log_audio_decode, "time to first byte %ums", stream_http_stats.ttfb);
+		}
+	}
+
+	/* data is flowing again */
+	stream->body_bytes += len;
+	if (stream->body_bytes >= STREAM_HTTP_RESUME_RESET) {
+		stream->resumes = 0;
+	}
+
+	if (stream->icy_metaint) {
+		stream_http_icy_track(stream, buf, len);
+	}
+	stream->body_offset += len;
+}
+
+
+/* feed body data, dropping any bytes already received before a resume */
+static void stream_http_body(struct stream *stream, u8_t *buf, size_t len) {
+	if (stream->discard) {
+		size_t n = (stream->discard < len) ? stream->discard : len;
+
+		stream->discard -= n;
+		stream->body_offset += n;
+		buf += n;
+		len -= n;
+	}
+
+	if (!len) {
+		return;
+	}
+
+	streambuf_feed(buf, len);
+	stream_http_body_fed(stream, buf, len);
+}
+
+
+/* remove the chunked transfer encoding, returns false on a bad chunk */
+static bool_t stream_http_dechunk(struct stream *stream, u8_t *buf, size_t len) {
+	size_t n;
+	int c;
+
+	while (len) {
+		switch (stream->chunk_state) {
+		case CHUNK_SIZE:
+			c = *buf;
+			if (isxdigit(c) && stream->chunk_remaining < 0x1000000) {
+				stream->chunk_remaining = (stream->chunk_remaining << 4)
+					| (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+			}
+			else if (c == '\n') {
+				stream->chunk_state = (stream->chunk_remaining) ? CHUNK_DATA : CHUNK_TRAILER;
+				stream->trailer_len = 0;
+			}
+			else if (c == ';') {
+				stream->chunk_state = CHUNK_EXT;
+			}
+			else if (c != '\r' && c != ' ') {
+				return false;
+			}
+			buf++;
+			len--;
+			break;
+
+		case CHUNK_EXT:
+			if (*buf == '\n') {
+				stream->chunk_state = (stream->chunk_remaining) ? CHUNK_DATA : CHUNK_TRAILER;
+				stream->trailer_len = 0;
+			}
+			buf++;
+			len--;
+			break;
+
+		case CHUNK_DATA:
+			n = stream->chunk_remaining;
+			if (n > len) {
+				n = len;
+			}
+
+			stream_http_body(stream, buf, n);
+
+			stream->chunk_remaining -= n;
+			if (!stream->chunk_remaining) {
+				stream->chunk_state = CHUNK_DATA_END;
+			}
+			buf += n;
+			len -= n;
+			break;
+
+		case CHUNK_DATA_END:
+			if (*buf == '\n') {
+				stream->chunk_state = CHUNK_SIZE;
+			}
+			buf++;
+			len--;
+			break;
+
+		case CHUNK_TRAILER:
+			/* trailers end with a blank line */
+			if (*buf == '\n') {
+				if (stream->trailer_len == 0) {
+					stream->chunk_state = CHUNK_DONE;
+				}
+				stream->trailer_len = 0;
+			}
+			else if (*buf != '\r') {
+				stream->trailer_len++;
+			}
+			buf++;
+			len--;
+			break;
+
+		case CHUNK_DONE:
+			return true;
+		}
+	}
+
+	return true;
+}
+
+
+static int stream_load_loopL(lua_State *L) {
+	int fd;
+	ssize_t n, len;
+	char *filename;
+
+	/*
+	 * 1: self
+	 * 2: file
+	 */
+
+	filename = alloca(PATH_MAX);
+	if (!squeezeplay_find_file(lua_tostring(L, 2), filename)) {
+		LOG_ERROR(log_audio_decode, "Can't find image %s\n", lua_tostring(L, 2));
+		return 0;
+	}
+
+
+	if ((fd = open(filename, O_RDONLY)) < 0) {
+		LOG_ERROR(log_audio_decode, "Can't open %s", lua_tostring(L, 2));
+		return 0;
+	}
+
+	fifo_lock(&streambuf_fifo);
+
+	streambuf_lptr = streambuf_fifo.wptr;
+	streambuf_loop = TRUE;
+
+	if (proxy_num_clients) {
+		proxy_valid = FALSE;
+	}
+
+	n = fifo_bytes_free(&streambuf_fifo);
+	if ((len = read(fd, streambuf_buf + streambuf_fifo.wptr, n)) < 0) {
+		goto read_err;
+	}
+	fifo_wptr_incby(&streambuf_fifo, len);
+
+	n = fifo_bytes_free(&streambuf_fifo);
+	if (n) {
+		if ((n = read(fd, streambuf_buf + streambuf_fifo.wptr, n)) < 0) {
+			goto read_err;
+		}
+		fifo_wptr_incby(&streambuf_fifo, n);
+		len += n;
+	}
+
+	streambuf_streaming = FALSE;
+	streambuf_bytes_received = len;
+	streambuf_filter = streambuf_next_filter;
+	streambuf_next_filter = NULL;
+
+	fifo_unlock(&streambuf_fifo);
+	close(fd);
+
+	streambuf_wake_decoder();
+
+	return 0;
+
+ read_err:
+	fifo_unlock(&streambuf_fifo);
+	close(fd);
+
+	return 0;
+}
+
+
+/* open a non-blocking connection to addr */
+static socket_t stream_open(struct sockaddr_in *addr) {
+	int flags;
+	int err;
+	socket_t fd;
+
+	LOG_DEBUG(log_audio_decode, "streambuf connect %s:%d", inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+
+	/* Create socket */
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == INVALID_SOCKET) {
+		return INVALID_SOCKET;
+	}
+
+	/* Make socket non-blocking */
+#if defined(WIN32)
+	{
+		u_long iMode = 0;
+		flags = ioctlsocket(fd, FIONBIO, &iMode);
+	}
+#else
+	flags = fcntl(fd, F_GETFL, 0);
+	flags |= O_NONBLOCK;
+	fcntl(fd, F_SETFL, flags);
+#endif
+
+	/* Connect socket */
+	err = connect(fd, (struct sockaddr *)addr, sizeof(*addr));
+	if (err != 0
+#if !defined(WIN32)
+		&&  SOCKETERROR != EINPROGRESS
+#endif
+		) {
+		CLOSESOCKET(fd);
+		return INVALID_SOCKET;
+	}
+
+	return fd;
+}
+
+
+static void stream_addr(lua_State *L, int idx, struct sockaddr_in *addr) {
+	memset(addr, 0, sizeof(*addr));
+	if (lua_type(L, idx) == LUA_TSTRING) {
+		addr->sin_addr.s_addr = inet_addr(luaL_checkstring(L, idx));
+	}
+	else {
+		addr->sin_addr.s_addr = htonl(luaL_checkinteger(L, idx));
+	}
+	addr->sin_port = htons(luaL_checkinteger(L, idx + 1));
+	addr->sin_family = AF_INET;
+}
+
+
+static int stream_connectL(lua_State *L) {
+
+	/*
+	 * 1: self
+	 * 2: server_ip
+	 * 3: server_port
+	 * 4: http, follow redirects and resume the stream
+	 */
+
+	struct sockaddr_in serv_addr;
+	struct stream *stream;
+	socket_t fd;
+
+	/* Server address and port */
+	stream_addr(L, 2, &serv_addr);
+
+	fd = stream_open(&serv_addr);
+	if (fd == INVALID_SOCKET) {
+		lua_pushnil(L);
+		lua_pushstring(L, strerror(SOCKETERROR));
+		return 2;
+	}
+
+	/* Stream object */
+	stream = lua_newuserdata(L, sizeof(struct stream));
+
+	memset(stream, 0, sizeof(*stream));
+	stream->fd = fd;
+	stream->addr = serv_addr;
+	stream->http = lua_toboolean(L, 4);
+	stream->connect_jiffies = jive_jiffies();
+
+	luaL_getmetatable(L, "squeezeplay.stream");
+	lua_setmetatable(L, -2);
+
+	fifo_lock(&streambuf_fifo);
+
+	streambuf_loop = FALSE;
+	streambuf_bytes_received = 0;
+	streambuf_copyright = FALSE;
+
+	/* with a next track the current track's tail is still read */
+	if (streambuf_has_next) {
+		streambuf_mark_filter = streambuf_next_filter;
+	}
+	else {
+		streambuf_filter = streambuf_next_filter;
+	}
+	streambuf_next_filter = NULL;
+
+	/* new proxy clients start with this stream */
+	proxy_stream_start = proxy_wpos;
+	if (proxy_header) {
+		free(proxy_header);
+		proxy_header = NULL;
+		proxy_header_len = 0;
+	}
+
+	memset(&stream_http_stats, 0, sizeof(stream_http_stats));
+
+	fifo_unlock(&streambuf_fifo);
+
+	return 1;
+}
+
+
+static int stream_disconnectL(lua_State *L) {
+	struct stream *stream;
+
+	/*
+	 * 1: self
+	 */
+
+	stream = lua_touserdata(L, 1);
+
+	if (stream->request) {
+		free(stream->request);
+		stream->request = NULL;
+	}
+
+	if (stream->location) {
+		free(stream->location);
+		stream->location = NULL;
+	}
+
+	if (stream->fd) {
+		CLOSESOCKET(stream->fd);
+		stream->fd = 0;
+	}
+
+	return 0;
+}
+
+
+static int stream_flushL(lua_State *L) {
+	streambuf_flush();
+	return 0;
+}
+
+
+static int stream_getfdL(lua_State *L) {
+	struct stream *stream;
+
+	/*
+	 * 1: self
+	 */
+
+	stream = lua_touserdata(L, 1);
+
+	if (stream->fd > 0) {
+		lua_pushinteger(L, stream->fd);
+	}
+	else {
+		lua_pushnil(L);
+	}
+	return 1;
+}
+
+
+/* the response headers are complete */
+static int stream_headersL(lua_State *L, struct stream *stream) {
+	char *headers;
+	bool_t ok;
+
+	headers = malloc(stream->header_len + 1);
+	memcpy(headers, stream->header, stream->header_len);
+	headers[stream->header_len] = '\0';
+
+	ok = stream_http_parse_headers(stream, headers);
+	free(headers);
+
+	if (!ok) {
+		lua_pushnil(L);
+		lua_pushstring(L, "bad http response");
+		return 2;
+	}
+
+	stream_http_stats.status = stream->status;
+
+	/* the redirect is followed by Playback, the body is not used */
+	if (stream->http && stream_http_is_redirect(stream)) {
+		const char *path;
+		char hostport[256];
+
+		if (stream->redirects < STREAM_HTTP_MAX_REDIRECTS
+		    && stream_http_parse_location(stream->location, hostport, sizeof(hostport), &path)) {
+			LOG_DEBUG(log_audio_decode, "redirect %d to %s", stream->status, stream->location);
+
+			lua_pushboolean(L, FALSE);
+			return 1;
+		}
+	}
+
+	if (stream->resuming) {
+		/* the server and proxy clients already have the headers */
+		if (stream->status != 200 && stream->status != 206) {
+			lua_pushnil(L);
+			lua_pushfstring(L, "resume failed with status %d", stream->status);
+			return 2;
+		}
+		return 0;
+	}
+
+	/* the icy filter starts with the first metadata interval */
+	stream->icy_audio_remaining = stream->icy_metaint;
+
+	/* Send headers to SqueezeCenter */
+	lua_getfield(L, 2, "_streamHttpHeaders");
+	lua_pushvalue(L, 2);
+	lua_pushlstring(L, stream->header, stream->header_len);
+	lua_call(L, 2, 0);
+
+	/* Send headers to proxy clients, they get the body without the
+	 * chunked encoding */
+	headers = malloc(stream->header_len + 1);
+	memcpy(headers, stream->header, stream->header_len);
+	headers[stream->header_len] = '\0';
+	if (stream->chunked) {
+		headers = stream_http_set_header(headers, "Transfer-Encoding", NULL);
+	}
+
+	fifo_lock(&streambuf_fifo);
+	proxy_set_header((u8_t *)headers, strlen(headers));
+	fifo_unlock(&streambuf_fifo);
+
+	free(headers);
+
+	return 0;
+}
+
+
+static int stream_readL(lua_State *L) {
+	struct stream *stream;
+	u8_t buf[4096];
+	u8_t *buf_ptr;
+	size_t header_end, free_bytes;
+	ssize_t n;
+	int r;
+
+	/*
+	 * 1: Stream (self)
+	 * 2: Playback (self)
+	 */
+
+	stream = lua_touserdata(L, 1);
+
+	/* keep the icy metadata aligned after reconnecting a live stream */
+	if (stream->pad_remaining) {
+		fifo_lock(&streambuf_fifo);
+		free_bytes = streambuf_feed_freebytes();
+		fifo_unlock(&streambuf_fifo);
+
+		n = (free_bytes < stream->pad_remaining) ? free_bytes : stream->pad_remaining;
+		if (n > (ssize_t)sizeof(buf)) {
+			n = sizeof(buf);
+		}
+
+		memset(buf, 0, n);
+		streambuf_feed(buf, n);
+		stream->pad_remaining -= n;
+
+		lua_pushinteger(L, n);
+		return 1;
+	}
+
+	/* shortcut, just read to streambuf */
+	if (stream->header_done && !stream->chunked && !stream->discard) {
+		n = streambuf_feed_fd(stream->fd, L);
+		if (n == 0) {
+			/* closed */
+			lua_pushboolean(L, FALSE);
+			return 1;
+		}
+
+		if (n == -ENOSPC) {
+			lua_pushinteger(L, 0);
+			return 1;
+		}
+
+		if (n < 0) {
+			CLOSESOCKET(stream->fd);
+			stream->fd = 0;
+
+			lua_pushnil(L);
+			lua_pushstring(L, strerror(-n));
+			return 2;
+
+		}
+
+		/* the data is in one piece before the write pointer */
+		stream_http_body_fed(stream, streambuf_buf + ((streambuf_fifo.wptr + STREAMBUF_SIZE - n) % STREAMBUF_SIZE), n);
+
+		lua_pushinteger(L, n);
+		return 1;
+	}
+
+	/* read buffer, but we must not overflow the stream fifo */
+	fifo_lock(&streambuf_fifo);
+	free_bytes = streambuf_feed_freebytes();
+	fifo_unlock(&streambuf_fifo);
+
+	if (stream->header_done) {
+		if (free_bytes > sizeof(buf)) {
+			free_bytes = sizeof(buf);
+		}
+		buf_ptr = buf;
+	}
+	else {
+		/* the body data that follows the headers is fed from here */
+		if (free_bytes > STREAM_HTTP_HEADER_MAX - stream->header_len) {
+			free_bytes = STREAM_HTTP_HEADER_MAX - stream->header_len;
+		}
+		buf_ptr = (u8_t *)stream->header + stream->header_len;
+	}
+
+	if (free_bytes == 0) {
+		lua_pushinteger(L, 0);
+		return 1;
+	}
+
+	n = recv(stream->fd, buf_ptr, free_bytes, 0);
+
+	/* socket closed */
+	if (n == 0) {
+		lua_pushboolean(L, FALSE);
+		return 1;
+	}
+
+	/* socket error */
+	if (n < 0) {
+		// XXXX do we need to handle timeout here?
+		CLOSESOCKET(stream->fd);
+		stream->fd = 0;
+
+		lua_pushnil(L);
+		lua_pushstring(L, strerror(SOCKETERROR));
+		return 2;
+	}
+
+
+	/* read http header */
+	if (!stream->header_done) {
+		size_t scan = (stream->header_len > 2) ? stream->header_len - 2 : 0;
+
+		stream->header_len += n;
+
+		header_end = stream_http_header_end(stream->header + scan, stream->header_len - scan);
+		if (!header_end) {
+			if (stream->header_len == STREAM_HTTP_HEADER_MAX) {
+				lua_pushnil(L);
+				lua_pushstring(L, "http headers too long");
+				return 2;
+			}
+
+			lua_pushboolean(L, TRUE);
+			return 1;
+		}
+		header_end += scan;
+
+		buf_ptr = (u8_t *)stream->header + header_end;
+		n = stream->header_len - header_end;
+
+		stream->header_len = header_end;
+		stream->header_done = TRUE;
+
+		//LOG_DEBUG(log_audio_decode, "headers %d %*s\n", header_end, header_end, stream->header);
+
+		r = stream_headersL(L, stream);
+		if (r) {
+			return r;
+		}
+
+		/* we need to loop when playing sound effects, so we need to remember where the stream starts */
+		if (!stream->resuming) {
+			streambuf_lptr = streambuf_fifo.wptr;
+		}
+	}
+
+	/* feed remaining buffer */
+	if (stream->chunked) {
+		if (!stream_http_dechunk(stream, buf_ptr, n)) {
+			lua_pushnil(L);
+			lua_pushstring(L, "bad http chunk");
+			return 2;
+		}
+	}
+	else {
+		stream_http_body(stream, buf_ptr, n);
+	}
+
+	lua_pushboolean(L, TRUE);
+	return 1;
+}
+
+
+static int stream_writeL(lua_State *L) {
+	struct stream *stream;
+	const char *header;
+	ssize_t n;
+	size_t len;
+
+	/*
+	 * 1: Stream (self)
+	 * 2: Playback (self)
+	 * 3: header
+	 */
+
+	stream = lua_touserdata(L, 1);
+	header = lua_tolstring(L, 3, &len);
+
+	/* keep the request to reconnect */
+	if (stream->http) {
+		if (stream->request) {
+			free(stream->request);
+		}
+		stream->request = strdup(header);
+	}
+
+	while (len > 0) {
+		n = send(stream->fd, header, len, 0);
+
+		if (n < 0) {
+			CLOSESOCKET(stream->fd);
+
+			lua_pushnil(L);
+			lua_pushstring(L, strerror(SOCKETERROR));
+			return 2;
+		}
+
+		len -= n;
+	}
+
+	/*
+	if (shutdown(stream->fd, SHUT_WR) != 0) {
+		CLOSESOCKET(stream->fd);
+
 		lua_pushnil(L);
+		lua_pushstring(L, strerror(SOCKETERROR));
+		return 2;
 	}
+	*/
+
+	lua_pushboolean(L, TRUE);
 	return 1;
 }
 
 
-static int stream_readL(lua_State *L) {
+/*
+ * After a redirect or a dropped connection, work out where to reconnect
+ * to. Returns host, port, the request and a delay in ms, or nil if the
+ * stream can't be resumed.
+ */
+static int stream_http_resumeL(lua_State *L) {
 	struct stream *stream;
-	u8_t buf[1024];
-	u8_t *buf_ptr, *body_ptr;
-	size_t header_len;
-	ssize_t n;
+	const char *path;
+	char hostport[256], offset[32], *ptr;
+	int port, delay = 0;
 
 	/*
 	 * 1: Stream (self)
-	 * 2: Playback (self)
 	 */
 
 	stream = lua_touserdata(L, 1);
 
+	if (!stream->http || !stream->request) {
+		return 0;
+	}
+
+	/* a failed resume is tried again */
+	if (!stream->header_done && !stream->resuming) {
+		return 0;
+	}
 
-	/* shortcut, just read to streambuf */
-	if (stream->num_crlf == 4) {
-		n = streambuf_feed_fd(stream->fd, L);
-		if (n == 0) {
-			/* closed */
-			lua_pushboolean(L, FALSE);
-			return 1;
-		}
+	strcpy(hostport, inet_ntoa(stream->addr.sin_addr));
+	port = ntohs(stream->addr.sin_port);
 
-		if (n == -ENOSPC) {
-			lua_pushinteger(L, 0);
-			return 1;
+	if (stream_http_is_redirect(stream)) {
+		if (stream->redirects >= STREAM_HTTP_MAX_REDIRECTS
+		    || !stream_http_parse_location(stream->location, hostport, sizeof(hostport), &path)) {
+			return 0;
 		}
 
-		if (n < 0) {
-			CLOSESOCKET(stream->fd);
+		stream->redirects++;
+		stream_http_stats.redirects++;
 
-			lua_pushnil(L);
-			lua_pushstring(L, strerror(n));
-			return 2;
+		stream->request = stream_http_set_target(stream->request, path);
+		if (hostport[0]) {
+			stream->request = stream_http_set_header(stream->request, "Host", hostport);
 
+			port = 80;
+			if ((ptr = strchr(hostport, ':'))) {
+				*ptr = '\0';
+				port = strtoul(ptr + 1, NULL, 10);
+			}
+		}
+		else {
+			/* relative to the current server */
+			strcpy(hostport, inet_ntoa(stream->addr.sin_addr));
 		}
 
-		lua_pushinteger(L, n);
-		return 1;
-	}
+		LOG_INFO(log_audio_decode, "redirect to %s", stream->location);
 
-	/* read buffer, but we must not overflow the stream fifo */
-	n = streambuf_get_freebytes();
-	if (n > (ssize_t)sizeof(buf)) {
-		n = sizeof(buf);
+		stream->connect_jiffies = jive_jiffies();
+	}
+	else if (stream->status != 200 && stream->status != 206) {
+		return 0;
 	}
+	else {
+		if (stream_http_complete(stream) || stream->resumes >= STREAM_HTTP_MAX_RESUMES) {
+			return 0;
+		}
+
+		if (stream->icy) {
+			/* a live stream starts again, pad the interrupted metadata
+			 * interval so the icy filter stays aligned */
+			if (stream->icy_metaint && (stream->got_body || !stream->resuming)) {
+				if (stream->icy_audio_remaining) {
+					stream->pad_remaining = stream->icy_audio_remaining + 1;
+				}
+				else if (stream->icy_meta_remaining) {
+					stream->pad_remaining = stream->icy_meta_remaining;
+				}
+				else {
+					stream->pad_remaining = 1;
+				}
+				stream->icy_audio_remaining = stream->icy_metaint;
+				stream->icy_meta_remaining = 0;
+			}
+		}
+		else if (stream->content_length && stream->accept_ranges) {
+			sprintf(offset, "bytes=%llu-", (unsigned long long)stream->body_offset);
+			stream->request = stream_http_set_header(stream->request, "Range", offset);
+		}
+		else {
+			return 0;
+		}
 
-	n = recv(stream->fd, buf, sizeof(buf), 0);
+		if (!stream->resuming || stream->got_body) {
+			stream->drop_jiffies = jive_jiffies();
+			stream_http_stats.rebuffers++;
 
-	/* socket closed */
-	if (n == 0) {
-		lua_pushboolean(L, FALSE);
-		return 1;
+			LOG_WARN(log_audio_decode, "stream dropped at %llu, resuming", (unsigned long long)stream->body_offset);
+		}
+
+		delay = stream->resumes * STREAM_HTTP_RESUME_DELAY;
+		stream->resumes++;
+		stream->resuming = TRUE;
 	}
 
-	/* socket error */
-	if (n < 0) {
-		// XXXX do we need to handle timeout here?
+	lua_pushstring(L, hostport);
+	lua_pushinteger(L, port);
+	lua_pushstring(L, stream->request);
+	lua_pushinteger(L, delay);
+	return 4;
+}
+
+
+/* connect the stream again, see stream_http_resumeL */
+static int stream_reconnectL(lua_State *L) {
+	struct stream *stream;
+	struct sockaddr_in serv_addr;
+	socket_t fd;
+
+	/*
+	 * 1: Stream (self)
+	 * 2: server_ip
+	 * 3: server_port
+	 */
+
+	stream = lua_touserdata(L, 1);
+
+	stream_addr(L, 2, &serv_addr);
+
+	if (stream->fd) {
 		CLOSESOCKET(stream->fd);
+		stream->fd = 0;
+	}
 
+	fd = stream_open(&serv_addr);
+	if (fd == INVALID_SOCKET) {
 		lua_pushnil(L);
 		lua_pushstring(L, strerror(SOCKETERROR));
 		return 2;
 	}
 
-	buf_ptr = buf;
-
-
-	/* read http header */
-	if (stream->num_crlf < 4) {
-		stream->body = realloc(stream->body, stream->body_len + n);
-		body_ptr = stream->body + stream->body_len;
-		stream->body_len += n;
+	stream->fd = fd;
+	stream->addr = serv_addr;
+	stream->header_len = 0;
+	stream->header_done = FALSE;
+	stream->got_body = FALSE;
+	stream->body_bytes = 0;
 
-		while (n) {
-			*body_ptr++ = *buf_ptr;
+	lua_pushboolean(L, TRUE);
+	return 1;
+}
 
-			if (*buf_ptr == '\n' || *buf_ptr == '\r') {
-				stream->num_crlf++;
-			}
-			else {
-				stream->num_crlf = 0;
-			}
 
-			buf_ptr++;
-			n--;
+static int stream_proxyAddL(lua_State *L) {
+	struct proxy_client *client;
+	socket_t fd;
 
-			if (stream->num_crlf == 4) {
-				header_len = body_ptr - stream->body;
+	/*
+	 * 1: Stream (self)
+	 * 2: proxy client fd
+	 */
 
-				//LOG_DEBUG(log_audio_decode, "headers %d %*s\n", header_len, header_len, stream->body);
+	fd = luaL_checkinteger(L, 2);
 
-				/* Send headers to SqueezeCenter */
-				lua_getfield(L, 2, "_streamHttpHeaders");
-				lua_pushvalue(L, 2);
-				lua_pushlstring(L, (char *)stream->body, header_len);
-				lua_call(L, 2, 0);
+	fifo_lock(&streambuf_fifo);
 
-				/* do not free the header here - leave it to disconnect -
-				 * so that it can be used by the proxy code
-				 */
+	if (!proxy_num_clients) {
+		proxy_valid = TRUE;
+	}
 
-				/* Send headers to proxy clients */
-				proxy_chunk(stream->body, header_len, L);
+	/* the start of the stream must still be in the streambuf */
+	if (proxy_num_clients == PROXY_MAX_CLIENTS
+	    || proxy_wpos - proxy_stream_start >= STREAMBUF_SIZE - 1) {
+		fifo_unlock(&streambuf_fifo);
 
-				break;
-			}
-		}
+		lua_pushnil(L);
+		lua_pushstring(L, "can't proxy stream");
+		return 2;
 	}
 
-	/* we need to loop when playing sound effects, so we need to remember where the stream starts */
-	streambuf_lptr = streambuf_fifo.wptr;
+	client = &proxy_clients[proxy_num_clients++];
+	memset(client, 0, sizeof(*client));
+	client->fd = fd;
+	client->pos = proxy_stream_start;
 
-	/* feed remaining buffer */
-	streambuf_feedL(buf_ptr, n, L);
+	fifo_unlock(&streambuf_fifo);
 
 	lua_pushboolean(L, TRUE);
 	return 1;
 }
 
 
-static int stream_writeL(lua_State *L) {
-	struct stream *stream;
-	const char *header;
+static int stream_proxyRemoveL(lua_State *L) {
+	struct proxy_client *client;
+
+	/*
+	 * 1: Stream (self)
+	 * 2: proxy client fd
+	 */
+
+	fifo_lock(&streambuf_fifo);
+
+	client = proxy_find(luaL_checkinteger(L, 2));
+	if (client) {
+		*client = proxy_clients[--proxy_num_clients];
+	}
+
+	fifo_unlock(&streambuf_fifo);
+
+	return 0;
+}
+
+
+/* send the headers and stream to a proxy client, returns the bytes pending */
+static int stream_proxySendL(lua_State *L) {
+	struct proxy_client *client;
+	struct iovec iov[3];
+	int iovcnt = 0;
+	size_t offset, avail, header_len = 0, len;
 	ssize_t n;
-	size_t len;
+#if !defined(WIN32)
+	struct msghdr msg;
+#endif
 
 	/*
 	 * 1: Stream (self)
-	 * 2: Playback (self)
-	 * 3: header
+	 * 2: proxy client fd
 	 */
 
-	stream = lua_touserdata(L, 1);
-	header = lua_tolstring(L, 3, &len);
+	fifo_lock(&streambuf_fifo);
 
-	while (len > 0) {
-		n = send(stream->fd, header, len, 0);
+	client = proxy_find(luaL_checkinteger(L, 2));
+	if (!client || !proxy_valid) {
+		fifo_unlock(&streambuf_fifo);
 
-		if (n < 0) {
-			CLOSESOCKET(stream->fd);
+		lua_pushnil(L);
+		lua_pushstring(L, "proxy stream flushed");
+		return 2;
+	}
+
+	if (!client->header_done && proxy_header) {
+		header_len = proxy_header_len - client->header_sent;
+
+		iov[iovcnt].iov_base = proxy_header + client->header_sent;
+		iov[iovcnt].iov_len = header_len;
+		iovcnt++;
+	}
+
+	/* the stream from the client cursor, in up to two parts */
+	avail = proxy_wpos - client->pos;
+	if (client->header_done || header_len) {
+		offset = (streambuf_fifo.wptr + STREAMBUF_SIZE - avail) % STREAMBUF_SIZE;
+
+		len = STREAMBUF_SIZE - offset;
+		if (len > avail) {
+			len = avail;
+		}
+		if (len) {
+			iov[iovcnt].iov_base = streambuf_buf + offset;
+			iov[iovcnt].iov_len = len;
+			iovcnt++;
+		}
+		if (avail - len) {
+			iov[iovcnt].iov_base = streambuf_buf;
+			iov[iovcnt].iov_len = avail - len;
+			iovcnt++;
+		}
+	}
+	else {
+		avail = 0;
+	}
+
+	if (proxy_wpos - client->pos > client->max_lag) {
+		client->max_lag = proxy_wpos - client->pos;
+	}
+
+	fifo_unlock(&streambuf_fifo);
+
+	if (!iovcnt) {
+		lua_pushinteger(L, 0);
+		return 1;
+	}
+
+	/* the data can't be overwritten while it is sent, as the origin does
+	 * not overtake the client cursor */
+#if defined(WIN32)
+	n = send(client->fd, iov[0].iov_base, iov[0].iov_len, 0);
+#else
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iovcnt;
 
+	n = sendmsg(client->fd, &msg,
+#ifdef MSG_NOSIGNAL
+		    MSG_NOSIGNAL
+#else
+		    0
+#endif
+		);
+#endif
+
+	if (n < 0) {
+		if (SOCKETERROR != EAGAIN) {
 			lua_pushnil(L);
 			lua_pushstring(L, strerror(SOCKETERROR));
 			return 2;
 		}
 
-		len -= n;
+		client->stalls++;
+		n = 0;
 	}
 
-	/*
-	if (shutdown(stream->fd, SHUT_WR) != 0) {
-		CLOSESOCKET(stream->fd);
+	client->bytes_sent += n;
 
-		lua_pushnil(L);
-		lua_pushstring(L, strerror(SOCKETERROR));
-		return 2;
+	if (header_len) {
+		if ((size_t)n < header_len) {
+			client->header_sent += n;
+			n = 0;
+		}
+		else {
+			client->header_done = TRUE;
+			n -= header_len;
+			header_len = 0;
+		}
 	}
-	*/
+	client->pos += n;
+	avail -= n;
 
-	lua_pushboolean(L, TRUE);
+	lua_pushinteger(L, header_len + avail);
 	return 1;
 }
 
 
-static int stream_proxyWriteL(lua_State *L) {
-	struct stream *stream;
-	struct chunk *chunk;
-	ssize_t n;
-	size_t len, offset;
+/* bytes waiting to be sent to a proxy client */
+static int stream_proxyPendingL(lua_State *L) {
+	struct proxy_client *client;
+	size_t n = 0;
 
 	/*
 	 * 1: Stream (self)
-	 * 2: Proxy stream
-	 * 3: chunk
-	 * 4: offset
+	 * 2: proxy client fd
 	 */
 
-	stream = lua_touserdata(L, 2);
-	chunk = lua_touserdata(L, 3);
-	offset = lua_tointeger(L, 4);
+	fifo_lock(&streambuf_fifo);
 
-	len = chunk->len - offset;
-	n = send(stream->fd, chunk->buf + offset, len,
-#ifdef MSG_NOSIGNAL
-										MSG_NOSIGNAL
-#else
-										0
-#endif
-										);
-	if (n < 0) {
-		if (errno != EAGAIN) {
-			lua_pushnil(L);
-			lua_pushstring(L, strerror(SOCKETERROR));
-			return 2;
+	client = proxy_find(luaL_checkinteger(L, 2));
+	if (client && proxy_valid) {
+		if (!client->header_done && proxy_header) {
+			n = proxy_header_len - client->header_sent
+				+ (proxy_wpos - client->pos);
 		}
-	} else if ((size_t)n < len) {
-		offset += n;
-	} else {
-		/* wrote it all */
-		lua_pushnil(L);
-		return 1;
+		else if (client->header_done) {
+			n = proxy_wpos - client->pos;
+		}
+	}
+	else if (client) {
+		/* let the sender report the error */
+		n = 1;
+	}
+
+	fifo_unlock(&streambuf_fifo);
+
+	lua_pushinteger(L, n);
+	return 1;
+}
+
+
+/* bytes the origin stream can read before a proxy client blocks it */
+static int stream_proxyFreeL(lua_State *L) {
+	size_t n;
+
+	fifo_lock(&streambuf_fifo);
+	n = proxy_bytes_free();
+	fifo_unlock(&streambuf_fifo);
+
+	lua_pushinteger(L, n);
+	return 1;
+}
+
+
+static int stream_proxyStatsL(lua_State *L) {
+	struct proxy_client *client;
+	int i;
+
+	/*
+	 * 1: Stream (self)
+	 */
+
+	fifo_lock(&streambuf_fifo);
+
+	lua_newtable(L);
+	for (i = 0; i < proxy_num_clients; i++) {
+		client = &proxy_clients[i];
+
+		lua_newtable(L);
+
+		lua_pushinteger(L, client->fd);
+		lua_setfield(L, -2, "fd");
+
+		lua_pushnumber(L, (lua_Number) client->bytes_sent);
+		lua_setfield(L, -2, "sent");
+
+		lua_pushinteger(L, (lua_Integer) (proxy_wpos - client->pos));
+		lua_setfield(L, -2, "lag");
+
+		lua_pushinteger(L, (lua_Integer) client->max_lag);
+		lua_setfield(L, -2, "maxLag");
+
+		lua_pushinteger(L, client->stalls);
+		lua_setfield(L, -2, "stalls");
+
+		lua_rawseti(L, -2, i + 1);
 	}
-	lua_pushinteger(L, offset);
+
+	fifo_unlock(&streambuf_fifo);
+
+	return 1;
+}
+
+
+static int stream_httpStatsL(lua_State *L) {
+	/*
+	 * 1: Stream (self)
+	 */
+
+	lua_newtable(L);
+
+	lua_pushinteger(L, stream_http_stats.status);
+	lua_setfield(L, -2, "status");
+
+	lua_pushinteger(L, stream_http_stats.ttfb);
+	lua_setfield(L, -2, "ttfb");
+
+	lua_pushinteger(L, stream_http_stats.redirects);
+	lua_setfield(L, -2, "redirects");
+
+	lua_pushinteger(L, stream_http_stats.rebuffers);
+	lua_setfield(L, -2, "rebuffers");
+
+	lua_pushinteger(L, stream_http_stats.rebuffer_time);
+	lua_setfield(L, -2, "rebufferTime");
+
+	lua_pushinteger(L, stream_http_stats.rebuffer_total);
+	lua_setfield(L, -2, "rebufferTotal");
+
 	return 1;
 }
 
@@ -824,7 +2097,9 @@ static int stream_feedfromL(lua_State *L) {
 	 * 2: string to enqueue to streambuf
 	 */
 
-	n = streambuf_get_freebytes();
+	fifo_lock(&streambuf_fifo);
+	n = streambuf_feed_freebytes();
+	fifo_unlock(&streambuf_fifo);
 
 	if (n == 0) {
 		lua_pushinteger(L, 0);
@@ -911,6 +2186,8 @@ static int stream_setstreamingL(lua_State *L) {
 	 */
 	streambuf_streaming = lua_toboolean(L, 2);
 
+	streambuf_wake_decoder();
+
 	return 0;
 }
 
@@ -926,6 +2203,13 @@ static int stream_mark_loopL(lua_State *L) {
 }
 
 
+static int stream_mark_nextL(lua_State *L) {
+	streambuf_mark_next();
+
+	return 0;
+}
+
+
 static int stream_icy_metaintervalL(lua_State *L) {
 	/*
 	 * 1: Stream (self)
@@ -934,10 +2218,16 @@ static int stream_icy_metaintervalL(lua_State *L) {
 
 	fifo_lock(&streambuf_fifo);
 
-	streambuf_filter = streambuf_icy_filter;
+	if (streambuf_has_next) {
+		streambuf_mark_filter = streambuf_icy_filter;
+		icy_mark_interval = lua_tointeger(L, 2);
+	}
+	else {
+		streambuf_filter = streambuf_icy_filter;
 
-	icy_meta_interval = lua_tointeger(L, 2);
-	icy_meta_remaining = icy_meta_interval;
+		icy_meta_interval = lua_tointeger(L, 2);
+		icy_meta_remaining = icy_meta_interval;
+	}
 
 	fifo_unlock(&streambuf_fifo);
 
@@ -950,8 +2240,15 @@ static const struct luaL_Reg stream_f[] = {
 	{ "flush", stream_flushL },
 	{ "loadLoop", stream_load_loopL },
 	{ "markLoop", stream_mark_loopL },
+	{ "markNext", stream_mark_nextL },
 	{ "icyMetaInterval", stream_icy_metaintervalL },
-	{ "proxyWrite", stream_proxyWriteL },
+	{ "proxyAdd", stream_proxyAddL },
+	{ "proxyRemove", stream_proxyRemoveL },
+	{ "proxySend", stream_proxySendL },
+	{ "proxyPending", stream_proxyPendingL },
+	{ "proxyFree", stream_proxyFreeL },
+	{ "proxyStats", stream_proxyStatsL },
+	{ "httpStats", stream_httpStatsL },
 	{ NULL, NULL }
 };
 
@@ -961,6 +2258,8 @@ static const struct luaL_Reg stream_m[] = {
 	{ "getfd", stream_getfdL },
 	{ "read", stream_readL },
 	{ "write", stream_writeL },
+	{ "httpResume", stream_http_resumeL },
+	{ "reconnect", stream_reconnectL },
 	{ "feedFromLua", stream_feedfromL },
 	{ "readToLua", stream_readtoL },
 	{ "readToNull", stream_readtonullL },
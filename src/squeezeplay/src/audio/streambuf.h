@@ -39,6 +39,12 @@ extern void streambuf_flush(void);
 
 extern void streambuf_feed(u8_t *buf, size_t size);
 
+extern void streambuf_mark_next(void);
+
+extern bool_t streambuf_at_next(void);
+
+extern void streambuf_next_track(void);
+
 /* the mutex should be locked when using fast read */
 extern size_t streambuf_fast_read(u8_t *buf, size_t min, size_t max, bool_t *streaming);
 
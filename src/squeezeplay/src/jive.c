@@ -32,6 +32,9 @@ extern int luaopen_jive_ui_framework(lua_State *L);
 extern int luaopen_jive_net_dns(lua_State *L);
 extern int luaopen_jive_debug(lua_State *L);
 
+/* Lua allocator */
+extern void *jive_lua_alloc(void *ud, void *ptr, size_t osize, size_t nsize);
+
 /* LUA_DEFAULT_SCRIPT
 ** The default script this program runs, unless another script is given
 ** on the command line
@@ -68,6 +71,17 @@ static void l_message (const char *pname, const char *msg) {
 }
 
 
+/* l_panic
+** reports unprotected errors, as luaL_newstate does
+*/
+static int l_panic (lua_State *L) {
+	const char *msg = lua_tostring(L, -1);
+
+	l_message("PANIC: unprotected error in call to Lua API", msg ? msg : "(error object is not a string)");
+	return 0;
+}
+
+
 /******************************************************************************/
 /* Code below is specific to jive                                       */
 /******************************************************************************/
@@ -523,12 +537,13 @@ int main (int argc, char **argv) {
 	// say hello
 	l_message(NULL, "\nSqueezeplay " JIVE_VERSION);
 	
-	// create state
-	L = lua_open();
+	// create state, with heap accounting for the gc pacer
+	L = lua_newstate(jive_lua_alloc, NULL);
 	if (L == NULL) {
 		l_message(argv[0], "cannot create state: not enough memory");
 		return EXIT_FAILURE;
 	}
+	lua_atpanic(L, l_panic);
 	
 	// call our main in protected mode
 	s.argc = argc;
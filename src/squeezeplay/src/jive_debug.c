@@ -11,6 +11,9 @@
 
 static struct log_category *log_debug_hooks;
 
+/* Lua allocator pools */
+extern void jive_lua_alloc_pushstats(lua_State *L);
+
 struct perf_hook_data {
 	Uint32 hook_stack;
 	clock_t hook_threshold;
@@ -380,6 +383,29 @@ static int jiveL_heap(lua_State *L) {
 	lua_pushinteger(L, s.free_lightuserdata);
 	lua_setfield(L, -2, "free_lightuserdata");
 
+	lua_pushinteger(L, lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0));
+	lua_setfield(L, -2, "lua_bytes");
+
+	jive_lua_alloc_pushstats(L);
+	lua_setfield(L, -2, "pools");
+
+#if defined(__linux__)
+	{
+		FILE *fp;
+		unsigned long size, rss;
+
+		/* resident set size, to track fragmentation over long runs */
+		fp = fopen("/proc/self/statm", "r");
+		if (fp) {
+			if (fscanf(fp, "%lu %lu", &size, &rss) == 2) {
+				lua_pushinteger(L, rss * getpagesize());
+				lua_setfield(L, -2, "rss");
+			}
+			fclose(fp);
+		}
+	}
+#endif
+
 	return 1;
 }
 
@@ -22,6 +22,9 @@
 /* updated to the max effective rate of scrolling on a fab4 */
 #define JIVE_FRAME_RATE 22
 
+/* frame rate used during window transitions and scrolling */
+#define JIVE_FRAME_RATE_ACTIVE 30
+
 /* print profile information for blit's */
 #undef JIVE_PROFILE_BLIT
 
@@ -293,6 +296,9 @@ struct jive_font {
 	int capheight;
 	int ascend;
 
+	// Character width cache, direct mapped by code point
+	struct jive_font_char_width *char_width;
+
 	struct jive_font *next;
 
 	const char *magic;
@@ -307,6 +313,18 @@ struct jive_perfwarn {
 	Uint32 garbage;
 };
 
+struct jive_layout_stats {
+	Uint32 visited;		/* widgets checked for layout */
+	Uint32 skinned;		/* widgets reskinned */
+	Uint32 laid_out;	/* widgets laid out */
+};
+
+typedef enum {
+	JIVE_FRAME_IDLE = 0,	/* nothing to layout, animate or draw */
+	JIVE_FRAME_NORMAL,	/* draw at JIVE_FRAME_RATE */
+	JIVE_FRAME_ACTIVE,	/* draw at JIVE_FRAME_RATE_ACTIVE */
+} JiveFrameState;
+
 
 /* logging */
 extern LOG_CATEGORY *log_ui_draw;
@@ -335,12 +353,42 @@ extern Uint32 jive_origin;
 void jive_print_stack(lua_State *L, char *str);
 void jive_debug_traceback(lua_State *L, int n);
 int jiveL_getframework(lua_State *L);
+
+/* Lua heap accounting and garbage collector pacing */
+void *jive_lua_alloc(void *ud, void *ptr, size_t osize, size_t nsize);
+void jive_lua_alloc_pushstats(lua_State *L);
+int jiveL_gc_step(lua_State *L);
+int jiveL_get_gc_stats(lua_State *L);
+
+/* Task run queue */
+void jive_task_register(lua_State *L);
+
+/* Fast Surface bindings */
+void jive_draw_register(lua_State *L);
+
+/* Global listeners and input to action map */
+void jive_action_init(lua_State *L);
+int jiveL_add_listener(lua_State *L);
+int jiveL_remove_listener(lua_State *L);
+int jiveL_event(lua_State *L);
+int jiveL_clear_input_map(lua_State *L);
+int jiveL_map_input(lua_State *L);
+int jiveL_input_to_action(lua_State *L);
+int jiveL_get_action_stats(lua_State *L);
 int jive_getmethod(lua_State *L, int index, char *method) ;
 void *jive_getpeer(lua_State *L, int index, JivePeerMeta *peerMeta);
 void jive_torect(lua_State *L, int index, SDL_Rect *rect);
 void jive_rect_union(SDL_Rect *a, SDL_Rect *b, SDL_Rect *c);
 void jive_rect_intersection(SDL_Rect *a, SDL_Rect *b, SDL_Rect *c);
 void jive_queue_event(JiveEvent *evt);
+void jive_input_init(void);
+bool jive_input_pending(void);
+bool jive_input_next(JiveEvent *evt);
+void jive_input_mark(Uint32 queued);
+void jive_input_frame(bool drawn);
+void jive_input_add_fd(int fd);
+int jiveL_get_input_fds(lua_State *L);
+int jiveL_get_input_stats(lua_State *L);
 int jive_traceback (lua_State *L);
 
 /* Surface functions */
@@ -366,6 +414,7 @@ void jive_surface_blit(JiveSurface *src, JiveSurface *dst, Uint16 dx, Uint16 dy)
 void jive_surface_blit_clip(JiveSurface *src, Uint16 sx, Uint16 sy, Uint16 sw, Uint16 sh,
 			    JiveSurface* dst, Uint16 dx, Uint16 dy);
 void jive_surface_blit_alpha(JiveSurface *src, JiveSurface *dst, Uint16 dx, Uint16 dy, Uint8 alpha);
+void jive_surface_blit_rotated(JiveSurface *srf, JiveSurface *dst, Sint16 cx, Sint16 cy, double angle, int steps);
 void jive_surface_get_size(JiveSurface *srf, Uint16 *w, Uint16 *h);
 int jive_surface_get_bytes(JiveSurface *srf);
 void jive_surface_free(JiveSurface *srf);
@@ -407,6 +456,8 @@ void jive_tile_set_alpha(JiveTile *tile, Uint32 flags);
 void jive_tile_free(JiveTile *tile);
 void jive_tile_blit(JiveTile *tile, JiveSurface *dst, Uint16 dx, Uint16 dy, Uint16 dw, Uint16 dh);
 void jive_tile_blit_centered(JiveTile *tile, JiveSurface *dst, Uint16 dx, Uint16 dy, Uint16 dw, Uint16 dh);
+int jive_tile_preload_images(void);
+void jive_tile_preload_pump(void);
 SDL_Surface *jive_tile_get_image_surface(JiveTile *tile);
 
 
@@ -416,6 +467,7 @@ JiveFont *jive_font_ref(JiveFont *font);
 void jive_font_free(JiveFont *font);
 int jive_font_width(JiveFont *font, const char *str);
 int jive_font_nwidth(JiveFont *font, const char *str, size_t len);
+int jive_font_char_width(JiveFont *font, const char *ptr, const char **nptr);
 int jive_font_miny_char(JiveFont *font, Uint16 ch);
 int jive_font_maxy_char(JiveFont *font, Uint16 ch);
 int jive_font_height(JiveFont *font);
@@ -0,0 +1,598 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+
+#include "common.h"
+#include "jive.h"
+
+
+/* The global event listeners, added with Framework:addListener, are kept
+ * here instead of in Lua tables. Each listener is indexed in a bucket for
+ * each event type bit in its mask, or for action listeners added with
+ * Framework:addActionListener in a bucket for the action. The buckets are
+ * kept in priority order, the most recently added listener first for equal
+ * priorities, so dispatching an event only visits the listeners for its
+ * type or action.
+ *
+ * The input to action map is hashed by event type and key, char, ir or
+ * gesture code, with the action translations already applied, so an input
+ * event is converted to an action with a single lookup.
+ */
+
+#define LISTENER_TYPES 32
+
+/* listeners copied on the stack for each dispatch, more are malloced */
+#define LISTENER_STACK 64
+
+#define LISTENERS_KEY "jive_listeners"
+
+
+struct jive_listener {
+	Uint32 mask;
+	int action;		/* action index, or 0 for all events */
+	int priority;
+	Uint32 seq;
+	int ref;		/* handle in the registry */
+	bool removed;
+	struct jive_listener *next;	/* removed during dispatch */
+};
+
+struct listener_vec {
+	struct jive_listener **l;
+	int n;
+	int size;
+};
+
+struct listener_list {
+	struct listener_vec all;
+	struct listener_vec type[LISTENER_TYPES];
+	struct listener_vec *action;	/* by action index */
+	int num_actions;
+};
+
+/* unused listeners, then global listeners */
+static struct listener_list listeners[2];
+
+static Uint32 listener_seq = 0;
+static int dispatch_depth = 0;
+static struct jive_listener *removed_listeners = NULL;
+
+
+struct input_map_entry {
+	Uint32 type;		/* 0 if empty */
+	Uint32 code;
+	int action;
+};
+
+static struct input_map_entry *input_map = NULL;
+static int input_map_bits = 0;
+static int input_map_n = 0;
+
+
+static struct jive_action_stats {
+	Uint32 listeners;	/* registered */
+	Uint32 events;
+	Uint32 called;		/* listeners called */
+	Uint32 called_max;	/* for one event */
+	Uint32 mapped;		/* input converted to an action */
+	Uint32 unmapped;
+} action_stats;
+
+
+static int type_bit(Uint32 type) {
+	int i;
+
+	for (i = 0; i < LISTENER_TYPES; i++) {
+		if (type & (1 << i)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+/* true if listener a is called before b */
+static inline bool listener_before(struct jive_listener *a, struct jive_listener *b) {
+	return (a->priority < b->priority) || (a->priority == b->priority && a->seq > b->seq);
+}
+
+
+static void vec_insert(struct listener_vec *vec, struct jive_listener *listener) {
+	int lo, hi, mid;
+
+	if (vec->n == vec->size) {
+		vec->size = vec->size ? vec->size * 2 : 8;
+		vec->l = realloc(vec->l, vec->size * sizeof(struct jive_listener *));
+	}
+
+	/* the new listener goes before the others with the same priority */
+	lo = 0;
+	hi = vec->n;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (listener_before(vec->l[mid], listener)) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	memmove(&vec->l[lo + 1], &vec->l[lo], (vec->n - lo) * sizeof(struct jive_listener *));
+	vec->l[lo] = listener;
+	vec->n++;
+}
+
+
+static void vec_remove(struct listener_vec *vec, struct jive_listener *listener) {
+	int i;
+
+	for (i = 0; i < vec->n; i++) {
+		if (vec->l[i] == listener) {
+			memmove(&vec->l[i], &vec->l[i + 1], (vec->n - i - 1) * sizeof(struct jive_listener *));
+			vec->n--;
+			return;
+		}
+	}
+}
+
+
+static struct listener_vec *action_vec(struct listener_list *list, int action) {
+	int n;
+
+	if (action >= list->num_actions) {
+		n = list->num_actions ? list->num_actions : 64;
+		while (n <= action) {
+			n *= 2;
+		}
+
+		list->action = realloc(list->action, n * sizeof(struct listener_vec));
+		memset(&list->action[list->num_actions], 0, (n - list->num_actions) * sizeof(struct listener_vec));
+		list->num_actions = n;
+	}
+
+	return &list->action[action];
+}
+
+
+static void free_removed_listeners(void) {
+	struct jive_listener *listener;
+
+	while (removed_listeners) {
+		listener = removed_listeners;
+		removed_listeners = listener->next;
+		free(listener);
+	}
+}
+
+
+int jiveL_add_listener(lua_State *L) {
+	struct jive_listener *listener;
+	struct listener_list *list;
+	int i;
+
+	/* stack is:
+	 * 1: framework
+	 * 2: handle
+	 * 3: global listener
+	 * 4: action index (optional)
+	 */
+
+	luaL_checktype(L, 2, LUA_TTABLE);
+
+	listener = calloc(1, sizeof(struct jive_listener));
+
+	lua_rawgeti(L, 2, 1);
+	listener->mask = (Uint32) lua_tointeger(L, -1);
+	lua_rawgeti(L, 2, 3);
+	listener->priority = lua_tointeger(L, -1);
+	lua_pop(L, 2);
+
+	listener->action = luaL_optinteger(L, 4, 0);
+	listener->seq = ++listener_seq;
+
+	lua_pushvalue(L, 2);
+	listener->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	/* handle -> listener */
+	lua_getfield(L, LUA_REGISTRYINDEX, LISTENERS_KEY);
+	lua_pushvalue(L, 2);
+	lua_pushlightuserdata(L, listener);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+
+	list = &listeners[lua_toboolean(L, 3) ? 1 : 0];
+
+	vec_insert(&list->all, listener);
+	if (listener->action > 0) {
+		vec_insert(action_vec(list, listener->action), listener);
+	}
+	else {
+		for (i = 0; i < LISTENER_TYPES; i++) {
+			if (listener->mask & (1 << i)) {
+				vec_insert(&list->type[i], listener);
+			}
+		}
+	}
+
+	action_stats.listeners++;
+
+	return 0;
+}
+
+
+int jiveL_remove_listener(lua_State *L) {
+	struct jive_listener *listener;
+	struct listener_list *list;
+	int i, j;
+
+	/* stack is:
+	 * 1: framework
+	 * 2: handle
+	 */
+
+	lua_getfield(L, LUA_REGISTRYINDEX, LISTENERS_KEY);
+	lua_pushvalue(L, 2);
+	lua_rawget(L, -2);
+	listener = lua_touserdata(L, -1);
+	lua_pop(L, 1);
+
+	if (!listener) {
+		lua_pop(L, 1);
+		return 0;
+	}
+
+	lua_pushvalue(L, 2);
+	lua_pushnil(L);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+
+	/* the listener is in one list, removing from both is harmless */
+	for (j = 0; j < 2; j++) {
+		list = &listeners[j];
+
+		vec_remove(&list->all, listener);
+		if (listener->action > 0) {
+			if (listener->action < list->num_actions) {
+				vec_remove(&list->action[listener->action], listener);
+			}
+		}
+		else {
+			for (i = 0; i < LISTENER_TYPES; i++) {
+				if (listener->mask & (1 << i)) {
+					vec_remove(&list->type[i], listener);
+				}
+			}
+		}
+	}
+
+	luaL_unref(L, LUA_REGISTRYINDEX, listener->ref);
+	listener->removed = true;
+
+	action_stats.listeners--;
+
+	/* a dispatch in progress may still reference the listener */
+	if (dispatch_depth) {
+		listener->next = removed_listeners;
+		removed_listeners = listener;
+	}
+	else {
+		free(listener);
+	}
+
+	return 0;
+}
+
+
+/*
+ * Copy the listeners for event into buf, in the order they are called,
+ * a and b are merged if both are given. Returns the number of listeners.
+ */
+static int collect_listeners(struct listener_vec *a, struct listener_vec *b, struct jive_listener **buf) {
+	int i = 0, j = 0, n = 0;
+
+	if (!b) {
+		memcpy(buf, a->l, a->n * sizeof(struct jive_listener *));
+		return a->n;
+	}
+
+	while (i < a->n || j < b->n) {
+		if (j == b->n || (i < a->n && listener_before(a->l[i], b->l[j]))) {
+			buf[n++] = a->l[i++];
+		}
+		else {
+			buf[n++] = b->l[j++];
+		}
+	}
+	return n;
+}
+
+
+int jiveL_event(lua_State *L) {
+	struct jive_listener *stack_buf[LISTENER_STACK], **buf;
+	struct listener_list *list;
+	struct listener_vec *a, *b = NULL;
+	JiveEvent *event;
+	Uint32 called = 0;
+	int i, n, bit, traceback, r = 0;
+
+	/* stack is:
+	 * 1: framework
+	 * 2: event
+	 * 3: globalListeners if true, or unusedListeners
+	 */
+
+	event = (JiveEvent *) lua_touserdata(L, 2);
+	if (event == NULL) {
+		luaL_error(L, "invalid Event");
+	}
+
+	list = &listeners[lua_toboolean(L, 3) ? 1 : 0];
+
+	if (event->type & (event->type - 1)) {
+		/* more than one type, check all listeners */
+		a = &list->all;
+	}
+	else {
+		bit = type_bit(event->type);
+		if (bit < 0) {
+			lua_pushinteger(L, 0);
+			return 1;
+		}
+
+		a = &list->type[bit];
+		if (event->type == JIVE_ACTION
+		    && event->u.action.index > 0
+		    && event->u.action.index < list->num_actions) {
+			b = &list->action[event->u.action.index];
+		}
+	}
+
+	n = a->n + (b ? b->n : 0);
+	if (n == 0) {
+		lua_pushinteger(L, 0);
+		return 1;
+	}
+
+	buf = (n > LISTENER_STACK) ? malloc(n * sizeof(struct jive_listener *)) : stack_buf;
+	n = collect_listeners(a, b, buf);
+
+	lua_pushcfunction(L, jive_traceback);
+	traceback = lua_gettop(L);
+
+	dispatch_depth++;
+
+	for (i = 0; i < n && r == 0; i++) {
+		struct jive_listener *listener = buf[i];
+
+		if (listener->removed || !(event->type & listener->mask)) {
+			continue;
+		}
+		if (listener->action > 0 && (event->type != JIVE_ACTION || event->u.action.index != listener->action)) {
+			continue;
+		}
+
+		lua_rawgeti(L, LUA_REGISTRYINDEX, listener->ref);
+		lua_rawgeti(L, -1, 2);
+		lua_pushvalue(L, 2);
+
+		called++;
+		if (lua_pcall(L, 1, 1, traceback) != 0) {
+			/* clean up before passing the error on */
+			dispatch_depth--;
+			if (!dispatch_depth) {
+				free_removed_listeners();
+			}
+			if (buf != stack_buf) {
+				free(buf);
+			}
+			lua_error(L);
+		}
+
+		r = r | lua_tointeger(L, -1);
+		lua_pop(L, 2);
+	}
+
+	dispatch_depth--;
+	if (!dispatch_depth) {
+		free_removed_listeners();
+	}
+	if (buf != stack_buf) {
+		free(buf);
+	}
+
+	action_stats.events++;
+	action_stats.called += called;
+	if (called > action_stats.called_max) {
+		action_stats.called_max = called;
+	}
+
+	lua_pushinteger(L, r);
+	return 1;
+}
+
+
+static inline Uint32 input_map_hash(Uint32 type, Uint32 code) {
+	return ((code ^ type) * 2654435761u) >> (32 - input_map_bits);
+}
+
+
+static struct input_map_entry *input_map_find(Uint32 type, Uint32 code) {
+	Uint32 i, mask;
+
+	if (!input_map) {
+		return NULL;
+	}
+
+	mask = (1 << input_map_bits) - 1;
+	for (i = input_map_hash(type, code); input_map[i].type; i = (i + 1) & mask) {
+		if (input_map[i].type == type && input_map[i].code == code) {
+			return &input_map[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+static void input_map_insert(Uint32 type, Uint32 code, int action) {
+	struct input_map_entry *old_map;
+	Uint32 i, mask;
+	int old_size;
+
+	/* keep the table at most half full */
+	if ((input_map_n + 1) * 2 > (1 << input_map_bits)) {
+		old_map = input_map;
+		old_size = input_map ? (1 << input_map_bits) : 0;
+
+		input_map_bits = input_map_bits ? input_map_bits + 1 : 8;
+		input_map = calloc(1 << input_map_bits, sizeof(struct input_map_entry));
+		input_map_n = 0;
+
+		for (i = 0; i < (Uint32) old_size; i++) {
+			if (old_map[i].type) {
+				input_map_insert(old_map[i].type, old_map[i].code, old_map[i].action);
+			}
+		}
+		free(old_map);
+	}
+
+	mask = (1 << input_map_bits) - 1;
+	for (i = input_map_hash(type, code); input_map[i].type; i = (i + 1) & mask) {
+		if (input_map[i].type == type && input_map[i].code == code) {
+			input_map[i].action = action;
+			return;
+		}
+	}
+
+	input_map[i].type = type;
+	input_map[i].code = code;
+	input_map[i].action = action;
+	input_map_n++;
+}
+
+
+int jiveL_clear_input_map(lua_State *L) {
+	free(input_map);
+	input_map = NULL;
+	input_map_bits = 0;
+	input_map_n = 0;
+
+	return 0;
+}
+
+
+int jiveL_map_input(lua_State *L) {
+
+	/* stack is:
+	 * 1: framework
+	 * 2: event type
+	 * 3: code
+	 * 4: action index
+	 */
+
+	input_map_insert((Uint32) luaL_checknumber(L, 2), (Uint32) luaL_checknumber(L, 3), luaL_checkinteger(L, 4));
+
+	return 0;
+}
+
+
+int jiveL_input_to_action(lua_State *L) {
+	struct input_map_entry *entry;
+	JiveEvent *event;
+	Uint32 code;
+
+	/* stack is:
+	 * 1: framework
+	 * 2: event
+	 */
+
+	event = (JiveEvent *) lua_touserdata(L, 2);
+	if (event == NULL) {
+		luaL_error(L, "invalid Event");
+	}
+
+	switch (event->type) {
+	case JIVE_EVENT_KEY_PRESS:
+	case JIVE_EVENT_KEY_HOLD:
+		code = event->u.key.code;
+		break;
+
+	case JIVE_EVENT_CHAR_PRESS:
+		code = event->u.text.unicode;
+		break;
+
+	case JIVE_EVENT_IR_PRESS:
+	case JIVE_EVENT_IR_HOLD:
+		code = event->u.ir.code;
+		break;
+
+	case JIVE_EVENT_GESTURE:
+		code = event->u.gesture.code;
+		break;
+
+	default:
+		return 0;
+	}
+
+	entry = input_map_find(event->type, code);
+	if (!entry) {
+		action_stats.unmapped++;
+		return 0;
+	}
+
+	action_stats.mapped++;
+
+	lua_pushinteger(L, entry->action);
+	return 1;
+}
+
+
+int jiveL_get_action_stats(lua_State *L) {
+
+	/* stack is:
+	 * 1: framework
+	 * 2: reset (optional)
+	 */
+
+	lua_newtable(L);
+
+	lua_pushinteger(L, action_stats.listeners);
+	lua_setfield(L, -2, "listeners");
+
+	lua_pushinteger(L, action_stats.events);
+	lua_setfield(L, -2, "events");
+
+	lua_pushinteger(L, action_stats.called);
+	lua_setfield(L, -2, "called");
+
+	lua_pushinteger(L, action_stats.called_max);
+	lua_setfield(L, -2, "calledMax");
+
+	lua_pushinteger(L, action_stats.mapped);
+	lua_setfield(L, -2, "mapped");
+
+	lua_pushinteger(L, action_stats.unmapped);
+	lua_setfield(L, -2, "unmapped");
+
+	lua_pushinteger(L, input_map_n);
+	lua_setfield(L, -2, "inputMap");
+
+	if (lua_toboolean(L, 2)) {
+		Uint32 registered = action_stats.listeners;
+
+		memset(&action_stats, 0, sizeof(action_stats));
+		action_stats.listeners = registered;
+	}
+
+	return 1;
+}
+
+
+void jive_action_init(lua_State *L) {
+	lua_newtable(L);
+	lua_setfield(L, LUA_REGISTRYINDEX, LISTENERS_KEY);
+}
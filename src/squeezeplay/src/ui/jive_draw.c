@@ -0,0 +1,660 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+
+#include "common.h"
+#include "jive.h"
+
+
+/* Fast bindings for the Surface and Tile methods called many times per
+ * frame. The tolua++ bindings check each argument by name in the type
+ * tables, these closures compare the userdata metatables with the ones
+ * cached in their upvalues. Anything they do not expect is passed to the
+ * original tolua++ function, so errors are reported as before.
+ *
+ * Surface:drawList(list) draws a flat array of primitives with one call,
+ * each an operation followed by its arguments, for example:
+ *
+ *   { Surface.DRAW_FILLED_RECTANGLE, x1, y1, x2, y2, color,
+ *     Surface.DRAW_BLIT, image, x, y }
+ */
+
+/* closure upvalues */
+#define UPVALUE_SURFACE lua_upvalueindex(1)
+#define UPVALUE_TILE lua_upvalueindex(2)
+#define UPVALUE_TOLUA lua_upvalueindex(3)
+
+enum jive_draw_op {
+	DRAW_BLIT = 1,		/* src, x, y */
+	DRAW_BLIT_CLIP,		/* src, sx, sy, sw, sh, x, y */
+	DRAW_BLIT_ALPHA,	/* src, x, y, alpha */
+	DRAW_TILE,		/* tile, x, y, w, h */
+	DRAW_PIXEL,		/* x, y, color */
+	DRAW_HLINE,		/* x1, x2, y, color */
+	DRAW_VLINE,		/* x, y1, y2, color */
+	DRAW_RECTANGLE,		/* x1, y1, x2, y2, color */
+	DRAW_FILLED_RECTANGLE,	/* x1, y1, x2, y2, color */
+	DRAW_LINE,		/* x1, y1, x2, y2, color */
+	DRAW_AALINE,		/* x1, y1, x2, y2, color */
+	DRAW_OPS
+};
+
+static const char *draw_op_names[DRAW_OPS] = {
+	NULL,
+	"DRAW_BLIT",
+	"DRAW_BLIT_CLIP",
+	"DRAW_BLIT_ALPHA",
+	"DRAW_TILE",
+	"DRAW_PIXEL",
+	"DRAW_HLINE",
+	"DRAW_VLINE",
+	"DRAW_RECTANGLE",
+	"DRAW_FILLED_RECTANGLE",
+	"DRAW_LINE",
+	"DRAW_AALINE",
+};
+
+/* arguments after the operation, the blits take an image first */
+static const int draw_op_args[DRAW_OPS] = {
+	0, 3, 7, 4, 5, 3, 4, 4, 5, 5, 5, 5
+};
+
+
+/* the object at index if its metatable is mt, otherwise NULL */
+static inline void *to_object(lua_State *L, int index, int mt) {
+	void **ptr;
+	bool ok;
+
+	ptr = lua_touserdata(L, index);
+	if (!ptr || !lua_getmetatable(L, index)) {
+		return NULL;
+	}
+
+	ok = lua_rawequal(L, -1, mt);
+	lua_pop(L, 1);
+
+	return ok ? *ptr : NULL;
+}
+
+
+/* are the n arguments from index numbers, and nothing after them? */
+static inline bool check_numbers(lua_State *L, int index, int n) {
+	int i;
+
+	if (lua_gettop(L) != index + n - 1) {
+		return false;
+	}
+
+	for (i = index; i < index + n; i++) {
+		if (lua_type(L, i) != LUA_TNUMBER) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+#define TO_INT(i) ((int) lua_tointeger(L, (i)))
+#define TO_COLOR(i) ((Uint32) lua_tonumber(L, (i)))
+
+
+/* call the tolua++ binding with the same arguments */
+static int draw_tolua(lua_State *L) {
+	int n = lua_gettop(L);
+
+	lua_pushvalue(L, UPVALUE_TOLUA);
+	lua_insert(L, 1);
+	lua_call(L, n, LUA_MULTRET);
+
+	return lua_gettop(L);
+}
+
+
+static int jiveL_surface_blit(lua_State *L) {
+	JiveSurface *srf, *dst;
+
+	/* stack is:
+	 * 1: surface
+	 * 2: dst
+	 * 3: dx
+	 * 4: dy
+	 */
+
+	srf = to_object(L, 1, UPVALUE_SURFACE);
+	dst = to_object(L, 2, UPVALUE_SURFACE);
+	if (!srf || !dst || !check_numbers(L, 3, 2)) {
+		return draw_tolua(L);
+	}
+
+	jive_surface_blit(srf, dst, TO_INT(3), TO_INT(4));
+	return 0;
+}
+
+
+static int jiveL_surface_blit_clip(lua_State *L) {
+	JiveSurface *srf, *dst;
+
+	/* stack is:
+	 * 1: surface
+	 * 2: sx
+	 * 3: sy
+	 * 4: sw
+	 * 5: sh
+	 * 6: dst
+	 * 7: dx
+	 * 8: dy
+	 */
+
+	srf = to_object(L, 1, UPVALUE_SURFACE);
+	dst = to_object(L, 6, UPVALUE_SURFACE);
+	if (!srf || !dst || lua_gettop(L) != 8
+	    || lua_type(L, 2) != LUA_TNUMBER || lua_type(L, 3) != LUA_TNUMBER
+	    || lua_type(L, 4) != LUA_TNUMBER || lua_type(L, 5) != LUA_TNUMBER
+	    || lua_type(L, 7) != LUA_TNUMBER || lua_type(L, 8) != LUA_TNUMBER) {
+		return draw_tolua(L);
+	}
+
+	jive_surface_blit_clip(srf, TO_INT(2), TO_INT(3), TO_INT(4), TO_INT(5), dst, TO_INT(7), TO_INT(8));
+	return 0;
+}
+
+
+static int jiveL_surface_blit_alpha(lua_State *L) {
+	JiveSurface *srf, *dst;
+
+	/* stack is:
+	 * 1: surface
+	 * 2: dst
+	 * 3: dx
+	 * 4: dy
+	 * 5: alpha
+	 */
+
+	srf = to_object(L, 1, UPVALUE_SURFACE);
+	dst = to_object(L, 2, UPVALUE_SURFACE);
+	if (!srf || !dst || !check_numbers(L, 3, 3)) {
+		return draw_tolua(L);
+	}
+
+	jive_surface_blit_alpha(srf, dst, TO_INT(3), TO_INT(4), TO_INT(5));
+	return 0;
+}
+
+
+static int jiveL_surface_get_size(lua_State *L) {
+	JiveSurface *srf;
+	Uint16 w = 0, h = 0;
+
+	/* stack is:
+	 * 1: surface
+	 */
+
+	srf = to_object(L, 1, UPVALUE_SURFACE);
+	if (!srf || lua_gettop(L) != 1) {
+		return draw_tolua(L);
+	}
+
+	jive_surface_get_size(srf, &w, &h);
+
+	lua_pushinteger(L, w);
+	lua_pushinteger(L, h);
+	return 2;
+}
+
+
+static int jiveL_surface_pixel(lua_State *L) {
+	JiveSurface *srf;
+
+	/* stack is:
+	 * 1: surface
+	 * 2: x
+	 * 3: y
+	 * 4: color
+	 */
+
+	srf = to_object(L, 1, UPVALUE_SURFACE);
+	if (!srf || !check_numbers(L, 2, 3)) {
+		return draw_tolua(L);
+	}
+
+	jive_surface_pixelColor(srf, TO_INT(2), TO_INT(3), TO_COLOR(4));
+	return 0;
+}
+
+
+static int jiveL_surface_hline(lua_State *L) {
+	JiveSurface *srf;
+
+	/* stack is:
+	 * 1: surface
+	 * 2: x1
+	 * 3: x2
+	 * 4: y
+	 * 5: color
+	 */
+
+	srf = to_object(L, 1, UPVALUE_SURFACE);
+	if (!srf || !check_numbers(L, 2, 4)) {
+		return draw_tolua(L);
+	}
+
+	jive_surface_hlineColor(srf, TO_INT(2), TO_INT(3), TO_INT(4), TO_COLOR(5));
+	return 0;
+}
+
+
+static int jiveL_surface_vline(lua_State *L) {
+	JiveSurface *srf;
+
+	/* stack is:
+	 * 1: surface
+	 * 2: x
+	 * 3: y1
+	 * 4: y2
+	 * 5: color
+	 */
+
+	srf = to_object(L, 1, UPVALUE_SURFACE);
+	if (!srf || !check_numbers(L, 2, 4)) {
+		return draw_tolua(L);
+	}
+
+	jive_surface_vlineColor(srf, TO_INT(2), TO_INT(3), TO_INT(4), TO_COLOR(5));
+	return 0;
+}
+
+
+static int jiveL_surface_rectangle(lua_State *L) {
+	JiveSurface *srf;
+
+	/* stack is:
+	 * 1: surface
+	 * 2: x1
+	 * 3: y1
+	 * 4: x2
+	 * 5: y2
+	 * 6: color
+	 */
+
+	srf = to_object(L, 1, UPVALUE_SURFACE);
+	if (!srf || !check_numbers(L, 2, 5)) {
+		return draw_tolua(L);
+	}
+
+	jive_surface_rectangleColor(srf, TO_INT(2), TO_INT(3), TO_INT(4), TO_INT(5), TO_COLOR(6));
+	return 0;
+}
+
+
+static int jiveL_surface_filled_rectangle(lua_State *L) {
+	JiveSurface *srf;
+
+	/* stack is:
+	 * 1: surface
+	 * 2: x1
+	 * 3: y1
+	 * 4: x2
+	 * 5: y2
+	 * 6: color
+	 */
+
+	srf = to_object(L, 1, UPVALUE_SURFACE);
+	if (!srf || !check_numbers(L, 2, 5)) {
+		return draw_tolua(L);
+	}
+
+	jive_surface_boxColor(srf, TO_INT(2), TO_INT(3), TO_INT(4), TO_INT(5), TO_COLOR(6));
+	return 0;
+}
+
+
+static int jiveL_surface_line(lua_State *L) {
+	JiveSurface *srf;
+
+	/* stack is:
+	 * 1: surface
+	 * 2: x1
+	 * 3: y1
+	 * 4: x2
+	 * 5: y2
+	 * 6: color
+	 */
+
+	srf = to_object(L, 1, UPVALUE_SURFACE);
+	if (!srf || !check_numbers(L, 2, 5)) {
+		return draw_tolua(L);
+	}
+
+	jive_surface_lineColor(srf, TO_INT(2), TO_INT(3), TO_INT(4), TO_INT(5), TO_COLOR(6));
+	return 0;
+}
+
+
+static int jiveL_surface_aaline(lua_State *L) {
+	JiveSurface *srf;
+
+	/* stack is:
+	 * 1: surface
+	 * 2: x1
+	 * 3: y1
+	 * 4: x2
+	 * 5: y2
+	 * 6: color
+	 */
+
+	srf = to_object(L, 1, UPVALUE_SURFACE);
+	if (!srf || !check_numbers(L, 2, 5)) {
+		return draw_tolua(L);
+	}
+
+	jive_surface_aalineColor(srf, TO_INT(2), TO_INT(3), TO_INT(4), TO_INT(5), TO_COLOR(6));
+	return 0;
+}
+
+
+static int jiveL_tile_blit(lua_State *L) {
+	JiveTile *tile;
+	JiveSurface *dst;
+
+	/* stack is:
+	 * 1: tile
+	 * 2: dst
+	 * 3: dx
+	 * 4: dy
+	 * 5: dw
+	 * 6: dh
+	 */
+
+	tile = to_object(L, 1, UPVALUE_TILE);
+	dst = to_object(L, 2, UPVALUE_SURFACE);
+	if (!tile || !dst || !check_numbers(L, 3, 4)) {
+		return draw_tolua(L);
+	}
+
+	jive_tile_blit(tile, dst, TO_INT(3), TO_INT(4), TO_INT(5), TO_INT(6));
+	return 0;
+}
+
+
+static int jiveL_surface_draw_list(lua_State *L) {
+	JiveSurface *dst, *srf = NULL;
+	int i, j, n, op, nargs, base;
+
+	/* stack is:
+	 * 1: surface
+	 * 2: list
+	 */
+
+	dst = to_object(L, 1, UPVALUE_SURFACE);
+	if (!dst) {
+		return luaL_argerror(L, 1, "Surface expected");
+	}
+	luaL_checktype(L, 2, LUA_TTABLE);
+
+	n = lua_objlen(L, 2);
+	for (i = 1; i <= n; i += nargs + 1) {
+		lua_rawgeti(L, 2, i);
+		op = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+
+		if (op <= 0 || op >= DRAW_OPS) {
+			return luaL_error(L, "invalid draw operation at %d", i);
+		}
+
+		nargs = draw_op_args[op];
+		if (i + nargs > n) {
+			return luaL_error(L, "missing arguments for %s at %d", draw_op_names[op], i);
+		}
+
+		luaL_checkstack(L, nargs, NULL);
+		for (j = 1; j <= nargs; j++) {
+			lua_rawgeti(L, 2, i + j);
+		}
+		base = lua_gettop(L) - nargs + 1;
+
+		switch (op) {
+		case DRAW_BLIT:
+		case DRAW_BLIT_CLIP:
+		case DRAW_BLIT_ALPHA:
+			srf = to_object(L, base, UPVALUE_SURFACE);
+			if (!srf) {
+				return luaL_error(L, "Surface expected for %s at %d", draw_op_names[op], i);
+			}
+			break;
+		case DRAW_TILE:
+			srf = to_object(L, base, UPVALUE_TILE);
+			if (!srf) {
+				return luaL_error(L, "Tile expected for %s at %d", draw_op_names[op], i);
+			}
+			break;
+		default:
+			break;
+		}
+
+		switch (op) {
+		case DRAW_BLIT:
+			jive_surface_blit(srf, dst, TO_INT(base + 1), TO_INT(base + 2));
+			break;
+		case DRAW_BLIT_CLIP:
+			jive_surface_blit_clip(srf, TO_INT(base + 1), TO_INT(base + 2), TO_INT(base + 3), TO_INT(base + 4),
+					       dst, TO_INT(base + 5), TO_INT(base + 6));
+			break;
+		case DRAW_BLIT_ALPHA:
+			jive_surface_blit_alpha(srf, dst, TO_INT(base + 1), TO_INT(base + 2), TO_INT(base + 3));
+			break;
+		case DRAW_TILE:
+			jive_tile_blit(srf, dst, TO_INT(base + 1), TO_INT(base + 2), TO_INT(base + 3), TO_INT(base + 4));
+			break;
+		case DRAW_PIXEL:
+			jive_surface_pixelColor(dst, TO_INT(base), TO_INT(base + 1), TO_COLOR(base + 2));
+			break;
+		case DRAW_HLINE:
+			jive_surface_hlineColor(dst, TO_INT(base), TO_INT(base + 1), TO_INT(base + 2), TO_COLOR(base + 3));
+			break;
+		case DRAW_VLINE:
+			jive_surface_vlineColor(dst, TO_INT(base), TO_INT(base + 1), TO_INT(base + 2), TO_COLOR(base + 3));
+			break;
+		case DRAW_RECTANGLE:
+			jive_surface_rectangleColor(dst, TO_INT(base), TO_INT(base + 1), TO_INT(base + 2), TO_INT(base + 3), TO_COLOR(base + 4));
+			break;
+		case DRAW_FILLED_RECTANGLE:
+			jive_surface_boxColor(dst, TO_INT(base), TO_INT(base + 1), TO_INT(base + 2), TO_INT(base + 3), TO_COLOR(base + 4));
+			break;
+		case DRAW_LINE:
+			jive_surface_lineColor(dst, TO_INT(base), TO_INT(base + 1), TO_INT(base + 2), TO_INT(base + 3), TO_COLOR(base + 4));
+			break;
+		case DRAW_AALINE:
+			jive_surface_aalineColor(dst, TO_INT(base), TO_INT(base + 1), TO_INT(base + 2), TO_INT(base + 3), TO_COLOR(base + 4));
+			break;
+		}
+
+		lua_settop(L, 2);
+	}
+
+	return 0;
+}
+
+
+/* calls per second of method on surface, called with nargs arguments
+ * from index */
+static int benchmark_calls(lua_State *L, int method, int index, int nargs, int n) {
+	Uint32 t0, elapsed;
+	int i, j;
+
+	if (method < 0) {
+		method = lua_gettop(L) + method + 1;
+	}
+
+	t0 = jive_jiffies();
+	for (i = 0; i < n; i++) {
+		lua_pushvalue(L, method);
+		for (j = 0; j < nargs; j++) {
+			lua_pushvalue(L, index + j);
+		}
+		lua_call(L, nargs, 0);
+	}
+	elapsed = jive_jiffies() - t0;
+
+	return (int) ((double) n * 1000 / (elapsed ? elapsed : 1));
+}
+
+
+static int jiveL_surface_benchmark(lua_State *L) {
+	JiveSurface *dst, *srf;
+	int n, top, i;
+
+	/* stack is:
+	 * 1: Surface class
+	 * 2: number of calls (optional)
+	 */
+
+	n = luaL_optinteger(L, 2, 100000);
+
+	dst = jive_surface_newRGB(64, 64);
+	srf = jive_surface_newRGB(8, 8);
+
+	lua_newtable(L);
+	top = lua_gettop(L);
+
+	/* blit: method, srf, dst, x, y */
+	tolua_pushusertype(L, srf, "Surface");
+	tolua_pushusertype(L, dst, "Surface");
+	lua_pushinteger(L, 4);
+	lua_pushinteger(L, 4);
+
+	luaL_getmetatable(L, "Surface");
+	lua_getfield(L, -1, "blit");
+	lua_getupvalue(L, -1, 3);
+	lua_pushinteger(L, benchmark_calls(L, -1, top + 1, 4, n));
+	lua_setfield(L, top, "blitTolua");
+	lua_pop(L, 1);
+	lua_pushinteger(L, benchmark_calls(L, -1, top + 1, 4, n));
+	lua_setfield(L, top, "blit");
+	lua_pop(L, 2);
+
+	/* filledRectangle: method, dst, x1, y1, x2, y2, color */
+	lua_settop(L, top);
+	tolua_pushusertype(L, dst, "Surface");
+	lua_pushinteger(L, 0);
+	lua_pushinteger(L, 0);
+	lua_pushinteger(L, 2);
+	lua_pushinteger(L, 2);
+	lua_pushnumber(L, 0xFFFFFFFF);
+
+	luaL_getmetatable(L, "Surface");
+	lua_getfield(L, -1, "filledRectangle");
+	lua_getupvalue(L, -1, 3);
+	lua_pushinteger(L, benchmark_calls(L, -1, top + 1, 6, n));
+	lua_setfield(L, top, "filledRectangleTolua");
+	lua_pop(L, 1);
+	lua_pushinteger(L, benchmark_calls(L, -1, top + 1, 6, n));
+	lua_setfield(L, top, "filledRectangle");
+	lua_pop(L, 2);
+
+	/* the same rectangles, 100 per drawList call */
+	lua_settop(L, top);
+	tolua_pushusertype(L, dst, "Surface");
+	lua_createtable(L, 600, 0);
+	for (i = 0; i < 100; i++) {
+		lua_pushinteger(L, DRAW_FILLED_RECTANGLE);
+		lua_rawseti(L, -2, i * 6 + 1);
+		lua_pushinteger(L, 0);
+		lua_rawseti(L, -2, i * 6 + 2);
+		lua_pushinteger(L, 0);
+		lua_rawseti(L, -2, i * 6 + 3);
+		lua_pushinteger(L, 2);
+		lua_rawseti(L, -2, i * 6 + 4);
+		lua_pushinteger(L, 2);
+		lua_rawseti(L, -2, i * 6 + 5);
+		lua_pushnumber(L, 0xFFFFFFFF);
+		lua_rawseti(L, -2, i * 6 + 6);
+	}
+
+	luaL_getmetatable(L, "Surface");
+	lua_getfield(L, -1, "drawList");
+	lua_pushinteger(L, benchmark_calls(L, -1, top + 1, 2, n / 100) * 100);
+	lua_setfield(L, top, "drawList");
+
+	lua_settop(L, top);
+
+	jive_surface_free(srf);
+	jive_surface_free(dst);
+
+	return 1;
+}
+
+
+static const struct luaL_Reg surface_methods[] = {
+	{ "blit", jiveL_surface_blit },
+	{ "blitClip", jiveL_surface_blit_clip },
+	{ "blitAlpha", jiveL_surface_blit_alpha },
+	{ "getSize", jiveL_surface_get_size },
+	{ "pixel", jiveL_surface_pixel },
+	{ "hline", jiveL_surface_hline },
+	{ "vline", jiveL_surface_vline },
+	{ "rectangle", jiveL_surface_rectangle },
+	{ "filledRectangle", jiveL_surface_filled_rectangle },
+	{ "line", jiveL_surface_line },
+	{ "aaline", jiveL_surface_aaline },
+	{ "drawList", jiveL_surface_draw_list },
+	{ NULL, NULL }
+};
+
+static const struct luaL_Reg tile_methods[] = {
+	{ "blit", jiveL_tile_blit },
+	{ NULL, NULL }
+};
+
+
+/* replace the methods in the class metatable at index */
+static void draw_register(lua_State *L, int index, const struct luaL_Reg *methods) {
+	const struct luaL_Reg *reg;
+
+	for (reg = methods; reg->name; reg++) {
+		lua_pushstring(L, reg->name);
+
+		luaL_getmetatable(L, "Surface");
+		luaL_getmetatable(L, "Tile");
+		lua_pushstring(L, reg->name);
+		lua_rawget(L, index);
+		lua_pushcclosure(L, reg->func, 3);
+
+		lua_rawset(L, index);
+	}
+}
+
+
+/*
+ * Install the fast Surface and Tile bindings, after the tolua++ classes
+ * are registered.
+ */
+void jive_draw_register(lua_State *L) {
+	int i;
+
+	luaL_getmetatable(L, "Surface");
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		return;
+	}
+
+	draw_register(L, lua_gettop(L), surface_methods);
+
+	for (i = 1; i < DRAW_OPS; i++) {
+		lua_pushstring(L, draw_op_names[i]);
+		lua_pushinteger(L, i);
+		lua_rawset(L, -3);
+	}
+
+	lua_pushstring(L, "benchmark");
+	lua_pushcfunction(L, jiveL_surface_benchmark);
+	lua_rawset(L, -3);
+
+	lua_pop(L, 1);
+
+	luaL_getmetatable(L, "Tile");
+	draw_register(L, lua_gettop(L), tile_methods);
+	lua_pop(L, 1);
+}
@@ -11,6 +11,14 @@
 
 static const char *JIVE_FONT_MAGIC = "Font";
 
+/* character width cache size, a power of two */
+#define JIVE_FONT_CHAR_WIDTH_CACHE 512
+
+struct jive_font_char_width {
+	Uint32 code;
+	int width;
+};
+
 static JiveFont *fonts = NULL;
 
 
@@ -92,6 +100,9 @@ void jive_font_free(JiveFont *font) {
 	}
 
 	font->destroy(font);
+	if (font->char_width) {
+		free(font->char_width);
+	}
 	free(font->name);
 	free(font);
 
@@ -124,6 +135,49 @@ int jive_font_nwidth(JiveFont *font, const char *str, size_t len) {
 	return font->width(font, tmp);
 }
 
+/*
+ * Returns the width of the UTF-8 character at ptr, and sets nptr to the
+ * next character. The widths are cached per font, so measuring text one
+ * character at a time does not need a TTF_SizeUTF8 call per character.
+ */
+int jive_font_char_width(JiveFont *font, const char *ptr, const char **nptr) {
+	struct jive_font_char_width *entry;
+	const char *next;
+	char tmp[8];
+	Uint32 code;
+	size_t len;
+
+	assert(font && font->magic == JIVE_FONT_MAGIC);
+
+	code = utf8_get_char(ptr, &next);
+	if (nptr) {
+		*nptr = next;
+	}
+
+	if (!font->char_width) {
+		font->char_width = malloc(sizeof(struct jive_font_char_width) * JIVE_FONT_CHAR_WIDTH_CACHE);
+		if (!font->char_width) {
+			return jive_font_nwidth(font, ptr, next - ptr);
+		}
+		memset(font->char_width, 0xFF, sizeof(struct jive_font_char_width) * JIVE_FONT_CHAR_WIDTH_CACHE);
+	}
+
+	entry = &font->char_width[code & (JIVE_FONT_CHAR_WIDTH_CACHE - 1)];
+	if (entry->code != code) {
+		len = next - ptr;
+		if (len >= sizeof(tmp)) {
+			len = sizeof(tmp) - 1;
+		}
+		memcpy(tmp, ptr, len);
+		tmp[len] = '\0';
+
+		entry->code = code;
+		entry->width = font->width(font, tmp);
+	}
+
+	return entry->width;
+}
+
 int jive_font_miny_char(JiveFont *font, Uint16 ch) {
 	int miny;
 
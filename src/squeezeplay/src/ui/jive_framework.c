@@ -28,6 +28,43 @@ static Uint32 next_jive_origin = 0;
 struct jive_perfwarn perfwarn = { 0, 0, 0, 0, 0, 0 };
 
 
+/* frame time histogram, collected while perfwarn.screen is enabled.
+ * bucket 0 counts frames < 1ms, bucket n counts frames of 2^(n-1) to
+ * 2^n - 1 ms and the last bucket everything longer.
+ */
+#define FRAME_HISTOGRAM_BUCKETS 8
+
+enum {
+	FRAME_PHASE_LAYOUT = 0,
+	FRAME_PHASE_ANIMATE,
+	FRAME_PHASE_BACKGROUND,
+	FRAME_PHASE_DRAW,
+	FRAME_PHASE_FLIP,
+	FRAME_PHASE_SCREEN,
+	FRAME_PHASES
+};
+
+static const char *frame_phase_names[FRAME_PHASES] = {
+	"layout", "animate", "background", "draw", "flip", "screen"
+};
+
+static Uint32 frame_histogram[FRAME_PHASES][FRAME_HISTOGRAM_BUCKETS];
+static Uint32 frames_drawn = 0;
+static Uint32 frames_idle = 0;
+
+/* number of consecutive frames that were redrawn */
+static int frames_busy = 0;
+
+/* layout counters, updated by jiveL_widget_check_layout. the per frame
+ * counts are summed into layout_total and the busiest frame is kept in
+ * layout_max.
+ */
+struct jive_layout_stats layout_stats = { 0, 0, 0 };
+static struct jive_layout_stats layout_total = { 0, 0, 0 };
+static struct jive_layout_stats layout_max = { 0, 0, 0 };
+static Uint32 layout_frames = 0;
+
+
 /* button hold threshold 1 seconds */
 #define HOLD_TIMEOUT 1000
 
@@ -128,7 +165,9 @@ static struct jive_keyir irmap[] = {
 };
 
 static int process_event(lua_State *L, SDL_Event *event);
+static int do_dispatch_event(lua_State *L, JiveEvent *jevent);
 static void process_timers(lua_State *L);
+static JiveFrameState frame_state(lua_State *L);
 static int filter_events(const SDL_Event *event);
 int jiveL_update_screen(lua_State *L);
 
@@ -176,6 +215,8 @@ static int jiveL_initSDL(lua_State *L) {
 		exit(-1);
 	}
 
+	jive_input_init();
+
 	/* report video info */
 	if ((video_info = SDL_GetVideoInfo())) {
 		LOG_INFO(log_ui_draw, "%d,%d %d bits/pixel %d bytes/pixel [R<<%d G<<%d B<<%d]", video_info->current_w, video_info->current_h, video_info->vfmt->BitsPerPixel, video_info->vfmt->BytesPerPixel, video_info->vfmt->Rshift, video_info->vfmt->Gshift, video_info->vfmt->Bshift);
@@ -340,9 +381,34 @@ static int jiveL_quit(lua_State *L) {
 }
 
 
+static void pump_events(lua_State *L) {
+	SDL_PumpEvents();
+
+	if (jive_sdlevent_pump) {
+		jive_sdlevent_pump(L);
+	}
+}
+
+
+static int jiveL_poll_input(lua_State *L) {
+	SDL_Event event;
+
+	/* stack:
+	 * 1 : jive.ui.Framework
+	 */
+
+	pump_events(L);
+
+	lua_pushboolean(L, jive_input_pending() || SDL_PeepEvents(&event, 1, SDL_PEEKEVENT, SDL_ALLEVENTS) > 0);
+	return 1;
+}
+
+
 static int jiveL_process_events(lua_State *L) {
 	Uint32 r = 0;
 	SDL_Event event;
+	JiveEvent jevent;
+	bool more;
 
 	/* stack:
 	 * 1 : jive.ui.Framework
@@ -361,12 +427,8 @@ static int jiveL_process_events(lua_State *L) {
 	lua_rawgeti(L, -1, 1);
 
 
-	/* pump keyboard/mouse events once per frame */
-	SDL_PumpEvents();
-
-	if (jive_sdlevent_pump) {
-		jive_sdlevent_pump(L);
-	}
+	/* pump keyboard/mouse events */
+	pump_events(L);
 
 	/* check queue size */
 	if (perfwarn.queue) {
@@ -377,9 +439,19 @@ static int jiveL_process_events(lua_State *L) {
 
 	/* process events */
 	process_timers(L);
-	while (SDL_PeepEvents(&event, 1, SDL_GETEVENT, SDL_ALLEVENTS) > 0 ) {
-		r |= process_event(L, &event);
-	}
+	do {
+		more = false;
+
+		while (SDL_PeepEvents(&event, 1, SDL_GETEVENT, SDL_ALLEVENTS) > 0 ) {
+			r |= process_event(L, &event);
+		}
+
+		/* platform input, this may queue more sdl events */
+		while (jive_input_next(&jevent)) {
+			r |= do_dispatch_event(L, &jevent);
+			more = true;
+		}
+	} while (more);
 
 	lua_pop(L, 2);
 	
@@ -422,6 +494,18 @@ int jiveL_set_update_screen(lua_State *L) {
 }
 
 
+static void frame_histogram_add(int phase, Uint32 ms) {
+	int bucket = 0;
+
+	while (ms && bucket < FRAME_HISTOGRAM_BUCKETS - 1) {
+		ms >>= 1;
+		bucket++;
+	}
+
+	frame_histogram[phase][bucket]++;
+}
+
+
 static int _draw_screen(lua_State *L) {
 	JiveSurface *srf;
 	Uint32 t0 = 0, t1 = 0, t2 = 0, t3 = 0, t4 = 0;
@@ -456,6 +540,8 @@ static int _draw_screen(lua_State *L) {
 	}
 
 
+	memset(&layout_stats, 0, sizeof(layout_stats));
+
 	do {
 		jive_origin = next_jive_origin;
 
@@ -469,6 +555,17 @@ static int _draw_screen(lua_State *L) {
 	} while (jive_origin != next_jive_origin);
 
 	if (perfwarn.screen) t1 = jive_jiffies();
+
+	if (!standalone_draw && layout_stats.laid_out) {
+		layout_frames++;
+		layout_total.visited += layout_stats.visited;
+		layout_total.skinned += layout_stats.skinned;
+		layout_total.laid_out += layout_stats.laid_out;
+
+		if (layout_stats.laid_out > layout_max.laid_out) {
+			memcpy(&layout_max, &layout_stats, sizeof(layout_max));
+		}
+	}
  
 	/* Widget animations - don't update in a standalone draw as its not the main screen update */
 	if (!standalone_draw) {
@@ -569,15 +666,26 @@ static int _draw_screen(lua_State *L) {
 		drawn = true;
 	}
 
+	if (!standalone_draw) {
+		frames_busy = drawn ? frames_busy + 1 : 0;
+	}
+
 	if (perfwarn.screen) {
 		t4 = jive_jiffies();
 		c1 = clock();
+		if (!t3) {
+			t3 = t2;
+		}
+		if (!standalone_draw) {
+			frame_histogram_add(FRAME_PHASE_LAYOUT, t1-t0);
+			frame_histogram_add(FRAME_PHASE_ANIMATE, t2-t1);
+			frame_histogram_add(FRAME_PHASE_BACKGROUND, t3-t2);
+			frame_histogram_add(FRAME_PHASE_DRAW, t4-t3);
+			frame_histogram_add(FRAME_PHASE_SCREEN, t4-t0);
+		}
 		if (t4-t0 > perfwarn.screen) {
-			if (!t3) {
-				t3 = t2;
-			}
-			printf("update_screen > %dms: %4dms (%dms) [layout:%dms animate:%dms background:%dms draw:%dms]\n",
-				   perfwarn.screen, t4-t0, (int)((c1-c0) * 1000 / CLOCKS_PER_SEC), t1-t0, t2-t1, t3-t2, t4-t3);
+			printf("update_screen > %dms: %4dms (%dms) [layout:%dms (%d/%d widgets) animate:%dms background:%dms draw:%dms]\n",
+				   perfwarn.screen, t4-t0, (int)((c1-c0) * 1000 / CLOCKS_PER_SEC), t1-t0, layout_stats.laid_out, layout_stats.visited, t2-t1, t3-t2, t4-t3);
 		}
 	}
 	
@@ -616,6 +724,7 @@ int jiveL_draw(lua_State *L) {
 
 int jiveL_update_screen(lua_State *L) {
 	JiveSurface *screen;
+	Uint32 t0 = 0;
 
 	/* stack is:
 	 * 1: framework
@@ -629,6 +738,16 @@ int jiveL_update_screen(lua_State *L) {
 		return 0;
 	}
 
+	/* convert preloaded images */
+	jive_tile_preload_pump();
+
+	/* nothing to layout, animate or draw */
+	if (frame_state(L) == JIVE_FRAME_IDLE) {
+		frames_idle++;
+		jive_input_frame(false);
+		return 0;
+	}
+
 	lua_pushcfunction(L, jive_traceback);  /* push traceback function */
 
 	lua_pushcfunction(L, _draw_screen);
@@ -648,8 +767,16 @@ int jiveL_update_screen(lua_State *L) {
 
 	/* flip screen */
 	if (lua_toboolean(L, -1)) {
+		if (perfwarn.screen) t0 = jive_jiffies();
+
 		jive_surface_flip(screen);
+		frames_drawn++;
+
+		if (perfwarn.screen) {
+			frame_histogram_add(FRAME_PHASE_FLIP, jive_jiffies() - t0);
+		}
 	}
+	jive_input_frame(lua_toboolean(L, -1));
 
 	lua_pop(L, 2);
 
@@ -657,6 +784,204 @@ int jiveL_update_screen(lua_State *L) {
 }
 
 
+static bool layout_pending(lua_State *L, int index) {
+	JiveWidget *peer;
+	bool pending;
+
+	lua_getfield(L, index, "peer");
+	peer = lua_touserdata(L, -1);
+	lua_pop(L, 1);
+
+	pending = (!peer
+		   || peer->skin_origin != jive_origin
+		   || peer->layout_origin != jive_origin
+		   || peer->child_origin != jive_origin);
+
+	return pending;
+}
+
+
+/*
+ * Returns JIVE_FRAME_IDLE if the next frame would not layout, animate or
+ * draw anything, JIVE_FRAME_ACTIVE during window transitions and when
+ * consecutive frames are redrawn without widget animations (scrolling),
+ * otherwise JIVE_FRAME_NORMAL.
+ */
+static JiveFrameState frame_state(lua_State *L) {
+	JiveFrameState state = JIVE_FRAME_IDLE;
+
+	/* stack is:
+	 * 1: framework
+	 */
+
+	JIVEL_STACK_CHECK_BEGIN(L);
+
+	lua_getfield(L, 1, "transition");
+	if (!lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+
+		JIVEL_STACK_CHECK_ASSERT(L);
+		return JIVE_FRAME_ACTIVE;
+	}
+	lua_pop(L, 1);
+
+	lua_getfield(L, 1, "animations");
+	if (lua_objlen(L, -1) > 0) {
+		lua_pop(L, 1);
+
+		JIVEL_STACK_CHECK_ASSERT(L);
+		return JIVE_FRAME_NORMAL;
+	}
+	lua_pop(L, 1);
+
+	if (jive_dirty_region.w || jive_origin != next_jive_origin) {
+		state = (frames_busy >= 2) ? JIVE_FRAME_ACTIVE : JIVE_FRAME_NORMAL;
+	}
+	else {
+		/* top window and global widgets */
+		lua_getfield(L, 1, "windowStack");
+		lua_rawgeti(L, -1, 1);
+		if (!lua_isnil(L, -1) && layout_pending(L, -1)) {
+			state = JIVE_FRAME_NORMAL;
+		}
+		lua_pop(L, 2);
+
+		lua_getfield(L, 1, "widgets");
+		lua_pushnil(L);
+		while (state == JIVE_FRAME_IDLE && lua_next(L, -2) != 0) {
+			if (layout_pending(L, -1)) {
+				state = JIVE_FRAME_NORMAL;
+			}
+			lua_pop(L, 1);
+		}
+		if (state != JIVE_FRAME_IDLE) {
+			/* lua_next did not complete, pop the key */
+			lua_pop(L, 1);
+		}
+		lua_pop(L, 1);
+	}
+
+	JIVEL_STACK_CHECK_END(L);
+
+	return state;
+}
+
+
+int jiveL_get_frame_interval(lua_State *L) {
+	/* stack is:
+	 * 1: framework
+	 *
+	 * returns the interval in ms until the next frame should be drawn,
+	 * or 0 if there is nothing to draw.
+	 */
+
+	switch (frame_state(L)) {
+	case JIVE_FRAME_ACTIVE:
+		lua_pushinteger(L, 1000 / JIVE_FRAME_RATE_ACTIVE);
+		break;
+	case JIVE_FRAME_NORMAL:
+		lua_pushinteger(L, 1000 / JIVE_FRAME_RATE);
+		break;
+	default:
+		lua_pushinteger(L, 0);
+		break;
+	}
+
+	return 1;
+}
+
+
+int jiveL_get_frame_histogram(lua_State *L) {
+	int i, j;
+
+	/* stack is:
+	 * 1: framework
+	 * 2: reset (optional)
+	 */
+
+	lua_newtable(L);
+
+	for (i = 0; i < FRAME_PHASES; i++) {
+		lua_newtable(L);
+		for (j = 0; j < FRAME_HISTOGRAM_BUCKETS; j++) {
+			lua_pushinteger(L, frame_histogram[i][j]);
+			lua_rawseti(L, -2, j + 1);
+		}
+		lua_setfield(L, -2, frame_phase_names[i]);
+	}
+
+	lua_pushinteger(L, frames_drawn);
+	lua_setfield(L, -2, "frames");
+
+	lua_pushinteger(L, frames_idle);
+	lua_setfield(L, -2, "idle");
+
+	if (lua_toboolean(L, 2)) {
+		memset(frame_histogram, 0, sizeof(frame_histogram));
+		frames_drawn = 0;
+		frames_idle = 0;
+	}
+
+	return 1;
+}
+
+
+static void push_layout_stats(lua_State *L, struct jive_layout_stats *stats) {
+	lua_newtable(L);
+
+	lua_pushinteger(L, stats->visited);
+	lua_setfield(L, -2, "visited");
+
+	lua_pushinteger(L, stats->skinned);
+	lua_setfield(L, -2, "skinned");
+
+	lua_pushinteger(L, stats->laid_out);
+	lua_setfield(L, -2, "layout");
+}
+
+
+int jiveL_preload_images(lua_State *L) {
+
+	/* stack is:
+	 * 1: framework
+	 */
+
+	lua_pushinteger(L, jive_tile_preload_images());
+	return 1;
+}
+
+
+int jiveL_get_layout_stats(lua_State *L) {
+
+	/* stack is:
+	 * 1: framework
+	 * 2: reset (optional)
+	 */
+
+	lua_newtable(L);
+
+	push_layout_stats(L, &layout_stats);
+	lua_setfield(L, -2, "last");
+
+	push_layout_stats(L, &layout_max);
+	lua_setfield(L, -2, "max");
+
+	push_layout_stats(L, &layout_total);
+	lua_setfield(L, -2, "total");
+
+	lua_pushinteger(L, layout_frames);
+	lua_setfield(L, -2, "frames");
+
+	if (lua_toboolean(L, 2)) {
+		memset(&layout_total, 0, sizeof(layout_total));
+		memset(&layout_max, 0, sizeof(layout_max));
+		layout_frames = 0;
+	}
+
+	return 1;
+}
+
+
 void jive_redraw(SDL_Rect *r) {
 	if (jive_dirty_region.w) {
 		jive_rect_union(&jive_dirty_region, r, &jive_dirty_region);
@@ -717,18 +1042,6 @@ int jiveL_style_changed(lua_State *L) {
 }
 
 
-void jive_queue_event(JiveEvent *evt) {
-	SDL_Event user_event;
-	user_event.type = SDL_USEREVENT;
-
-	user_event.user.code = JIVE_USER_EVENT_EVENT;
-	user_event.user.data1 = malloc(sizeof(JiveEvent));
-	memcpy(user_event.user.data1, evt, sizeof(JiveEvent));
-
-	SDL_PushEvent(&user_event);
-}
-
-
 int jiveL_dispatch_event(lua_State *L) {
 	Uint32 r = 0;
 	Uint32 t0 = 0, t1 = 0;
@@ -914,56 +1227,6 @@ int jiveL_push_event(lua_State *L) {
 	return 0;
 } 
 
-int jiveL_event(lua_State *L) {
-	int r = 0;
-	int listener_type;
-	int event_type;
-
-	/* stack is:
-	 * 1: framework
-	 * 2: event
-	 * 3: globalListeners if true, or unusedListeners
-	 */
-
-	lua_getfield(L, 2, "getType");
-	lua_pushvalue(L, 2);
-	lua_call(L, 1, 1);
-	event_type = lua_tointeger(L, -1);
-	lua_pop(L, 1);
-
-	listener_type = lua_toboolean(L, 3);
-	if (listener_type) {
-		lua_getfield(L, 1, "globalListeners");
-	}
-	else {
-		lua_getfield(L, 1, "unusedListeners");
-	}
-	lua_pushnil(L);
-	while (r == 0 && lua_next(L, -2) != 0) {
-		int mask;
-
-		lua_rawgeti(L, -1, 1);
-		mask = lua_tointeger(L, -1);
-
-		if (event_type & mask) {
-			lua_rawgeti(L, -2, 2);
-			lua_pushvalue(L, 2);
-			lua_call(L, 1, 1);
-
-			r = r | lua_tointeger(L, -1);
-
-			lua_pop(L, 1);
-		}
-
-		lua_pop(L, 2);
-	}
-	lua_pop(L, 1);
-
-	lua_pushinteger(L, r);
-	return 1;
-}
-
-
 int jiveL_get_ticks(lua_State *L) {
 	lua_pushinteger(L, jive_jiffies());
 	return 1;
@@ -1291,6 +1554,10 @@ static int process_event(lua_State *L, SDL_Event *event) {
 		return 0;
 	}
 
+	if (jevent.type & JIVE_EVENT_ALL_INPUT) {
+		jive_input_mark(now);
+	}
+
 	return do_dispatch_event(L, &jevent);
 }
 
@@ -1487,6 +1754,7 @@ static const struct luaL_Reg core_methods[] = {
 	{ "initSDL", jiveL_initSDL },
 	{ "quit", jiveL_quit },
 	{ "processEvents", jiveL_process_events },
+	{ "pollInput", jiveL_poll_input },
 	{ "setUpdateScreen", jiveL_set_update_screen },
 	{ "draw", jiveL_draw },
 	{ "updateScreen", jiveL_update_screen },
@@ -1500,7 +1768,21 @@ static const struct luaL_Reg core_methods[] = {
 	{ "setBackground", jiveL_set_background },
 	{ "styleChanged", jiveL_style_changed },
 	{ "perfwarn", jiveL_perfwarn },
+	{ "getFrameInterval", jiveL_get_frame_interval },
+	{ "getFrameHistogram", jiveL_get_frame_histogram },
+	{ "getLayoutStats", jiveL_get_layout_stats },
+	{ "gcStep", jiveL_gc_step },
+	{ "getGCStats", jiveL_get_gc_stats },
+	{ "getInputFds", jiveL_get_input_fds },
+	{ "getInputStats", jiveL_get_input_stats },
+	{ "getActionStats", jiveL_get_action_stats },
+	{ "preloadImages", jiveL_preload_images },
+	{ "_addListener", jiveL_add_listener },
+	{ "_removeListener", jiveL_remove_listener },
 	{ "_event", jiveL_event },
+	{ "_clearInputMap", jiveL_clear_input_map },
+	{ "_mapInput", jiveL_map_input },
+	{ "_inputToAction", jiveL_input_to_action },
 	{ NULL, NULL }
 };
 
@@ -1560,6 +1842,14 @@ static int jiveL_core_init(lua_State *L) {
 	lua_getfield(L, 2, "Framework");
 	luaL_register(L, NULL, core_methods);
 	lua_pop(L, 1);
+
+	jive_action_init(L);
+
+	lua_getfield(L, 2, "Task");
+	jive_task_register(L);
+	lua_pop(L, 1);
+
+	jive_draw_register(L);
 	
 	return 0;
 }
@@ -0,0 +1,454 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+
+#include "common.h"
+#include "jive.h"
+#include "valgrind.h"
+
+
+/* The Lua heap is accounted by jive_lua_alloc, and the event loop keeps
+ * the collector stopped and calls jiveL_gc_step once a frame with the
+ * idle time left before the next frame is due. Each frame the pacer
+ * steps the collector for the bytes Lua allocated since the last frame,
+ * until the budget runs out; unpaid debt is carried to the next frame.
+ * If the heap grows past JIVE_GC_PAUSE percent of its size after the
+ * last cycle the debt is paid whatever the budget.
+ */
+
+/* kbytes of allocation collected by each step */
+#define JIVE_GC_STEP_KB 4
+
+/* heap growth over the last cycle, in percent, that forces a collection */
+#define JIVE_GC_PAUSE 200
+
+
+/* Small Lua objects (strings, tables, closures, upvalues) are allocated
+ * from per size class free lists, carved from JIVE_POOL_SLAB byte slabs,
+ * so they do not fragment the malloc heap. Lua passes the old block size
+ * to the allocator, which tells us which pool a block belongs to. Larger
+ * blocks use malloc. Slabs are never returned, the pools settle at the
+ * peak number of objects of each size.
+ */
+#define JIVE_POOL_SLAB 16384
+
+/* size classes are 8 bytes apart to 128 bytes, then 16 bytes to 256 */
+#define JIVE_POOL_MAX 256
+#define JIVE_POOL_CLASSES (128 / 8 + (JIVE_POOL_MAX - 128) / 16)
+
+struct jive_pool {
+	void *free;		/* free list, linked through the blocks */
+	Uint32 size;
+	Uint32 slabs;
+	Uint32 used;		/* blocks */
+	Uint32 peak;
+	Uint32 allocs;
+};
+
+static struct jive_pool pools[JIVE_POOL_CLASSES];
+static int pools_enabled = -1;
+
+static Uint32 large_allocs = 0;
+static size_t large_bytes = 0;
+
+
+extern struct jive_perfwarn perfwarn;
+
+
+/* heap accounting, updated by the allocator */
+static size_t heap_bytes = 0;
+static size_t heap_max = 0;
+static size_t heap_peak = 0;		/* since the stats were reset */
+static size_t frame_alloc = 0;		/* since the last gc step */
+
+/* pacer state */
+static size_t gc_debt = 0;
+static size_t gc_cycle_heap = 0;	/* heap at the end of the last cycle */
+
+static struct jive_gc_stats {
+	Uint32 frames;
+	Uint32 steps;
+	Uint32 cycles;
+	Uint32 forced;		/* frames over budget to bound the heap */
+	Uint32 time_last;	/* ms */
+	Uint32 time_max;
+	Uint32 time_total;
+	size_t alloc_last;	/* bytes */
+	size_t alloc_max;
+} gc_stats;
+
+
+static inline int pool_class(size_t size) {
+	if (size <= 128) {
+		return (size - 1) / 8;
+	}
+	return 128 / 8 + (size - 129) / 16;
+}
+
+
+static void pools_init(void) {
+	int i;
+
+	/* valgrind checks the individual blocks */
+	pools_enabled = !RUNNING_ON_VALGRIND;
+
+	for (i = 0; i < JIVE_POOL_CLASSES; i++) {
+		pools[i].size = (i < 128 / 8) ? (i + 1) * 8 : 128 + (i - 128 / 8 + 1) * 16;
+	}
+}
+
+
+static void *pool_alloc(struct jive_pool *pool) {
+	void *ptr;
+	char *slab;
+	size_t i, n;
+
+	if (!pool->free) {
+		slab = malloc(JIVE_POOL_SLAB);
+		if (!slab) {
+			return NULL;
+		}
+
+		n = JIVE_POOL_SLAB / pool->size;
+		for (i = 0; i < n; i++) {
+			*(void **)(slab + i * pool->size) = pool->free;
+			pool->free = slab + i * pool->size;
+		}
+		pool->slabs++;
+	}
+
+	ptr = pool->free;
+	pool->free = *(void **)ptr;
+
+	pool->allocs++;
+	if (++pool->used > pool->peak) {
+		pool->peak = pool->used;
+	}
+
+	return ptr;
+}
+
+
+static void pool_free(struct jive_pool *pool, void *ptr) {
+	*(void **)ptr = pool->free;
+	pool->free = ptr;
+	pool->used--;
+}
+
+
+/* allocate nsize bytes, moving the osize byte block ptr */
+static void *heap_realloc(void *ptr, size_t osize, size_t nsize) {
+	void *nptr;
+	int oclass, nclass;
+
+	oclass = (ptr && osize <= JIVE_POOL_MAX) ? pool_class(osize) : -1;
+	nclass = (nsize && nsize <= JIVE_POOL_MAX) ? pool_class(nsize) : -1;
+
+	if (oclass < 0 && nclass < 0) {
+		if (nsize == 0) {
+			free(ptr);
+			large_bytes -= osize;
+			return NULL;
+		}
+
+		nptr = realloc(ptr, nsize);
+		if (nptr) {
+			if (!ptr) {
+				large_allocs++;
+			}
+			large_bytes += nsize - osize;
+		}
+		else if (ptr && nsize < osize) {
+			/* lua assumes a shrink can't fail */
+			large_bytes -= osize - nsize;
+			nptr = ptr;
+		}
+		return nptr;
+	}
+
+	if (oclass == nclass) {
+		/* same size class */
+		return ptr;
+	}
+
+	if (nclass >= 0) {
+		nptr = pool_alloc(&pools[nclass]);
+	}
+	else if (nsize) {
+		nptr = malloc(nsize);
+		if (nptr) {
+			large_allocs++;
+			large_bytes += nsize;
+		}
+	}
+	else {
+		nptr = NULL;
+	}
+
+	if (nsize && !nptr) {
+		if (!ptr || nsize >= osize) {
+			return NULL;
+		}
+
+		/* lua assumes a shrink can't fail. the block is big enough
+		 * for the new size class and slabs are never returned, so it
+		 * is given to that pool instead of being copied */
+		if (oclass >= 0) {
+			pools[oclass].used--;
+		}
+		else {
+			large_bytes -= osize;
+		}
+		if (++pools[nclass].used > pools[nclass].peak) {
+			pools[nclass].peak = pools[nclass].used;
+		}
+
+		return ptr;
+	}
+
+	if (ptr) {
+		if (nptr) {
+			memcpy(nptr, ptr, (osize < nsize) ? osize : nsize);
+		}
+
+		if (oclass >= 0) {
+			pool_free(&pools[oclass], ptr);
+		}
+		else {
+			free(ptr);
+			large_bytes -= osize;
+		}
+	}
+
+	return nptr;
+}
+
+
+/*
+ * The lua_Alloc used for the Lua state. Small blocks come from the size
+ * class pools, the heap size and the bytes allocated per frame are
+ * accounted for the gc pacer.
+ */
+void *jive_lua_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+	if (pools_enabled < 0) {
+		pools_init();
+	}
+
+	if (!pools_enabled) {
+		if (nsize == 0) {
+			free(ptr);
+			heap_bytes -= osize;
+			return NULL;
+		}
+
+		ptr = realloc(ptr, nsize);
+	}
+	else {
+		ptr = heap_realloc(ptr, osize, nsize);
+		if (nsize == 0) {
+			heap_bytes -= osize;
+			return NULL;
+		}
+	}
+
+	if (!ptr) {
+		return NULL;
+	}
+
+	if (nsize > osize) {
+		heap_bytes += nsize - osize;
+		frame_alloc += nsize - osize;
+
+		if (heap_bytes > heap_max) {
+			heap_max = heap_bytes;
+		}
+		if (heap_bytes > heap_peak) {
+			heap_peak = heap_bytes;
+		}
+	}
+	else {
+		heap_bytes -= osize - nsize;
+	}
+
+	return ptr;
+}
+
+
+int jiveL_gc_step(lua_State *L) {
+	Uint32 t0, now, elapsed;
+	int budget, steps;
+	bool forced;
+
+	/* stack is:
+	 * 1: framework
+	 * 2: budget in ms
+	 */
+
+	budget = luaL_optinteger(L, 2, 0);
+
+	t0 = jive_jiffies();
+
+	gc_stats.alloc_last = frame_alloc;
+	if (frame_alloc > gc_stats.alloc_max) {
+		gc_stats.alloc_max = frame_alloc;
+	}
+
+	gc_debt += frame_alloc;
+	frame_alloc = 0;
+
+	if (!gc_cycle_heap) {
+		gc_cycle_heap = heap_bytes;
+	}
+	forced = (heap_bytes > (gc_cycle_heap / 100) * JIVE_GC_PAUSE);
+
+	/* always one step per frame, so garbage is collected while idle */
+	steps = 0;
+	do {
+		steps++;
+
+		if (lua_gc(L, LUA_GCSTEP, JIVE_GC_STEP_KB)) {
+			/* cycle finished */
+			gc_stats.cycles++;
+			gc_cycle_heap = heap_bytes;
+			gc_debt = 0;
+			break;
+		}
+
+		if (gc_debt > JIVE_GC_STEP_KB * 1024) {
+			gc_debt -= JIVE_GC_STEP_KB * 1024;
+		}
+		else {
+			gc_debt = 0;
+		}
+
+		now = jive_jiffies();
+	} while (gc_debt && (forced || (int)(now - t0) < budget));
+
+	/* stepping restarts the automatic collector, the pacer does the
+	 * collecting while the event loop runs */
+	lua_gc(L, LUA_GCSTOP, 0);
+
+	elapsed = jive_jiffies() - t0;
+
+	gc_stats.frames++;
+	gc_stats.steps += steps;
+	gc_stats.time_last = elapsed;
+	gc_stats.time_total += elapsed;
+	if (elapsed > gc_stats.time_max) {
+		gc_stats.time_max = elapsed;
+	}
+	if (forced && (int)elapsed > budget) {
+		gc_stats.forced++;
+	}
+
+	if (perfwarn.garbage && elapsed > perfwarn.garbage) {
+		printf("gc_step > %dms: %4dms budget:%dms steps:%d debt:%dKB heap:%dKB %s\n", perfwarn.garbage, elapsed, budget, steps, (int)(gc_debt / 1024), (int)(heap_bytes / 1024), forced ? "forced" : "");
+	}
+
+	return 0;
+}
+
+
+int jiveL_get_gc_stats(lua_State *L) {
+
+	/* stack is:
+	 * 1: framework
+	 * 2: reset (optional)
+	 */
+
+	lua_newtable(L);
+
+	lua_pushinteger(L, gc_stats.frames);
+	lua_setfield(L, -2, "frames");
+
+	lua_pushinteger(L, gc_stats.steps);
+	lua_setfield(L, -2, "steps");
+
+	lua_pushinteger(L, gc_stats.cycles);
+	lua_setfield(L, -2, "cycles");
+
+	lua_pushinteger(L, gc_stats.forced);
+	lua_setfield(L, -2, "forced");
+
+	lua_pushinteger(L, gc_stats.time_last);
+	lua_setfield(L, -2, "time");
+
+	lua_pushinteger(L, gc_stats.time_max);
+	lua_setfield(L, -2, "timeMax");
+
+	lua_pushinteger(L, gc_stats.time_total);
+	lua_setfield(L, -2, "timeTotal");
+
+	lua_pushinteger(L, gc_stats.alloc_last);
+	lua_setfield(L, -2, "alloc");
+
+	lua_pushinteger(L, gc_stats.alloc_max);
+	lua_setfield(L, -2, "allocMax");
+
+	lua_pushinteger(L, heap_bytes);
+	lua_setfield(L, -2, "heap");
+
+	lua_pushinteger(L, heap_peak);
+	lua_setfield(L, -2, "heapPeak");
+
+	lua_pushinteger(L, heap_max);
+	lua_setfield(L, -2, "heapMax");
+
+	if (lua_toboolean(L, 2)) {
+		memset(&gc_stats, 0, sizeof(gc_stats));
+		heap_peak = heap_bytes;
+	}
+
+	return 1;
+}
+
+
+/*
+ * Push a table of the allocator pools: an array of the size classes, each
+ * with the block size, slabs, blocks used, peak blocks used and allocs,
+ * and the number and size of the large blocks.
+ */
+void jive_lua_alloc_pushstats(lua_State *L) {
+	size_t pooled = 0;
+	int i;
+
+	lua_newtable(L);
+
+	for (i = 0; i < JIVE_POOL_CLASSES; i++) {
+		lua_newtable(L);
+
+		lua_pushinteger(L, pools[i].size);
+		lua_setfield(L, -2, "size");
+
+		lua_pushinteger(L, pools[i].slabs);
+		lua_setfield(L, -2, "slabs");
+
+		lua_pushinteger(L, pools[i].used);
+		lua_setfield(L, -2, "used");
+
+		lua_pushinteger(L, pools[i].peak);
+		lua_setfield(L, -2, "peak");
+
+		lua_pushinteger(L, pools[i].allocs);
+		lua_setfield(L, -2, "allocs");
+
+		lua_rawseti(L, -2, i + 1);
+
+		pooled += pools[i].slabs * JIVE_POOL_SLAB;
+	}
+
+	lua_pushboolean(L, pools_enabled > 0);
+	lua_setfield(L, -2, "enabled");
+
+	lua_pushinteger(L, pooled);
+	lua_setfield(L, -2, "slabBytes");
+
+	lua_pushinteger(L, large_allocs);
+	lua_setfield(L, -2, "largeAllocs");
+
+	lua_pushinteger(L, large_bytes);
+	lua_setfield(L, -2, "largeBytes");
+}
@@ -0,0 +1,328 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+
+#include "common.h"
+#include "jive.h"
+
+
+/* Events queued by jive_queue_event, from the platform input handlers,
+ * are kept in a ring instead of being copied into SDL user events. A
+ * mouse move or drag replaces the last queued event of the same kind, if
+ * it has not been dispatched yet, so the ui only sees the latest finger
+ * position. If the ring is full events are kept in an overflow list,
+ * dispatched after the ring so the input stays in order. The event loop
+ * polls the input between frames, and dispatches it before the next frame
+ * is drawn. When the ui is idle it stops polling, the platform registers
+ * its input devices and the network task wakes the loop when they are
+ * readable.
+ *
+ * The time from queueing the oldest input event to the flip of the first
+ * frame drawn after it is dispatched is collected in a histogram.
+ */
+
+#define INPUT_RING_SIZE 64
+
+/* latency histogram in ms, the last bucket counts longer latencies */
+#define INPUT_LATENCY_BUCKETS 256
+
+#define INPUT_COALESCE (JIVE_EVENT_MOUSE_MOVE | JIVE_EVENT_MOUSE_DRAG | JIVE_EVENT_MOTION)
+
+#define INPUT_MAX_FDS 8
+
+
+static SDL_mutex *input_mutex = NULL;
+
+static struct jive_input {
+	JiveEvent event;
+	Uint32 queued;		/* jiffies */
+} input_ring[INPUT_RING_SIZE];
+
+static int input_head = 0;	/* next event to dispatch */
+static int input_tail = 0;	/* next free entry */
+
+/* events queued while the ring was full, newer than those in the ring */
+struct jive_input_overflow {
+	struct jive_input input;
+	struct jive_input_overflow *next;
+};
+
+static struct jive_input_overflow *overflow_head = NULL;
+static struct jive_input_overflow *overflow_tail = NULL;
+
+/* platform input devices read by jive_sdlevent_pump */
+static int input_fds[INPUT_MAX_FDS];
+static int input_nfds = 0;
+
+/* oldest input dispatched since the last frame, or 0 */
+static Uint32 input_pending = 0;
+
+static struct jive_input_stats {
+	Uint32 queued;
+	Uint32 coalesced;
+	Uint32 overflow;
+	Uint32 dispatched;
+	Uint32 frames;		/* frames with input latency measured */
+	Uint32 latency_max;
+	Uint32 latency[INPUT_LATENCY_BUCKETS];
+} input_stats;
+
+
+void jive_input_init(void) {
+	if (!input_mutex) {
+		input_mutex = SDL_CreateMutex();
+	}
+}
+
+
+/*
+ * Register an input device read by the platform event pump. Called by
+ * the platform when it opens its devices.
+ */
+void jive_input_add_fd(int fd) {
+	if (input_nfds < INPUT_MAX_FDS) {
+		input_fds[input_nfds++] = fd;
+	}
+}
+
+
+/* can evt replace the last queued event? */
+static bool input_coalesce(JiveEvent *last, JiveEvent *evt) {
+	if (!(evt->type & INPUT_COALESCE) || last->type != evt->type) {
+		return false;
+	}
+
+	if (evt->type == JIVE_EVENT_MOTION) {
+		return true;
+	}
+
+	/* chiral values are relative, those can't be merged */
+	return last->u.mouse.finger_count == evt->u.mouse.finger_count
+		&& !evt->u.mouse.chiral_active && !last->u.mouse.chiral_active;
+}
+
+
+void jive_queue_event(JiveEvent *evt) {
+	struct jive_input_overflow *overflow;
+	struct jive_input *last = NULL;
+	int next;
+
+	jive_input_init();
+
+	SDL_LockMutex(input_mutex);
+
+	if (overflow_tail) {
+		last = &overflow_tail->input;
+	}
+	else if (input_head != input_tail) {
+		last = &input_ring[(input_tail + INPUT_RING_SIZE - 1) % INPUT_RING_SIZE];
+	}
+
+	if (last && input_coalesce(&last->event, evt)) {
+		memcpy(&last->event, evt, sizeof(JiveEvent));
+		input_stats.coalesced++;
+
+		SDL_UnlockMutex(input_mutex);
+		return;
+	}
+
+	next = (input_tail + 1) % INPUT_RING_SIZE;
+	if (!overflow_tail && next != input_head) {
+		memcpy(&input_ring[input_tail].event, evt, sizeof(JiveEvent));
+		input_ring[input_tail].queued = jive_jiffies();
+		input_tail = next;
+		input_stats.queued++;
+
+		SDL_UnlockMutex(input_mutex);
+		return;
+	}
+
+	/* ring full, queue behind it */
+	overflow = malloc(sizeof(struct jive_input_overflow));
+	if (!overflow) {
+		SDL_UnlockMutex(input_mutex);
+		return;
+	}
+
+	memcpy(&overflow->input.event, evt, sizeof(JiveEvent));
+	overflow->input.queued = jive_jiffies();
+	overflow->next = NULL;
+
+	if (overflow_tail) {
+		overflow_tail->next = overflow;
+	}
+	else {
+		overflow_head = overflow;
+	}
+	overflow_tail = overflow;
+
+	input_stats.queued++;
+	input_stats.overflow++;
+
+	SDL_UnlockMutex(input_mutex);
+}
+
+
+bool jive_input_pending(void) {
+	/* a racy read is fine, the event loop polls again */
+	return input_head != input_tail || overflow_head;
+}
+
+
+/*
+ * Remove the next queued event into evt. Returns false if the queue is
+ * empty.
+ */
+bool jive_input_next(JiveEvent *evt) {
+	struct jive_input_overflow *overflow;
+	Uint32 queued;
+
+	if (input_head == input_tail && !overflow_head) {
+		return false;
+	}
+
+	SDL_LockMutex(input_mutex);
+
+	if (input_head != input_tail) {
+		memcpy(evt, &input_ring[input_head].event, sizeof(JiveEvent));
+		queued = input_ring[input_head].queued;
+		input_head = (input_head + 1) % INPUT_RING_SIZE;
+	}
+	else {
+		overflow = overflow_head;
+		overflow_head = overflow->next;
+		if (!overflow_head) {
+			overflow_tail = NULL;
+		}
+
+		memcpy(evt, &overflow->input.event, sizeof(JiveEvent));
+		queued = overflow->input.queued;
+		free(overflow);
+	}
+
+	SDL_UnlockMutex(input_mutex);
+
+	input_stats.dispatched++;
+
+	if (evt->type & JIVE_EVENT_ALL_INPUT) {
+		jive_input_mark(queued);
+	}
+
+	return true;
+}
+
+
+/*
+ * Note input queued at jiffies queued has been dispatched, the latency is
+ * measured when the next frame is flipped.
+ */
+void jive_input_mark(Uint32 queued) {
+	if (!input_pending || (int)(queued - input_pending) < 0) {
+		input_pending = queued ? queued : 1;
+	}
+}
+
+
+/*
+ * Called after each frame, drawn is true if the screen was flipped.
+ */
+void jive_input_frame(bool drawn) {
+	Uint32 ms;
+
+	if (!input_pending) {
+		return;
+	}
+
+	/* input that did not change the screen is not measured */
+	if (drawn) {
+		ms = jive_jiffies() - input_pending;
+
+		input_stats.frames++;
+		if (ms > input_stats.latency_max) {
+			input_stats.latency_max = ms;
+		}
+		input_stats.latency[(ms < INPUT_LATENCY_BUCKETS) ? ms : INPUT_LATENCY_BUCKETS - 1]++;
+	}
+
+	input_pending = 0;
+}
+
+
+int jiveL_get_input_fds(lua_State *L) {
+	int i;
+
+	/* stack is:
+	 * 1: framework
+	 */
+
+	lua_createtable(L, input_nfds, 0);
+	for (i = 0; i < input_nfds; i++) {
+		lua_pushinteger(L, input_fds[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	return 1;
+}
+
+
+static int latency_percentile(int percent) {
+	Uint32 n, count = 0;
+	int i;
+
+	n = (input_stats.frames * percent + 99) / 100;
+	for (i = 0; i < INPUT_LATENCY_BUCKETS; i++) {
+		count += input_stats.latency[i];
+		if (count >= n && count) {
+			return i;
+		}
+	}
+
+	return 0;
+}
+
+
+int jiveL_get_input_stats(lua_State *L) {
+
+	/* stack is:
+	 * 1: framework
+	 * 2: reset (optional)
+	 */
+
+	lua_newtable(L);
+
+	lua_pushinteger(L, input_stats.queued);
+	lua_setfield(L, -2, "queued");
+
+	lua_pushinteger(L, input_stats.coalesced);
+	lua_setfield(L, -2, "coalesced");
+
+	lua_pushinteger(L, input_stats.overflow);
+	lua_setfield(L, -2, "overflow");
+
+	lua_pushinteger(L, input_stats.dispatched);
+	lua_setfield(L, -2, "dispatched");
+
+	lua_pushinteger(L, input_stats.frames);
+	lua_setfield(L, -2, "frames");
+
+	lua_pushinteger(L, latency_percentile(50));
+	lua_setfield(L, -2, "latency50");
+
+	lua_pushinteger(L, latency_percentile(90));
+	lua_setfield(L, -2, "latency90");
+
+	lua_pushinteger(L, latency_percentile(99));
+	lua_setfield(L, -2, "latency99");
+
+	lua_pushinteger(L, input_stats.latency_max);
+	lua_setfield(L, -2, "latencyMax");
+
+	if (lua_toboolean(L, 2)) {
+		memset(&input_stats, 0, sizeof(input_stats));
+	}
+
+	return 1;
+}
@@ -52,6 +52,7 @@ typedef struct label_widget {
 	int scroll_offset_step;
 	
 	// prepared lines
+	bool prepared;
 	int scroll_offset;
 	size_t num_lines;
 	Uint16 text_w, text_h; // maximum label width and height
@@ -131,6 +132,10 @@ int jiveL_label_skin(lua_State *L) {
 	}
 
 	peer->text_align = jive_style_align(L, 1, "align", JIVE_ALIGN_LEFT);
+
+	/* render the text again with the new skin */
+	peer->prepared = false;
+
 	return 0;
 }
 
@@ -148,9 +153,6 @@ static void prepare(lua_State *L) {
 	peer = jive_getpeer(L, 1, &labelPeerMeta);
 
 
-	/* free existing text surfaces */
-	jive_label_gc_lines(peer);
-
 	/* split multi-line text */
 	lua_getglobal(L, "tostring");
 	lua_getfield(L, 1, "value");
@@ -167,6 +169,22 @@ static void prepare(lua_State *L) {
 	}
 	lua_call(L, 1, 1);
 
+	/* the text surfaces are kept while the label is moved, for example
+	 * when menu items scroll, unless the text or skin has changed */
+	lua_getfield(L, 1, "_preparedText");
+	if (peer->prepared && lua_rawequal(L, -1, -2)) {
+		lua_pop(L, 2);
+		return;
+	}
+	lua_pop(L, 1);
+
+	lua_pushvalue(L, -1);
+	lua_setfield(L, 1, "_preparedText");
+	peer->prepared = true;
+
+	/* free existing text surfaces */
+	jive_label_gc_lines(peer);
+
 	ptr = str = lua_tostring(L, -1);
 
 	if (!ptr || *ptr == '\0') {
@@ -38,6 +38,8 @@ struct image {
 	Uint16 flags;
 #   define IMAGE_FLAG_INIT  (1<<0)			/* Have w & h been evaluated yet */
 #   define IMAGE_FLAG_AMASK (1<<1)
+#   define IMAGE_FLAG_QUEUED (1<<2)			/* queued for preloading */
+#   define IMAGE_FLAG_PRELOADED (1<<3)		/* preloaded, not used yet */
 	Uint16 ref_count;
 #ifdef JIVE_PROFILE_IMAGE_CACHE
 	Uint16 use_count;
@@ -84,6 +86,93 @@ struct jive_surface {
 static SDL_Surface *real_sdl = NULL;
 #endif
 
+/* Skin images are decoded ahead of need by a worker thread. The main
+ * thread converts the decoded images to the display format in
+ * jive_tile_preload_pump, while there is room in the image cache. The
+ * worker keeps a copy of the path as the image index may be reused.
+ *
+ * SDL_image counts the users of its format loaders without locking, so
+ * images are only loaded holding img_mutex once the worker is running.
+ * More workers would just wait for each other.
+ */
+#define PRELOAD_THREADS 1
+#define PRELOAD_PUMP_MS 4
+
+struct preload_image {
+	Uint16 image;
+	char *path;
+	SDL_Surface *srf;
+	struct preload_image *next;
+};
+
+static SDL_Thread *preload_thread[PRELOAD_THREADS];
+static SDL_mutex *preload_mutex = NULL;
+static SDL_cond *preload_cond = NULL;
+static struct preload_image *preload_queue = NULL;	/* waiting for a worker */
+static struct preload_image *preload_done = NULL;	/* decoded */
+static volatile int preload_pending = 0;
+static Uint32 preload_start;
+static int preload_count;
+
+static SDL_mutex *img_mutex = NULL;
+
+static SDL_Surface *_preload_take(Uint16 index);
+
+
+static SDL_Surface *_img_load(const char *path) {
+	SDL_Surface *srf;
+
+	if (!img_mutex) {
+		return IMG_Load(path);
+	}
+
+	SDL_LockMutex(img_mutex);
+	srf = IMG_Load(path);
+	SDL_UnlockMutex(img_mutex);
+
+	return srf;
+}
+
+
+static SDL_Surface *_img_load_rw(SDL_RWops *src) {
+	SDL_Surface *srf;
+
+	if (!img_mutex) {
+		return IMG_Load_RW(src, 1);
+	}
+
+	SDL_LockMutex(img_mutex);
+	srf = IMG_Load_RW(src, 1);
+	SDL_UnlockMutex(img_mutex);
+
+	return srf;
+}
+
+/* Rotated images drawn with jive_surface_blit_rotated are cached, at
+ * the angle rounded to the number of steps asked for. The rotated image
+ * is cropped to its visible pixels, a clock tick is only a few pixels of
+ * a screen sized image. The least recently used rotations are freed when
+ * the cache grows over ROTATE_CACHE_BYTES.
+ */
+#define ROTATE_CACHE_BYTES (1024 * 1024)
+#define ROTATE_CACHE_HASH 64
+
+struct rotate_frame {
+	JiveSurface *src;
+	Uint16 step, steps;
+	SDL_Surface *sdl;		/* NULL if nothing is visible */
+	Sint16 x, y;			/* offset from the rotation centre */
+	size_t bytes;
+	struct rotate_frame *prev, *next;	/* LRU list, most recent first */
+	struct rotate_frame *hnext;
+};
+
+static struct rotate_frame *rotate_hash[ROTATE_CACHE_HASH];
+static struct rotate_frame *rotate_lru_head, *rotate_lru_tail;
+static size_t rotate_cache_bytes;
+
+static void _rotate_cache_purge(JiveSurface *src);
+
 static int _new_image(const char *path) {
 	Uint16 i;
 
@@ -202,7 +291,13 @@ static void _load_image (Uint16 index, bool hasAlphaFlags, Uint32 alphaFlags) {
 	struct image *image = &images[index];
 	SDL_Surface *tmp, *srf;
 
-	tmp = IMG_Load(image->path);
+	tmp = NULL;
+	if (image->flags & IMAGE_FLAG_QUEUED) {
+		tmp = _preload_take(index);
+	}
+	if (!tmp) {
+		tmp = _img_load(image->path);
+	}
 	if (!tmp) {
 		LOG_WARN(log_ui_draw, "Error loading tile image %s: %s\n", image->path, IMG_GetError());
 		return;
@@ -260,8 +355,17 @@ static void _load_tile_images (JiveTile *tile) {
 		if (!image)
 			continue;
 
-		if (images[image].loaded)
+		if (images[image].loaded) {
+			/* preloaded without the tile alpha flags */
+			if (images[image].flags & IMAGE_FLAG_PRELOADED) {
+				if (tile->flags & TILE_FLAG_ALPHA) {
+					SDL_SetAlpha(images[image].loaded->srf, tile->alpha_flags, 0);
+				}
+				images[image].flags &= ~IMAGE_FLAG_PRELOADED;
+			}
+
 			_use_image(image);
+		}
 	}
 
 	for (i = 0; i < max; i++) {
@@ -295,6 +399,250 @@ static void _load_tile_images (JiveTile *tile) {
 
 }
 
+static int _preload_thread_execute(void *unused) {
+	struct preload_image *item;
+
+	while (1) {
+		SDL_LockMutex(preload_mutex);
+		while (!preload_queue) {
+			SDL_CondWait(preload_cond, preload_mutex);
+		}
+
+		item = preload_queue;
+		preload_queue = item->next;
+		SDL_UnlockMutex(preload_mutex);
+
+		/* decode outside the queue lock */
+		item->srf = _img_load(item->path);
+
+		SDL_LockMutex(preload_mutex);
+		item->next = preload_done;
+		preload_done = item;
+		SDL_UnlockMutex(preload_mutex);
+	}
+
+	return 0;
+}
+
+
+static void _preload_free(struct preload_image *item) {
+	if (item->srf) {
+		SDL_FreeSurface(item->srf);
+	}
+	free(item->path);
+	free(item);
+
+	preload_pending--;
+}
+
+
+/* Is the preloaded item still for the image at its index? */
+static bool _preload_valid(struct preload_image *item) {
+	struct image *image = &images[item->image];
+
+	return item->image < n_images && image->ref_count > 0 && !image->loaded
+		&& image->path && strcmp(image->path, item->path) == 0;
+}
+
+
+/*
+ * Take the decoded surface for an image the main thread needs now. If the
+ * image is still waiting for a worker it is removed from the queue and the
+ * caller loads it.
+ */
+static SDL_Surface *_preload_take(Uint16 index) {
+	struct preload_image **ptr, *item;
+	SDL_Surface *srf = NULL;
+
+	images[index].flags &= ~IMAGE_FLAG_QUEUED;
+
+	if (!preload_mutex) {
+		return NULL;
+	}
+
+	SDL_LockMutex(preload_mutex);
+
+	/* items decoded from a previous image at this index are dropped */
+	ptr = &preload_done;
+	while (*ptr) {
+		item = *ptr;
+		if (item->image != index) {
+			ptr = &item->next;
+			continue;
+		}
+
+		*ptr = item->next;
+
+		if (!srf && strcmp(item->path, images[index].path) == 0) {
+			srf = item->srf;
+			item->srf = NULL;
+		}
+		_preload_free(item);
+	}
+
+	ptr = &preload_queue;
+	while (*ptr) {
+		item = *ptr;
+		if (item->image != index) {
+			ptr = &item->next;
+			continue;
+		}
+
+		*ptr = item->next;
+		_preload_free(item);
+	}
+
+	SDL_UnlockMutex(preload_mutex);
+
+	return srf;
+}
+
+
+/*
+ * Queue the images referenced by the loaded tiles for decoding, up to the
+ * free space in the image cache. Returns the number of images queued.
+ */
+int jive_tile_preload_images(void) {
+	struct preload_image *item, **tail;
+	int i, budget, n = 0;
+
+	budget = MAX_LOADED_IMAGES - nloadedImages - preload_pending;
+	if (budget <= 0) {
+		return 0;
+	}
+
+	if (!preload_mutex) {
+		img_mutex = SDL_CreateMutex();
+		preload_mutex = SDL_CreateMutex();
+		preload_cond = SDL_CreateCond();
+
+		for (i = 0; i < PRELOAD_THREADS; i++) {
+			preload_thread[i] = SDL_CreateThread(_preload_thread_execute, NULL);
+		}
+	}
+
+	SDL_LockMutex(preload_mutex);
+
+	tail = &preload_queue;
+	while (*tail) {
+		tail = &(*tail)->next;
+	}
+
+	for (i = 1; i < n_images && n < budget; i++) {
+		struct image *image = &images[i];
+
+		if (image->ref_count <= 0 || !image->path || image->loaded
+		    || (image->flags & IMAGE_FLAG_QUEUED)) {
+			continue;
+		}
+
+		item = calloc(sizeof(struct preload_image), 1);
+		item->image = i;
+		item->path = strdup(image->path);
+
+		*tail = item;
+		tail = &item->next;
+
+		image->flags |= IMAGE_FLAG_QUEUED;
+		preload_pending++;
+		n++;
+	}
+
+	if (n) {
+		if (!preload_count) {
+			preload_start = jive_jiffies();
+		}
+		preload_count += n;
+
+		SDL_CondBroadcast(preload_cond);
+	}
+
+	SDL_UnlockMutex(preload_mutex);
+
+	return n;
+}
+
+
+/*
+ * Move the decoded images into the image cache, called from the main
+ * thread once per frame.
+ */
+void jive_tile_preload_pump(void) {
+	struct preload_image *item;
+	struct image *image;
+	SDL_Surface *srf;
+	Uint32 t0;
+
+	if (!preload_pending) {
+		return;
+	}
+
+	t0 = jive_jiffies();
+
+	while (jive_jiffies() - t0 < PRELOAD_PUMP_MS) {
+		SDL_LockMutex(preload_mutex);
+		item = preload_done;
+		if (item) {
+			preload_done = item->next;
+		}
+		SDL_UnlockMutex(preload_mutex);
+
+		if (!item) {
+			break;
+		}
+
+		image = &images[item->image];
+
+		/* skip images that were freed, or loaded meanwhile, and stay
+		 * within the cache budget */
+		if (item->srf && _preload_valid(item) && nloadedImages < MAX_LOADED_IMAGES) {
+			image->flags &= ~IMAGE_FLAG_QUEUED;
+
+			if (item->srf->format->Amask) {
+				srf = SDL_DisplayFormatAlpha(item->srf);
+				image->flags |= IMAGE_FLAG_AMASK;
+			} else {
+				srf = SDL_DisplayFormat(item->srf);
+			}
+
+			if (srf) {
+				image->loaded = calloc(sizeof *(image->loaded), 1);
+				image->loaded->image = item->image;
+				image->loaded->srf = srf;
+				image->flags |= IMAGE_FLAG_PRELOADED;
+
+				if (!(image->flags & IMAGE_FLAG_INIT)) {
+					image->w = srf->w;
+					image->h = srf->h;
+					image->flags |= IMAGE_FLAG_INIT;
+				}
+
+				/* insert at the tail, so unused images go first */
+				if (lruHead.next == 0) {
+					lruHead.next = &lruTail;
+					lruTail.prev = &lruHead;
+				}
+				image->loaded->prev = lruTail.prev;
+				image->loaded->next = &lruTail;
+				lruTail.prev->next = image->loaded;
+				lruTail.prev = image->loaded;
+				nloadedImages++;
+			}
+		}
+		else if (_preload_valid(item)) {
+			image->flags &= ~IMAGE_FLAG_QUEUED;
+		}
+
+		_preload_free(item);
+	}
+
+	if (!preload_pending) {
+		LOG_INFO(log_ui_draw, "Preloaded %d images in %dms, %d of %d loaded", preload_count, jive_jiffies() - preload_start, nloadedImages, MAX_LOADED_IMAGES);
+		preload_count = 0;
+	}
+}
+
+
 static void _init_image_sizes(struct image *image) {
 	if (image->loaded) {
 		image->w = image->loaded->srf->w;
@@ -306,7 +654,7 @@ static void _init_image_sizes(struct image *image) {
 		 LOG_DEBUG(log_ui_draw, "Loading image just for sizes: %s", image->path);
 #endif
 
-		tmp = IMG_Load(image->path);
+		tmp = _img_load(image->path);
 		if (!tmp) {
 			LOG_WARN(log_ui_draw, "Error loading tile image %s: %s\n", image->path, IMG_GetError());
 			image->flags |= IMAGE_FLAG_INIT;	/* fake it - no point in trying repeatedly */
@@ -482,7 +830,7 @@ JiveTile *jive_tile_load_image_data(const char *data, size_t len) {
 	tile->refcount = 1;
 
 	src = SDL_RWFromConstMem(data, (int) len);
-	tmp = IMG_Load_RW(src, 1);
+	tmp = _img_load_rw(src);
 
 	if (!tmp) {
 		LOG_WARN(log_ui_draw, "Error loading tile: %s\n", IMG_GetError());
@@ -612,6 +960,8 @@ void jive_tile_free(JiveTile *tile) {
 		return;
 	}
 
+	_rotate_cache_purge(tile);
+
 	if (tile->sdl) {
 		SDL_FreeSurface (tile->sdl);
 		tile->sdl = NULL;
@@ -993,7 +1343,7 @@ JiveSurface *jive_surface_load_image(const char *path) {
 
 JiveSurface *jive_surface_load_image_data(const char *data, size_t len) {
 	SDL_RWops *src = SDL_RWFromConstMem(data, (int) len);
-	SDL_Surface *sdl = IMG_Load_RW(src, 1);
+	SDL_Surface *sdl = _img_load_rw(src);
 
 	JiveSurface *srf = calloc(sizeof(JiveSurface), 1);
 	srf->refcount = 1;
@@ -1346,6 +1696,8 @@ void jive_surface_release(JiveSurface *srf) {
 		return;
 	}
 
+	_rotate_cache_purge(srf);
+
 	if (srf->sdl) {
 		SDL_FreeSurface (srf->sdl);
 		srf->sdl = NULL;
@@ -1371,6 +1723,218 @@ JiveSurface *jive_surface_rotozoomSurface(JiveSurface *srf, double angle, double
 	return srf2;
 }
 
+static inline int _rotate_hash(JiveSurface *src, Uint16 step) {
+	return (((size_t) src >> 4) + step) % ROTATE_CACHE_HASH;
+}
+
+static void _rotate_frame_free(struct rotate_frame *frame) {
+	struct rotate_frame **ptr;
+
+	ptr = &rotate_hash[_rotate_hash(frame->src, frame->step)];
+	while (*ptr != frame) {
+		ptr = &(*ptr)->hnext;
+	}
+	*ptr = frame->hnext;
+
+	if (frame->prev) {
+		frame->prev->next = frame->next;
+	}
+	else {
+		rotate_lru_head = frame->next;
+	}
+	if (frame->next) {
+		frame->next->prev = frame->prev;
+	}
+	else {
+		rotate_lru_tail = frame->prev;
+	}
+
+	rotate_cache_bytes -= frame->bytes;
+	if (frame->sdl) {
+		SDL_FreeSurface(frame->sdl);
+	}
+	free(frame);
+}
+
+static void _rotate_cache_purge(JiveSurface *src) {
+	struct rotate_frame *frame, *next;
+
+	for (frame = rotate_lru_head; frame; frame = next) {
+		next = frame->next;
+		if (frame->src == src) {
+			_rotate_frame_free(frame);
+		}
+	}
+}
+
+/* crop a 32 bit rotated image to the pixels that are not transparent */
+static SDL_Surface *_rotate_crop(SDL_Surface *rot, Sint16 *cx, Sint16 *cy) {
+	SDL_Surface *crop;
+	SDL_PixelFormat *fmt = rot->format;
+	int x, y, x0, y0, x1, y1;
+	Uint32 *row;
+
+	*cx = 0;
+	*cy = 0;
+
+	if (fmt->BytesPerPixel != 4 || !fmt->Amask) {
+		return rot;
+	}
+
+	x0 = rot->w;
+	y0 = rot->h;
+	x1 = -1;
+	y1 = -1;
+
+	SDL_LockSurface(rot);
+	for (y = 0; y < rot->h; y++) {
+		row = (Uint32 *)((Uint8 *)rot->pixels + y * rot->pitch);
+		for (x = 0; x < rot->w; x++) {
+			if (row[x] & fmt->Amask) {
+				if (x < x0) x0 = x;
+				if (x > x1) x1 = x;
+				if (y < y0) y0 = y;
+				y1 = y;
+			}
+		}
+	}
+
+	if (x1 < 0) {
+		/* nothing to see */
+		SDL_UnlockSurface(rot);
+		SDL_FreeSurface(rot);
+		return NULL;
+	}
+
+	if (x0 == 0 && y0 == 0 && x1 == rot->w - 1 && y1 == rot->h - 1) {
+		SDL_UnlockSurface(rot);
+		return rot;
+	}
+
+	crop = SDL_CreateRGBSurface(SDL_SWSURFACE | SDL_SRCALPHA, x1 - x0 + 1, y1 - y0 + 1, 32,
+				    fmt->Rmask, fmt->Gmask, fmt->Bmask, fmt->Amask);
+	if (crop) {
+		for (y = y0; y <= y1; y++) {
+			memcpy((Uint8 *)crop->pixels + (y - y0) * crop->pitch,
+			       (Uint8 *)rot->pixels + y * rot->pitch + x0 * 4,
+			       crop->w * 4);
+		}
+		*cx = x0;
+		*cy = y0;
+	}
+	SDL_UnlockSurface(rot);
+
+	if (!crop) {
+		return rot;
+	}
+
+	SDL_FreeSurface(rot);
+	return crop;
+}
+
+/*
+ * Blit srf rotated by angle degrees counter clockwise, centred on cx, cy.
+ * The angle is rounded to 360 / steps degrees, and the rotated image is
+ * cached so srf must not be changed after it is drawn rotated.
+ */
+void jive_surface_blit_rotated(JiveSurface *srf, JiveSurface *dst, Sint16 cx, Sint16 cy, double angle, int steps) {
+	struct rotate_frame *frame;
+	SDL_Surface *src_sdl, *rot;
+	Sint16 crop_x, crop_y;
+	SDL_Rect dr;
+	int step, hash;
+
+	if (steps <= 0 || steps > 3600) {
+		steps = 360;
+	}
+
+	step = (int) floor(angle * steps / 360.0 + 0.5) % steps;
+	if (step < 0) {
+		step += steps;
+	}
+
+	hash = _rotate_hash(srf, step);
+	for (frame = rotate_hash[hash]; frame; frame = frame->hnext) {
+		if (frame->src == srf && frame->step == step && frame->steps == steps) {
+			break;
+		}
+	}
+
+	if (frame) {
+		/* move to the front of the LRU list */
+		if (frame->prev) {
+			frame->prev->next = frame->next;
+			if (frame->next) {
+				frame->next->prev = frame->prev;
+			}
+			else {
+				rotate_lru_tail = frame->prev;
+			}
+
+			frame->prev = NULL;
+			frame->next = rotate_lru_head;
+			rotate_lru_head->prev = frame;
+			rotate_lru_head = frame;
+		}
+	}
+	else {
+		src_sdl = _resolve_SDL_surface(srf);
+		if (!src_sdl) {
+			LOG_ERROR(log_ui, "Underlying sdl surface already freed, possibly with release()");
+			return;
+		}
+
+		rot = rotozoomSurface(src_sdl, step * 360.0 / steps, 1, SMOOTHING_ON);
+		if (!rot) {
+			return;
+		}
+
+		frame = calloc(sizeof(struct rotate_frame), 1);
+		frame->src = srf;
+		frame->step = step;
+		frame->steps = steps;
+
+		/* offset from the centre of the rotated image */
+		frame->x = -((rot->w + 1) / 2);
+		frame->y = -((rot->h + 1) / 2);
+
+		frame->sdl = _rotate_crop(rot, &crop_x, &crop_y);
+		frame->x += crop_x;
+		frame->y += crop_y;
+
+		frame->bytes = sizeof(struct rotate_frame);
+		if (frame->sdl) {
+			frame->bytes += frame->sdl->pitch * frame->sdl->h;
+		}
+
+		frame->hnext = rotate_hash[hash];
+		rotate_hash[hash] = frame;
+
+		frame->next = rotate_lru_head;
+		if (rotate_lru_head) {
+			rotate_lru_head->prev = frame;
+		}
+		else {
+			rotate_lru_tail = frame;
+		}
+		rotate_lru_head = frame;
+
+		rotate_cache_bytes += frame->bytes;
+		while (rotate_cache_bytes > ROTATE_CACHE_BYTES && rotate_lru_tail != frame) {
+			_rotate_frame_free(rotate_lru_tail);
+		}
+	}
+
+	if (!frame->sdl) {
+		return;
+	}
+
+	dr.x = cx + frame->x + dst->offset_x;
+	dr.y = cy + frame->y + dst->offset_y;
+
+	SDL_BlitSurface(frame->sdl, 0, dst->sdl, &dr);
+}
+
 JiveSurface *jive_surface_zoomSurface(JiveSurface *srf, double zoomx, double zoomy, int smooth) {
 	SDL_Surface *srf1_sdl;
 	JiveSurface *srf2;
@@ -1663,6 +2227,10 @@ JiveTile *jive_tile_load_htiles(char *path[3]) {return DUMMY_SURFACE;}
 
 JiveTile *jive_tile_ref(JiveTile *tile) {return tile;}
 
+int jive_tile_preload_images(void) {return 0;}
+
+void jive_tile_preload_pump(void) {return;}
+
 void jive_tile_get_min_size(JiveTile *tile, Uint16 *w, Uint16 *h) {
 	if (w) *w = 1;
 	if (h) *h = 1;
@@ -1737,6 +2305,8 @@ void jive_surface_release(JiveSurface *srf) {return;}
 /* SDL_gfx encapsulated functions */
 JiveSurface *jive_surface_rotozoomSurface(JiveSurface *srf, double angle, double zoom, int smooth) {return srf;}
 
+void jive_surface_blit_rotated(JiveSurface *srf, JiveSurface *dst, Sint16 cx, Sint16 cy, double angle, int steps) {return;}
+
 JiveSurface *jive_surface_zoomSurface(JiveSurface *srf, double zoomx, double zoomy, int smooth) {return srf;}
 
 JiveSurface *jive_surface_shrinkSurface(JiveSurface *srf, int factorx, int factory) {return srf;}
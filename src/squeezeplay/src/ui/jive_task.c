@@ -0,0 +1,501 @@
+/*
+** Copyright 2010 Logitech. All Rights Reserved.
+**
+** This file is licensed under BSD. Please see the LICENSE file for details.
+*/
+
+
+#include "common.h"
+#include "jive.h"
+
+
+/* The jive.ui.Task run queue. Each priority has a doubly linked list of
+ * the active tasks, so adding and removing a task is O(1). A queued task
+ * is referenced from the registry, which keeps the task table and its
+ * peer alive. The wakeup arguments are kept in the task's args table,
+ * which is reused for every wakeup.
+ */
+
+#define TASK_PRIORITY_AUDIO 1
+#define TASK_PRIORITY_LOW 3
+
+enum jive_task_state {
+	TASK_SUSPENDED = 0,
+	TASK_ACTIVE,
+	TASK_ERROR,
+};
+
+typedef struct jive_task {
+	struct jive_task *prev, *next;
+	int priority;
+	int ref;		/* task table, while queued */
+	enum jive_task_state state;
+	int nargs;
+
+	/* accounting */
+	Uint32 resumes;
+	u64_t run_usecs;
+	Uint32 max_usecs;
+} JiveTask;
+
+
+static LOG_CATEGORY *log_task;
+
+static JiveTask *task_head[TASK_PRIORITY_LOW + 1];
+static JiveTask *task_tail[TASK_PRIORITY_LOW + 1];
+
+/* the next task returned by the iterator, tasks may be added or removed
+ * while iterating */
+static JiveTask *task_cursor = NULL;
+static int task_cursor_priority = TASK_PRIORITY_LOW + 1;
+
+static const char *task_state_names[] = {
+	"suspended", "active", "error"
+};
+
+
+static Uint32 task_usecs(void) {
+#if HAVE_CLOCK_GETTIME
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	/* wraps, only differences are used */
+	return ((Uint32)now.tv_sec * 1000000u) + (Uint32)(now.tv_nsec / 1000);
+#else
+	return SDL_GetTicks() * 1000;
+#endif
+}
+
+
+static JiveTask *task_getpeer(lua_State *L, int index) {
+	JiveTask *peer;
+
+	lua_getfield(L, index, "peer");
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+
+		peer = lua_newuserdata(L, sizeof(JiveTask));
+		memset(peer, 0, sizeof(JiveTask));
+		peer->ref = LUA_NOREF;
+
+		luaL_newmetatable(L, "JiveTask");
+		lua_setmetatable(L, -2);
+		lua_setfield(L, index, "peer");
+
+		/* all tasks, for Task:dump() */
+		lua_getfield(L, LUA_REGISTRYINDEX, "jive_tasks");
+		lua_pushvalue(L, index);
+		lua_pushboolean(L, 1);
+		lua_rawset(L, -3);
+		lua_pop(L, 1);
+	}
+	else {
+		peer = luaL_checkudata(L, -1, "JiveTask");
+		lua_pop(L, 1);
+	}
+
+	return peer;
+}
+
+
+static void task_set_args(lua_State *L, JiveTask *peer, int index, int nargs) {
+	int i;
+
+	lua_getfield(L, 1, "args");
+	if (!lua_istable(L, -1)) {
+		lua_pop(L, 1);
+
+		lua_createtable(L, nargs, 0);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, 1, "args");
+	}
+
+	for (i = 0; i < nargs; i++) {
+		lua_pushvalue(L, index + i);
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	/* release the old arguments */
+	for (i = nargs; i < peer->nargs; i++) {
+		lua_pushnil(L);
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_pop(L, 1);
+
+	peer->nargs = nargs;
+}
+
+
+static void task_remove(lua_State *L, JiveTask *peer) {
+	if (peer->state != TASK_ACTIVE) {
+		return;
+	}
+
+	if (task_cursor == peer) {
+		task_cursor = peer->next;
+	}
+
+	if (peer->prev) {
+		peer->prev->next = peer->next;
+	}
+	else {
+		task_head[peer->priority] = peer->next;
+	}
+
+	if (peer->next) {
+		peer->next->prev = peer->prev;
+	}
+	else {
+		task_tail[peer->priority] = peer->prev;
+	}
+
+	peer->prev = peer->next = NULL;
+
+	luaL_unref(L, LUA_REGISTRYINDEX, peer->ref);
+	peer->ref = LUA_NOREF;
+}
+
+
+static void task_log_name(lua_State *L, int index, const char *msg) {
+	if (IS_LOG_PRIORITY(log_task, LOG_PRIORITY_DEBUG)) {
+		lua_getfield(L, index, "name");
+		LOG_DEBUG(log_task, "%s %s", msg, lua_tostring(L, -1));
+		lua_pop(L, 1);
+	}
+}
+
+
+/*
+ * Task:addTask(...) adds the task to the end of its run queue, the
+ * arguments are passed to the task when it is next resumed.
+ */
+static int jiveL_task_add(lua_State *L) {
+	JiveTask *peer;
+	int priority;
+
+	/* stack is:
+	 * 1: task
+	 * 2...: args
+	 */
+
+	peer = task_getpeer(L, 1);
+
+	task_log_name(L, 1, "addTask");
+
+	if (peer->state == TASK_ERROR) {
+		lua_getfield(L, 1, "name");
+		LOG_WARN(log_task, "task %s in error state", lua_tostring(L, -1));
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+
+	if (peer->state == TASK_ACTIVE) {
+		lua_pushboolean(L, 1);
+		return 1;
+	}
+
+	task_set_args(L, peer, 2, lua_gettop(L) - 1);
+
+	lua_getfield(L, 1, "priority");
+	priority = luaL_optinteger(L, -1, TASK_PRIORITY_LOW);
+	lua_pop(L, 1);
+
+	if (priority < TASK_PRIORITY_AUDIO || priority > TASK_PRIORITY_LOW) {
+		priority = TASK_PRIORITY_LOW;
+	}
+
+	peer->state = TASK_ACTIVE;
+	peer->priority = priority;
+
+	lua_pushvalue(L, 1);
+	peer->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	/* append */
+	peer->next = NULL;
+	peer->prev = task_tail[priority];
+	if (task_tail[priority]) {
+		task_tail[priority]->next = peer;
+	}
+	else {
+		task_head[priority] = peer;
+	}
+	task_tail[priority] = peer;
+
+	/* the iterator has reached the end of this queue */
+	if (!task_cursor && task_cursor_priority == priority) {
+		task_cursor = peer;
+	}
+
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+
+/*
+ * Task:removeTask() removes the task from its run queue.
+ */
+static int jiveL_task_remove(lua_State *L) {
+	JiveTask *peer;
+
+	/* stack is:
+	 * 1: task
+	 */
+
+	peer = task_getpeer(L, 1);
+
+	task_log_name(L, 1, "removeTask");
+
+	task_remove(L, peer);
+	peer->state = TASK_SUSPENDED;
+
+	return 0;
+}
+
+
+/*
+ * Task:setArgs(...) sets the arguments passed to the co-routine function
+ * or yield.
+ */
+static int jiveL_task_set_args(lua_State *L) {
+	JiveTask *peer;
+
+	/* stack is:
+	 * 1: task
+	 * 2...: args
+	 */
+
+	peer = task_getpeer(L, 1);
+	task_set_args(L, peer, 2, lua_gettop(L) - 1);
+
+	return 0;
+}
+
+
+/*
+ * Task:resume() runs the task until it yields. Returns true if the task
+ * is suspended or false if it is completed.
+ */
+static int jiveL_task_resume(lua_State *L) {
+	JiveTask *peer;
+	lua_State *co;
+	Uint32 t0, elapsed;
+	int i, status, nres, val = 0;
+
+	/* stack is:
+	 * 1: task
+	 */
+
+	peer = task_getpeer(L, 1);
+
+	task_log_name(L, 1, "task:");
+
+	lua_getfield(L, 1, "thread");
+	co = lua_tothread(L, -1);
+	luaL_argcheck(L, co, 1, "coroutine expected");
+	lua_pop(L, 1);
+
+	lua_pushvalue(L, 1);
+	lua_setfield(L, LUA_REGISTRYINDEX, "jive_task_running");
+
+	if (lua_status(co) == 0 && lua_gettop(co) == 0) {
+		lua_pushliteral(L, "cannot resume dead coroutine");
+		status = LUA_ERRRUN;
+	}
+	else {
+		if (!lua_checkstack(co, peer->nargs + 1)) {
+			luaL_error(L, "too many arguments to resume");
+		}
+
+		lua_getfield(L, 1, "obj");
+		lua_getfield(L, 1, "args");
+		for (i = 1; i <= peer->nargs; i++) {
+			lua_rawgeti(L, -i, i);
+		}
+		lua_remove(L, -(peer->nargs + 1));
+		lua_xmove(L, co, peer->nargs + 1);
+
+		t0 = task_usecs();
+		status = lua_resume(co, peer->nargs + 1);
+		elapsed = task_usecs() - t0;
+
+		peer->resumes++;
+		peer->run_usecs += elapsed;
+		if (elapsed > peer->max_usecs) {
+			peer->max_usecs = elapsed;
+		}
+
+		if (status == 0 || status == LUA_YIELD) {
+			/* the first result says if the task continues, or
+			 * if the coroutine is still running */
+			nres = lua_gettop(co);
+			if (nres > 0 && !lua_isnil(co, -nres)) {
+				val = lua_toboolean(co, -nres);
+			}
+			else {
+				val = (status == LUA_YIELD);
+			}
+			lua_pop(co, nres);
+		}
+		else {
+			/* move error message */
+			lua_xmove(co, L, 1);
+		}
+	}
+
+	lua_pushnil(L);
+	lua_setfield(L, LUA_REGISTRYINDEX, "jive_task_running");
+
+	if (status == 0 || status == LUA_YIELD) {
+		if (val) {
+			/* continue to run task */
+			lua_pushboolean(L, 1);
+			return 1;
+		}
+
+		/* suspend task */
+		task_remove(L, peer);
+		peer->state = TASK_SUSPENDED;
+
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+
+	/* task has error */
+	lua_getfield(L, 1, "name");
+	LOG_ERROR(log_task, "task error %s: %s", lua_tostring(L, -1), lua_tostring(L, -2));
+	lua_pop(L, 2);
+
+	task_remove(L, peer);
+	peer->state = TASK_ERROR;
+
+	lua_getfield(L, 1, "errf");
+	if (!lua_isnil(L, -1)) {
+		lua_getfield(L, 1, "obj");
+		lua_call(L, 1, 0);
+	}
+	else {
+		lua_pop(L, 1);
+	}
+
+	lua_pushboolean(L, 0);
+	return 1;
+}
+
+
+static int task_iterator_next(lua_State *L) {
+	JiveTask *peer;
+
+	while (!task_cursor && task_cursor_priority < TASK_PRIORITY_LOW) {
+		task_cursor = task_head[++task_cursor_priority];
+	}
+
+	peer = task_cursor;
+	if (!peer) {
+		return 0;
+	}
+
+	task_cursor = peer->next;
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, peer->ref);
+	return 1;
+}
+
+
+/*
+ * Task:iterator() iterates over the active tasks in priority order. It is
+ * safe to add or remove tasks while iterating.
+ */
+static int jiveL_task_iterator(lua_State *L) {
+	task_cursor_priority = TASK_PRIORITY_AUDIO;
+	task_cursor = task_head[task_cursor_priority];
+
+	lua_pushcfunction(L, task_iterator_next);
+	return 1;
+}
+
+
+static int jiveL_task_running(lua_State *L) {
+	lua_getfield(L, LUA_REGISTRYINDEX, "jive_task_running");
+	return 1;
+}
+
+
+/*
+ * Task:dump() logs the run queues, and the resume count and run time of
+ * every task.
+ */
+static int jiveL_task_dump(lua_State *L) {
+	JiveTask *peer;
+	bool header = false;
+	int i;
+
+	for (i = TASK_PRIORITY_AUDIO; i <= TASK_PRIORITY_LOW; i++) {
+		for (peer = task_head[i]; peer; peer = peer->next) {
+			if (!header) {
+				LOG_INFO(log_task, "Task queue:");
+				header = true;
+			}
+
+			lua_rawgeti(L, LUA_REGISTRYINDEX, peer->ref);
+			lua_getfield(L, -1, "name");
+			LOG_INFO(log_task, "%d: %s (%p)", i, lua_tostring(L, -1), lua_topointer(L, -2));
+			lua_pop(L, 2);
+		}
+	}
+
+	LOG_INFO(log_task, "Task stats:");
+
+	lua_getfield(L, LUA_REGISTRYINDEX, "jive_tasks");
+	lua_pushnil(L);
+	while (lua_next(L, -2) != 0) {
+		lua_pop(L, 1);
+
+		lua_getfield(L, -1, "peer");
+		peer = lua_touserdata(L, -1);
+		lua_getfield(L, -2, "name");
+
+		if (peer) {
+			LOG_INFO(log_task, "%s (%s) resumes=%u run=%ums avg=%uus max=%uus",
+				 lua_tostring(L, -1),
+				 task_state_names[peer->state],
+				 peer->resumes,
+				 (unsigned int)(peer->run_usecs / 1000),
+				 peer->resumes ? (unsigned int)(peer->run_usecs / peer->resumes) : 0,
+				 peer->max_usecs);
+		}
+		lua_pop(L, 2);
+	}
+	lua_pop(L, 1);
+
+	return 0;
+}
+
+
+static const struct luaL_Reg task_methods[] = {
+	{ "addTask", jiveL_task_add },
+	{ "removeTask", jiveL_task_remove },
+	{ "setArgs", jiveL_task_set_args },
+	{ "resume", jiveL_task_resume },
+	{ "iterator", jiveL_task_iterator },
+	{ "running", jiveL_task_running },
+	{ "dump", jiveL_task_dump },
+	{ NULL, NULL }
+};
+
+
+/*
+ * Register the native methods in the Task class at the top of the stack.
+ */
+void jive_task_register(lua_State *L) {
+	log_task = LOG_CATEGORY_GET("squeezeplay.task");
+
+	/* weak table of all tasks */
+	lua_newtable(L);
+	lua_newtable(L);
+	lua_pushstring(L, "k");
+	lua_setfield(L, -2, "__mode");
+	lua_setmetatable(L, -2);
+	lua_setfield(L, LUA_REGISTRYINDEX, "jive_tasks");
+
+	luaL_register(L, NULL, task_methods);
+}
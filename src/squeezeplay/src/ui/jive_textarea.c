@@ -8,12 +8,24 @@
 #include "jive.h"
 
 
+typedef struct textarea_line {
+	JiveSurface *text_sh;
+	JiveSurface *text_fg;
+	Uint16 width;
+} TextareaLine;
+
+
 typedef struct textarea_widget {
 	JiveWidget w;
 
 	// pointer to start of lines
 	Uint16 num_lines;
 	int *lines;
+
+	// rendered lines, only kept near the visible lines
+	TextareaLine *line_cache;
+	int cache_first, cache_last;
+
 	Uint16 line_width;
 	bool has_scrollbar;
 	bool hide_scrollbar;
@@ -40,7 +52,8 @@ static JivePeerMeta textareaPeerMeta = {
 
 
 static void invalidate(TextareaWidget *peer);
-static void wordwrap(TextareaWidget *peer, char *text, int visible_lines, Uint16 sw, bool has_scrollbar);
+static void free_line_cache(TextareaWidget *peer);
+static void wordwrap(TextareaWidget *peer, const char *text, int visible_lines, Uint16 sw);
 
 
 int jiveL_textarea_skin(lua_State *L) {
@@ -234,6 +247,7 @@ int jiveL_textarea_layout(lua_State *L) {
 		/* nil is empty textarea */
 		lua_pop(L, 2);
 
+		free_line_cache(peer);
 		peer->num_lines = 0;
 		lua_pushinteger(L, peer->num_lines);
 		lua_setfield(L, 1, "numLines");
@@ -245,7 +259,7 @@ int jiveL_textarea_layout(lua_State *L) {
 	text = lua_tostring(L, -1);
 
 	visible_lines = peer->w.bounds.h / peer->line_height;
-	wordwrap(peer, (char *) text, visible_lines, sw, false);
+	wordwrap(peer, text, visible_lines, sw);
 
 	lua_pushinteger(L, peer->num_lines);
 	lua_setfield(L, 1, "numLines");
@@ -440,50 +454,84 @@ int jiveL_textarea_draw(lua_State *L) {
 
 	bottom_line = top_line + visible_lines;
 
+	if (num_lines > peer->num_lines) {
+		num_lines = peer->num_lines;
+	}
+
+	if (!peer->line_cache && num_lines > 0) {
+		peer->line_cache = calloc(peer->num_lines, sizeof(TextareaLine));
+		peer->cache_first = top_line;
+		peer->cache_last = top_line;
+	}
+
 	for (i = top_line; i < bottom_line + 1 && i < num_lines ; i++) {
-		JiveSurface *tsrf;
+		TextareaLine *tline = &peer->line_cache[i];
 		int x;
 
-		int line = peer->lines[i];
-		int next = peer->lines[i+1];
+		if (!tline->text_fg) {
+			/* render the line, it is kept while it is near the
+			 * visible lines so scrolling only renders new lines */
+			int line = peer->lines[i];
+			int next = peer->lines[i+1];
+
+			unsigned char b = text[(next - 1)];
+			unsigned char c = text[next];
+			text[next] = '\0';
+			if (b == '\n') {
+				text[(next - 1)] = '\0';
+			}
 
-		unsigned char b = text[(next - 1)];
-		unsigned char c = text[next];
-		text[next] = '\0';
-		if (b == '\n') {
-			text[(next - 1)] = '\0';
+			tline->width = jive_font_width(peer->font, &text[line]);
+			tline->text_sh = peer->is_sh ? jive_font_draw_text(peer->font, peer->sh, &text[line]) : NULL;
+			tline->text_fg = jive_font_draw_text(peer->font, peer->fg, &text[line]);
+
+			text[next] = c;
+			text[(next - 1)] = b;
 		}
 
 		x = peer->w.bounds.x + peer->w.padding.left;
 		switch (peer->align) {
 		case JIVE_ALIGN_CENTER:
 		case JIVE_ALIGN_TOP:
-		case JIVE_ALIGN_BOTTOM: {
-			Uint16 line_width = jive_font_width(peer->font, &text[line]);
-			x = jive_widget_halign((JiveWidget *)peer, peer->align, line_width);
+		case JIVE_ALIGN_BOTTOM:
+			x = jive_widget_halign((JiveWidget *)peer, peer->align, tline->width);
 			break;
-		}
 		default:
 			break;
 		}
 
 		/* shadow text */
-		if (peer->is_sh) {
-			tsrf = jive_font_draw_text(peer->font, peer->sh, &text[line]);
-			jive_surface_blit(tsrf, srf, x + 1, y + 1);
-			jive_surface_free(tsrf);
+		if (tline->text_sh) {
+			jive_surface_blit(tline->text_sh, srf, x + 1, y + 1);
 		}
 
 		/* foreground text */
-		tsrf = jive_font_draw_text(peer->font, peer->fg, &text[line]);
-		jive_surface_blit(tsrf, srf, x, y);
-		jive_surface_free(tsrf);
-
-		text[next] = c;
-		text[(next - 1)] = b;
+		jive_surface_blit(tline->text_fg, srf, x, y);
 
 		y += peer->line_height;
 	}
+
+	/* release the rendered lines more than a page from the visible lines */
+	if (peer->line_cache) {
+		int keep_first = top_line - visible_lines;
+		int keep_last = bottom_line + visible_lines;
+
+		for (i = peer->cache_first; i < peer->cache_last && i < peer->num_lines; i++) {
+			TextareaLine *tline = &peer->line_cache[i];
+
+			if ((i < keep_first || i > keep_last) && tline->text_fg) {
+				if (tline->text_sh) {
+					jive_surface_free(tline->text_sh);
+					tline->text_sh = NULL;
+				}
+				jive_surface_free(tline->text_fg);
+				tline->text_fg = NULL;
+			}
+		}
+
+		peer->cache_first = (keep_first > 0) ? keep_first : 0;
+		peer->cache_last = keep_last + 1;
+	}
 	if (!is_menu_child) {
 		jive_surface_set_offset(srf, old_pixel_offset_x, old_pixel_offset_y);
 	}
@@ -507,6 +555,8 @@ int jiveL_textarea_draw(lua_State *L) {
 
 static void invalidate(TextareaWidget *peer)
 {
+	free_line_cache(peer);
+
 	if (peer->lines) {
 		free(peer->lines);
 		peer->num_lines = 0;
@@ -515,47 +565,49 @@ static void invalidate(TextareaWidget *peer)
 }
 
 
-static void wordwrap(TextareaWidget *peer, char *text, int visible_lines, Uint16 scrollbar_width, bool has_scrollbar) {
-	// maximum text width
-	int width = peer->w.bounds.w - peer->w.padding.left - peer->w.padding.right;
-
-	// lines points to the start of each line
-	int max_lines = 100;
-	unsigned int *lines = malloc(sizeof(int) * max_lines);
-	int num_lines = 0;
-
-	char *ptr = text;
-	char *line_start = ptr;
-	char *word_break = NULL;
-	Uint16 line_width = 0;
+static void free_line_cache(TextareaWidget *peer)
+{
+	int i;
 
-	/* optimization, don't wrap text with width = 0 */
-	if (width <= 0) {
-		lines[0] = 0;
-		lines[1] = strlen(ptr);
+	if (!peer->line_cache) {
+		return;
+	}
 
-		if (peer->lines) {
-			free(peer->lines);
+	for (i = 0; i < peer->num_lines; i++) {
+		if (peer->line_cache[i].text_sh) {
+			jive_surface_free(peer->line_cache[i].text_sh);
 		}
+		if (peer->line_cache[i].text_fg) {
+			jive_surface_free(peer->line_cache[i].text_fg);
+		}
+	}
 
-		peer->num_lines = 1;
-		peer->lines = realloc(lines, sizeof(int) * (1 + 1));
+	free(peer->line_cache);
+	peer->line_cache = NULL;
+}
 
-		return;
-	}
 
+/*
+ * Break text into lines of at most width pixels. The start of each line
+ * is stored in *lines, followed by the end of the text. If abort_lines is
+ * not zero the wrap stops once there are more than abort_lines lines, and
+ * -1 is returned. Otherwise the number of lines is returned.
+ */
+static int wrap_lines(TextareaWidget *peer, const char *text, int width, int abort_lines, int **lines_ptr) {
+	// lines points to the start of each line
+	int max_lines = 100;
+	int *lines = malloc(sizeof(int) * max_lines);
+	int num_lines = 0;
 
-	peer->has_scrollbar = has_scrollbar;
-	if (has_scrollbar && !peer->is_header_widget) {
-		width -= scrollbar_width;
-	}
+	const char *ptr = text;
+	const char *word_break = NULL;
+	int line_width = 0;
 
 	lines[num_lines++] = (ptr - text);
 
 	while (*ptr) {
-		char c;
-		char *next;
-		Uint32 code = utf8_get_char(ptr, (const char **)&next);
+		const char *next;
+		Uint32 code = utf8_get_char(ptr, &next);
 
 		switch (code) {
 		case '\n':
@@ -568,9 +620,13 @@ static void wordwrap(TextareaWidget *peer, char *text, int visible_lines, Uint16
 				lines = realloc(lines, sizeof(int) * max_lines);
 			}
 
-			line_start = ptr;
 			lines[num_lines++] = (ptr - text);
 			line_width = 0;
+
+			if (abort_lines && num_lines > abort_lines) {
+				free(lines);
+				return -1;
+			}
 			continue;
 
 		case '.':
@@ -588,10 +644,7 @@ static void wordwrap(TextareaWidget *peer, char *text, int visible_lines, Uint16
 		}
 
 		// Calculate width of string to char
-		c = *next;
-		*next = '\0';
-		line_width += jive_font_width(peer->font, (char *)ptr);
-		*next = c;
+		line_width += jive_font_char_width(peer->font, ptr, NULL);
 
 		// Line is less than widget width
 		if (line_width < width) {
@@ -607,44 +660,103 @@ static void wordwrap(TextareaWidget *peer, char *text, int visible_lines, Uint16
 		// Next line
 		line_width = 0;
 
-		if (!has_scrollbar && num_lines > visible_lines && !(peer->is_header_widget || peer->hide_scrollbar)) {
-			free(lines);
-			return wordwrap(peer, text, visible_lines, scrollbar_width, true);
-		}
-
 		if (word_break) {
 			ptr = word_break;
 			word_break = NULL;
 		}
 
 		/* trim extra \n caused by line breaks */
-		code = utf8_get_char(ptr, (const char **)&next);
+		code = utf8_get_char(ptr, &next);
 		if (code == '\n') {
 			ptr = next;
-			code = utf8_get_char(ptr, (const char **)&next);
+			code = utf8_get_char(ptr, &next);
 		}
 
 		/* trim leading space on line break */
 	  	while (code != 0 && code == ' ') {
 			ptr = next;
-			code = utf8_get_char(ptr, (const char **)&next);
+			code = utf8_get_char(ptr, &next);
 		}
 
-		line_start = ptr;
 		lines[num_lines++] = (ptr - text);
+
+		if (abort_lines && num_lines > abort_lines) {
+			free(lines);
+			return -1;
+		}
 	}
 	lines[num_lines] = (ptr - text);
 
-	if (!has_scrollbar && num_lines > visible_lines && !(peer->is_header_widget || peer->hide_scrollbar)) {
-		free(lines);
-		return wordwrap(peer, text, visible_lines, scrollbar_width, true);
+	*lines_ptr = realloc(lines, sizeof(int) * (num_lines + 1));
+	return num_lines;
+}
+
+
+/*
+ * Word wrap the text. A scrollbar is needed if the text does not fit the
+ * visible lines at the full width, the text is then wrapped again leaving
+ * room for the scrollbar. The last wrap's scrollbar is assumed first, a
+ * wrap that turns out not to fit only runs until it overflows.
+ */
+static void wordwrap(TextareaWidget *peer, const char *text, int visible_lines, Uint16 scrollbar_width) {
+	// maximum text width
+	int width = peer->w.bounds.w - peer->w.padding.left - peer->w.padding.right;
+	bool allow_scrollbar = !(peer->is_header_widget || peer->hide_scrollbar);
+	int *lines = NULL, *wide_lines = NULL;
+	int num_lines;
+
+	free_line_cache(peer);
+
+	/* optimization, don't wrap text with width = 0 */
+	if (width <= 0) {
+		lines = malloc(sizeof(int) * (1 + 1));
+		lines[0] = 0;
+		lines[1] = strlen(text);
+
+		if (peer->lines) {
+			free(peer->lines);
+		}
+
+		peer->num_lines = 1;
+		peer->lines = lines;
+
+		return;
+	}
+
+	if (allow_scrollbar && peer->has_scrollbar) {
+		/* speculate the scrollbar is still needed */
+		num_lines = wrap_lines(peer, text, width - scrollbar_width, 0, &lines);
+
+		if (num_lines > visible_lines) {
+			/* confirm the text overflows without the scrollbar */
+			int n = wrap_lines(peer, text, width, visible_lines, &wide_lines);
+			if (n >= 0) {
+				free(lines);
+				lines = wide_lines;
+				num_lines = n;
+				peer->has_scrollbar = false;
+			}
+		}
+		else {
+			free(lines);
+			num_lines = wrap_lines(peer, text, width, 0, &lines);
+			peer->has_scrollbar = false;
+		}
+	}
+	else {
+		num_lines = wrap_lines(peer, text, width, allow_scrollbar ? visible_lines : 0, &lines);
+		peer->has_scrollbar = (num_lines < 0);
+
+		if (num_lines < 0) {
+			num_lines = wrap_lines(peer, text, width - scrollbar_width, 0, &lines);
+		}
 	}
 
 	if (peer->lines) {
 		free(peer->lines);
 	}
 	peer->num_lines = num_lines;
-	peer->lines = realloc(lines, sizeof(int) * (num_lines + 1));
+	peer->lines = lines;
 }
 
 
@@ -655,6 +767,8 @@ int jiveL_textarea_gc(lua_State *L) {
 
 	peer = lua_touserdata(L, 1);
 
+	free_line_cache(peer);
+
 	if (peer->lines) {
 		free(peer->lines);
 		peer->lines = NULL;
@@ -10,6 +10,7 @@
 #include <time.h>
 
 extern struct jive_perfwarn perfwarn;
+extern struct jive_layout_stats layout_stats;
 
 void jive_widget_pack(lua_State *L, int index, JiveWidget *data) {
 
@@ -323,7 +324,12 @@ int jiveL_widget_relayout(lua_State *L) {
 	 * 1: widget
 	 */
 
-	/* mark widgets for layout until a layout root is reached */
+	/* mark widgets for layout until a layout root is reached. a widget
+	 * with a current skin that fixes both its width and height is also a
+	 * layout root, its preferred bounds can't change so the parent does
+	 * not need to be laid out again. the ancestors are still marked so
+	 * check_layout finds the dirty subtree.
+	 */
 	dirty = true;
 	while (!lua_isnil(L, 1)) {
 		lua_getfield(L, 1, "peer");
@@ -335,11 +341,18 @@ int jiveL_widget_relayout(lua_State *L) {
 			if (dirty) {
 				peer->layout_origin = jive_origin - 1;
 
-				lua_getfield(L, 1, "layoutRoot");
-				if (lua_toboolean(L, -1)) {
+				if (peer->skin_origin == jive_origin
+				    && peer->preferred_bounds.w != JIVE_WH_NIL
+				    && peer->preferred_bounds.h != JIVE_WH_NIL) {
 					dirty = false;
 				}
-				lua_pop(L, 1);
+				else {
+					lua_getfield(L, 1, "layoutRoot");
+					if (lua_toboolean(L, -1)) {
+						dirty = false;
+					}
+					lua_pop(L, 1);
+				}
 			}
 		}
 		lua_pop(L, 1);
@@ -436,6 +449,8 @@ int jiveL_widget_check_layout(lua_State *L) {
 	peer = lua_touserdata(L, -1);
 	lua_pop(L, 1);
 
+	layout_stats.visited++;
+
 	if (!peer || peer->layout_origin != jive_origin) {
 		/* layout dirty, update */
 		if (perfwarn.layout) {
@@ -445,6 +460,8 @@ int jiveL_widget_check_layout(lua_State *L) {
 
 		/* does the skin need updating? */
 		if (!peer || peer->skin_origin != jive_origin) {
+			layout_stats.skinned++;
+
 			if (jive_getmethod(L, 1, "_skin")) {
 				lua_pushvalue(L, 1);
 				lua_call(L, 1, 0);
@@ -462,6 +479,7 @@ int jiveL_widget_check_layout(lua_State *L) {
 		if (perfwarn.layout) t1 = jive_jiffies();
 
 		peer->layout_origin = jive_origin;
+		layout_stats.laid_out++;
 
 		/* update the layout */
 		if (jive_getmethod(L, 1, "_layout")) {
@@ -707,6 +707,47 @@ static int tolua_jive_jive_ui_Surface_blitAlpha00(lua_State* tolua_S)
 }
 #endif //#ifndef TOLUA_DISABLE
 
+/* method: jive_surface_blit_rotated of class  Surface */
+#ifndef TOLUA_DISABLE_tolua_jive_jive_ui_Surface_blitRotated00
+static int tolua_jive_jive_ui_Surface_blitRotated00(lua_State* tolua_S)
+{
+#ifndef TOLUA_RELEASE
+ tolua_Error tolua_err;
+ if (
+ !tolua_isusertype(tolua_S,1,"Surface",0,&tolua_err) ||
+ !tolua_isusertype(tolua_S,2,"Surface",0,&tolua_err) ||
+ !tolua_isinteger(tolua_S,3,0,&tolua_err) ||
+ !tolua_isinteger(tolua_S,4,0,&tolua_err) ||
+ !tolua_isnumber(tolua_S,5,0,&tolua_err) ||
+ !tolua_isinteger(tolua_S,6,1,&tolua_err) ||
+ !tolua_isnoobj(tolua_S,7,&tolua_err)
+ )
+ goto tolua_lerror;
+ else
+#endif
+ {
+  Surface* self = (Surface*)  tolua_tousertype(tolua_S,1,0);
+  Surface* dst = ((Surface*)  tolua_tousertype(tolua_S,2,0));
+   short cx = ((  short)  tolua_tointeger(tolua_S,3,0));
+   short cy = ((  short)  tolua_tointeger(tolua_S,4,0));
+  double angle = ((double)  tolua_tonumber(tolua_S,5,0));
+  int steps = ((int)  tolua_tointeger(tolua_S,6,360));
+#ifndef TOLUA_RELEASE
+ if (!self) tolua_error(tolua_S,"invalid 'self' in function 'jive_surface_blit_rotated'",NULL);
+#endif
+ {
+  jive_surface_blit_rotated(self,dst,cx,cy,angle,steps);
+ }
+ }
+ return 0;
+#ifndef TOLUA_RELEASE
+ tolua_lerror:
+ tolua_error(tolua_S,"#ferror in function 'blitRotated'.",&tolua_err);
+ return 0;
+#endif
+}
+#endif //#ifndef TOLUA_DISABLE
+
 /* method: jive_surface_get_size of class  Surface */
 #ifndef TOLUA_DISABLE_tolua_jive_jive_ui_Surface_getSize00
 static int tolua_jive_jive_ui_Surface_getSize00(lua_State* tolua_S)
@@ -2217,6 +2258,7 @@ TOLUA_API int tolua_jive_open (lua_State* tolua_S)
    tolua_constant(tolua_S,"true",true);
    tolua_constant(tolua_S,"false",false);
    tolua_constant(tolua_S,"FRAME_RATE",JIVE_FRAME_RATE);
+   tolua_constant(tolua_S,"FRAME_RATE_ACTIVE",JIVE_FRAME_RATE_ACTIVE);
    tolua_constant(tolua_S,"XY_NIL",JIVE_XY_NIL);
    tolua_constant(tolua_S,"WH_NIL",JIVE_WH_NIL);
    tolua_constant(tolua_S,"WH_FILL",JIVE_WH_FILL);
@@ -2329,6 +2371,7 @@ TOLUA_API int tolua_jive_open (lua_State* tolua_S)
     tolua_function(tolua_S,"blit",tolua_jive_jive_ui_Surface_blit00);
     tolua_function(tolua_S,"blitClip",tolua_jive_jive_ui_Surface_blitClip00);
     tolua_function(tolua_S,"blitAlpha",tolua_jive_jive_ui_Surface_blitAlpha00);
+    tolua_function(tolua_S,"blitRotated",tolua_jive_jive_ui_Surface_blitRotated00);
     tolua_function(tolua_S,"getSize",tolua_jive_jive_ui_Surface_getSize00);
     tolua_function(tolua_S,"getBytes",tolua_jive_jive_ui_Surface_getBytes00);
     tolua_function(tolua_S,"rotozoom",tolua_jive_jive_ui_Surface_rotozoom00);
@@ -124,6 +124,7 @@ static int open_input_devices(void) {
 
 		if (strstr(name, "msp430")) {
 			msp430_event_fd = fd;
+			jive_input_add_fd(fd);
 		}
 		else {
 			close(fd);
@@ -353,9 +353,12 @@ static int open_input_devices(void) {
 
 			ioctl(fd, EVIOCGABS(ABS_Y), abs);
 			clearpad_max_y = abs[2];
+
+			jive_input_add_fd(fd);
 		}
 		else if (strstr(name, "FAB4 IR")) {
 			ir_event_fd = fd;
+			jive_input_add_fd(fd);
 		}
 		else {
 			close(fd);
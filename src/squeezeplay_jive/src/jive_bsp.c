@@ -230,7 +230,10 @@ static void open_input_devices(void) {
 		}
 		else {
 			close(fd);
+			continue;
 		}
+
+		jive_input_add_fd(fd);
 	}
 }
 